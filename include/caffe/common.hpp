@@ -93,6 +93,8 @@ using std::string;
 using std::stringstream;
 using std::vector;
 
+class ThreadPool;
+
 // A global initialization function that you should call in your main function.
 // Currently it initializes google flags and google logging.
 void GlobalInit(int* pargc, char*** pargv);
@@ -158,6 +160,14 @@ class Caffe {
   inline static void set_solver_count(int val) { Get().solver_count_ = val; }
   inline static bool root_solver() { return Get().root_solver_; }
   inline static void set_root_solver(bool val) { Get().root_solver_ = val; }
+  // Number of threads of the CPU kernels run from this thread. Defaults to
+  // the number of hardware threads on the main thread and 1 on the others.
+  // Internal threads take the value of the thread starting them, except the
+  // threads of a pool and the prefetch threads of data layers which take 1.
+  inline static int cpu_threads() { return Get().cpu_threads_; }
+  static void set_cpu_threads(int threads);
+  // Pool of cpu_threads() threads for the CPU kernels, created on first use.
+  static ThreadPool& cpu_pool();
 
  protected:
 #ifndef CPU_ONLY
@@ -169,6 +179,8 @@ class Caffe {
   Brew mode_;
   int solver_count_;
   bool root_solver_;
+  int cpu_threads_;
+  shared_ptr<ThreadPool> cpu_pool_;
 
  private:
   // The private constructor to avoid duplicate instantiation.
@@ -1,6 +1,7 @@
 #ifndef CAFFE_DATA_READER_HPP_
 #define CAFFE_DATA_READER_HPP_
 
+#include <deque>
 #include <map>
 #include <string>
 #include <vector>
@@ -12,6 +13,33 @@
 
 namespace caffe {
 
+/**
+ * @brief A datum read by a DataReader. If the database keeps its values
+ * mapped in memory (LMDB), the uint8 pixels of non-encoded datums are not
+ * copied into datum().data() but referenced in place, see data(). They are
+ * only read once, when DataTransformer writes them into the batch.
+ */
+class MappedDatum {
+ public:
+  MappedDatum() : datum_(), data_(NULL), size_(0) {}
+
+  // Parses a serialized datum. If in_place, value must remain valid as long
+  // as this datum is used.
+  void Parse(const char* value, size_t size, bool in_place);
+
+  inline const Datum& datum() const { return datum_; }
+  // The uint8 pixels, or NULL if the datum holds float_data
+  inline const char* data() const { return data_; }
+  inline size_t size() const { return size_; }
+
+ protected:
+  Datum datum_;
+  const char* data_;
+  size_t size_;
+
+DISABLE_COPY_AND_ASSIGN(MappedDatum);
+};
+
 /**
  * @brief Reads data from a source to queues available to data layers.
  * A single reading thread is created per source, even if multiple solvers
@@ -25,10 +53,10 @@ class DataReader {
   explicit DataReader(const LayerParameter& param);
   ~DataReader();
 
-  inline BlockingQueue<Datum*>& free() const {
+  inline BlockingQueue<MappedDatum*>& free() const {
     return queue_pair_->free_;
   }
-  inline BlockingQueue<Datum*>& full() const {
+  inline BlockingQueue<MappedDatum*>& full() const {
     return queue_pair_->full_;
   }
 
@@ -39,12 +67,39 @@ class DataReader {
     explicit QueuePair(int size);
     ~QueuePair();
 
-    BlockingQueue<Datum*> free_;
-    BlockingQueue<Datum*> full_;
+    BlockingQueue<MappedDatum*> free_;
+    BlockingQueue<MappedDatum*> full_;
 
   DISABLE_COPY_AND_ASSIGN(QueuePair);
   };
 
+  // A serialized record waiting to be parsed into a datum of a queue pair
+  class Record {
+   public:
+    // Either in place in the database or in value_
+    const char* data_;
+    size_t size_;
+    bool in_place_;
+    string value_;
+    MappedDatum* datum_;
+    QueuePair* qp_;
+  };
+
+  // Parses records off the reading thread, in the order they are pushed
+  class Parser : public InternalThread {
+   public:
+    Parser();
+    virtual ~Parser();
+
+    BlockingQueue<Record*> in_;
+    BlockingQueue<Record*> out_;
+
+   protected:
+    void InternalThreadEntry();
+
+  DISABLE_COPY_AND_ASSIGN(Parser);
+  };
+
   // A single body is created per source
   class Body : public InternalThread {
    public:
@@ -54,10 +109,23 @@ class DataReader {
    protected:
     void InternalThreadEntry();
     void read_one(db::Cursor* cursor, QueuePair* qp);
+    // Hands the oldest record in flight to its queue pair, waiting for its
+    // parser if needed. Records are issued to parsers round-robin, so
+    // popping parsers in the same order preserves the database order.
+    void deliver_one();
+    void deliver_all();
 
     const LayerParameter param_;
     BlockingQueue<shared_ptr<QueuePair> > new_queue_pairs_;
 
+    // Only used if parser_threads > 1
+    vector<shared_ptr<Parser> > parsers_;
+    vector<Record> records_;
+    vector<Record*> free_records_;
+    std::deque<Record*> in_flight_;
+    size_t issued_;
+    size_t delivered_;
+
     friend class DataReader;
 
   DISABLE_COPY_AND_ASSIGN(Body);
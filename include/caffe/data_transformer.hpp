@@ -25,6 +25,12 @@ class DataTransformer {
    */
   void InitRand();
 
+  /**
+   * @brief Initialize the Random number generations if needed, from a seed
+   *    drawn from the generator of transformer instead of the Caffe one.
+   */
+  void InitRand(DataTransformer<Dtype>* transformer);
+
   /**
    * @brief Applies the transformation defined in the data layer's
    * transform_param block to the data.
@@ -37,6 +43,24 @@ class DataTransformer {
    */
   void Transform(const Datum& datum, Blob<Dtype>* transformed_blob);
 
+  /**
+   * @brief Same as above, but reads the uint8 pixels of a non-encoded datum
+   * from data instead of datum.data(), e.g. in place in a database memory
+   * map. A size of 0 means the datum holds float_data instead. Encoded
+   * datums are still decoded from datum.data().
+   *
+   * @param datum
+   *    Datum describing the data to be transformed.
+   * @param data
+   *    The uint8 pixels of datum.
+   * @param size
+   *    The number of pixels at data.
+   * @param transformed_blob
+   *    This is destination blob, see above.
+   */
+  void Transform(const Datum& datum, const char* data, size_t size,
+                 Blob<Dtype>* transformed_blob);
+
   /**
    * @brief Applies the transformation defined in the data layer's
    * transform_param block to a vector of Datum.
@@ -138,7 +162,8 @@ class DataTransformer {
    */
   virtual int Rand(int n);
 
-  void Transform(const Datum& datum, Dtype* transformed_data);
+  void Transform(const Datum& datum, const char* data, size_t size,
+                 Dtype* transformed_data);
   // Tranformation parameters
   TransformationParameter param_;
 
@@ -23,7 +23,8 @@ class InternalThread {
 
   /**
    * Caffe's thread local state will be initialized using the current
-   * thread values, e.g. device id, solver index etc. The random seed
+   * thread values, e.g. device id, solver index, number of CPU kernel
+   * threads etc. The random seed
    * is initialized using caffe_rng_rand.
    */
   void StartInternalThread();
@@ -41,9 +42,13 @@ class InternalThread {
   /* Should be tested when running loops to exit when requested. */
   bool must_stop();
 
+  /* Starts the thread with the given random seed, leaving the random number
+     generator of the current thread untouched. */
+  void StartInternalThread(int rand_seed);
+
  private:
   void entry(int device, Caffe::Brew mode, int rand_seed, int solver_count,
-      bool root_solver);
+      bool root_solver, int cpu_threads);
 
   shared_ptr<boost::thread> thread_;
 };
@@ -31,15 +31,33 @@ class BaseConvolutionLayer : public Layer<Dtype> {
  protected:
   // Helper functions that abstract away the column buffer and gemm arguments.
   // The last argument in forward_cpu_gemm is so that we can skip the im2col if
-  // we just called weight_cpu_gemm with the same input.
+  // we just called weight_cpu_gemm with the same input. The last arguments in
+  // backward_cpu_gemm and weight_cpu_gemm replace col_buffer_ when given, so
+  // that several threads can convolve images at once.
   void forward_cpu_gemm(const Dtype* input, const Dtype* weights,
       Dtype* output, bool skip_im2col = false);
   void forward_cpu_bias(Dtype* output, const Dtype* bias);
   void backward_cpu_gemm(const Dtype* input, const Dtype* weights,
-      Dtype* output);
+      Dtype* output, Dtype* col_buff = NULL);
   void weight_cpu_gemm(const Dtype* input, const Dtype* output, Dtype*
-      weights);
+      weights, Dtype* col_buff = NULL);
   void backward_cpu_bias(Dtype* bias, const Dtype* input);
+  // Versions of the helpers above for count consecutive images, up to
+  // cpu_batch_, which compute the columns of all the images in one buffer and
+  // run one GEMM per group. The last argument in backward_cpu_gemm_batch is
+  // so that we can skip gathering the output if we just called
+  // weight_cpu_gemm_batch with the same output.
+  void forward_cpu_gemm_batch(const Dtype* input, const Dtype* weights,
+      Dtype* output, int count);
+  void backward_cpu_gemm_batch(const Dtype* output, const Dtype* weights,
+      Dtype* input, int count, bool skip_gather = false);
+  void weight_cpu_gemm_batch(const Dtype* input, const Dtype* output,
+      Dtype* weights, int count);
+  // Largest number of images convolved at once within a number of bytes of
+  // buffers, 1 for shapes without a batched convolution.
+  int max_cpu_batch(uint64_t bytes);
+  // Sets cpu_batch_ and allocates or releases the batch buffers.
+  void set_cpu_batch(int batch);
 
 #ifndef CPU_ONLY
   void forward_gpu_gemm(const Dtype* col_input, const Dtype* weights,
@@ -92,6 +110,10 @@ class BaseConvolutionLayer : public Layer<Dtype> {
   bool bias_term_;
   bool is_1x1_;
   bool force_nd_im2col_;
+  /// @brief Number of images convolved at once on the CPU, within
+  ///        ConvolutionParameter.cpu_batch_bytes or picked by autotuning.
+  ///        1 when batching is off.
+  int cpu_batch_;
 
  private:
   // wrap im2col/col2im so we don't have to remember the (long) argument lists
@@ -123,6 +145,29 @@ class BaseConvolutionLayer : public Layer<Dtype> {
           pad_.cpu_data(), stride_.cpu_data(), dilation_.cpu_data(), data);
     }
   }
+  // 2D versions writing and reading columns col_stride values apart
+  inline void conv_im2col_cpu(const Dtype* data, int col_stride,
+      Dtype* col_buff) {
+    im2col_cpu(data, conv_in_channels_,
+        conv_input_shape_.cpu_data()[1], conv_input_shape_.cpu_data()[2],
+        kernel_shape_.cpu_data()[0], kernel_shape_.cpu_data()[1],
+        pad_.cpu_data()[0], pad_.cpu_data()[1],
+        stride_.cpu_data()[0], stride_.cpu_data()[1],
+        dilation_.cpu_data()[0], dilation_.cpu_data()[1], col_stride,
+        col_buff);
+  }
+  inline void conv_col2im_cpu(const Dtype* col_buff, int col_stride,
+      Dtype* data) {
+    col2im_cpu(col_buff, conv_in_channels_,
+        conv_input_shape_.cpu_data()[1], conv_input_shape_.cpu_data()[2],
+        kernel_shape_.cpu_data()[0], kernel_shape_.cpu_data()[1],
+        pad_.cpu_data()[0], pad_.cpu_data()[1],
+        stride_.cpu_data()[0], stride_.cpu_data()[1],
+        dilation_.cpu_data()[0], dilation_.cpu_data()[1], col_stride, data);
+  }
+  // Copies the outputs of count images to or from output_batch_buffer_.
+  void gather_cpu_output(const Dtype* output, int count);
+  void scatter_cpu_output(Dtype* output, int count);
 #ifndef CPU_ONLY
   inline void conv_im2col_gpu(const Dtype* data, Dtype* col_buff) {
     if (!force_nd_im2col_ && num_spatial_axes_ == 2) {
@@ -167,6 +212,10 @@ class BaseConvolutionLayer : public Layer<Dtype> {
 
   Blob<Dtype> col_buffer_;
   Blob<Dtype> bias_multiplier_;
+  // Columns of cpu_batch_ images, interleaved so that the columns of each
+  // group form one matrix, and outputs in the matching order.
+  shared_ptr<Blob<Dtype> > col_batch_buffer_;
+  shared_ptr<Blob<Dtype> > output_batch_buffer_;
 };
 
 }  // namespace caffe
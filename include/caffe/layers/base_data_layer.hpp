@@ -1,6 +1,7 @@
 #ifndef CAFFE_DATA_LAYERS_HPP_
 #define CAFFE_DATA_LAYERS_HPP_
 
+#include <stdint.h>
 #include <vector>
 
 #include "caffe/blob.hpp"
@@ -9,6 +10,7 @@
 #include "caffe/layer.hpp"
 #include "caffe/proto/caffe.pb.h"
 #include "caffe/util/blocking_queue.hpp"
+#include "caffe/util/thread_pool.hpp"
 
 namespace caffe {
 
@@ -67,18 +69,70 @@ class BasePrefetchingDataLayer :
   virtual void Forward_gpu(const vector<Blob<Dtype>*>& bottom,
       const vector<Blob<Dtype>*>& top);
 
-  // Prefetches batches (asynchronously if to GPU memory)
-  static const int PREFETCH_COUNT = 3;
+  // Number of batches prefetched (asynchronously if to GPU memory), set by
+  // prefetch_param and final once the layer is set up.
+  inline int prefetch_depth() const { return prefetch_.size(); }
+  // Occupancy of the prefetch queue, sampled each time Forward takes a batch.
+  // A run is data-starved when Forward often finds no batch ready.
+  inline uint64_t prefetch_batches_taken() const { return batches_taken_; }
+  inline uint64_t prefetch_batches_starved() const {
+    return batches_starved_;
+  }
+  inline double prefetch_mean_occupancy() const {
+    return batches_taken_ ? static_cast<double>(batches_ready_) /
+        batches_taken_ : 0.;
+  }
 
  protected:
   virtual void InternalThreadEntry();
   virtual void load_batch(Batch<Dtype>* batch) = 0;
+  // Takes the next loaded batch for Forward, updating the occupancy counters.
+  // With prefetch_param.zero_copy, first returns the batch of the previous
+  // Forward, which the top blobs were sharing, to the prefetch thread.
+  Batch<Dtype>* take_batch();
 
-  Batch<Dtype> prefetch_[PREFETCH_COUNT];
+  // Calls load_item for items [0, count) of batch, in parallel on
+  // transform_param.threads threads. Call this from load_batch.
+  void load_items(Batch<Dtype>* batch, int count) {
+    load_items(batch, 0, count);
+  }
+  // Calls load_item for items [begin, end) of batch, for layers loading
+  // their batch in several parts.
+  void load_items(Batch<Dtype>* batch, int begin, int end);
+  // Loads item item_id into its slot of batch. Subclasses using load_items
+  // implement this, using the DataTransformer and the transformed data blob
+  // of the given thread (see transformers_ and transformed_items_).
+  // top_data and top_label are the CPU data of the batch, or NULL for the
+  // labels of a layer without them, resolved once by load_items: the
+  // threads must not call the accessors of shared blobs, as those update the
+  // state of their SyncedMemory.
+  virtual void load_item(Batch<Dtype>* batch, Dtype* top_data,
+      Dtype* top_label, int item_id, int thread) {
+    NOT_IMPLEMENTED;
+  }
+
+  // Holds prefetch_param.depth batches while DataLayerSetUp shapes them, the
+  // final depth once LayerSetUp has applied prefetch_param.max_bytes.
+  vector<shared_ptr<Batch<Dtype> > > prefetch_;
   BlockingQueue<Batch<Dtype>*> prefetch_free_;
   BlockingQueue<Batch<Dtype>*> prefetch_full_;
+  // Batch shared with the top blobs in zero-copy mode
+  Batch<Dtype>* prefetch_current_;
+  uint64_t batches_taken_;
+  uint64_t batches_starved_;
+  uint64_t batches_ready_;
 
   Blob<Dtype> transformed_data_;
+
+  // One per thread of transform_pool_. Each transformer has its own random
+  // number generator, so the first one is data_transformer_ itself, and
+  // each blob is shaped like transformed_data_ by load_items.
+  vector<shared_ptr<DataTransformer<Dtype> > > transformers_;
+  vector<shared_ptr<Blob<Dtype> > > transformed_items_;
+  shared_ptr<ThreadPool> transform_pool_;
+
+ private:
+  class LoadItems;
 };
 
 }  // namespace caffe
@@ -1,6 +1,7 @@
 #ifndef CAFFE_CONV_LAYER_HPP_
 #define CAFFE_CONV_LAYER_HPP_
 
+#include <string>
 #include <vector>
 
 #include "caffe/blob.hpp"
@@ -58,11 +59,20 @@ class ConvolutionLayer : public BaseConvolutionLayer<Dtype> {
    *  first group and input channels 3-4 and output channels 5-8 into the second
    *  group.
    *  - bias_term (\b optional, default true). Whether to have a bias.
-   *  - engine: convolution has CAFFE (matrix multiplication) and CUDNN (library
-   *    kernels + stream parallelism) engines.
+   *  - engine: convolution has CAFFE (matrix multiplication), CUDNN (library
+   *    kernels + stream parallelism) and WINOGRAD (CPU F(2x2, 3x3)) engines.
+   *    On the CPU, depthwise convolutions (group = channels) are computed
+   *    directly, without im2col, by all engines.
+   *  - cpu_autotune (\b optional, default false). Whether to time the CPU
+   *    algorithms for each input shape and keep the fastest.
+   *  - cpu_parallel_backward (\b optional, default false). Whether to split
+   *    the images of the CPU backward pass across threads.
    */
   explicit ConvolutionLayer(const LayerParameter& param)
-      : BaseConvolutionLayer<Dtype>(param) {}
+      : BaseConvolutionLayer<Dtype>(param),
+        cpu_algorithm_(ConvolutionAlgorithmCache_Algorithm_GEMM) {}
+  virtual void Reshape(const vector<Blob<Dtype>*>& bottom,
+      const vector<Blob<Dtype>*>& top);
 
   virtual inline const char* type() const { return "Convolution"; }
 
@@ -77,6 +87,55 @@ class ConvolutionLayer : public BaseConvolutionLayer<Dtype> {
       const vector<bool>& propagate_down, const vector<Blob<Dtype>*>& bottom);
   virtual inline bool reverse_dimensions() { return false; }
   virtual void compute_output_shape();
+
+  // Whether Winograd F(2x2, 3x3) computes the convolution: 2D 3x3 filters
+  // with stride 1 and dilation 1.
+  bool winograd_supported();
+  // Convolves all the images with Winograd F(2x2, 3x3), from the bottom to
+  // the top, or from the top diff to the bottom diff.
+  void forward_cpu_winograd(const Dtype* input, Dtype* output);
+  void backward_cpu_winograd(const Dtype* output, Dtype* input);
+  // Whether the convolution is depthwise, each input channel filtered on its
+  // own, in 2D.
+  bool depthwise_supported();
+  // Convolves all the images directly with the depthwise filters, and
+  // computes the gradients w.r.t. the filters and the bottom.
+  void forward_cpu_depthwise(const Dtype* bottom_data, Dtype* top_data);
+  void backward_cpu_depthwise(const Dtype* top_diff, const Dtype* bottom_data,
+      Dtype* bottom_diff, bool weight_down, bool data_down);
+  // Backward GEMMs of the images of one top, split across the threads of
+  // the CPU pool, the threads past the first accumulating their weight
+  // gradients apart before they are summed.
+  void backward_cpu_parallel(const Dtype* top_diff, const Dtype* bottom_data,
+      Dtype* bottom_diff, bool weight_down, bool data_down);
+  class BackwardImages;
+  class SumWeightDiffs;
+  // Sets the CPU algorithm, with batch images per chunk for BATCHED_GEMM,
+  // and shapes its buffers.
+  void set_cpu_algorithm(ConvolutionAlgorithmCache_Algorithm algorithm,
+      int batch);
+  // Sets the fastest CPU algorithm for the shape of the bottom, timing them
+  // on scratch blobs unless they were timed before.
+  void autotune_cpu(const vector<Blob<Dtype>*>& bottom,
+      const vector<Blob<Dtype>*>& top);
+  // Key of the shape and batch bytes of the layer and of the machine in the
+  // cache of the timed algorithms.
+  std::string cpu_autotune_key();
+
+  ConvolutionAlgorithmCache_Algorithm cpu_algorithm_;
+  // Key the CPU algorithm was picked for, and the number of CPU threads,
+  // num and input shape it was built from
+  std::string cpu_autotune_key_;
+  vector<int> cpu_autotune_shape_;
+  // Transformed filters, and transformed inputs and outputs of a block of
+  // tiles, of the WINOGRAD algorithm
+  shared_ptr<Blob<Dtype> > winograd_weight_;
+  shared_ptr<Blob<Dtype> > winograd_input_;
+  shared_ptr<Blob<Dtype> > winograd_output_;
+  // Column buffers and weight gradients of the threads of the CPU pool past
+  // the first, for cpu_parallel_backward
+  vector<shared_ptr<Blob<Dtype> > > thread_col_buffers_;
+  vector<shared_ptr<Blob<Dtype> > > thread_weight_diffs_;
 };
 
 }  // namespace caffe
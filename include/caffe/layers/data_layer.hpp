@@ -30,8 +30,12 @@ class DataLayer : public BasePrefetchingDataLayer<Dtype> {
 
  protected:
   virtual void load_batch(Batch<Dtype>* batch);
+  virtual void load_item(Batch<Dtype>* batch, Dtype* top_data,
+      Dtype* top_label, int item_id, int thread);
 
   DataReader reader_;
+  // Datums of the batch being loaded
+  vector<MappedDatum*> items_;
 };
 
 }  // namespace caffe
@@ -0,0 +1,108 @@
+#ifndef CAFFE_FUSED_ELEMENTWISE_LAYER_HPP_
+#define CAFFE_FUSED_ELEMENTWISE_LAYER_HPP_
+
+#include <vector>
+
+#include "caffe/blob.hpp"
+#include "caffe/layer.hpp"
+#include "caffe/proto/caffe.pb.h"
+
+namespace caffe {
+
+/**
+ * @brief Computes a chain of elementwise layers in one pass over tiles of
+ *        their bottom that stay in cache, forward and backward.
+ *
+ * Net builds it for the chains of layers it fuses, see
+ * NetParameter.fuse_elementwise. The layers of the chain keep their
+ * parameters and their place in the net, but are not run: this layer computes
+ * the top of the last one from the bottom of the first one, and the gradients
+ * of that bottom and of the parameters of the Scale and Bias layers. The
+ * layers it fuses are the neuron layers ReLU, Sigmoid, TanH, AbsVal, BNLL,
+ * ELU, Power, Exp and Log, and the Scale, Bias and BatchNorm layers that only
+ * scale and shift each channel: with learned parameters rather than a second
+ * bottom, and with the global statistics for BatchNorm.
+ */
+template <typename Dtype>
+class FusedElementwiseLayer : public Layer<Dtype> {
+ public:
+  FusedElementwiseLayer(const LayerParameter& param,
+      const vector<shared_ptr<Layer<Dtype> > >& layers);
+  // Whether layer computes each value of its top from the same value of its
+  // bottom alone, as a step of a fused chain
+  static bool CanFuse(const Layer<Dtype>& layer);
+
+  virtual void LayerSetUp(const vector<Blob<Dtype>*>& bottom,
+      const vector<Blob<Dtype>*>& top);
+  virtual void Reshape(const vector<Blob<Dtype>*>& bottom,
+      const vector<Blob<Dtype>*>& top);
+
+  virtual inline const char* type() const { return "FusedElementwise"; }
+  virtual inline int ExactNumBottomBlobs() const { return 1; }
+  virtual inline int ExactNumTopBlobs() const { return 1; }
+
+ protected:
+  virtual void Forward_cpu(const vector<Blob<Dtype>*>& bottom,
+      const vector<Blob<Dtype>*>& top);
+  virtual void Backward_cpu(const vector<Blob<Dtype>*>& top,
+      const vector<bool>& propagate_down, const vector<Blob<Dtype>*>& bottom);
+
+  enum Function { AFFINE, RELU, SIGMOID, TANH, ABSVAL, BNLL, ELU, POWER, EXP,
+      LOG };
+
+  // A layer of the chain as a function y = f(x) of each value
+  struct Step {
+    Function function;
+    // Constants of the function:
+    //   RELU: alpha = negative slope;
+    //   ELU: alpha;
+    //   POWER: y = (beta + alpha x)^gamma, with dy/dx = delta (beta +
+    //       alpha x)^(gamma - 1);
+    //   EXP: y = beta exp(alpha x);
+    //   LOG: y = gamma log(alpha x + beta), with dy/dx = delta /
+    //       (alpha x + beta).
+    Dtype alpha, beta, gamma, delta;
+    // AFFINE: y = scale[d] x + shift[d] with d = (i / inner) % dim for the
+    // value i of the bottom, where scale or shift may be NULL. Their blobs
+    // are those of the layer, or batch_norm_coefficients_ for BatchNorm, and
+    // are looked up for each pass as the net may share them. The gradients
+    // of learned ones are summed from scale_diff and shift_diff in the
+    // parameter gradients of each thread, or those are -1.
+    int layer, dim, inner;
+    Blob<Dtype>* scale_blob;
+    Blob<Dtype>* shift_blob;
+    const Dtype* scale;
+    const Dtype* shift;
+    int scale_diff, shift_diff;
+  };
+
+  // Looks up the coefficients of the AFFINE steps, computing those of
+  // BatchNorm from its statistics, and where their gradients are summed
+  void PrepareSteps(bool backward);
+  // Computes step over values [offset, offset + count) of the bottom, from x
+  // to y, which may be x
+  void StepForward(const Step& step, int offset, int count, const Dtype* x,
+      Dtype* y);
+  // Computes the gradient dx of step over values [offset, offset + count)
+  // from its input x, output y and top gradient dy, which may be dx, and adds
+  // the gradients of its parameters to param_diffs. dx may be NULL.
+  void StepBackward(const Step& step, int offset, int count, const Dtype* x,
+      const Dtype* y, const Dtype* dy, Dtype* dx, Dtype* param_diffs);
+  class CPUTask;
+
+  vector<shared_ptr<Layer<Dtype> > > layers_;
+  vector<Step> steps_;
+  // Scale and shift of the BatchNorm steps, by layer
+  vector<shared_ptr<Blob<Dtype> > > batch_norm_coefficients_;
+  // Copy of the bottom when computing in place in TRAIN, for Backward
+  Blob<Dtype> bottom_copy_;
+  // Outputs of each step and the gradient of a tile, and the parameter
+  // gradients, for each CPU thread
+  Blob<Dtype> thread_values_;
+  Blob<Dtype> thread_param_diffs_;
+  int num_param_diffs_;
+};
+
+}  // namespace caffe
+
+#endif  // CAFFE_FUSED_ELEMENTWISE_LAYER_HPP_
@@ -36,9 +36,13 @@ class ImageDataLayer : public BasePrefetchingDataLayer<Dtype> {
   shared_ptr<Caffe::RNG> prefetch_rng_;
   virtual void ShuffleImages();
   virtual void load_batch(Batch<Dtype>* batch);
+  virtual void load_item(Batch<Dtype>* batch, Dtype* top_data,
+      Dtype* top_label, int item_id, int thread);
 
   vector<std::pair<std::string, int> > lines_;
   int lines_id_;
+  // Lines of the batch being loaded
+  vector<std::pair<std::string, int> > items_;
 };
 
 
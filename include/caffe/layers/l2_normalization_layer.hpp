@@ -11,6 +11,8 @@ namespace caffe {
 
 /**
  * @brief L2 normalization
+ *
+ * Scales each input to unit L2 norm. Can be computed in place.
  */
 template <typename Dtype>
 class L2NormalizationLayer : public Layer<Dtype> {
@@ -39,8 +41,7 @@ class L2NormalizationLayer : public Layer<Dtype> {
      const vector<bool>& propagate_down, const vector<Blob<Dtype>*>& bottom);
 
   Blob<Dtype> sum_multiplier_;
-  Blob<Dtype> norm_;
-  Blob<Dtype> squared_;
+  Blob<Dtype> norm_;  // L2 norm of each input, cached for backward pass
 };
 
 }  // namespace caffe
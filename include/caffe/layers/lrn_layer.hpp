@@ -55,6 +55,26 @@ class LRNLayer : public Layer<Dtype> {
       const vector<bool>& propagate_down, const vector<Blob<Dtype>*>& bottom);
   virtual void WithinChannelBackward(const vector<Blob<Dtype>*>& top,
       const vector<bool>& propagate_down, const vector<Blob<Dtype>*>& bottom);
+  virtual void WithinChannelForward_cpu(const vector<Blob<Dtype>*>& bottom,
+      const vector<Blob<Dtype>*>& top);
+  virtual void WithinChannelBackward_cpu(const vector<Blob<Dtype>*>& top,
+      const vector<bool>& propagate_down, const vector<Blob<Dtype>*>& bottom);
+
+  // Normalize, or compute the gradient of, the positions [begin, end) of the
+  // height_ x width_ plane of image n across channels, or one channel plane
+  // within itself in the thread_row_sums_ rows of the calling thread. The
+  // images and planes are spread over the CPU threads.
+  void cross_channel_forward_cpu(int n, int begin, int end,
+      const Dtype* bottom_data, Dtype* scale_data, Dtype* top_data);
+  void cross_channel_backward_cpu(int n, int begin, int end,
+      const Dtype* top_diff, const Dtype* top_data, const Dtype* bottom_data,
+      const Dtype* scale_data, Dtype* bottom_diff);
+  void within_channel_forward_cpu(int plane, Dtype* rows,
+      const Dtype* bottom_data, Dtype* scale_data, Dtype* top_data);
+  void within_channel_backward_cpu(int plane, Dtype* rows,
+      const Dtype* top_diff, const Dtype* top_data, const Dtype* bottom_data,
+      const Dtype* scale_data, Dtype* bottom_diff);
+  class CPUTask;
 
   int size_;
   int pre_pad_;
@@ -66,11 +86,14 @@ class LRNLayer : public Layer<Dtype> {
   int height_;
   int width_;
 
-  // Fields used for normalization ACROSS_CHANNELS
-  // scale_ stores the intermediate summing results
+  // scale_ stores the intermediate summing results, on the CPU for both
+  // normalization regions
   Blob<Dtype> scale_;
+  // Window sums of the rows of a plane, and of the current row, for each CPU
+  // thread in WITHIN_CHANNEL
+  Blob<Dtype> thread_row_sums_;
 
-  // Fields used for normalization WITHIN_CHANNEL
+  // Fields used for normalization WITHIN_CHANNEL on the GPU
   shared_ptr<SplitLayer<Dtype> > split_layer_;
   vector<Blob<Dtype>*> split_top_vec_;
   shared_ptr<PowerLayer<Dtype> > square_layer_;
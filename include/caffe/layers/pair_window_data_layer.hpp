@@ -6,6 +6,10 @@
 #include <vector>
 #include <map>
 
+#ifdef USE_OPENCV
+#include <opencv2/core/core.hpp>
+#endif  // USE_OPENCV
+
 #include "caffe/blob.hpp"
 #include "caffe/data_transformer.hpp"
 #include "caffe/internal_thread.hpp"
@@ -15,6 +19,8 @@
 
 namespace caffe {
 
+class ImageCache;
+
 /**
  * @brief Provides data to the Net from windows of images files, specified
  *        by a window data file.
@@ -36,8 +42,13 @@ class PairWindowDataLayer : public BasePrefetchingDataLayer<Dtype> {
 
  protected:
   virtual unsigned int PrefetchRand();
+  // The window of box bb_index of image image_index, which must be kept
+  const vector<float>& window(int image_index, int bb_index) const;
   virtual void load_batch(Batch<Dtype>* batch);
-  bool prepare_window(cv::Mat &warpimg, int &pad_w, int &pad_h, bool &do_mirror, const vector<float> &window, const bool mirror, const int context_pad, const bool use_square, const int crop_size);
+  virtual void load_item(Batch<Dtype>* batch, Dtype* top_data,
+      Dtype* top_label, int item_id, int thread);
+  bool load_image(int image_index, cv::Mat* cv_img);
+  bool prepare_window(cv::Mat &warpimg, int &pad_w, int &pad_h, const bool do_mirror, const cv::Mat &cv_img, const vector<float> &window, const int context_pad, const bool use_square, const int crop_size);
 
   shared_ptr<Caffe::RNG> prefetch_rng_;
   vector<std::pair<std::string, vector<int> > > image_database_;
@@ -47,11 +58,29 @@ class PairWindowDataLayer : public BasePrefetchingDataLayer<Dtype> {
   vector<vector<int> > tg_pairs_;
   vector<vector<int> > ip_pairs_;
   Blob<Dtype> data_mean_;
+  // CPU data of data_mean_ for load_item, or NULL without a mean file
+  const Dtype* mean_data_;
   vector<Dtype> mean_values_;
   bool has_mean_file_;
   bool has_mean_values_;
   bool cache_images_;
   vector<std::pair<std::string, Datum > > image_database_cache_;
+  shared_ptr<ImageCache> image_cache_;
+  // Pairs of the batch being loaded, their windows and whether to mirror them
+  vector<vector<int> > item_pairs_;
+  vector<vector<float> > item_windows_;
+  vector<bool> item_mirrors_;
+  // Images of the part of the batch being loaded, and the index in
+  // batch_images_ of the image of each window. Each image is decoded once
+  // per part (see batch_images).
+  vector<int> batch_image_indices_;
+  vector<int> item_images_;
+#ifdef USE_OPENCV
+  vector<cv::Mat> batch_images_;
+#endif  // USE_OPENCV
+
+ private:
+  class LoadImages;
 };
 
 }// namespace caffe
@@ -44,6 +44,15 @@ class PoolingLayer : public Layer<Dtype> {
   virtual void Backward_gpu(const vector<Blob<Dtype>*>& top,
       const vector<bool>& propagate_down, const vector<Blob<Dtype>*>& bottom);
 
+  // Pool one channel of one image on the CPU, or compute its gradient from
+  // the mask or the windows. The channels are spread over the CPU threads.
+  void forward_cpu_plane(const Dtype* bottom_data, Dtype* top_data,
+      int* mask, Dtype* top_mask);
+  void backward_cpu_plane(const Dtype* top_diff, const int* mask,
+      const Dtype* top_mask, Dtype* bottom_diff);
+  class ForwardPlanes;
+  class BackwardPlanes;
+
   int kernel_h_, kernel_w_;
   int stride_h_, stride_w_;
   int pad_h_, pad_w_;
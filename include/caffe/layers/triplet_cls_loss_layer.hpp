@@ -12,22 +12,37 @@
 namespace caffe {
 
 
+/**
+ * @brief Computes the triplet loss max(0, ||s - t||^2 - ||s - i||^2 + margin)
+ *        of samples s, targets t and impostors i.
+ *
+ * By default the triplets are given by three bottoms. With mining set to
+ * BATCH_HARD or SEMI_HARD, the bottoms are instead the embeddings of a batch
+ * and one label per embedding, and the triplets are picked within the batch
+ * from the matrix of pairwise distances (see TripletClsLossParameter).
+ */
 template <typename Dtype>
 class TripletClsLossLayer : public LossLayer<Dtype> {
  public:
   explicit TripletClsLossLayer(const LayerParameter& param)
-      : LossLayer<Dtype>(param) {}
+      : LossLayer<Dtype>(param),
+        mining_(param.triplet_cls_loss_param().mining()) {}
   virtual void LayerSetUp(const vector<Blob<Dtype>*>& bottom,
       const vector<Blob<Dtype>*>& top);
+  virtual void Reshape(const vector<Blob<Dtype>*>& bottom,
+      const vector<Blob<Dtype>*>& top);
 
-  virtual inline int ExactNumBottomBlobs() const { return 3; }
+  virtual inline int ExactNumBottomBlobs() const { return -1; }
+  virtual inline int MinBottomBlobs() const { return 2; }
+  virtual inline int MaxBottomBlobs() const { return 3; }
    virtual inline const char* type() const { return "TripletClsLoss"; }
   /**
    * Unlike most loss layers, in the TripletLossLayer we can backpropagate
-   * to the first three inputs.
+   * to the first three inputs. When mining, the labels are the second input.
    */
   virtual inline bool AllowForceBackward(const int bottom_index) const {
-    return bottom_index != 3;
+    return mining_ == TripletClsLossParameter_Mining_NONE ?
+        bottom_index != 3 : bottom_index != 1;
   }
 
  protected:  
@@ -36,10 +51,24 @@ class TripletClsLossLayer : public LossLayer<Dtype> {
   virtual void Backward_cpu(const vector<Blob<Dtype>*>& top,
       const vector<bool>& propagate_down, const vector<Blob<Dtype>*>& bottom);
 
-  Blob<Dtype> const_;  // cached for backward pass
-  Blob<Dtype> diff_sample_target; // cached for backward pass
-  Blob<Dtype> diff_sample_impostor; // cached for backward pass
-  Blob<Dtype> diff_impostor_target;  // cached for backward pass
+  /// Picks the triplets of the batch and computes their loss.
+  void Forward_mining(const vector<Blob<Dtype>*>& bottom,
+      const vector<Blob<Dtype>*>& top);
+  void Backward_mining(const vector<Blob<Dtype>*>& top,
+      const vector<bool>& propagate_down, const vector<Blob<Dtype>*>& bottom);
+  /// Counts the triplet (anchor, positive, negative) and returns its loss,
+  /// keeping it for the backward pass if it violates the margin.
+  Dtype add_triplet(int anchor, int positive, int negative);
+
+  const TripletClsLossParameter_Mining mining_;
+  Dtype margin_;
+  Blob<Dtype> const_;  // violations, cached for backward pass
+  // Squared distances between the embeddings of the batch when mining
+  Blob<Dtype> distances_;
+  // Anchor, positive and negative of the mined triplets that violate the
+  // margin, cached for backward pass
+  vector<int> triplets_;
+  int num_triplets_;
 };
 }  // namespace caffe
 
@@ -6,6 +6,10 @@
 #include <vector>
 #include <map>
 
+#ifdef USE_OPENCV
+#include <opencv2/core/core.hpp>
+#endif  // USE_OPENCV
+
 #include "caffe/blob.hpp"
 #include "caffe/data_transformer.hpp"
 #include "caffe/internal_thread.hpp"
@@ -15,6 +19,8 @@
 
 namespace caffe {
 
+class ImageCache;
+
 template <typename Dtype>
 class TripletWindowDataLayer : public BasePrefetchingDataLayer<Dtype> {
  public:
@@ -31,22 +37,67 @@ class TripletWindowDataLayer : public BasePrefetchingDataLayer<Dtype> {
  protected:
   virtual unsigned int PrefetchRand();
   virtual void load_batch(Batch<Dtype>* batch);
-  bool prepare_window(cv::Mat &warpimg, int &pad_w, int &pad_h, bool &do_mirror, const vector<float> &window, const bool mirror, const int context_pad, const bool use_square, const int crop_size);
+  virtual void load_item(Batch<Dtype>* batch, Dtype* top_data,
+      Dtype* top_label, int item_id, int thread);
+  bool load_image(int image_index, cv::Mat* cv_img);
+  // A window kept by the layer. The indices and the label are stored as
+  // integers so that they stay exact however many windows there are.
+  struct Window {
+    int image_index;
+    int bb_index;
+    int label;
+    float overlap;
+    float x1, y1, x2, y2;
+  };
+  bool prepare_window(cv::Mat &warpimg, int &pad_w, int &pad_h, const bool do_mirror, const cv::Mat &cv_img, const Window& window, const int context_pad, const bool use_square, const int crop_size);
+  void add_image_windows(const vector<Window>& windows);
+  void set_triplets(const vector<int>& triplets, const vector<int>& triplet_cls);
+  // Index of the window of an image with a given box index, -1 if not kept
+  int find_window(int image_index, int bb_index) const;
+  inline const Window& window(int index) const {
+    return windows_[index];
+  }
+  inline const int* triplet(int index) const {
+    return &triplets_[index * NUM_TRIPLET_FIELDS];
+  }
 
   shared_ptr<Caffe::RNG> prefetch_rng_;
   vector<std::pair<std::string, vector<int> > > image_database_;
-  enum WindowField { IMAGE_INDEX, BB_INDEX, LABEL, OVERLAP, X1, Y1, X2, Y2, NUM_WIN_FIELDS };
-  enum PairField { PAIR_INDEX, IMAGE_INDEX_1, BB_INDEX_1, IMAGE_INDEX_2, BB_INDEX_2, IMAGE_INDEX_3, BB_INDEX_3, NUM_PAIR_FIELDS };
-  map<int, map<int, vector<float> > > windows_; //map imidx => (bbidx => window)
-  map<int, vector<vector<int> > > triplets_; //map class_label => triplets
-  map<int, int > cls_idx_; //clas_label => sample idx
+  enum TripletField { TRIPLET_INDEX, WINDOW_1, WINDOW_2, WINDOW_3, NUM_TRIPLET_FIELDS };
+  // Windows of all images, sorted by image then box index. The windows of
+  // image i are [image_windows_[i], image_windows_[i + 1]).
+  vector<Window> windows_;
+  vector<int> image_windows_;
+  // Triplets, NUM_TRIPLET_FIELDS values each with the indices of their
+  // windows, grouped by class of the sample. The triplets of class
+  // cls_keys_[c] are [cls_triplets_[c], cls_triplets_[c + 1]).
+  vector<int> triplets_;
+  vector<int> cls_triplets_;
+  vector<int> cls_idx_; // class => sample idx
   Blob<Dtype> data_mean_;
+  // CPU data of data_mean_ for load_item, or NULL without a mean file
+  const Dtype* mean_data_;
   vector<Dtype> mean_values_;
   bool has_mean_file_;
   bool has_mean_values_;
   bool cache_images_;
   vector<std::pair<std::string, Datum > > image_database_cache_;
+  shared_ptr<ImageCache> image_cache_;
   vector<int> cls_keys_;
+  // Triplets of the batch being loaded and whether to mirror their windows
+  vector<int> item_triplets_;
+  vector<bool> item_mirrors_;
+  // Images of the part of the batch being loaded, and the index in
+  // batch_images_ of the image of each window. Each image is decoded once
+  // per part (see batch_images).
+  vector<int> batch_image_indices_;
+  vector<int> item_images_;
+#ifdef USE_OPENCV
+  vector<cv::Mat> batch_images_;
+#endif  // USE_OPENCV
+
+ private:
+  class LoadImages;
 };
 
 }
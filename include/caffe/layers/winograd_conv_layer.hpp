@@ -0,0 +1,45 @@
+#ifndef CAFFE_WINOGRAD_CONV_LAYER_HPP_
+#define CAFFE_WINOGRAD_CONV_LAYER_HPP_
+
+#include <vector>
+
+#include "caffe/blob.hpp"
+#include "caffe/layer.hpp"
+#include "caffe/proto/caffe.pb.h"
+
+#include "caffe/layers/conv_layer.hpp"
+
+namespace caffe {
+
+/**
+ * @brief Winograd F(2x2, 3x3) implementation of ConvolutionLayer on the CPU.
+ *        Fallback to ConvolutionLayer for the GPU and for other shapes than
+ *        2D 3x3 filters with stride 1 and dilation 1.
+ *
+ * Each 2x2 tile of the output is computed from the 4x4 tile of the input
+ * that covers it, with 16 multiplications per input and output channel
+ * instead of the 36 of the direct convolution. The input tiles and the
+ * filters are transformed to 16 matrices each, multiplied pairwise with one
+ * GEMM per matrix, and the products are transformed back to the output
+ * tiles. The tiles of all the images are processed in blocks whose
+ * transformed inputs and outputs stay in cache, where im2col writes 9 values
+ * per input value of every image.
+ *
+ * The gradient w.r.t. the bottom is the convolution of the top diff with the
+ * filters flipped and transposed, so it is computed the same way. The
+ * gradients w.r.t. the filters and biases are computed with GEMMs. The
+ * WINOGRAD algorithm of ConvolutionLayer does the work, this layer only
+ * selects it; cpu_autotune selects it only when it is the fastest.
+ */
+template <typename Dtype>
+class WinogradConvolutionLayer : public ConvolutionLayer<Dtype> {
+ public:
+  explicit WinogradConvolutionLayer(const LayerParameter& param)
+      : ConvolutionLayer<Dtype>(param) {}
+  virtual void LayerSetUp(const vector<Blob<Dtype>*>& bottom,
+      const vector<Blob<Dtype>*>& top);
+};
+
+}  // namespace caffe
+
+#endif  // CAFFE_WINOGRAD_CONV_LAYER_HPP_
@@ -241,6 +241,25 @@ class Net {
   void AppendParam(const NetParameter& param, const int layer_id,
                    const int param_id);
 
+  /**
+   * @brief Sets up a FusedElementwiseLayer for each chain of consecutive
+   *        elementwise layers whose tops have no other consumer.
+   */
+  void FuseElementwiseLayers();
+  /// @brief The first layer of the fused chain of layer_id, or -1.
+  int FusedChainFirst(const int layer_id) const;
+  /**
+   * @brief Computes the blobs inside the fused chain starting at first with
+   *        its layers, for Backward to start or stop inside it.
+   */
+  void ForwardFusedChain(const int first);
+  /**
+   * @brief Lets the blobs of a TEST net whose lifetimes, from their first
+   *        producer to their last consumer, do not overlap share their
+   *        memory.
+   */
+  void ShareActivationMemory();
+
   /// @brief Helper for displaying debug info in Forward about input Blobs.
   void InputDebugInfo(const int layer_id);
   /// @brief Helper for displaying debug info in Forward.
@@ -259,6 +278,13 @@ class Net {
   vector<string> layer_names_;
   map<string, int> layer_names_index_;
   vector<bool> layer_need_backward_;
+  /// @brief The fused layer run in CPU mode in place of the layers from
+  /// layer_id to fused_last_[layer_id], for the first layer of each chain.
+  /// fused_first_ maps the last layer of each chain back to its first, and
+  /// both are -1 for the other layers.
+  vector<shared_ptr<Layer<Dtype> > > fused_layers_;
+  vector<int> fused_first_;
+  vector<int> fused_last_;
   /// @brief the blobs storing intermediate results between the layer.
   vector<shared_ptr<Blob<Dtype> > > blobs_;
   vector<string> blob_names_;
@@ -305,6 +331,13 @@ class Net {
   vector<bool> has_params_decay_;
   /// The bytes of memory used by this net
   size_t memory_used_;
+  /// Whether the blobs not in use at the same time share activation_memory_,
+  /// the ids of the blobs sharing it, and of the blobs of
+  /// NetParameter.pinned_blob that do not.
+  bool share_activation_memory_;
+  vector<shared_ptr<SyncedMemory> > activation_memory_;
+  vector<int> activation_memory_blob_ids_;
+  vector<int> pinned_blob_ids_;
   /// Whether to compute and display debug info for the net.
   bool debug_info_;
   /// The root net that actually holds the shared layers in data parallelism
@@ -0,0 +1,26 @@
+#ifndef CAFFE_UTIL_CONV_ALGORITHM_CACHE_HPP_
+#define CAFFE_UTIL_CONV_ALGORITHM_CACHE_HPP_
+
+#include <string>
+
+#include "caffe/proto/caffe.pb.h"
+
+namespace caffe {
+
+// CPU convolution algorithms picked by timing, shared by the layers of the
+// process. They are kept in memory and, once a file is set, read from it on
+// the first lookup and written back to it with every new entry.
+
+// Sets the file of the cache, empty to keep the cache in memory only.
+void SetConvolutionAlgorithmCacheFile(const std::string& filename);
+
+// Looks up the algorithm picked for a key, returns whether there is one.
+bool FindConvolutionAlgorithm(const std::string& key,
+    ConvolutionAlgorithmCache::Entry* entry);
+
+// Adds or replaces the algorithm picked for the key of the entry.
+void AddConvolutionAlgorithm(const ConvolutionAlgorithmCache::Entry& entry);
+
+}  // namespace caffe
+
+#endif  // CAFFE_UTIL_CONV_ALGORITHM_CACHE_HPP_
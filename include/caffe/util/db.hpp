@@ -18,6 +18,12 @@ class Cursor {
   virtual void Next() = 0;
   virtual string key() = 0;
   virtual string value() = 0;
+  // If the backend keeps values mapped in memory for the lifetime of the
+  // cursor, points data to the current value without copying and returns
+  // true. Otherwise returns false and value() has to be used.
+  virtual bool value_in_place(const char** data, size_t* size) {
+    return false;
+  }
   virtual bool valid() = 0;
 
   DISABLE_COPY_AND_ASSIGN(Cursor);
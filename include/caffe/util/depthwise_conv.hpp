@@ -0,0 +1,42 @@
+#ifndef CAFFE_UTIL_DEPTHWISE_CONV_HPP_
+#define CAFFE_UTIL_DEPTHWISE_CONV_HPP_
+
+namespace caffe {
+
+// Direct 2D depthwise convolution on the CPU, without im2col. Each of the
+// channels of num images of channels x height x width is convolved with
+// multiplier filters of its own, of kernel_h x kernel_w, giving output
+// channels c * multiplier to (c + 1) * multiplier - 1 of num x channels *
+// multiplier x output_h x output_w. The filters are laid out like those of
+// a ConvolutionLayer with group = channels.
+
+// Convolves the input with the filters, overwriting the output.
+template <typename Dtype>
+void depthwise_conv_cpu(const Dtype* input, const int num,
+    const int channels, const int height, const int width,
+    const int multiplier, const int kernel_h, const int kernel_w,
+    const int pad_h, const int pad_w, const int stride_h, const int stride_w,
+    const int dilation_h, const int dilation_w, const Dtype* weight,
+    Dtype* output);
+
+// Computes the gradient w.r.t. the input from the one w.r.t. the output,
+// overwriting input_diff.
+template <typename Dtype>
+void depthwise_conv_backward_cpu(const Dtype* output_diff, const int num,
+    const int channels, const int height, const int width,
+    const int multiplier, const int kernel_h, const int kernel_w,
+    const int pad_h, const int pad_w, const int stride_h, const int stride_w,
+    const int dilation_h, const int dilation_w, const Dtype* weight,
+    Dtype* input_diff);
+
+// Adds the gradient w.r.t. the filters to weight_diff.
+template <typename Dtype>
+void depthwise_conv_weight_cpu(const Dtype* input, const Dtype* output_diff,
+    const int num, const int channels, const int height, const int width,
+    const int multiplier, const int kernel_h, const int kernel_w,
+    const int pad_h, const int pad_w, const int stride_h, const int stride_w,
+    const int dilation_h, const int dilation_w, Dtype* weight_diff);
+
+}  // namespace caffe
+
+#endif  // CAFFE_UTIL_DEPTHWISE_CONV_HPP_
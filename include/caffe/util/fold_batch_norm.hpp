@@ -0,0 +1,20 @@
+#ifndef _CAFFE_UTIL_FOLD_BATCH_NORM_HPP_
+#define _CAFFE_UTIL_FOLD_BATCH_NORM_HPP_
+
+#include "caffe/proto/caffe.pb.h"
+
+namespace caffe {
+
+// Copy the NetParameter of a TEST net and its trained weights, as read from a
+// .caffemodel, with the BatchNorm, Scale and Bias layers that follow a
+// Convolution or InnerProduct layer folded into its weights and bias. Only
+// the layers that scale and shift each channel of a top with no other
+// consumer are folded, and the folded layer takes the top of the last one.
+// param_folded gets the layers without their blobs and weights_folded with
+// them.
+void FoldBatchNorm(const NetParameter& param, const NetParameter& weights,
+    NetParameter* param_folded, NetParameter* weights_folded);
+
+}  // namespace caffe
+
+#endif  // _CAFFE_UTIL_FOLD_BATCH_NORM_HPP_
@@ -0,0 +1,65 @@
+#ifndef CAFFE_UTIL_IMAGE_CACHE_HPP_
+#define CAFFE_UTIL_IMAGE_CACHE_HPP_
+
+#ifdef USE_OPENCV
+#include <opencv2/core/core.hpp>
+#include <stdint.h>
+
+#include <list>
+#include <map>
+
+#include "caffe/common.hpp"
+
+namespace boost { class mutex; }
+
+namespace caffe {
+
+/**
+ * @brief Keeps decoded images in memory, up to a number of bytes, evicting
+ *        the least recently used ones.
+ *
+ * The cache can be used from several threads. Images are returned by
+ * reference to the cached data, they must not be modified. Hit rates are
+ * logged every log_interval lookups.
+ */
+class ImageCache {
+ public:
+  explicit ImageCache(size_t max_bytes, int log_interval = 10000);
+  ~ImageCache();
+
+  // Returns the image with the given key if it is cached.
+  bool Get(int key, cv::Mat* image);
+  // Adds an image, unless it is larger than the cache.
+  void Put(int key, const cv::Mat& image);
+
+  inline size_t max_bytes() const { return max_bytes_; }
+  size_t bytes() const;
+  uint64_t hits() const;
+  uint64_t misses() const;
+  void LogStats() const;
+
+ protected:
+  struct Entry {
+    cv::Mat image;
+    size_t bytes;
+    std::list<int>::iterator use;
+  };
+
+  const size_t max_bytes_;
+  const int log_interval_;
+  size_t bytes_;
+  uint64_t hits_;
+  uint64_t misses_;
+  uint64_t evictions_;
+  std::map<int, Entry> entries_;
+  // Keys from the most to the least recently used
+  std::list<int> uses_;
+  shared_ptr<boost::mutex> mutex_;
+
+  DISABLE_COPY_AND_ASSIGN(ImageCache);
+};
+
+}  // namespace caffe
+
+#endif  // USE_OPENCV
+#endif  // CAFFE_UTIL_IMAGE_CACHE_HPP_
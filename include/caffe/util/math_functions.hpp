@@ -9,6 +9,7 @@
 #include "caffe/common.hpp"
 #include "caffe/util/device_alternate.hpp"
 #include "caffe/util/mkl_alternate.hpp"
+#include "caffe/util/simd.hpp"
 
 namespace caffe {
 
@@ -128,7 +129,11 @@ inline int8_t caffe_sign(Dtype val) {
   }
 
 // output is 1 for the positives, 0 for zero, and -1 for the negatives
-DEFINE_CAFFE_CPU_UNARY_FUNC(sign, y[i] = caffe_sign<Dtype>(x[i]));
+template <typename Dtype>
+inline void caffe_cpu_sign(const int n, const Dtype* x, Dtype* y) {
+  CHECK_GT(n, 0); CHECK(x); CHECK(y);
+  simd_sign(n, x, y);
+}
 
 // This returns a nonzero value if the input has its sign bit set.
 // The name sngbit is meant to avoid conflicts with std::signbit in the macro.
@@ -137,7 +142,11 @@ DEFINE_CAFFE_CPU_UNARY_FUNC(sign, y[i] = caffe_sign<Dtype>(x[i]));
 DEFINE_CAFFE_CPU_UNARY_FUNC(sgnbit, \
     y[i] = static_cast<bool>((std::signbit)(x[i])));
 
-DEFINE_CAFFE_CPU_UNARY_FUNC(fabs, y[i] = std::fabs(x[i]));
+template <typename Dtype>
+inline void caffe_cpu_fabs(const int n, const Dtype* x, Dtype* y) {
+  CHECK_GT(n, 0); CHECK(x); CHECK(y);
+  simd_abs(n, x, y);
+}
 
 template <typename Dtype>
 void caffe_cpu_scale(const int n, const Dtype alpha, const Dtype *x, Dtype* y);
@@ -12,70 +12,64 @@ extern "C" {
 }
 #include <math.h>
 
-// Functions that caffe uses but are not present if MKL is not linked.
+#include "caffe/util/simd.hpp"
 
-// A simple way to define the vsl unary functions. The operation should
-// be in the form e.g. y[i] = sqrt(a[i])
-#define DEFINE_VSL_UNARY_FUNC(name, operation) \
-  template<typename Dtype> \
-  void v##name(const int n, const Dtype* a, Dtype* y) { \
-    CHECK_GT(n, 0); CHECK(a); CHECK(y); \
-    for (int i = 0; i < n; ++i) { operation; } \
-  } \
+// Functions that caffe uses but are not present if MKL is not linked, which
+// run the elementwise kernels of simd.hpp.
+
+// A simple way to define the vsl unary functions from the kernel computing
+// e.g. y[i] = sqrt(a[i])
+#define DEFINE_VSL_UNARY_FUNC(name, kernel) \
   inline void vs##name( \
     const int n, const float* a, float* y) { \
-    v##name<float>(n, a, y); \
+    CHECK_GT(n, 0); CHECK(a); CHECK(y); \
+    caffe::kernel<float>(n, a, y); \
   } \
   inline void vd##name( \
       const int n, const double* a, double* y) { \
-    v##name<double>(n, a, y); \
+    CHECK_GT(n, 0); CHECK(a); CHECK(y); \
+    caffe::kernel<double>(n, a, y); \
   }
 
-DEFINE_VSL_UNARY_FUNC(Sqr, y[i] = a[i] * a[i]);
-DEFINE_VSL_UNARY_FUNC(Exp, y[i] = exp(a[i]));
-DEFINE_VSL_UNARY_FUNC(Ln, y[i] = log(a[i]));
-DEFINE_VSL_UNARY_FUNC(Abs, y[i] = fabs(a[i]));
+DEFINE_VSL_UNARY_FUNC(Sqr, simd_sqr);
+DEFINE_VSL_UNARY_FUNC(Exp, simd_exp);
+DEFINE_VSL_UNARY_FUNC(Ln, simd_log);
+DEFINE_VSL_UNARY_FUNC(Abs, simd_abs);
 
-// A simple way to define the vsl unary functions with singular parameter b.
-// The operation should be in the form e.g. y[i] = pow(a[i], b)
-#define DEFINE_VSL_UNARY_FUNC_WITH_PARAM(name, operation) \
-  template<typename Dtype> \
-  void v##name(const int n, const Dtype* a, const Dtype b, Dtype* y) { \
-    CHECK_GT(n, 0); CHECK(a); CHECK(y); \
-    for (int i = 0; i < n; ++i) { operation; } \
-  } \
+// A simple way to define the vsl unary functions with singular parameter b,
+// from the kernel computing e.g. y[i] = pow(a[i], b)
+#define DEFINE_VSL_UNARY_FUNC_WITH_PARAM(name, kernel) \
   inline void vs##name( \
     const int n, const float* a, const float b, float* y) { \
-    v##name<float>(n, a, b, y); \
+    CHECK_GT(n, 0); CHECK(a); CHECK(y); \
+    caffe::kernel<float>(n, a, b, y); \
   } \
   inline void vd##name( \
       const int n, const double* a, const float b, double* y) { \
-    v##name<double>(n, a, b, y); \
+    CHECK_GT(n, 0); CHECK(a); CHECK(y); \
+    caffe::kernel<double>(n, a, b, y); \
   }
 
-DEFINE_VSL_UNARY_FUNC_WITH_PARAM(Powx, y[i] = pow(a[i], b));
+DEFINE_VSL_UNARY_FUNC_WITH_PARAM(Powx, simd_powx);
 
-// A simple way to define the vsl binary functions. The operation should
-// be in the form e.g. y[i] = a[i] + b[i]
-#define DEFINE_VSL_BINARY_FUNC(name, operation) \
-  template<typename Dtype> \
-  void v##name(const int n, const Dtype* a, const Dtype* b, Dtype* y) { \
-    CHECK_GT(n, 0); CHECK(a); CHECK(b); CHECK(y); \
-    for (int i = 0; i < n; ++i) { operation; } \
-  } \
+// A simple way to define the vsl binary functions from the kernel computing
+// e.g. y[i] = a[i] + b[i]
+#define DEFINE_VSL_BINARY_FUNC(name, kernel) \
   inline void vs##name( \
     const int n, const float* a, const float* b, float* y) { \
-    v##name<float>(n, a, b, y); \
+    CHECK_GT(n, 0); CHECK(a); CHECK(b); CHECK(y); \
+    caffe::kernel<float>(n, a, b, y); \
   } \
   inline void vd##name( \
       const int n, const double* a, const double* b, double* y) { \
-    v##name<double>(n, a, b, y); \
+    CHECK_GT(n, 0); CHECK(a); CHECK(b); CHECK(y); \
+    caffe::kernel<double>(n, a, b, y); \
   }
 
-DEFINE_VSL_BINARY_FUNC(Add, y[i] = a[i] + b[i]);
-DEFINE_VSL_BINARY_FUNC(Sub, y[i] = a[i] - b[i]);
-DEFINE_VSL_BINARY_FUNC(Mul, y[i] = a[i] * b[i]);
-DEFINE_VSL_BINARY_FUNC(Div, y[i] = a[i] / b[i]);
+DEFINE_VSL_BINARY_FUNC(Add, simd_add);
+DEFINE_VSL_BINARY_FUNC(Sub, simd_sub);
+DEFINE_VSL_BINARY_FUNC(Mul, simd_mul);
+DEFINE_VSL_BINARY_FUNC(Div, simd_div);
 
 // In addition, MKL comes with an additional function axpby that is not present
 // in standard blas. We will simply use a two-step (inefficient, of course) way
@@ -0,0 +1,81 @@
+#ifndef CAFFE_UTIL_SIMD_HPP_
+#define CAFFE_UTIL_SIMD_HPP_
+
+namespace caffe {
+
+/**
+ * @brief Instruction sets of the elementwise CPU kernels, from the oldest.
+ *
+ * SIMD_GENERIC is what the compiler targets by default, SSE2 on x86-64. The
+ * kernels of the others are built with GCC target attributes and picked at
+ * run time from CPUID, so that one binary runs everywhere.
+ */
+enum SimdLevel {
+  SIMD_GENERIC = 0,
+  SIMD_AVX2 = 1,
+  SIMD_AVX512 = 2
+};
+
+// Instruction set used by the kernels, the best one of the CPU by default
+SimdLevel simd_level();
+// Best instruction set of the CPU
+SimdLevel simd_cpu_level();
+// Restricts the kernels to level, or to the CPU level if it is lower. This is
+// for tests and benchmarks and should not be called while kernels run.
+void set_simd_level(SimdLevel level);
+const char* simd_level_name(SimdLevel level);
+
+// Elementwise kernels behind caffe_add and the other vector functions when
+// MKL is not used, and behind the caffe_cpu_* ones that MKL does not have.
+// They run on the CPU threads above a few hundred thousand values, and
+// support y being one of the inputs.
+template <typename Dtype>
+void simd_add(const int n, const Dtype* a, const Dtype* b, Dtype* y);
+template <typename Dtype>
+void simd_sub(const int n, const Dtype* a, const Dtype* b, Dtype* y);
+template <typename Dtype>
+void simd_mul(const int n, const Dtype* a, const Dtype* b, Dtype* y);
+template <typename Dtype>
+void simd_div(const int n, const Dtype* a, const Dtype* b, Dtype* y);
+template <typename Dtype>
+void simd_sqr(const int n, const Dtype* a, Dtype* y);
+template <typename Dtype>
+void simd_abs(const int n, const Dtype* a, Dtype* y);
+template <typename Dtype>
+void simd_sign(const int n, const Dtype* a, Dtype* y);
+template <typename Dtype>
+void simd_scale(const int n, const Dtype alpha, const Dtype* a, Dtype* y);
+template <typename Dtype>
+void simd_add_scalar(const int n, const Dtype alpha, const Dtype* a,
+    Dtype* y);
+
+// Transcendental functions, from the Taylor series of exp and of atanh after
+// reducing their argument. They are within 1 ulp of the exact results for exp
+// and ELU, 2 for sigmoid, 3 for log and tanh and 4 for BNLL, in float and in
+// double, so at most 1 ulp more from those of libm. Infinite, NaN, zero and
+// subnormal arguments give the results of libm.
+template <typename Dtype>
+void simd_exp(const int n, const Dtype* a, Dtype* y);
+template <typename Dtype>
+void simd_log(const int n, const Dtype* a, Dtype* y);
+template <typename Dtype>
+void simd_tanh(const int n, const Dtype* a, Dtype* y);
+// y = 1 / (1 + exp(-a))
+template <typename Dtype>
+void simd_sigmoid(const int n, const Dtype* a, Dtype* y);
+// y = max(a, 0) + alpha (exp(min(a, 0)) - 1)
+template <typename Dtype>
+void simd_elu(const int n, const Dtype alpha, const Dtype* a, Dtype* y);
+// y = log(1 + exp(a)), and its gradient y = b / (1 + exp(-a))
+template <typename Dtype>
+void simd_bnll(const int n, const Dtype* a, Dtype* y);
+template <typename Dtype>
+void simd_bnll_backward(const int n, const Dtype* a, const Dtype* b,
+    Dtype* y);
+// Scalar pow calls, only spread over the threads, but for b = 2 and b = -1
+template <typename Dtype>
+void simd_powx(const int n, const Dtype* a, const Dtype b, Dtype* y);
+
+}  // namespace caffe
+
+#endif  // CAFFE_UTIL_SIMD_HPP_
@@ -0,0 +1,58 @@
+#ifndef CAFFE_UTIL_THREAD_POOL_HPP_
+#define CAFFE_UTIL_THREAD_POOL_HPP_
+
+#include <vector>
+
+#include "caffe/common.hpp"
+
+namespace caffe {
+
+/**
+ * @brief Runs a task over a range of indices on a fixed set of threads.
+ *
+ * The range is split in contiguous blocks, one per thread, and the calling
+ * thread processes the first block itself. For a given range and pool size,
+ * an index is therefore always processed by the same thread, which keeps
+ * per-thread state such as random number generators deterministic.
+ * Run() should only be called from one thread at a time. Tasks may call it
+ * again from the calling thread, which then processes the range alone.
+ */
+class ThreadPool {
+ public:
+  class Task {
+   public:
+    virtual ~Task() {}
+    // Processes indices [begin, end) on thread `thread`, in [0, size()).
+    virtual void Run(int thread, int begin, int end) = 0;
+  };
+
+  // Creates size - 1 worker threads, the caller being the last one.
+  explicit ThreadPool(int size);
+  ~ThreadPool();
+
+  inline int size() const { return workers_.size() + 1; }
+
+  // Runs task over [0, count) and returns once all blocks are processed.
+  void Run(Task* task, int count);
+
+ protected:
+  class Worker;
+  class sync;
+
+  void RunBlock(Task* task, int thread, int count);
+
+  vector<shared_ptr<Worker> > workers_;
+  shared_ptr<sync> sync_;
+  Task* task_;
+  int count_;
+  int generation_;
+  int pending_;
+  // Whether Run() is processing a task
+  bool running_;
+
+DISABLE_COPY_AND_ASSIGN(ThreadPool);
+};
+
+}  // namespace caffe
+
+#endif  // CAFFE_UTIL_THREAD_POOL_HPP_
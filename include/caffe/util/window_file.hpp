@@ -0,0 +1,97 @@
+#ifndef CAFFE_UTIL_WINDOW_FILE_HPP_
+#define CAFFE_UTIL_WINDOW_FILE_HPP_
+
+#include <string>
+#include <vector>
+
+#include "caffe/common.hpp"
+
+namespace caffe {
+
+/**
+ * @brief Images, windows and pairs of a window file, as read by the pair and
+ *        triplet window data layers.
+ *
+ * The text format has a "# FULL_IMAGES index" section per image, numbered in
+ * order from 0, followed by the image path, channels, height, width, the
+ * number of windows and a "bb_index label overlap x1 y1 x2 y2" line per
+ * window. "# PAIRS count" sections follow with the integers of count pairs,
+ * each starting with the pair index, separated by any whitespace; all pairs
+ * of a file have the same number of integers.
+ *
+ * Text files can be compiled by tools/convert_window_file into a binary file,
+ * which is memory mapped and read in place instead of being parsed. Binary
+ * files are in host byte order.
+ */
+class WindowFile {
+ public:
+  struct Window {
+    int bb_index;
+    int label;
+    float overlap;
+    int x1, y1, x2, y2;
+  };
+
+  WindowFile();
+  ~WindowFile();
+
+  // Reads a text or binary window file, depending on its first bytes.
+  void Open(const string& filename);
+  void Close();
+  // Writes the file in binary format.
+  void Write(const string& filename) const;
+
+  inline bool binary() const { return map_ != NULL; }
+  inline int num_images() const { return num_images_; }
+  inline const char* image_path(int image) const {
+    return paths_ + image_paths_[image];
+  }
+  // Channels, height and width of an image
+  inline const int* image_size(int image) const {
+    return image_sizes_ + 3 * image;
+  }
+  inline int num_windows(int image) const {
+    return image_windows_[image + 1] - image_windows_[image];
+  }
+  inline const Window* windows(int image) const {
+    return windows_ + image_windows_[image];
+  }
+  inline int num_pairs() const { return num_pairs_; }
+  // Number of integers per pair, including the pair index
+  inline int pair_size() const { return pair_size_; }
+  inline const int* pair(int index) const {
+    return pairs_ + static_cast<size_t>(index) * pair_size_;
+  }
+
+ protected:
+  void ReadText(const string& filename);
+  void Map(const string& filename, int fd, size_t size);
+
+  int num_images_;
+  int num_pairs_;
+  int pair_size_;
+  int paths_size_;
+  const int* image_sizes_;
+  const int* image_windows_;
+  const int* image_paths_;
+  const Window* windows_;
+  const int* pairs_;
+  const char* paths_;
+
+  // Memory map of a binary file
+  void* map_;
+  size_t map_size_;
+  // Contents of a text file
+  vector<int> text_image_sizes_;
+  vector<int> text_image_windows_;
+  vector<int> text_image_paths_;
+  vector<Window> text_windows_;
+  vector<int> text_pairs_;
+  string text_paths_;
+
+  DISABLE_COPY_AND_ASSIGN(WindowFile);
+};
+
+}  // namespace caffe
+
+#endif  // CAFFE_UTIL_WINDOW_FILE_HPP_
@@ -0,0 +1,45 @@
+#ifndef CAFFE_UTIL_WINOGRAD_HPP_
+#define CAFFE_UTIL_WINOGRAD_HPP_
+
+namespace caffe {
+
+// Winograd F(2x2, 3x3) convolution on the CPU. Each 2x2 tile of the output
+// is computed from the 4x4 tile of the input that covers it: the input tiles
+// and the filters are transformed to 16 matrices each, multiplied pairwise
+// with one GEMM per matrix, and the products transformed back.
+
+// Number of tiles transformed at once, so that their transformed inputs and
+// outputs stay in cache, out of the given tiles.
+template <typename Dtype>
+int winograd_block_tiles(int channels, int num_output, int tiles);
+
+// Number of values of the transformed filters of one group.
+int winograd_weight_count(int channels, int num_output);
+
+// Number of values of the transformed inputs or outputs of a block of tiles.
+int winograd_buffer_count(int channels, int block_tiles);
+
+// Transforms 3x3 filters of group x num_output x channels to 16 matrices of
+// num_output x channels per group, or of channels x num_output with flip, the
+// filters flipped and transposed to convolve the top diff to the bottom diff.
+template <typename Dtype>
+void winograd_transform_weight_cpu(const Dtype* weight, const int group,
+    const int channels, const int num_output, const bool flip,
+    Dtype* transformed_weight);
+
+// Convolves num images of channels x height x width, input_dim values apart,
+// with the transformed filters of one group. The images are padded by pad_h
+// and pad_w, negative values cropping them, and the outputs of num_output x
+// output_h x output_w, output_dim values apart, are overwritten. The
+// transformed inputs and outputs hold winograd_buffer_count values for
+// channels and num_output.
+template <typename Dtype>
+void winograd_cpu(const Dtype* input, const int num, const int input_dim,
+    const int channels, const int height, const int width, const int pad_h,
+    const int pad_w, const Dtype* transformed_weight, const int num_output,
+    const int output_dim, const int output_h, const int output_w,
+    Dtype* transformed_input, Dtype* transformed_output, Dtype* output);
+
+}  // namespace caffe
+
+#endif  // CAFFE_UTIL_WINOGRAD_HPP_
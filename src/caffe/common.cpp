@@ -1,11 +1,13 @@
 #include <boost/thread.hpp>
 #include <glog/logging.h>
+#include <algorithm>
 #include <cmath>
 #include <cstdio>
 #include <ctime>
 
 #include "caffe/common.hpp"
 #include "caffe/util/rng.hpp"
+#include "caffe/util/thread_pool.hpp"
 
 namespace caffe {
 
@@ -19,6 +21,33 @@ Caffe& Caffe::Get() {
   return *(thread_instance_.get());
 }
 
+// Static initialization runs on the main thread.
+static const boost::thread::id main_thread_id = boost::this_thread::get_id();
+
+static int default_cpu_threads() {
+  // Other threads run their kernels alone unless told otherwise, so that
+  // each of them does not get a pool of all the hardware threads
+  if (boost::this_thread::get_id() != main_thread_id) {
+    return 1;
+  }
+  return std::max(1u, boost::thread::hardware_concurrency());
+}
+
+void Caffe::set_cpu_threads(int threads) {
+  CHECK_GE(threads, 1);
+  if (threads != Get().cpu_threads_) {
+    Get().cpu_threads_ = threads;
+    Get().cpu_pool_.reset();
+  }
+}
+
+ThreadPool& Caffe::cpu_pool() {
+  if (!Get().cpu_pool_) {
+    Get().cpu_pool_.reset(new ThreadPool(Get().cpu_threads_));
+  }
+  return *(Get().cpu_pool_);
+}
+
 // random seeding
 int64_t cluster_seedgen(void) {
   int64_t s, seed, pid;
@@ -53,7 +82,8 @@ void GlobalInit(int* pargc, char*** pargv) {
 
 Caffe::Caffe()
     : random_generator_(), mode_(Caffe::CPU),
-      solver_count_(1), root_solver_(true) { }
+      solver_count_(1), root_solver_(true),
+      cpu_threads_(default_cpu_threads()) { }
 
 Caffe::~Caffe() { }
 
@@ -97,7 +127,8 @@ void* Caffe::RNG::generator() {
 
 Caffe::Caffe()
     : cublas_handle_(NULL), curand_generator_(NULL), random_generator_(),
-    mode_(Caffe::CPU), solver_count_(1), root_solver_(true) {
+    mode_(Caffe::CPU), solver_count_(1), root_solver_(true),
+    cpu_threads_(default_cpu_threads()) {
   // Try to create a cublas handler, and report an error if failed (but we will
   // keep the program running as one might just want to run CPU code).
   if (cublasCreate(&cublas_handle_) != CUBLAS_STATUS_SUCCESS) {
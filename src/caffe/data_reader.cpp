@@ -1,4 +1,8 @@
 #include <boost/thread.hpp>
+#include <google/protobuf/io/coded_stream.h>
+#include <google/protobuf/wire_format_lite.h>
+#include <stdint.h>
+
 #include <map>
 #include <string>
 #include <vector>
@@ -11,10 +15,61 @@
 namespace caffe {
 
 using boost::weak_ptr;
+using google::protobuf::io::CodedInputStream;
+using google::protobuf::internal::WireFormatLite;
 
 map<const string, weak_ptr<DataReader::Body> > DataReader::bodies_;
 static boost::mutex bodies_mutex_;
 
+void MappedDatum::Parse(const char* value, size_t size, bool in_place) {
+  const uint8_t* buffer = reinterpret_cast<const uint8_t*>(value);
+  if (!in_place) {
+    datum_.ParseFromArray(buffer, size);
+    data_ = datum_.data().size() ? datum_.data().data() : NULL;
+    size_ = datum_.data().size();
+    return;
+  }
+  // Find the data field, and only parse the fields around it
+  const uint32_t data_tag = WireFormatLite::MakeTag(Datum::kDataFieldNumber,
+      WireFormatLite::WIRETYPE_LENGTH_DELIMITED);
+  const int total = size;
+  CodedInputStream input(buffer, total);
+  int begin = total;
+  int end = total;
+  uint32_t length = 0;
+  while (true) {
+    const int position = input.CurrentPosition();
+    const uint32_t tag = input.ReadTag();
+    if (tag == 0) {
+      break;
+    }
+    if (tag == data_tag) {
+      begin = position;
+      CHECK(input.ReadVarint32(&length));
+      data_ = value + input.CurrentPosition();
+      CHECK(input.Skip(length));
+      end = input.CurrentPosition();
+    } else {
+      CHECK(WireFormatLite::SkipField(&input, tag));
+    }
+  }
+  datum_.ParseFromArray(buffer, begin);
+  if (end < total) {
+    CodedInputStream suffix(buffer + end, total - end);
+    datum_.MergeFromCodedStream(&suffix);
+  }
+  size_ = begin < total ? length : 0;
+  if (!size_) {
+    data_ = NULL;
+  } else if (datum_.encoded()) {
+    // Encoded images are decoded from datum.data()
+    datum_.set_data(data_, size_);
+    data_ = datum_.data().data();
+  }
+}
+
+//
+
 DataReader::DataReader(const LayerParameter& param)
     : queue_pair_(new QueuePair(  //
         param.data_param().prefetch() * param.data_param().batch_size())) {
@@ -44,12 +99,12 @@ DataReader::~DataReader() {
 DataReader::QueuePair::QueuePair(int size) {
   // Initialize the free queue with requested number of datums
   for (int i = 0; i < size; ++i) {
-    free_.push(new Datum());
+    free_.push(new MappedDatum());
   }
 }
 
 DataReader::QueuePair::~QueuePair() {
-  Datum* datum;
+  MappedDatum* datum;
   while (free_.try_pop(&datum)) {
     delete datum;
   }
@@ -60,9 +115,34 @@ DataReader::QueuePair::~QueuePair() {
 
 //
 
+DataReader::Parser::Parser()
+    : in_(), out_() {
+  StartInternalThread();
+}
+
+DataReader::Parser::~Parser() {
+  StopInternalThread();
+}
+
+void DataReader::Parser::InternalThreadEntry() {
+  try {
+    while (!must_stop()) {
+      Record* record = in_.pop();
+      record->datum_->Parse(record->data_, record->size_, record->in_place_);
+      out_.push(record);
+    }
+  } catch (boost::thread_interrupted&) {
+    // Interrupted exception is expected on shutdown
+  }
+}
+
+//
+
 DataReader::Body::Body(const LayerParameter& param)
     : param_(param),
-      new_queue_pairs_() {
+      new_queue_pairs_(),
+      issued_(0),
+      delivered_(0) {
   StartInternalThread();
 }
 
@@ -75,6 +155,17 @@ void DataReader::Body::InternalThreadEntry() {
   db->Open(param_.data_param().source(), db::READ);
   shared_ptr<db::Cursor> cursor(db->NewCursor());
   vector<shared_ptr<QueuePair> > qps;
+  const int parser_count = param_.data_param().parser_threads();
+  if (parser_count > 1) {
+    // Keep two records per parser in flight, one being parsed and one queued
+    records_.resize(2 * parser_count);
+    for (int i = 0; i < records_.size(); ++i) {
+      free_records_.push_back(&records_[i]);
+    }
+    for (int i = 0; i < parser_count; ++i) {
+      parsers_.push_back(shared_ptr<Parser>(new Parser()));
+    }
+  }
   try {
     int solver_count = param_.phase() == TRAIN ? Caffe::solver_count() : 1;
 
@@ -84,6 +175,7 @@ void DataReader::Body::InternalThreadEntry() {
     for (int i = 0; i < solver_count; ++i) {
       shared_ptr<QueuePair> qp(new_queue_pairs_.pop());
       read_one(cursor.get(), qp.get());
+      deliver_all();
       qps.push_back(qp);
     }
     // Main loop
@@ -100,13 +192,58 @@ void DataReader::Body::InternalThreadEntry() {
   } catch (boost::thread_interrupted&) {
     // Interrupted exception is expected on shutdown
   }
+  // Stop parsers, then give datums still in flight back to their queues. The
+  // loop can also end on must_stop() with the interruption still pending,
+  // which would make the joins of the parser threads throw instead of wait.
+  boost::this_thread::disable_interruption no_interruption;
+  parsers_.clear();
+  while (!in_flight_.empty()) {
+    Record* record = in_flight_.front();
+    in_flight_.pop_front();
+    record->qp_->free_.push(record->datum_);
+  }
 }
 
 void DataReader::Body::read_one(db::Cursor* cursor, QueuePair* qp) {
-  Datum* datum = qp->free_.pop();
-  // TODO deserialize in-place instead of copy?
-  datum->ParseFromString(cursor->value());
-  qp->full_.push(datum);
+  if (parsers_.empty()) {
+    MappedDatum* datum = qp->free_.pop();
+    const char* data;
+    size_t size;
+    if (cursor->value_in_place(&data, &size)) {
+      datum->Parse(data, size, true);
+    } else {
+      const string value = cursor->value();
+      datum->Parse(value.data(), value.size(), false);
+    }
+    qp->full_.push(datum);
+  } else {
+    if (free_records_.empty()) {
+      deliver_one();
+    }
+    // Records in flight may hold all the free datums of this queue pair,
+    // deliver them first instead of waiting on the consumer.
+    MappedDatum* datum;
+    while (!qp->free_.try_pop(&datum)) {
+      if (in_flight_.empty()) {
+        datum = qp->free_.pop();
+        break;
+      }
+      deliver_one();
+    }
+    Record* record = free_records_.back();
+    free_records_.pop_back();
+    record->in_place_ = cursor->value_in_place(&record->data_,
+        &record->size_);
+    if (!record->in_place_) {
+      record->value_ = cursor->value();
+      record->data_ = record->value_.data();
+      record->size_ = record->value_.size();
+    }
+    record->datum_ = datum;
+    record->qp_ = qp;
+    in_flight_.push_back(record);
+    parsers_[issued_++ % parsers_.size()]->in_.push(record);
+  }
 
   // go to the next iter
   cursor->Next();
@@ -116,4 +253,19 @@ void DataReader::Body::read_one(db::Cursor* cursor, QueuePair* qp) {
   }
 }
 
+void DataReader::Body::deliver_one() {
+  Record* record = parsers_[delivered_ % parsers_.size()]->out_.pop();
+  CHECK_EQ(record, in_flight_.front());
+  ++delivered_;
+  in_flight_.pop_front();
+  record->qp_->full_.push(record->datum_);
+  free_records_.push_back(record);
+}
+
+void DataReader::Body::deliver_all() {
+  while (!in_flight_.empty()) {
+    deliver_one();
+  }
+}
+
 }  // namespace caffe
@@ -19,6 +19,10 @@ bool InternalThread::must_stop() {
 }
 
 void InternalThread::StartInternalThread() {
+  StartInternalThread(caffe_rng_rand());
+}
+
+void InternalThread::StartInternalThread(int rand_seed) {
   CHECK(!is_started()) << "Threads should persist and not be restarted.";
 
   int device = 0;
@@ -26,20 +30,20 @@ void InternalThread::StartInternalThread() {
   CUDA_CHECK(cudaGetDevice(&device));
 #endif
   Caffe::Brew mode = Caffe::mode();
-  int rand_seed = caffe_rng_rand();
   int solver_count = Caffe::solver_count();
   bool root_solver = Caffe::root_solver();
+  int cpu_threads = Caffe::cpu_threads();
 
   try {
     thread_.reset(new boost::thread(&InternalThread::entry, this, device, mode,
-          rand_seed, solver_count, root_solver));
+          rand_seed, solver_count, root_solver, cpu_threads));
   } catch (std::exception& e) {
     LOG(FATAL) << "Thread exception: " << e.what();
   }
 }
 
 void InternalThread::entry(int device, Caffe::Brew mode, int rand_seed,
-    int solver_count, bool root_solver) {
+    int solver_count, bool root_solver, int cpu_threads) {
 #ifndef CPU_ONLY
   CUDA_CHECK(cudaSetDevice(device));
 #endif
@@ -47,6 +51,7 @@ void InternalThread::entry(int device, Caffe::Brew mode, int rand_seed,
   Caffe::set_random_seed(rand_seed);
   Caffe::set_solver_count(solver_count);
   Caffe::set_root_solver(root_solver);
+  Caffe::set_cpu_threads(cpu_threads);
 
   InternalThreadEntry();
 }
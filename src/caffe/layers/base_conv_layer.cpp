@@ -1,4 +1,7 @@
+#include <stdint.h>
+
 #include <algorithm>
+#include <limits>
 #include <vector>
 
 #include "caffe/filler.hpp"
@@ -180,6 +183,7 @@ void BaseConvolutionLayer<Dtype>::LayerSetUp(const vector<Blob<Dtype>*>& bottom,
   weight_offset_ = conv_out_channels_ * kernel_dim_ / group_;
   // Propagate gradients to the parameters (as directed by backward pass).
   this->param_propagate_down_.resize(this->blobs_.size(), true);
+  cpu_batch_ = 1;
 }
 
 template <typename Dtype>
@@ -251,6 +255,45 @@ void BaseConvolutionLayer<Dtype>::Reshape(const vector<Blob<Dtype>*>& bottom,
     caffe_set(bias_multiplier_.count(), Dtype(1),
         bias_multiplier_.mutable_cpu_data());
   }
+  // Batches of images are sized to fit their columns and outputs in the
+  // memory cap. ConvolutionLayer sizes them itself when autotuning.
+  const ConvolutionParameter& conv_param =
+      this->layer_param_.convolution_param();
+  if (!conv_param.cpu_autotune()) {
+    set_cpu_batch(max_cpu_batch(conv_param.cpu_batch_bytes()));
+  }
+}
+
+template <typename Dtype>
+int BaseConvolutionLayer<Dtype>::max_cpu_batch(uint64_t bytes) {
+  if (reverse_dimensions() || force_nd_im2col_ || num_spatial_axes_ != 2) {
+    return 1;
+  }
+  const uint64_t image_bytes = sizeof(Dtype) * conv_out_spatial_dim_ *
+      (static_cast<uint64_t>(kernel_dim_) * group_ + conv_out_channels_);
+  return std::max<uint64_t>(1, std::min<uint64_t>(num_, bytes / image_bytes));
+}
+
+template <typename Dtype>
+void BaseConvolutionLayer<Dtype>::set_cpu_batch(int batch) {
+  CHECK_GE(batch, 1);
+  CHECK_LE(batch, max_cpu_batch(std::numeric_limits<uint64_t>::max()));
+  cpu_batch_ = batch;
+  if (cpu_batch_ == 1) {
+    // The batch buffers are only allocated when used
+    col_batch_buffer_.reset();
+    output_batch_buffer_.reset();
+    return;
+  }
+  if (!col_batch_buffer_) {
+    col_batch_buffer_.reset(new Blob<Dtype>());
+    output_batch_buffer_.reset(new Blob<Dtype>());
+  }
+  vector<int> batch_shape(1, cpu_batch_ * conv_out_spatial_dim_);
+  batch_shape.insert(batch_shape.begin(), kernel_dim_ * group_);
+  col_batch_buffer_->Reshape(batch_shape);
+  batch_shape[0] = conv_out_channels_;
+  output_batch_buffer_->Reshape(batch_shape);
 }
 
 template <typename Dtype>
@@ -281,10 +324,11 @@ void BaseConvolutionLayer<Dtype>::forward_cpu_bias(Dtype* output,
 
 template <typename Dtype>
 void BaseConvolutionLayer<Dtype>::backward_cpu_gemm(const Dtype* output,
-    const Dtype* weights, Dtype* input) {
-  Dtype* col_buff = col_buffer_.mutable_cpu_data();
+    const Dtype* weights, Dtype* input, Dtype* col_buff) {
   if (is_1x1_) {
     col_buff = input;
+  } else if (!col_buff) {
+    col_buff = col_buffer_.mutable_cpu_data();
   }
   for (int g = 0; g < group_; ++g) {
     caffe_cpu_gemm<Dtype>(CblasTrans, CblasNoTrans, kernel_dim_,
@@ -299,16 +343,19 @@ void BaseConvolutionLayer<Dtype>::backward_cpu_gemm(const Dtype* output,
 
 template <typename Dtype>
 void BaseConvolutionLayer<Dtype>::weight_cpu_gemm(const Dtype* input,
-    const Dtype* output, Dtype* weights) {
-  const Dtype* col_buff = input;
+    const Dtype* output, Dtype* weights, Dtype* col_buff) {
+  const Dtype* col_data = input;
   if (!is_1x1_) {
-    conv_im2col_cpu(input, col_buffer_.mutable_cpu_data());
-    col_buff = col_buffer_.cpu_data();
+    if (!col_buff) {
+      col_buff = col_buffer_.mutable_cpu_data();
+    }
+    conv_im2col_cpu(input, col_buff);
+    col_data = col_buff;
   }
   for (int g = 0; g < group_; ++g) {
     caffe_cpu_gemm<Dtype>(CblasNoTrans, CblasTrans, conv_out_channels_ / group_,
         kernel_dim_, conv_out_spatial_dim_,
-        (Dtype)1., output + output_offset_ * g, col_buff + col_offset_ * g,
+        (Dtype)1., output + output_offset_ * g, col_data + col_offset_ * g,
         (Dtype)1., weights + weight_offset_ * g);
   }
 }
@@ -320,6 +367,99 @@ void BaseConvolutionLayer<Dtype>::backward_cpu_bias(Dtype* bias,
       input, bias_multiplier_.cpu_data(), 1., bias);
 }
 
+// In the batch buffers, the values of image b at position s of row r are
+// at r * count * conv_out_spatial_dim_ + b * conv_out_spatial_dim_ + s.
+template <typename Dtype>
+void BaseConvolutionLayer<Dtype>::gather_cpu_output(const Dtype* output,
+    int count) {
+  Dtype* output_buff = output_batch_buffer_->mutable_cpu_data();
+  for (int c = 0; c < conv_out_channels_; ++c) {
+    for (int b = 0; b < count; ++b) {
+      caffe_copy(conv_out_spatial_dim_,
+          output + b * top_dim_ + c * conv_out_spatial_dim_,
+          output_buff + (c * count + b) * conv_out_spatial_dim_);
+    }
+  }
+}
+
+template <typename Dtype>
+void BaseConvolutionLayer<Dtype>::scatter_cpu_output(Dtype* output,
+    int count) {
+  const Dtype* output_buff = output_batch_buffer_->cpu_data();
+  for (int c = 0; c < conv_out_channels_; ++c) {
+    for (int b = 0; b < count; ++b) {
+      caffe_copy(conv_out_spatial_dim_,
+          output_buff + (c * count + b) * conv_out_spatial_dim_,
+          output + b * top_dim_ + c * conv_out_spatial_dim_);
+    }
+  }
+}
+
+template <typename Dtype>
+void BaseConvolutionLayer<Dtype>::forward_cpu_gemm_batch(const Dtype* input,
+    const Dtype* weights, Dtype* output, int count) {
+  DCHECK_LE(count, cpu_batch_);
+  const int col_stride = count * conv_out_spatial_dim_;
+  Dtype* col_buff = col_batch_buffer_->mutable_cpu_data();
+  for (int b = 0; b < count; ++b) {
+    conv_im2col_cpu(input + b * bottom_dim_, col_stride,
+        col_buff + b * conv_out_spatial_dim_);
+  }
+  Dtype* output_buff = output_batch_buffer_->mutable_cpu_data();
+  for (int g = 0; g < group_; ++g) {
+    caffe_cpu_gemm<Dtype>(CblasNoTrans, CblasNoTrans, conv_out_channels_ /
+        group_, col_stride, kernel_dim_,
+        (Dtype)1., weights + weight_offset_ * g,
+        col_buff + col_offset_ * count * g,
+        (Dtype)0., output_buff + output_offset_ * count * g);
+  }
+  scatter_cpu_output(output, count);
+}
+
+template <typename Dtype>
+void BaseConvolutionLayer<Dtype>::backward_cpu_gemm_batch(const Dtype* output,
+    const Dtype* weights, Dtype* input, int count, bool skip_gather) {
+  DCHECK_LE(count, cpu_batch_);
+  const int col_stride = count * conv_out_spatial_dim_;
+  if (!skip_gather) {
+    gather_cpu_output(output, count);
+  }
+  const Dtype* output_buff = output_batch_buffer_->cpu_data();
+  Dtype* col_buff = col_batch_buffer_->mutable_cpu_data();
+  for (int g = 0; g < group_; ++g) {
+    caffe_cpu_gemm<Dtype>(CblasTrans, CblasNoTrans, kernel_dim_,
+        col_stride, conv_out_channels_ / group_,
+        (Dtype)1., weights + weight_offset_ * g,
+        output_buff + output_offset_ * count * g,
+        (Dtype)0., col_buff + col_offset_ * count * g);
+  }
+  for (int b = 0; b < count; ++b) {
+    conv_col2im_cpu(col_buff + b * conv_out_spatial_dim_, col_stride,
+        input + b * bottom_dim_);
+  }
+}
+
+template <typename Dtype>
+void BaseConvolutionLayer<Dtype>::weight_cpu_gemm_batch(const Dtype* input,
+    const Dtype* output, Dtype* weights, int count) {
+  DCHECK_LE(count, cpu_batch_);
+  const int col_stride = count * conv_out_spatial_dim_;
+  Dtype* col_buff = col_batch_buffer_->mutable_cpu_data();
+  for (int b = 0; b < count; ++b) {
+    conv_im2col_cpu(input + b * bottom_dim_, col_stride,
+        col_buff + b * conv_out_spatial_dim_);
+  }
+  gather_cpu_output(output, count);
+  const Dtype* output_buff = output_batch_buffer_->cpu_data();
+  for (int g = 0; g < group_; ++g) {
+    caffe_cpu_gemm<Dtype>(CblasNoTrans, CblasTrans, conv_out_channels_ / group_,
+        kernel_dim_, col_stride,
+        (Dtype)1., output_buff + output_offset_ * count * g,
+        col_buff + col_offset_ * count * g,
+        (Dtype)1., weights + weight_offset_ * g);
+  }
+}
+
 #ifndef CPU_ONLY
 
 template <typename Dtype>
@@ -1,4 +1,5 @@
 #include <boost/thread.hpp>
+#include <algorithm>
 #include <vector>
 
 #include "caffe/blob.hpp"
@@ -36,9 +37,13 @@ template <typename Dtype>
 BasePrefetchingDataLayer<Dtype>::BasePrefetchingDataLayer(
     const LayerParameter& param)
     : BaseDataLayer<Dtype>(param),
-      prefetch_free_(), prefetch_full_() {
-  for (int i = 0; i < PREFETCH_COUNT; ++i) {
-    prefetch_free_.push(&prefetch_[i]);
+      prefetch_free_(), prefetch_full_(), prefetch_current_(NULL),
+      batches_taken_(0),
+      batches_starved_(0), batches_ready_(0) {
+  const int depth = param.prefetch_param().depth();
+  CHECK_GE(depth, 1) << "Prefetch depth must be at least 1";
+  for (int i = 0; i < depth; ++i) {
+    prefetch_.push_back(shared_ptr<Batch<Dtype> >(new Batch<Dtype>()));
   }
 }
 
@@ -46,34 +51,81 @@ template <typename Dtype>
 void BasePrefetchingDataLayer<Dtype>::LayerSetUp(
     const vector<Blob<Dtype>*>& bottom, const vector<Blob<Dtype>*>& top) {
   BaseDataLayer<Dtype>::LayerSetUp(bottom, top);
+  // DataLayerSetUp has shaped the batches, fit their number to the budget
+  const PrefetchParameter& prefetch_param = this->layer_param_.prefetch_param();
+  if (prefetch_param.max_bytes() > 0) {
+    const uint64_t batch_bytes = (prefetch_[0]->data_.count() +
+        (this->output_labels_ ? prefetch_[0]->label_.count() : 0)) *
+        sizeof(Dtype);
+    uint64_t depth = batch_bytes ? prefetch_param.max_bytes() / batch_bytes :
+        prefetch_param.depth();
+    if (prefetch_param.has_depth()) {
+      depth = std::min(depth, static_cast<uint64_t>(prefetch_param.depth()));
+    }
+    depth = std::max(depth, static_cast<uint64_t>(1));
+    prefetch_.resize(depth);
+    for (int i = 1; i < prefetch_.size(); ++i) {
+      if (!prefetch_[i]) {
+        prefetch_[i].reset(new Batch<Dtype>());
+        prefetch_[i]->data_.ReshapeLike(prefetch_[0]->data_);
+        prefetch_[i]->label_.ReshapeLike(prefetch_[0]->label_);
+      }
+    }
+    LOG(INFO) << "Prefetching " << depth << " batches of " << batch_bytes
+        << " bytes";
+  }
+  for (int i = 0; i < prefetch_.size(); ++i) {
+    prefetch_free_.push(prefetch_[i].get());
+  }
+  if (prefetch_param.zero_copy()) {
+    CHECK_EQ(Caffe::solver_count(), 1)
+        << "Zero-copy prefetching does not support multiple solvers";
+  }
   // Before starting the prefetch thread, we make cpu_data and gpu_data
   // calls so that the prefetch thread does not accidentally make simultaneous
   // cudaMalloc calls when the main thread is running. In some GPUs this
   // seems to cause failures if we do not so.
-  for (int i = 0; i < PREFETCH_COUNT; ++i) {
-    prefetch_[i].data_.mutable_cpu_data();
+  for (int i = 0; i < prefetch_.size(); ++i) {
+    prefetch_[i]->data_.mutable_cpu_data();
     if (this->output_labels_) {
-      prefetch_[i].label_.mutable_cpu_data();
+      prefetch_[i]->label_.mutable_cpu_data();
     }
   }
 #ifndef CPU_ONLY
   if (Caffe::mode() == Caffe::GPU) {
-    for (int i = 0; i < PREFETCH_COUNT; ++i) {
-      prefetch_[i].data_.mutable_gpu_data();
+    for (int i = 0; i < prefetch_.size(); ++i) {
+      prefetch_[i]->data_.mutable_gpu_data();
       if (this->output_labels_) {
-        prefetch_[i].label_.mutable_gpu_data();
+        prefetch_[i]->label_.mutable_gpu_data();
       }
     }
   }
 #endif
   DLOG(INFO) << "Initializing prefetch";
   this->data_transformer_->InitRand();
+  const int threads = this->transform_param_.threads();
+  CHECK_GE(threads, 1);
+  transformers_.push_back(this->data_transformer_);
+  // The other transformers, and the threads of the pool, are seeded without
+  // drawing from the Caffe RNG, so that the layers set up after this one get
+  // the same weights whatever the number of threads
+  for (int i = 1; i < threads; ++i) {
+    transformers_.push_back(shared_ptr<DataTransformer<Dtype> >(
+        new DataTransformer<Dtype>(this->transform_param_, this->phase_)));
+    transformers_[i]->InitRand(this->data_transformer_.get());
+  }
+  for (int i = 0; i < threads; ++i) {
+    transformed_items_.push_back(shared_ptr<Blob<Dtype> >(new Blob<Dtype>()));
+  }
+  transform_pool_.reset(new ThreadPool(threads));
   StartInternalThread();
   DLOG(INFO) << "Prefetch initialized.";
 }
 
 template <typename Dtype>
 void BasePrefetchingDataLayer<Dtype>::InternalThreadEntry() {
+  // The items of a batch are spread over the transform pool instead
+  Caffe::set_cpu_threads(1);
 #ifndef CPU_ONLY
   cudaStream_t stream;
   if (Caffe::mode() == Caffe::GPU) {
@@ -103,12 +155,79 @@ void BasePrefetchingDataLayer<Dtype>::InternalThreadEntry() {
 #endif
 }
 
+template <typename Dtype>
+class BasePrefetchingDataLayer<Dtype>::LoadItems : public ThreadPool::Task {
+ public:
+  LoadItems(BasePrefetchingDataLayer<Dtype>* layer, Batch<Dtype>* batch,
+      Dtype* top_data, Dtype* top_label, int first)
+      : layer_(layer), batch_(batch), top_data_(top_data),
+        top_label_(top_label), first_(first) {}
+  virtual void Run(int thread, int begin, int end) {
+    for (int item_id = first_ + begin; item_id < first_ + end; ++item_id) {
+      layer_->load_item(batch_, top_data_, top_label_, item_id, thread);
+    }
+  }
+
+ protected:
+  BasePrefetchingDataLayer<Dtype>* layer_;
+  Batch<Dtype>* batch_;
+  Dtype* top_data_;
+  Dtype* top_label_;
+  int first_;
+};
+
+template <typename Dtype>
+void BasePrefetchingDataLayer<Dtype>::load_items(Batch<Dtype>* batch,
+    int begin, int end) {
+  for (int i = 0; i < transformed_items_.size(); ++i) {
+    transformed_items_[i]->ReshapeLike(transformed_data_);
+  }
+  // Moves the batch to the CPU before the threads write to it
+  Dtype* top_data = batch->data_.mutable_cpu_data();
+  Dtype* top_label = this->output_labels_ ?
+      batch->label_.mutable_cpu_data() : NULL;
+  LoadItems task(this, batch, top_data, top_label, begin);
+  transform_pool_->Run(&task, end - begin);
+}
+
+template <typename Dtype>
+Batch<Dtype>* BasePrefetchingDataLayer<Dtype>::take_batch() {
+  if (prefetch_current_) {
+#ifndef CPU_ONLY
+    if (Caffe::mode() == Caffe::GPU) {
+      // The kernels of the last iteration may still read the shared batch,
+      // wait for them before the prefetch thread pushes the next one into it
+      CUDA_CHECK(cudaStreamSynchronize(cudaStreamDefault));
+    }
+#endif
+    prefetch_free_.push(prefetch_current_);
+    prefetch_current_ = NULL;
+  }
+  const size_t ready = prefetch_full_.size();
+  ++batches_taken_;
+  batches_ready_ += ready;
+  if (ready == 0) {
+    ++batches_starved_;
+  }
+  return prefetch_full_.pop("Data layer prefetch queue empty");
+}
+
 template <typename Dtype>
 void BasePrefetchingDataLayer<Dtype>::Forward_cpu(
     const vector<Blob<Dtype>*>& bottom, const vector<Blob<Dtype>*>& top) {
-  Batch<Dtype>* batch = prefetch_full_.pop("Data layer prefetch queue empty");
+  Batch<Dtype>* batch = take_batch();
   // Reshape to loaded data.
   top[0]->ReshapeLike(batch->data_);
+  if (this->layer_param_.prefetch_param().zero_copy()) {
+    // Share the data and labels, the batch is released by the next Forward
+    top[0]->ShareData(batch->data_);
+    if (this->output_labels_) {
+      top[1]->ReshapeLike(batch->label_);
+      top[1]->ShareData(batch->label_);
+    }
+    prefetch_current_ = batch;
+    return;
+  }
   // Copy the data
   caffe_copy(batch->data_.count(), batch->data_.cpu_data(),
              top[0]->mutable_cpu_data());
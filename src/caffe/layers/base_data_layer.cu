@@ -7,9 +7,20 @@ namespace caffe {
 template <typename Dtype>
 void BasePrefetchingDataLayer<Dtype>::Forward_gpu(
     const vector<Blob<Dtype>*>& bottom, const vector<Blob<Dtype>*>& top) {
-  Batch<Dtype>* batch = prefetch_full_.pop("Data layer prefetch queue empty");
+  Batch<Dtype>* batch = take_batch();
   // Reshape to loaded data.
   top[0]->ReshapeLike(batch->data_);
+  if (this->layer_param_.prefetch_param().zero_copy()) {
+    // Share the data and labels, already pushed to the GPU by the prefetch
+    // thread. The batch is released by the next Forward.
+    top[0]->ShareData(batch->data_);
+    if (this->output_labels_) {
+      top[1]->ReshapeLike(batch->label_);
+      top[1]->ShareData(batch->label_);
+    }
+    prefetch_current_ = batch;
+    return;
+  }
   // Copy the data
   caffe_copy(batch->data_.count(), batch->data_.gpu_data(),
       top[0]->mutable_gpu_data());
@@ -1,9 +1,24 @@
+#include <unistd.h>
+
+#include <algorithm>
+#include <sstream>
+#include <string>
 #include <vector>
 
 #include "caffe/layers/conv_layer.hpp"
+#include "caffe/util/benchmark.hpp"
+#include "caffe/util/conv_algorithm_cache.hpp"
+#include "caffe/util/depthwise_conv.hpp"
+#include "caffe/util/math_functions.hpp"
+#include "caffe/util/thread_pool.hpp"
+#include "caffe/util/winograd.hpp"
 
 namespace caffe {
 
+// Bytes of the chunks of images of BATCHED_GEMM timed when autotuning a layer
+// without cpu_batch_bytes
+const uint64_t kAutotuneBatchBytes = 64 << 20;
+
 template <typename Dtype>
 void ConvolutionLayer<Dtype>::compute_output_shape() {
   const int* kernel_shape_data = this->kernel_shape_.cpu_data();
@@ -21,16 +36,254 @@ void ConvolutionLayer<Dtype>::compute_output_shape() {
   }
 }
 
+template <typename Dtype>
+void ConvolutionLayer<Dtype>::Reshape(const vector<Blob<Dtype>*>& bottom,
+      const vector<Blob<Dtype>*>& top) {
+  BaseConvolutionLayer<Dtype>::Reshape(bottom, top);
+  if (this->layer_param_.convolution_param().cpu_autotune() &&
+      Caffe::mode() == Caffe::CPU) {
+    autotune_cpu(bottom, top);
+  } else if (depthwise_supported()) {
+    set_cpu_algorithm(ConvolutionAlgorithmCache_Algorithm_DEPTHWISE, 1);
+  } else if (cpu_algorithm_ == ConvolutionAlgorithmCache_Algorithm_WINOGRAD) {
+    set_cpu_algorithm(cpu_algorithm_, 1);
+  }
+}
+
+template <typename Dtype>
+bool ConvolutionLayer<Dtype>::winograd_supported() {
+  if (this->num_spatial_axes_ != 2 || this->force_nd_im2col_) {
+    return false;
+  }
+  const int* kernel_shape_data = this->kernel_shape_.cpu_data();
+  const int* stride_data = this->stride_.cpu_data();
+  const int* dilation_data = this->dilation_.cpu_data();
+  for (int i = 0; i < this->num_spatial_axes_; ++i) {
+    if (kernel_shape_data[i] != 3 || stride_data[i] != 1 ||
+        dilation_data[i] != 1) {
+      return false;
+    }
+  }
+  return true;
+}
+
+template <typename Dtype>
+bool ConvolutionLayer<Dtype>::depthwise_supported() {
+  return this->num_spatial_axes_ == 2 && !this->force_nd_im2col_ &&
+      this->group_ > 1 && this->group_ == this->channels_;
+}
+
+template <typename Dtype>
+void ConvolutionLayer<Dtype>::set_cpu_algorithm(
+    ConvolutionAlgorithmCache_Algorithm algorithm, int batch) {
+  cpu_algorithm_ = algorithm;
+  CHECK(algorithm != ConvolutionAlgorithmCache_Algorithm_DEPTHWISE ||
+      depthwise_supported()) << "Layer " << this->layer_param_.name()
+      << " is not a depthwise convolution.";
+  if (algorithm != ConvolutionAlgorithmCache_Algorithm_WINOGRAD) {
+    this->set_cpu_batch(
+        algorithm == ConvolutionAlgorithmCache_Algorithm_BATCHED_GEMM ?
+        batch : 1);
+    winograd_weight_.reset();
+    winograd_input_.reset();
+    winograd_output_.reset();
+    return;
+  }
+  CHECK(winograd_supported()) << "Layer " << this->layer_param_.name()
+      << " only convolves 2D 3x3 filters with stride 1 and dilation 1 with "
+      << "Winograd.";
+  this->set_cpu_batch(1);
+  if (!winograd_weight_) {
+    winograd_weight_.reset(new Blob<Dtype>());
+    winograd_input_.reset(new Blob<Dtype>());
+    winograd_output_.reset(new Blob<Dtype>());
+  }
+  const int channels = this->channels_ / this->group_;
+  const int num_output = this->num_output_ / this->group_;
+  // Tiles of a block of the top for the forward pass and of the bottom for
+  // the backward
+  const int top_tiles = winograd_block_tiles<Dtype>(channels, num_output,
+      this->num_ * ((this->output_shape_[0] + 1) / 2) *
+      ((this->output_shape_[1] + 1) / 2));
+  const int bottom_tiles = winograd_block_tiles<Dtype>(channels, num_output,
+      this->num_ * ((this->input_shape(1) + 1) / 2) *
+      ((this->input_shape(2) + 1) / 2));
+  vector<int> shape(1,
+      this->group_ * winograd_weight_count(channels, num_output));
+  winograd_weight_->Reshape(shape);
+  shape[0] = std::max(winograd_buffer_count(channels, top_tiles),
+      winograd_buffer_count(num_output, bottom_tiles));
+  winograd_input_->Reshape(shape);
+  shape[0] = std::max(winograd_buffer_count(num_output, top_tiles),
+      winograd_buffer_count(channels, bottom_tiles));
+  winograd_output_->Reshape(shape);
+}
+
+template <typename Dtype>
+std::string ConvolutionLayer<Dtype>::cpu_autotune_key() {
+  char hostname[256] = "";
+  gethostname(hostname, sizeof(hostname) - 1);
+  const int* kernel_shape_data = this->kernel_shape_.cpu_data();
+  const int* stride_data = this->stride_.cpu_data();
+  const int* pad_data = this->pad_.cpu_data();
+  const int* dilation_data = this->dilation_.cpu_data();
+  std::ostringstream key;
+  key << hostname << " threads " << Caffe::cpu_threads() << " "
+      << (sizeof(Dtype) == sizeof(float) ? "float" : "double") << " "
+      << (this->phase_ == TRAIN ? "train" : "test") << " input";
+  for (int i = 0; i <= this->num_spatial_axes_; ++i) {
+    key << " " << this->input_shape(i);
+  }
+  key << " num " << this->num_ << " output " << this->num_output_
+      << " group " << this->group_ << " kernel";
+  for (int i = 0; i < this->num_spatial_axes_; ++i) {
+    key << " " << kernel_shape_data[i];
+  }
+  key << " stride";
+  for (int i = 0; i < this->num_spatial_axes_; ++i) {
+    key << " " << stride_data[i];
+  }
+  key << " pad";
+  for (int i = 0; i < this->num_spatial_axes_; ++i) {
+    key << " " << pad_data[i];
+  }
+  key << " dilation";
+  for (int i = 0; i < this->num_spatial_axes_; ++i) {
+    key << " " << dilation_data[i];
+  }
+  if (this->force_nd_im2col_) {
+    key << " nd";
+  }
+  // The chunks of images of BATCHED_GEMM are bounded by the batch bytes
+  const uint64_t batch_bytes =
+      this->layer_param_.convolution_param().cpu_batch_bytes();
+  key << " batch_bytes " << (batch_bytes ? batch_bytes : kAutotuneBatchBytes);
+  return key.str();
+}
+
+template <typename Dtype>
+void ConvolutionLayer<Dtype>::autotune_cpu(const vector<Blob<Dtype>*>& bottom,
+      const vector<Blob<Dtype>*>& top) {
+  // The key is only built again when the inputs of the key that can change
+  // after set up do
+  vector<int> shape(1, Caffe::cpu_threads());
+  shape.push_back(this->num_);
+  for (int i = 0; i <= this->num_spatial_axes_; ++i) {
+    shape.push_back(this->input_shape(i));
+  }
+  if (!cpu_autotune_key_.empty() && shape == cpu_autotune_shape_) {
+    set_cpu_algorithm(cpu_algorithm_, this->cpu_batch_);
+    return;
+  }
+  cpu_autotune_shape_ = shape;
+  const std::string key = cpu_autotune_key();
+  cpu_autotune_key_ = key;
+  ConvolutionAlgorithmCache::Entry best;
+  if (FindConvolutionAlgorithm(key, &best)) {
+    set_cpu_algorithm(best.algorithm(), best.batch());
+    return;
+  }
+  vector<ConvolutionAlgorithmCache::Entry> candidates(1);
+  candidates[0].set_algorithm(ConvolutionAlgorithmCache_Algorithm_GEMM);
+  const uint64_t batch_bytes =
+      this->layer_param_.convolution_param().cpu_batch_bytes();
+  const int max_batch =
+      this->max_cpu_batch(batch_bytes ? batch_bytes : kAutotuneBatchBytes);
+  // Chunks of powers of two images, up to the most that fit the bytes
+  for (int batch = 2; batch < 2 * max_batch; batch *= 2) {
+    candidates.push_back(ConvolutionAlgorithmCache::Entry());
+    candidates.back().set_algorithm(
+        ConvolutionAlgorithmCache_Algorithm_BATCHED_GEMM);
+    candidates.back().set_batch(std::min(batch, max_batch));
+  }
+  if (winograd_supported()) {
+    candidates.push_back(ConvolutionAlgorithmCache::Entry());
+    candidates.back().set_algorithm(
+        ConvolutionAlgorithmCache_Algorithm_WINOGRAD);
+  }
+  if (depthwise_supported()) {
+    candidates.push_back(ConvolutionAlgorithmCache::Entry());
+    candidates.back().set_algorithm(
+        ConvolutionAlgorithmCache_Algorithm_DEPTHWISE);
+  }
+  // When training, the backward pass is timed too, leaving the gradients of
+  // the parameters as they were
+  const bool backward = this->phase_ == TRAIN;
+  vector<shared_ptr<Blob<Dtype> > > param_diffs;
+  for (int i = 0; backward && i < this->blobs_.size(); ++i) {
+    param_diffs.push_back(shared_ptr<Blob<Dtype> >(new Blob<Dtype>()));
+    param_diffs[i]->CopyFrom(*this->blobs_[i], true, true);
+  }
+  // The candidates write to scratch blobs, which only share the data of the
+  // bottoms, so that the top data and bottom diffs are left as they were
+  vector<shared_ptr<Blob<Dtype> > > scratch_blobs;
+  vector<Blob<Dtype>*> scratch_bottom;
+  vector<Blob<Dtype>*> scratch_top;
+  for (int i = 0; i < bottom.size(); ++i) {
+    scratch_blobs.push_back(shared_ptr<Blob<Dtype> >(new Blob<Dtype>()));
+    scratch_blobs.back()->ReshapeLike(*bottom[i]);
+    scratch_blobs.back()->ShareData(*bottom[i]);
+    scratch_bottom.push_back(scratch_blobs.back().get());
+    scratch_blobs.push_back(shared_ptr<Blob<Dtype> >(new Blob<Dtype>()));
+    scratch_blobs.back()->ReshapeLike(*top[i]);
+    scratch_top.push_back(scratch_blobs.back().get());
+  }
+  const vector<bool> propagate_down(bottom.size(), true);
+  CPUTimer timer;
+  int fastest = 0;
+  for (int i = 0; i < candidates.size(); ++i) {
+    set_cpu_algorithm(candidates[i].algorithm(), candidates[i].batch());
+    // Warm up the buffers and the caches
+    Forward_cpu(scratch_bottom, scratch_top);
+    timer.Start();
+    Forward_cpu(scratch_bottom, scratch_top);
+    if (backward) {
+      Backward_cpu(scratch_top, propagate_down, scratch_bottom);
+    }
+    candidates[i].set_time(timer.MilliSeconds());
+    if (candidates[i].time() < candidates[fastest].time()) {
+      fastest = i;
+    }
+  }
+  for (int i = 0; i < param_diffs.size(); ++i) {
+    this->blobs_[i]->CopyFrom(*param_diffs[i], true);
+  }
+  best = candidates[fastest];
+  best.set_key(key);
+  set_cpu_algorithm(best.algorithm(), best.batch());
+  AddConvolutionAlgorithm(best);
+  LOG(INFO) << "Layer " << this->layer_param_.name() << " convolves with "
+      << ConvolutionAlgorithmCache_Algorithm_Name(best.algorithm())
+      << " (batch " << best.batch() << "), " << best.time() << " ms, out of "
+      << candidates.size() << " timed algorithms";
+}
+
 template <typename Dtype>
 void ConvolutionLayer<Dtype>::Forward_cpu(const vector<Blob<Dtype>*>& bottom,
       const vector<Blob<Dtype>*>& top) {
   const Dtype* weight = this->blobs_[0]->cpu_data();
+  const bool gemm = cpu_algorithm_ == ConvolutionAlgorithmCache_Algorithm_GEMM
+      || cpu_algorithm_ == ConvolutionAlgorithmCache_Algorithm_BATCHED_GEMM;
   for (int i = 0; i < bottom.size(); ++i) {
     const Dtype* bottom_data = bottom[i]->cpu_data();
     Dtype* top_data = top[i]->mutable_cpu_data();
+    if (cpu_algorithm_ == ConvolutionAlgorithmCache_Algorithm_WINOGRAD) {
+      forward_cpu_winograd(bottom_data, top_data);
+    } else if (cpu_algorithm_ ==
+        ConvolutionAlgorithmCache_Algorithm_DEPTHWISE) {
+      forward_cpu_depthwise(bottom_data, top_data);
+    } else if (this->cpu_batch_ > 1) {
+      for (int n = 0; n < this->num_; n += this->cpu_batch_) {
+        this->forward_cpu_gemm_batch(bottom_data + n * this->bottom_dim_,
+            weight, top_data + n * this->top_dim_,
+            std::min(this->cpu_batch_, this->num_ - n));
+      }
+    }
     for (int n = 0; n < this->num_; ++n) {
-      this->forward_cpu_gemm(bottom_data + n * this->bottom_dim_, weight,
-          top_data + n * this->top_dim_);
+      if (gemm && this->cpu_batch_ == 1) {
+        this->forward_cpu_gemm(bottom_data + n * this->bottom_dim_, weight,
+            top_data + n * this->top_dim_);
+      }
       if (this->bias_term_) {
         const Dtype* bias = this->blobs_[1]->cpu_data();
         this->forward_cpu_bias(top_data + n * this->top_dim_, bias);
@@ -44,10 +297,17 @@ void ConvolutionLayer<Dtype>::Backward_cpu(const vector<Blob<Dtype>*>& top,
       const vector<bool>& propagate_down, const vector<Blob<Dtype>*>& bottom) {
   const Dtype* weight = this->blobs_[0]->cpu_data();
   Dtype* weight_diff = this->blobs_[0]->mutable_cpu_diff();
+  const bool winograd =
+      cpu_algorithm_ == ConvolutionAlgorithmCache_Algorithm_WINOGRAD;
+  const bool parallel =
+      this->layer_param_.convolution_param().cpu_parallel_backward() &&
+      Caffe::cpu_threads() > 1 && this->num_ > 1;
   for (int i = 0; i < top.size(); ++i) {
     const Dtype* top_diff = top[i]->cpu_diff();
     const Dtype* bottom_data = bottom[i]->cpu_data();
     Dtype* bottom_diff = bottom[i]->mutable_cpu_diff();
+    // Winograd convolves the top diff to the bottom diff after the GEMMs
+    const bool gemm_down = propagate_down[i] && !winograd;
     // Bias gradient, if necessary.
     if (this->bias_term_ && this->param_propagate_down_[1]) {
       Dtype* bias_diff = this->blobs_[1]->mutable_cpu_diff();
@@ -55,7 +315,27 @@ void ConvolutionLayer<Dtype>::Backward_cpu(const vector<Blob<Dtype>*>& top,
         this->backward_cpu_bias(bias_diff, top_diff + n * this->top_dim_);
       }
     }
-    if (this->param_propagate_down_[0] || propagate_down[i]) {
+    if (cpu_algorithm_ == ConvolutionAlgorithmCache_Algorithm_DEPTHWISE) {
+      backward_cpu_depthwise(top_diff, bottom_data, bottom_diff,
+          this->param_propagate_down_[0], propagate_down[i]);
+    } else if (this->cpu_batch_ > 1 &&
+        (this->param_propagate_down_[0] || gemm_down)) {
+      for (int n = 0; n < this->num_; n += this->cpu_batch_) {
+        const int count = std::min(this->cpu_batch_, this->num_ - n);
+        if (this->param_propagate_down_[0]) {
+          this->weight_cpu_gemm_batch(bottom_data + n * this->bottom_dim_,
+              top_diff + n * this->top_dim_, weight_diff, count);
+        }
+        if (gemm_down) {
+          this->backward_cpu_gemm_batch(top_diff + n * this->top_dim_, weight,
+              bottom_diff + n * this->bottom_dim_, count,
+              this->param_propagate_down_[0]);
+        }
+      }
+    } else if (parallel && (this->param_propagate_down_[0] || gemm_down)) {
+      backward_cpu_parallel(top_diff, bottom_data, bottom_diff,
+          this->param_propagate_down_[0], gemm_down);
+    } else if (this->param_propagate_down_[0] || gemm_down) {
       for (int n = 0; n < this->num_; ++n) {
         // gradient w.r.t. weight. Note that we will accumulate diffs.
         if (this->param_propagate_down_[0]) {
@@ -63,12 +343,212 @@ void ConvolutionLayer<Dtype>::Backward_cpu(const vector<Blob<Dtype>*>& top,
               top_diff + n * this->top_dim_, weight_diff);
         }
         // gradient w.r.t. bottom data, if necessary.
-        if (propagate_down[i]) {
+        if (gemm_down) {
           this->backward_cpu_gemm(top_diff + n * this->top_dim_, weight,
               bottom_diff + n * this->bottom_dim_);
         }
       }
     }
+    if (winograd && propagate_down[i]) {
+      backward_cpu_winograd(top_diff, bottom_diff);
+    }
+  }
+}
+
+template <typename Dtype>
+void ConvolutionLayer<Dtype>::forward_cpu_depthwise(const Dtype* bottom_data,
+    Dtype* top_data) {
+  const int* kernel_shape_data = this->kernel_shape_.cpu_data();
+  const int* stride_data = this->stride_.cpu_data();
+  const int* pad_data = this->pad_.cpu_data();
+  const int* dilation_data = this->dilation_.cpu_data();
+  depthwise_conv_cpu(bottom_data, this->num_, this->channels_,
+      this->input_shape(1), this->input_shape(2),
+      this->num_output_ / this->channels_, kernel_shape_data[0],
+      kernel_shape_data[1], pad_data[0], pad_data[1], stride_data[0],
+      stride_data[1], dilation_data[0], dilation_data[1],
+      this->blobs_[0]->cpu_data(), top_data);
+}
+
+template <typename Dtype>
+void ConvolutionLayer<Dtype>::backward_cpu_depthwise(const Dtype* top_diff,
+    const Dtype* bottom_data, Dtype* bottom_diff, bool weight_down,
+    bool data_down) {
+  const int* kernel_shape_data = this->kernel_shape_.cpu_data();
+  const int* stride_data = this->stride_.cpu_data();
+  const int* pad_data = this->pad_.cpu_data();
+  const int* dilation_data = this->dilation_.cpu_data();
+  const int height = this->input_shape(1);
+  const int width = this->input_shape(2);
+  const int multiplier = this->num_output_ / this->channels_;
+  if (weight_down) {
+    depthwise_conv_weight_cpu(bottom_data, top_diff, this->num_,
+        this->channels_, height, width, multiplier, kernel_shape_data[0],
+        kernel_shape_data[1], pad_data[0], pad_data[1], stride_data[0],
+        stride_data[1], dilation_data[0], dilation_data[1],
+        this->blobs_[0]->mutable_cpu_diff());
+  }
+  if (data_down) {
+    depthwise_conv_backward_cpu(top_diff, this->num_, this->channels_,
+        height, width, multiplier, kernel_shape_data[0],
+        kernel_shape_data[1], pad_data[0], pad_data[1], stride_data[0],
+        stride_data[1], dilation_data[0], dilation_data[1],
+        this->blobs_[0]->cpu_data(), bottom_diff);
+  }
+}
+
+// Runs the backward GEMMs of images [begin, end) of thread `thread` with the
+// column buffer of the thread, NULL for the one of the layer, and the weight
+// gradient of the thread, which is zeroed first past thread 0.
+template <typename Dtype>
+class ConvolutionLayer<Dtype>::BackwardImages : public ThreadPool::Task {
+ public:
+  BackwardImages(ConvolutionLayer<Dtype>* layer, const Dtype* top_diff,
+      const Dtype* bottom_data, Dtype* bottom_diff, bool weight_down,
+      bool data_down, const vector<Dtype*>& col_buffs,
+      const vector<Dtype*>& weight_diffs)
+      : layer_(layer), weight_(layer->blobs_[0]->cpu_data()),
+        top_diff_(top_diff), bottom_data_(bottom_data),
+        bottom_diff_(bottom_diff), weight_down_(weight_down),
+        data_down_(data_down), col_buffs_(col_buffs),
+        weight_diffs_(weight_diffs), used_(col_buffs.size(), 0) {}
+
+  virtual void Run(int thread, int begin, int end) {
+    used_[thread] = 1;
+    if (weight_down_ && thread > 0) {
+      caffe_set(layer_->blobs_[0]->count(), Dtype(0), weight_diffs_[thread]);
+    }
+    for (int n = begin; n < end; ++n) {
+      if (weight_down_) {
+        layer_->weight_cpu_gemm(bottom_data_ + n * layer_->bottom_dim_,
+            top_diff_ + n * layer_->top_dim_, weight_diffs_[thread],
+            col_buffs_[thread]);
+      }
+      if (data_down_) {
+        layer_->backward_cpu_gemm(top_diff_ + n * layer_->top_dim_, weight_,
+            bottom_diff_ + n * layer_->bottom_dim_, col_buffs_[thread]);
+      }
+    }
+  }
+
+  // Whether each thread had images, and so a weight gradient
+  inline const vector<int>& used() const { return used_; }
+
+ protected:
+  ConvolutionLayer<Dtype>* layer_;
+  const Dtype* weight_;
+  const Dtype* top_diff_;
+  const Dtype* bottom_data_;
+  Dtype* bottom_diff_;
+  const bool weight_down_;
+  const bool data_down_;
+  const vector<Dtype*> col_buffs_;
+  const vector<Dtype*> weight_diffs_;
+  vector<int> used_;
+};
+
+// Adds the weight gradients of the threads past 0 to the first one, over
+// weights [begin, end) on each thread.
+template <typename Dtype>
+class ConvolutionLayer<Dtype>::SumWeightDiffs : public ThreadPool::Task {
+ public:
+  SumWeightDiffs(const vector<Dtype*>& weight_diffs, const vector<int>& used)
+      : weight_diffs_(weight_diffs), used_(used) {}
+
+  virtual void Run(int thread, int begin, int end) {
+    for (int i = 1; i < weight_diffs_.size(); ++i) {
+      if (used_[i]) {
+        caffe_axpy(end - begin, Dtype(1), weight_diffs_[i] + begin,
+            weight_diffs_[0] + begin);
+      }
+    }
+  }
+
+ protected:
+  const vector<Dtype*>& weight_diffs_;
+  const vector<int>& used_;
+};
+
+template <typename Dtype>
+void ConvolutionLayer<Dtype>::backward_cpu_parallel(const Dtype* top_diff,
+    const Dtype* bottom_data, Dtype* bottom_diff, bool weight_down,
+    bool data_down) {
+  // Thread 0 uses the buffers of the layer, the others their own, allocated
+  // here on the calling thread
+  const int threads = Caffe::cpu_threads();
+  thread_col_buffers_.resize(threads - 1);
+  thread_weight_diffs_.resize(threads - 1);
+  vector<Dtype*> col_buffs(1, static_cast<Dtype*>(NULL));
+  vector<Dtype*> weight_diffs(1,
+      weight_down ? this->blobs_[0]->mutable_cpu_diff() : NULL);
+  for (int i = 0; i < threads - 1; ++i) {
+    if (!thread_col_buffers_[i]) {
+      thread_col_buffers_[i].reset(new Blob<Dtype>());
+      thread_weight_diffs_[i].reset(new Blob<Dtype>());
+    }
+    thread_col_buffers_[i]->Reshape(this->col_buffer_shape_);
+    thread_weight_diffs_[i]->ReshapeLike(*this->blobs_[0]);
+    col_buffs.push_back(this->is_1x1_ ? NULL :
+        thread_col_buffers_[i]->mutable_cpu_data());
+    weight_diffs.push_back(weight_down ?
+        thread_weight_diffs_[i]->mutable_cpu_data() : NULL);
+  }
+  BackwardImages images(this, top_diff, bottom_data, bottom_diff, weight_down,
+      data_down, col_buffs, weight_diffs);
+  Caffe::cpu_pool().Run(&images, this->num_);
+  if (weight_down) {
+    SumWeightDiffs sum(weight_diffs, images.used());
+    Caffe::cpu_pool().Run(&sum, this->blobs_[0]->count());
+  }
+}
+
+template <typename Dtype>
+void ConvolutionLayer<Dtype>::forward_cpu_winograd(const Dtype* input,
+    Dtype* output) {
+  const int channels = this->channels_ / this->group_;
+  const int num_output = this->num_output_ / this->group_;
+  const int height = this->input_shape(1);
+  const int width = this->input_shape(2);
+  const int output_h = this->output_shape_[0];
+  const int output_w = this->output_shape_[1];
+  const int* pad_data = this->pad_.cpu_data();
+  winograd_transform_weight_cpu(this->blobs_[0]->cpu_data(), this->group_,
+      channels, num_output, false, winograd_weight_->mutable_cpu_data());
+  const Dtype* weight = winograd_weight_->cpu_data();
+  for (int g = 0; g < this->group_; ++g) {
+    winograd_cpu(input + g * channels * height * width, this->num_,
+        this->bottom_dim_, channels, height, width, pad_data[0], pad_data[1],
+        weight + g * winograd_weight_count(channels, num_output), num_output,
+        this->top_dim_, output_h, output_w,
+        winograd_input_->mutable_cpu_data(),
+        winograd_output_->mutable_cpu_data(),
+        output + g * num_output * output_h * output_w);
+  }
+}
+
+template <typename Dtype>
+void ConvolutionLayer<Dtype>::backward_cpu_winograd(const Dtype* output,
+    Dtype* input) {
+  const int channels = this->channels_ / this->group_;
+  const int num_output = this->num_output_ / this->group_;
+  const int height = this->input_shape(1);
+  const int width = this->input_shape(2);
+  const int output_h = this->output_shape_[0];
+  const int output_w = this->output_shape_[1];
+  const int* pad_data = this->pad_.cpu_data();
+  winograd_transform_weight_cpu(this->blobs_[0]->cpu_data(), this->group_,
+      channels, num_output, true, winograd_weight_->mutable_cpu_data());
+  const Dtype* weight = winograd_weight_->cpu_data();
+  // The top diff is padded by 2 - pad to convolve it to the bottom shape
+  for (int g = 0; g < this->group_; ++g) {
+    winograd_cpu(output + g * num_output * output_h * output_w, this->num_,
+        this->top_dim_, num_output, output_h, output_w, 2 - pad_data[0],
+        2 - pad_data[1],
+        weight + g * winograd_weight_count(channels, num_output), channels,
+        this->bottom_dim_, height, width,
+        winograd_input_->mutable_cpu_data(),
+        winograd_output_->mutable_cpu_data(),
+        input + g * channels * height * width);
   }
 }
 
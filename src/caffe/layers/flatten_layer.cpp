@@ -24,6 +24,9 @@ void FlattenLayer<Dtype>::Reshape(const vector<Blob<Dtype>*>& bottom,
   }
   top[0]->Reshape(top_shape);
   CHECK_EQ(top[0]->count(), bottom[0]->count());
+  // Shared here as well so that the Net sees the top alias the bottom before
+  // Forward
+  top[0]->ShareData(*bottom[0]);
 }
 
 template <typename Dtype>
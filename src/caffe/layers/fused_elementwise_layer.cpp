@@ -0,0 +1,516 @@
+#include <algorithm>
+#include <cmath>
+#include <string>
+#include <vector>
+
+#include "caffe/layers/fused_elementwise_layer.hpp"
+#include "caffe/util/math_functions.hpp"
+#include "caffe/util/simd.hpp"
+#include "caffe/util/thread_pool.hpp"
+
+namespace caffe {
+
+// Number of values of the bottom taken through the whole chain at once, whose
+// values at each step stay in L1 or L2
+const int kFusedTile = 1024;
+
+// Number of values below which the CPU passes run on the calling thread
+const int kFusedMinParallelCount = 1 << 16;
+
+template <typename Dtype>
+FusedElementwiseLayer<Dtype>::FusedElementwiseLayer(
+    const LayerParameter& param,
+    const vector<shared_ptr<Layer<Dtype> > >& layers)
+    : Layer<Dtype>(param), layers_(layers), num_param_diffs_(0) {
+  CHECK_GT(layers_.size(), 0) << "No layers to fuse";
+  for (int i = 0; i < layers_.size(); ++i) {
+    CHECK(CanFuse(*layers_[i])) << "Cannot fuse layer "
+        << layers_[i]->layer_param().name() << " of type "
+        << layers_[i]->type();
+  }
+}
+
+template <typename Dtype>
+bool FusedElementwiseLayer<Dtype>::CanFuse(const Layer<Dtype>& layer) {
+  const string type = layer.type();
+  const LayerParameter& param = layer.layer_param();
+  if (type == "ReLU" || type == "Sigmoid" || type == "TanH" ||
+      type == "AbsVal" || type == "BNLL" || type == "ELU" ||
+      type == "Power" || type == "Exp" || type == "Log") {
+    return true;
+  }
+  if (type == "Scale" || type == "Bias") {
+    return param.bottom_size() == 1;
+  }
+  if (type == "BatchNorm") {
+    const BatchNormParameter& batch_norm_param = param.batch_norm_param();
+    return batch_norm_param.has_use_global_stats() ?
+        batch_norm_param.use_global_stats() : param.phase() == TEST;
+  }
+  return false;
+}
+
+template <typename Dtype>
+void FusedElementwiseLayer<Dtype>::LayerSetUp(
+    const vector<Blob<Dtype>*>& bottom, const vector<Blob<Dtype>*>& top) {
+  steps_.resize(layers_.size());
+  batch_norm_coefficients_.resize(layers_.size());
+  for (int i = 0; i < layers_.size(); ++i) {
+    const string type = layers_[i]->type();
+    const LayerParameter& param = layers_[i]->layer_param();
+    Step& step = steps_[i];
+    step.alpha = step.beta = step.gamma = step.delta = Dtype(0);
+    step.layer = i;
+    step.dim = step.inner = 1;
+    step.scale_blob = step.shift_blob = NULL;
+    step.scale = step.shift = NULL;
+    step.scale_diff = step.shift_diff = -1;
+    if (type == "Scale" || type == "Bias" || type == "BatchNorm") {
+      step.function = AFFINE;
+      if (type == "BatchNorm") {
+        batch_norm_coefficients_[i].reset(new Blob<Dtype>(
+            2, layers_[i]->blobs()[0]->count(), 1, 1));
+      }
+    } else if (type == "ReLU") {
+      step.function = RELU;
+      step.alpha = param.relu_param().negative_slope();
+    } else if (type == "Sigmoid") {
+      step.function = SIGMOID;
+    } else if (type == "TanH") {
+      step.function = TANH;
+    } else if (type == "AbsVal") {
+      step.function = ABSVAL;
+    } else if (type == "BNLL") {
+      step.function = BNLL;
+    } else if (type == "ELU") {
+      step.function = ELU;
+      step.alpha = param.elu_param().alpha();
+    } else if (type == "Power") {
+      step.function = POWER;
+      step.alpha = param.power_param().scale();
+      step.beta = param.power_param().shift();
+      step.gamma = param.power_param().power();
+      step.delta = step.gamma * step.alpha;
+    } else if (type == "Exp") {
+      // As in ExpLayer, with base -1 standing for e
+      step.function = EXP;
+      const Dtype base = param.exp_param().base();
+      const Dtype log_base = (base == Dtype(-1)) ? Dtype(1) : log(base);
+      const Dtype shift = param.exp_param().shift();
+      step.alpha = log_base * param.exp_param().scale();
+      step.beta = (shift == Dtype(0)) ? Dtype(1) : pow(base, shift);
+    } else if (type == "Log") {
+      step.function = LOG;
+      const Dtype base = param.log_param().base();
+      const Dtype log_base = (base == Dtype(-1)) ? Dtype(1) : log(base);
+      step.alpha = param.log_param().scale();
+      step.beta = param.log_param().shift();
+      step.gamma = Dtype(1) / log_base;
+      step.delta = step.alpha / log_base;
+    } else {
+      LOG(FATAL) << "Cannot fuse layer of type " << type;
+    }
+  }
+}
+
+template <typename Dtype>
+void FusedElementwiseLayer<Dtype>::Reshape(const vector<Blob<Dtype>*>& bottom,
+    const vector<Blob<Dtype>*>& top) {
+  if (bottom[0] != top[0]) {
+    top[0]->ReshapeLike(*bottom[0]);
+  } else if (this->phase_ == TRAIN) {
+    bottom_copy_.ReshapeLike(*bottom[0]);
+  }
+  for (int i = 0; i < steps_.size(); ++i) {
+    Step& step = steps_[i];
+    if (step.function != AFFINE) {
+      continue;
+    }
+    // Mirrors the Reshape of ScaleLayer and BiasLayer, and the channels of
+    // BatchNormLayer
+    Layer<Dtype>& layer = *layers_[i];
+    const string type = layer.type();
+    if (type == "BatchNorm") {
+      step.dim = layer.blobs()[0]->count();
+      step.inner = bottom[0]->num_axes() == 1 ?
+          bottom[0]->count() : bottom[0]->count(2);
+      continue;
+    }
+    const Blob<Dtype>& coefficients = *layer.blobs()[0];
+    const int axis = coefficients.num_axes() == 0 ? 0 :
+        bottom[0]->CanonicalAxisIndex(type == "Scale" ?
+            layer.layer_param().scale_param().axis() :
+            layer.layer_param().bias_param().axis());
+    CHECK_GE(bottom[0]->num_axes(), axis + coefficients.num_axes());
+    for (int j = 0; j < coefficients.num_axes(); ++j) {
+      CHECK_EQ(bottom[0]->shape(axis + j), coefficients.shape(j))
+          << "dimension mismatch between the bottom and the parameters of "
+          << layer.layer_param().name();
+    }
+    step.dim = coefficients.count();
+    step.inner = bottom[0]->count(axis + coefficients.num_axes());
+  }
+}
+
+template <typename Dtype>
+void FusedElementwiseLayer<Dtype>::PrepareSteps(bool backward) {
+  num_param_diffs_ = 0;
+  for (int i = 0; i < steps_.size(); ++i) {
+    Step& step = steps_[i];
+    if (step.function != AFFINE) {
+      continue;
+    }
+    Layer<Dtype>& layer = *layers_[i];
+    const string type = layer.type();
+    if (type == "BatchNorm") {
+      // As in BatchNormLayer with global statistics, y = (x - mean) /
+      // sqrt(variance + eps), for the statistics scaled by their weight
+      const Dtype weight = layer.blobs()[2]->cpu_data()[0];
+      const Dtype factor = weight == 0 ? Dtype(0) : Dtype(1) / weight;
+      const Dtype eps = layer.layer_param().batch_norm_param().eps();
+      const Dtype* mean = layer.blobs()[0]->cpu_data();
+      const Dtype* variance = layer.blobs()[1]->cpu_data();
+      Dtype* scale = batch_norm_coefficients_[i]->mutable_cpu_data();
+      Dtype* shift = scale + step.dim;
+      for (int d = 0; d < step.dim; ++d) {
+        scale[d] = Dtype(1) / std::sqrt(variance[d] * factor + eps);
+        shift[d] = -mean[d] * factor * scale[d];
+      }
+      step.scale = scale;
+      step.shift = shift;
+      continue;
+    }
+    step.scale_blob = type == "Scale" ? layer.blobs()[0].get() : NULL;
+    step.shift_blob = type == "Bias" ? layer.blobs()[0].get() :
+        (layer.blobs().size() > 1 ? layer.blobs()[1].get() : NULL);
+    step.scale = step.scale_blob ? step.scale_blob->cpu_data() : NULL;
+    step.shift = step.shift_blob ? step.shift_blob->cpu_data() : NULL;
+    step.scale_diff = step.shift_diff = -1;
+    if (backward && step.scale_blob && layer.param_propagate_down(0)) {
+      step.scale_diff = num_param_diffs_;
+      num_param_diffs_ += step.dim;
+    }
+    if (backward && step.shift_blob &&
+        layer.param_propagate_down(layer.blobs().size() - 1)) {
+      step.shift_diff = num_param_diffs_;
+      num_param_diffs_ += step.dim;
+    }
+  }
+}
+
+template <typename Dtype>
+void FusedElementwiseLayer<Dtype>::StepForward(const Step& step, int offset,
+    int count, const Dtype* x, Dtype* y) {
+  switch (step.function) {
+  case AFFINE:
+    for (int i = 0; i < count; ) {
+      const int index = offset + i;
+      const int d = index / step.inner % step.dim;
+      const int end = std::min(count, i + step.inner - index % step.inner);
+      const Dtype scale = step.scale ? step.scale[d] : Dtype(1);
+      const Dtype shift = step.shift ? step.shift[d] : Dtype(0);
+      for (; i < end; ++i) {
+        y[i] = scale * x[i] + shift;
+      }
+    }
+    break;
+  case RELU:
+    for (int i = 0; i < count; ++i) {
+      y[i] = std::max(x[i], Dtype(0)) + step.alpha * std::min(x[i], Dtype(0));
+    }
+    break;
+  case SIGMOID:
+    simd_sigmoid(count, x, y);
+    break;
+  case TANH:
+    simd_tanh(count, x, y);
+    break;
+  case ABSVAL:
+    caffe_abs(count, x, y);
+    break;
+  case BNLL:
+    simd_bnll(count, x, y);
+    break;
+  case ELU:
+    simd_elu(count, step.alpha, x, y);
+    break;
+  case POWER:
+    if (step.delta == Dtype(0)) {
+      const Dtype value = (step.gamma == 0) ? Dtype(1) :
+          pow(step.beta, step.gamma);
+      caffe_set(count, value, y);
+      break;
+    }
+    for (int i = 0; i < count; ++i) {
+      y[i] = step.alpha * x[i] + step.beta;
+    }
+    if (step.gamma != Dtype(1)) {
+      caffe_powx(count, y, step.gamma, y);
+    }
+    break;
+  case EXP:
+    if (step.alpha == Dtype(1)) {
+      caffe_exp(count, x, y);
+    } else {
+      caffe_cpu_scale(count, step.alpha, x, y);
+      caffe_exp(count, y, y);
+    }
+    if (step.beta != Dtype(1)) {
+      caffe_scal(count, step.beta, y);
+    }
+    break;
+  case LOG:
+    if (step.alpha == Dtype(1) && step.beta == Dtype(0)) {
+      caffe_log(count, x, y);
+    } else {
+      for (int i = 0; i < count; ++i) {
+        y[i] = step.alpha * x[i] + step.beta;
+      }
+      caffe_log(count, y, y);
+    }
+    if (step.gamma != Dtype(1)) {
+      caffe_scal(count, step.gamma, y);
+    }
+    break;
+  }
+}
+
+template <typename Dtype>
+void FusedElementwiseLayer<Dtype>::StepBackward(const Step& step, int offset,
+    int count, const Dtype* x, const Dtype* y, const Dtype* dy, Dtype* dx,
+    Dtype* param_diffs) {
+  if (step.function == AFFINE) {
+    for (int i = 0; i < count; ) {
+      const int index = offset + i;
+      const int d = index / step.inner % step.dim;
+      const int end = std::min(count, i + step.inner - index % step.inner);
+      const Dtype scale = step.scale ? step.scale[d] : Dtype(1);
+      Dtype scale_diff = 0, shift_diff = 0;
+      for (; i < end; ++i) {
+        scale_diff += dy[i] * x[i];
+        shift_diff += dy[i];
+        if (dx) {
+          dx[i] = scale * dy[i];
+        }
+      }
+      if (step.scale_diff >= 0) {
+        param_diffs[step.scale_diff + d] += scale_diff;
+      }
+      if (step.shift_diff >= 0) {
+        param_diffs[step.shift_diff + d] += shift_diff;
+      }
+    }
+    return;
+  }
+  if (!dx) {
+    return;
+  }
+  switch (step.function) {
+  case RELU:
+    for (int i = 0; i < count; ++i) {
+      dx[i] = dy[i] * ((x[i] > 0) + step.alpha * (x[i] <= 0));
+    }
+    break;
+  case SIGMOID:
+    for (int i = 0; i < count; ++i) {
+      dx[i] = dy[i] * y[i] * (Dtype(1) - y[i]);
+    }
+    break;
+  case TANH:
+    for (int i = 0; i < count; ++i) {
+      dx[i] = dy[i] * (Dtype(1) - y[i] * y[i]);
+    }
+    break;
+  case ABSVAL:
+    for (int i = 0; i < count; ++i) {
+      dx[i] = dy[i] * caffe_sign(x[i]);
+    }
+    break;
+  case BNLL:
+    simd_bnll_backward(count, x, dy, dx);
+    break;
+  case ELU:
+    for (int i = 0; i < count; ++i) {
+      dx[i] = dy[i] * ((x[i] > 0) + (step.alpha + y[i]) * (x[i] <= 0));
+    }
+    break;
+  case POWER:
+    // As in PowerLayer, from y when the power is not 2
+    if (step.delta == Dtype(0)) {
+      caffe_set(count, Dtype(0), dx);
+    } else if (step.gamma == Dtype(1)) {
+      for (int i = 0; i < count; ++i) {
+        dx[i] = dy[i] * step.delta;
+      }
+    } else if (step.gamma == Dtype(2)) {
+      for (int i = 0; i < count; ++i) {
+        dx[i] = dy[i] * (step.delta * step.alpha * x[i]
+            + step.delta * step.beta);
+      }
+    } else if (step.beta == Dtype(0)) {
+      for (int i = 0; i < count; ++i) {
+        dx[i] = dy[i] * (step.gamma * y[i] / x[i]);
+      }
+    } else {
+      for (int i = 0; i < count; ++i) {
+        dx[i] = dy[i] * (step.delta * y[i] / (step.alpha * x[i] + step.beta));
+      }
+    }
+    break;
+  case EXP:
+    for (int i = 0; i < count; ++i) {
+      dx[i] = dy[i] * y[i] * step.alpha;
+    }
+    break;
+  case LOG:
+    for (int i = 0; i < count; ++i) {
+      dx[i] = dy[i] * (step.delta / (step.alpha * x[i] + step.beta));
+    }
+    break;
+  default:
+    LOG(FATAL) << "Unknown function";
+  }
+}
+
+// Runs a CPU pass of the chain over tiles of kFusedTile values. The backward
+// pass takes the CPU data of thread_values_ and thread_param_diffs_, resolved
+// once by the caller, as the threads must not update their SyncedMemory.
+template <typename Dtype>
+class FusedElementwiseLayer<Dtype>::CPUTask : public ThreadPool::Task {
+ public:
+  CPUTask(FusedElementwiseLayer<Dtype>* layer, int count,
+      const Dtype* bottom_data, Dtype* bottom_copy, Dtype* top_data,
+      const Dtype* top_diff, Dtype* bottom_diff, Dtype* thread_values,
+      Dtype* thread_param_diffs, bool backward)
+      : layer_(layer), count_(count), bottom_data_(bottom_data),
+        bottom_copy_(bottom_copy), top_data_(top_data), top_diff_(top_diff),
+        bottom_diff_(bottom_diff), thread_values_(thread_values),
+        thread_param_diffs_(thread_param_diffs), backward_(backward) {}
+  virtual void Run(int thread, int begin, int end) {
+    const vector<Step>& steps = layer_->steps_;
+    const int last = steps.size() - 1;
+    for (int tile = begin; tile < end; ++tile) {
+      const int offset = tile * kFusedTile;
+      const int count = std::min(kFusedTile, count_ - offset);
+      const Dtype* x = bottom_data_ + offset;
+      if (!backward_) {
+        if (bottom_copy_) {
+          caffe_copy(count, x, bottom_copy_ + offset);
+        }
+        Dtype* y = top_data_ + offset;
+        for (int k = 0; k <= last; ++k) {
+          layer_->StepForward(steps[k], offset, count, k == 0 ? x : y, y);
+        }
+        continue;
+      }
+      // Recomputes the output of each step, then takes the gradient back
+      // through them
+      Dtype* values = thread_values_ + thread * (last + 2) * kFusedTile;
+      Dtype* param_diffs = thread_param_diffs_ ?
+          thread_param_diffs_ + thread * layer_->num_param_diffs_ : NULL;
+      for (int k = 0; k <= last; ++k) {
+        layer_->StepForward(steps[k], offset, count,
+            k == 0 ? x : values + (k - 1) * kFusedTile,
+            values + k * kFusedTile);
+      }
+      const Dtype* dy = top_diff_ + offset;
+      Dtype* diff = values + (last + 1) * kFusedTile;
+      for (int k = last; k >= 0; --k) {
+        Dtype* dx = k > 0 ? diff : (bottom_diff_ ? bottom_diff_ + offset :
+            NULL);
+        layer_->StepBackward(steps[k], offset, count,
+            k == 0 ? x : values + (k - 1) * kFusedTile,
+            values + k * kFusedTile, dy, dx, param_diffs);
+        dy = dx;
+      }
+    }
+  }
+  // Runs the pass over the bottom, on the CPU threads if it is big enough
+  void Run() {
+    const int tiles = (count_ + kFusedTile - 1) / kFusedTile;
+    if (Caffe::cpu_threads() == 1 || count_ < kFusedMinParallelCount) {
+      Run(0, 0, tiles);
+    } else {
+      Caffe::cpu_pool().Run(this, tiles);
+    }
+  }
+
+ protected:
+  FusedElementwiseLayer<Dtype>* layer_;
+  const int count_;
+  const Dtype* bottom_data_;
+  Dtype* bottom_copy_;
+  Dtype* top_data_;
+  const Dtype* top_diff_;
+  Dtype* bottom_diff_;
+  Dtype* thread_values_;
+  Dtype* thread_param_diffs_;
+  const bool backward_;
+};
+
+template <typename Dtype>
+void FusedElementwiseLayer<Dtype>::Forward_cpu(
+    const vector<Blob<Dtype>*>& bottom, const vector<Blob<Dtype>*>& top) {
+  PrepareSteps(false);
+  // The bottom is saved for Backward as it is overwritten in place
+  const bool save_bottom = bottom[0] == top[0] && this->phase_ == TRAIN;
+  CPUTask task(this, bottom[0]->count(), bottom[0]->cpu_data(),
+      save_bottom ? bottom_copy_.mutable_cpu_data() : NULL,
+      top[0]->mutable_cpu_data(), NULL, NULL, NULL, NULL, false);
+  task.Run();
+}
+
+template <typename Dtype>
+void FusedElementwiseLayer<Dtype>::Backward_cpu(
+    const vector<Blob<Dtype>*>& top, const vector<bool>& propagate_down,
+    const vector<Blob<Dtype>*>& bottom) {
+  PrepareSteps(true);
+  if (!propagate_down[0] && num_param_diffs_ == 0) {
+    return;
+  }
+  const bool in_place = bottom[0] == top[0];
+  CHECK(!in_place || this->phase_ == TRAIN)
+      << "Fused layers computed in place only support Backward in TRAIN";
+  const int threads = Caffe::cpu_threads();
+  vector<int> values_shape(3);
+  values_shape[0] = threads;
+  values_shape[1] = steps_.size() + 1;
+  values_shape[2] = kFusedTile;
+  thread_values_.Reshape(values_shape);
+  Dtype* thread_param_diffs = NULL;
+  if (num_param_diffs_ > 0) {
+    thread_param_diffs_.Reshape(threads, num_param_diffs_, 1, 1);
+    thread_param_diffs = thread_param_diffs_.mutable_cpu_data();
+    caffe_set(thread_param_diffs_.count(), Dtype(0), thread_param_diffs);
+  }
+  CPUTask task(this, bottom[0]->count(),
+      (in_place ? &bottom_copy_ : bottom[0])->cpu_data(), NULL, NULL,
+      top[0]->cpu_diff(),
+      propagate_down[0] ? bottom[0]->mutable_cpu_diff() : NULL,
+      thread_values_.mutable_cpu_data(), thread_param_diffs, true);
+  task.Run();
+  if (num_param_diffs_ == 0) {
+    return;
+  }
+  // Adds the parameter gradients of the threads, in order, to those of the
+  // layers
+  const Dtype* param_diffs = thread_param_diffs_.cpu_data();
+  for (int i = 0; i < steps_.size(); ++i) {
+    const Step& step = steps_[i];
+    for (int t = 0; t < threads; ++t) {
+      const Dtype* thread_diffs = param_diffs + thread_param_diffs_.offset(t);
+      if (step.scale_diff >= 0) {
+        caffe_axpy(step.dim, Dtype(1), thread_diffs + step.scale_diff,
+            step.scale_blob->mutable_cpu_diff());
+      }
+      if (step.shift_diff >= 0) {
+        caffe_axpy(step.dim, Dtype(1), thread_diffs + step.shift_diff,
+            step.shift_blob->mutable_cpu_diff());
+      }
+    }
+  }
+}
+
+INSTANTIATE_CLASS(FusedElementwiseLayer);
+
+}  // namespace caffe
@@ -23,43 +23,75 @@ void L2NormalizationLayer<Dtype>::Reshape(const vector<Blob<Dtype>*>& bottom,
     const vector<Blob<Dtype>*>& top) {
   // Layer<Dtype>::Reshape(bottom, top);
   top[0]->ReshapeLike(*bottom[0]);
-  squared_.ReshapeLike(*bottom[0]);
+  norm_.Reshape(bottom[0]->num(), 1, 1, 1);
   // top[0]->Reshape(bottom[0]->num(), bottom[0]->channels(),
   //     bottom[0]->height(), bottom[0]->width());
-  // squared_.Reshape(bottom[0]->num(), bottom[0]->channels(), 
-  //   bottom[0]->height(), bottom[0]->width());
 }
 
+// The squared norm of each row is accumulated in four independent partial
+// sums, then the row is scaled. The norms are cached for the backward pass,
+// which only reads the top, so that the layer can be computed in place.
 template <typename Dtype>
 void L2NormalizationLayer<Dtype>::Forward_cpu(const vector<Blob<Dtype>*>& bottom,
     const vector<Blob<Dtype>*>& top) {
   const Dtype* bottom_data = bottom[0]->cpu_data();
   Dtype* top_data = top[0]->mutable_cpu_data();
-  Dtype* squared_data = squared_.mutable_cpu_data();
+  Dtype* norm_data = norm_.mutable_cpu_data();
   int n = bottom[0]->num();
   int d = bottom[0]->count() / n;
-  caffe_sqr<Dtype>(n*d, bottom_data, squared_data);
   for (int i=0; i<n; ++i) {
-    Dtype normsqr = caffe_cpu_asum<Dtype>(d, squared_data+i*d);
-    caffe_cpu_scale<Dtype>(d, pow(normsqr, -0.5), bottom_data+i*d, top_data+i*d);
+    const Dtype* x = bottom_data+i*d;
+    Dtype* y = top_data+i*d;
+    Dtype sums[4] = {0, 0, 0, 0};
+    int j = 0;
+    for (; j+4 <= d; j += 4) {
+      for (int k=0; k<4; ++k) {
+        sums[k] += x[j+k]*x[j+k];
+      }
+    }
+    for (; j<d; ++j) {
+      sums[0] += x[j]*x[j];
+    }
+    norm_data[i] = sqrt((sums[0]+sums[1]) + (sums[2]+sums[3]));
+    const Dtype scale = Dtype(1) / norm_data[i];
+    for (j=0; j<d; ++j) {
+      y[j] = x[j]*scale;
+    }
   }
 }
 
+// bottom_diff = (top_diff - (top_data . top_diff) top_data) / norm
 template <typename Dtype>
 void L2NormalizationLayer<Dtype>::Backward_cpu(const vector<Blob<Dtype>*>& top,
     const vector<bool>& propagate_down, const vector<Blob<Dtype>*>& bottom) {
+  if (!propagate_down[0]) {
+    return;
+  }
   const Dtype* top_diff = top[0]->cpu_diff();
   const Dtype* top_data = top[0]->cpu_data();
-  const Dtype* bottom_data = bottom[0]->cpu_data();
+  const Dtype* norm_data = norm_.cpu_data();
   Dtype* bottom_diff = bottom[0]->mutable_cpu_diff();
   int n = top[0]->num();
   int d = top[0]->count() / n;
   for (int i=0; i<n; ++i) {
-    Dtype a = caffe_cpu_dot(d, top_data+i*d, top_diff+i*d);
-    caffe_cpu_scale(d, a, top_data+i*d, bottom_diff+i*d);
-    caffe_sub(d, top_diff+i*d, bottom_diff+i*d, bottom_diff+i*d);
-    a = caffe_cpu_dot(d, bottom_data+i*d, bottom_data+i*d);
-    caffe_cpu_scale(d, Dtype(pow(a, -0.5)), bottom_diff+i*d, bottom_diff+i*d);
+    const Dtype* y = top_data+i*d;
+    const Dtype* dy = top_diff+i*d;
+    Dtype* dx = bottom_diff+i*d;
+    Dtype sums[4] = {0, 0, 0, 0};
+    int j = 0;
+    for (; j+4 <= d; j += 4) {
+      for (int k=0; k<4; ++k) {
+        sums[k] += y[j+k]*dy[j+k];
+      }
+    }
+    for (; j<d; ++j) {
+      sums[0] += y[j]*dy[j];
+    }
+    const Dtype a = (sums[0]+sums[1]) + (sums[2]+sums[3]);
+    const Dtype scale = Dtype(1) / norm_data[i];
+    for (j=0; j<d; ++j) {
+      dx[j] = (dy[j] - a*y[j])*scale;
+    }
   }
 }
 
@@ -15,20 +15,65 @@
 
 namespace caffe {
 
+template <typename Dtype>
+__global__ void kernel_row_dot(const int num, const int dim,
+    const Dtype* data_1, const Dtype* data_2, Dtype* row_dot) {
+  CUDA_KERNEL_LOOP(index, num) {
+    Dtype dot = 0;
+    for (int j = 0; j < dim; ++j) {
+      dot += data_1[index * dim + j] * data_2[index * dim + j];
+    }
+    row_dot[index] = dot;
+  }
+}
+
+template <typename Dtype>
+__global__ void kernel_row_sqrt(const int num, Dtype* data) {
+  CUDA_KERNEL_LOOP(index, num) {
+    data[index] = sqrt(data[index]);
+  }
+}
+
+template <typename Dtype>
+__global__ void kernel_row_div(const int count, const int dim,
+    const Dtype* data, const Dtype* row_norm, Dtype* out) {
+  CUDA_KERNEL_LOOP(index, count) {
+    out[index] = data[index] / row_norm[index / dim];
+  }
+}
+
+template <typename Dtype>
+__global__ void kernel_row_backward(const int count, const int dim,
+    const Dtype* top_data, const Dtype* top_diff, const Dtype* row_dot,
+    const Dtype* row_norm, Dtype* bottom_diff) {
+  CUDA_KERNEL_LOOP(index, count) {
+    const int i = index / dim;
+    bottom_diff[index] =
+        (top_diff[index] - row_dot[i] * top_data[index]) / row_norm[i];
+  }
+}
+
+// The norms are computed and kept on the device, one thread per row, and
+// each element is then scaled by the norm of its row.
 template <typename Dtype>
 void L2NormalizationLayer<Dtype>::Forward_gpu(const vector<Blob<Dtype>*>& bottom,
     const vector<Blob<Dtype>*>& top) {
   const Dtype* bottom_data = bottom[0]->gpu_data();
   Dtype* top_data = top[0]->mutable_gpu_data();
-  Dtype* squared_data = squared_.mutable_gpu_data();
-  Dtype normsqr;
+  Dtype* norm_data = norm_.mutable_gpu_data();
   int n = bottom[0]->num();
-  int d = bottom[0]->count() / n;
-  caffe_gpu_powx(n*d, bottom_data, Dtype(2), squared_data);
-  for (int i=0; i<n; ++i) {
-    caffe_gpu_asum<Dtype>(d, squared_data+i*d, &normsqr);
-    caffe_gpu_scale<Dtype>(d, pow(normsqr, -0.5), bottom_data+i*d, top_data+i*d);
-  }
+  int count = bottom[0]->count();
+  int d = count / n;
+  // NOLINT_NEXT_LINE(whitespace/operators)
+  kernel_row_dot<Dtype><<<CAFFE_GET_BLOCKS(n), CAFFE_CUDA_NUM_THREADS>>>(
+      n, d, bottom_data, bottom_data, norm_data);
+  // NOLINT_NEXT_LINE(whitespace/operators)
+  kernel_row_sqrt<Dtype><<<CAFFE_GET_BLOCKS(n), CAFFE_CUDA_NUM_THREADS>>>(
+      n, norm_data);
+  // NOLINT_NEXT_LINE(whitespace/operators)
+  kernel_row_div<Dtype><<<CAFFE_GET_BLOCKS(count), CAFFE_CUDA_NUM_THREADS>>>(
+      count, d, bottom_data, norm_data, top_data);
+  CUDA_POST_KERNEL_CHECK;
 /*
   const Dtype* out = top[0]->cpu_data();
   for (int i=0; i<n; ++i) {
@@ -48,20 +93,27 @@ void L2NormalizationLayer<Dtype>::Forward_gpu(const vector<Blob<Dtype>*>& bottom
 template <typename Dtype>
 void L2NormalizationLayer<Dtype>::Backward_gpu(const vector<Blob<Dtype>*>& top,
     const vector<bool>& propagate_down, const vector<Blob<Dtype>*>& bottom) {
+  if (!propagate_down[0]) {
+    return;
+  }
   const Dtype* top_diff = top[0]->gpu_diff();
   const Dtype* top_data = top[0]->gpu_data();
-  const Dtype* bottom_data = bottom[0]->gpu_data();
+  const Dtype* norm_data = norm_.gpu_data();
+  // the diff of norm_ holds the dot product of each row
+  Dtype* dot_data = norm_.mutable_gpu_diff();
   Dtype* bottom_diff = bottom[0]->mutable_gpu_diff();
   int n = top[0]->num();
-  int d = top[0]->count() / n;
-  Dtype a;
-  for (int i=0; i<n; ++i) {
-    caffe_gpu_dot(d, top_data+i*d, top_diff+i*d, &a);
-    caffe_gpu_scale(d, a, top_data+i*d, bottom_diff+i*d);
-    caffe_gpu_sub(d, top_diff+i*d, bottom_diff+i*d, bottom_diff+i*d);
-    caffe_gpu_dot(d, bottom_data+i*d, bottom_data+i*d, &a);
-    caffe_gpu_scale(d, Dtype(pow(a, -0.5)), bottom_diff+i*d, bottom_diff+i*d);
-  }
+  int count = top[0]->count();
+  int d = count / n;
+  // bottom_diff = (top_diff - (top_data . top_diff) top_data) / norm
+  // NOLINT_NEXT_LINE(whitespace/operators)
+  kernel_row_dot<Dtype><<<CAFFE_GET_BLOCKS(n), CAFFE_CUDA_NUM_THREADS>>>(
+      n, d, top_data, top_diff, dot_data);
+  // NOLINT_NEXT_LINE(whitespace/operators)
+  kernel_row_backward<Dtype><<<CAFFE_GET_BLOCKS(count),
+      CAFFE_CUDA_NUM_THREADS>>>(count, d, top_data, top_diff, dot_data,
+      norm_data, bottom_diff);
+  CUDA_POST_KERNEL_CHECK;
 /*
 const Dtype* b = bottom[0]->cpu_data();
 for (int i = 0; i < n; i++) {
@@ -1,7 +1,10 @@
+#include <algorithm>
+#include <cmath>
 #include <vector>
 
 #include "caffe/layers/lrn_layer.hpp"
 #include "caffe/util/math_functions.hpp"
+#include "caffe/util/thread_pool.hpp"
 
 namespace caffe {
 
@@ -80,6 +83,8 @@ void LRNLayer<Dtype>::Reshape(const vector<Blob<Dtype>*>& bottom,
     scale_.Reshape(num_, channels_, height_, width_);
     break;
   case LRNParameter_NormRegion_WITHIN_CHANNEL:
+    // The blobs of the GPU layers are only allocated if they run
+    scale_.Reshape(num_, channels_, height_, width_);
     split_layer_->Reshape(bottom, split_top_vec_);
     square_layer_->Reshape(square_bottom_vec_, square_top_vec_);
     pool_layer_->Reshape(square_top_vec_, pool_top_vec_);
@@ -97,60 +102,180 @@ void LRNLayer<Dtype>::Forward_cpu(const vector<Blob<Dtype>*>& bottom,
     CrossChannelForward_cpu(bottom, top);
     break;
   case LRNParameter_NormRegion_WITHIN_CHANNEL:
-    WithinChannelForward(bottom, top);
+    WithinChannelForward_cpu(bottom, top);
     break;
   default:
     LOG(FATAL) << "Unknown normalization region.";
   }
 }
 
+// Number of positions of an image normalized together across channels on the
+// CPU, whose running window sums stay on the stack
+const int kLRNTile = 512;
+
+// Number of inputs below which the CPU passes run on the calling thread
+const int kLRNMinParallelCount = 1 << 16;
+
+// scale^-beta, with two square roots in place of pow for the usual 0.75
 template <typename Dtype>
-void LRNLayer<Dtype>::CrossChannelForward_cpu(
-    const vector<Blob<Dtype>*>& bottom, const vector<Blob<Dtype>*>& top) {
-  const Dtype* bottom_data = bottom[0]->cpu_data();
-  Dtype* top_data = top[0]->mutable_cpu_data();
-  Dtype* scale_data = scale_.mutable_cpu_data();
-  // start with the constant value
-  for (int i = 0; i < scale_.count(); ++i) {
-    scale_data[i] = k_;
+inline Dtype lrn_power(Dtype scale, Dtype beta) {
+  if (beta == Dtype(0.75)) {
+    const Dtype root = std::sqrt(scale);
+    return Dtype(1) / (root * std::sqrt(root));
   }
-  Blob<Dtype> padded_square(1, channels_ + size_ - 1, height_, width_);
-  Dtype* padded_square_data = padded_square.mutable_cpu_data();
-  caffe_set(padded_square.count(), Dtype(0), padded_square_data);
-  Dtype alpha_over_size = alpha_ / size_;
-  // go through the images
-  for (int n = 0; n < num_; ++n) {
-    // compute the padded square
-    caffe_sqr(channels_ * height_ * width_,
-        bottom_data + bottom[0]->offset(n),
-        padded_square_data + padded_square.offset(0, pre_pad_));
-    // Create the first channel scale
-    for (int c = 0; c < size_; ++c) {
-      caffe_axpy<Dtype>(height_ * width_, alpha_over_size,
-          padded_square_data + padded_square.offset(0, c),
-          scale_data + scale_.offset(n, 0));
+  return std::pow(scale, -beta);
+}
+
+// Sums the size-wide windows of the rows of a height x width plane, centered
+// at pre_pad and clipped to the plane, into rows
+template <typename Dtype>
+static void row_window_sums(const Dtype* in, int height, int width,
+    int size, int pre_pad, Dtype* rows) {
+  caffe_set(height * width, Dtype(0), rows);
+  for (int h = 0; h < height; ++h) {
+    const Dtype* in_row = in + h * width;
+    Dtype* row = rows + h * width;
+    for (int d = -pre_pad; d < size - pre_pad; ++d) {
+      const int end = std::min(width, width - d);
+      for (int w = std::max(0, -d); w < end; ++w) {
+        row[w] += in_row[w + d];
+      }
     }
-    for (int c = 1; c < channels_; ++c) {
-      // copy previous scale
-      caffe_copy<Dtype>(height_ * width_,
-          scale_data + scale_.offset(n, c - 1),
-          scale_data + scale_.offset(n, c));
-      // add head
-      caffe_axpy<Dtype>(height_ * width_, alpha_over_size,
-          padded_square_data + padded_square.offset(0, c + size_ - 1),
-          scale_data + scale_.offset(n, c));
-      // subtract tail
-      caffe_axpy<Dtype>(height_ * width_, -alpha_over_size,
-          padded_square_data + padded_square.offset(0, c - 1),
-          scale_data + scale_.offset(n, c));
+  }
+}
+
+// Sums the rows [h - pre_pad, h - pre_pad + size) of row_window_sums, clipped
+// to the plane, into sum
+template <typename Dtype>
+static void column_window_sum(const Dtype* rows, int height, int width,
+    int size, int pre_pad, int h, Dtype* sum) {
+  caffe_set(width, Dtype(0), sum);
+  const int end = std::min(height, h - pre_pad + size);
+  for (int r = std::max(0, h - pre_pad); r < end; ++r) {
+    const Dtype* row = rows + r * width;
+    for (int w = 0; w < width; ++w) {
+      sum[w] += row[w];
     }
   }
+}
+
+// Runs a CPU pass over tiles of kLRNTile positions of each image across
+// channels, or over the channel planes within them
+template <typename Dtype>
+class LRNLayer<Dtype>::CPUTask : public ThreadPool::Task {
+ public:
+  enum Pass { CROSS_FORWARD, CROSS_BACKWARD, WITHIN_FORWARD, WITHIN_BACKWARD };
 
-  // In the end, compute output
-  caffe_powx<Dtype>(scale_.count(), scale_data, -beta_, top_data);
-  caffe_mul<Dtype>(scale_.count(), top_data, bottom_data, top_data);
+  CPUTask(LRNLayer<Dtype>* layer, Pass pass, const Dtype* bottom_data,
+      const Dtype* top_data, const Dtype* top_diff, Dtype* result)
+      : layer_(layer), pass_(pass), bottom_data_(bottom_data),
+        top_data_(top_data), top_diff_(top_diff), result_(result),
+        scale_data_(layer->scale_.mutable_cpu_data()),
+        row_sums_(pass == WITHIN_FORWARD || pass == WITHIN_BACKWARD ?
+            layer->thread_row_sums_.mutable_cpu_data() : NULL),
+        spatial_(layer->height_ * layer->width_),
+        tiles_((spatial_ + kLRNTile - 1) / kLRNTile) {}
+  virtual void Run(int thread, int begin, int end) {
+    for (int unit = begin; unit < end; ++unit) {
+      const int n = unit / tiles_;
+      const int tile_begin = unit % tiles_ * kLRNTile;
+      const int tile_end = std::min(tile_begin + kLRNTile, spatial_);
+      switch (pass_) {
+      case CROSS_FORWARD:
+        layer_->cross_channel_forward_cpu(n, tile_begin, tile_end,
+            bottom_data_, scale_data_, result_);
+        break;
+      case CROSS_BACKWARD:
+        layer_->cross_channel_backward_cpu(n, tile_begin, tile_end,
+            top_diff_, top_data_, bottom_data_, scale_data_, result_);
+        break;
+      case WITHIN_FORWARD:
+        layer_->within_channel_forward_cpu(unit, thread_row_sums(thread),
+            bottom_data_, scale_data_, result_);
+        break;
+      case WITHIN_BACKWARD:
+        layer_->within_channel_backward_cpu(unit, thread_row_sums(thread),
+            top_diff_, top_data_, bottom_data_, scale_data_, result_);
+        break;
+      }
+    }
+  }
+  // Runs the pass over all images, on the CPU threads if there are enough
+  void Run() {
+    const int units = pass_ == CROSS_FORWARD || pass_ == CROSS_BACKWARD ?
+        layer_->num_ * tiles_ : layer_->num_ * layer_->channels_;
+    if (Caffe::cpu_threads() == 1 || layer_->num_ * layer_->channels_
+        * spatial_ < kLRNMinParallelCount) {
+      Run(0, 0, units);
+    } else {
+      Caffe::cpu_pool().Run(this, units);
+    }
+  }
+
+ protected:
+  Dtype* thread_row_sums(int thread) {
+    return row_sums_ + layer_->thread_row_sums_.offset(thread);
+  }
+
+  LRNLayer<Dtype>* layer_;
+  const Pass pass_;
+  const Dtype* bottom_data_;
+  const Dtype* top_data_;
+  const Dtype* top_diff_;
+  Dtype* result_;
+  Dtype* scale_data_;
+  Dtype* row_sums_;
+  const int spatial_;
+  const int tiles_;
+};
+template <typename Dtype>
+void LRNLayer<Dtype>::CrossChannelForward_cpu(
+    const vector<Blob<Dtype>*>& bottom, const vector<Blob<Dtype>*>& top) {
+  CPUTask task(this, CPUTask::CROSS_FORWARD, bottom[0]->cpu_data(), NULL,
+      NULL, top[0]->mutable_cpu_data());
+  task.Run();
 }
 
+template <typename Dtype>
+void LRNLayer<Dtype>::cross_channel_forward_cpu(int n, int begin, int end,
+    const Dtype* bottom_data, Dtype* scale_data, Dtype* top_data) {
+  const int step = height_ * width_;
+  const int offset = scale_.offset(n) + begin;
+  const int count = end - begin;
+  const Dtype* in = bottom_data + offset;
+  Dtype* scale = scale_data + offset;
+  Dtype* out = top_data + offset;
+  const Dtype alpha_over_size = alpha_ / size_;
+  const int post_pad = size_ - pre_pad_ - 1;
+  // Sum of the squares over the window of the current channel, which slides
+  // by adding its head and subtracting its tail
+  Dtype accum[kLRNTile];
+  caffe_set(count, Dtype(0), accum);
+  for (int c = 0; c < std::min(post_pad, channels_); ++c) {
+    for (int i = 0; i < count; ++i) {
+      accum[i] += in[c * step + i] * in[c * step + i];
+    }
+  }
+  for (int c = 0; c < channels_; ++c) {
+    const int head = c + post_pad;
+    if (head < channels_) {
+      for (int i = 0; i < count; ++i) {
+        accum[i] += in[head * step + i] * in[head * step + i];
+      }
+    }
+    const int tail = c - pre_pad_ - 1;
+    if (tail >= 0) {
+      for (int i = 0; i < count; ++i) {
+        accum[i] -= in[tail * step + i] * in[tail * step + i];
+      }
+    }
+    for (int i = 0; i < count; ++i) {
+      scale[c * step + i] = k_ + alpha_over_size * accum[i];
+      out[c * step + i] = in[c * step + i]
+          * lrn_power(scale[c * step + i], beta_);
+    }
+  }
+}
 template <typename Dtype>
 void LRNLayer<Dtype>::WithinChannelForward(
     const vector<Blob<Dtype>*>& bottom, const vector<Blob<Dtype>*>& top) {
@@ -169,7 +294,7 @@ void LRNLayer<Dtype>::Backward_cpu(const vector<Blob<Dtype>*>& top,
     CrossChannelBackward_cpu(top, propagate_down, bottom);
     break;
   case LRNParameter_NormRegion_WITHIN_CHANNEL:
-    WithinChannelBackward(top, propagate_down, bottom);
+    WithinChannelBackward_cpu(top, propagate_down, bottom);
     break;
   default:
     LOG(FATAL) << "Unknown normalization region.";
@@ -180,57 +305,56 @@ template <typename Dtype>
 void LRNLayer<Dtype>::CrossChannelBackward_cpu(
     const vector<Blob<Dtype>*>& top, const vector<bool>& propagate_down,
     const vector<Blob<Dtype>*>& bottom) {
-  const Dtype* top_diff = top[0]->cpu_diff();
-  const Dtype* top_data = top[0]->cpu_data();
-  const Dtype* bottom_data = bottom[0]->cpu_data();
-  const Dtype* scale_data = scale_.cpu_data();
-  Dtype* bottom_diff = bottom[0]->mutable_cpu_diff();
-  Blob<Dtype> padded_ratio(1, channels_ + size_ - 1, height_, width_);
-  Blob<Dtype> accum_ratio(1, 1, height_, width_);
-  Dtype* padded_ratio_data = padded_ratio.mutable_cpu_data();
-  Dtype* accum_ratio_data = accum_ratio.mutable_cpu_data();
-  // We hack a little bit by using the diff() to store an additional result
-  Dtype* accum_ratio_times_bottom = accum_ratio.mutable_cpu_diff();
-  caffe_set(padded_ratio.count(), Dtype(0), padded_ratio_data);
-  Dtype cache_ratio_value = 2. * alpha_ * beta_ / size_;
-
-  caffe_powx<Dtype>(scale_.count(), scale_data, -beta_, bottom_diff);
-  caffe_mul<Dtype>(scale_.count(), top_diff, bottom_diff, bottom_diff);
+  CPUTask task(this, CPUTask::CROSS_BACKWARD, bottom[0]->cpu_data(),
+      top[0]->cpu_data(), top[0]->cpu_diff(), bottom[0]->mutable_cpu_diff());
+  task.Run();
+}
 
-  // go through individual data
-  int inverse_pre_pad = size_ - (size_ + 1) / 2;
-  for (int n = 0; n < num_; ++n) {
-    int block_offset = scale_.offset(n);
-    // first, compute diff_i * y_i / s_i
-    caffe_mul<Dtype>(channels_ * height_ * width_,
-        top_diff + block_offset, top_data + block_offset,
-        padded_ratio_data + padded_ratio.offset(0, inverse_pre_pad));
-    caffe_div<Dtype>(channels_ * height_ * width_,
-        padded_ratio_data + padded_ratio.offset(0, inverse_pre_pad),
-        scale_data + block_offset,
-        padded_ratio_data + padded_ratio.offset(0, inverse_pre_pad));
-    // Now, compute the accumulated ratios and the bottom diff
-    caffe_set(accum_ratio.count(), Dtype(0), accum_ratio_data);
-    for (int c = 0; c < size_ - 1; ++c) {
-      caffe_axpy<Dtype>(height_ * width_, 1.,
-          padded_ratio_data + padded_ratio.offset(0, c), accum_ratio_data);
+template <typename Dtype>
+void LRNLayer<Dtype>::cross_channel_backward_cpu(int n, int begin, int end,
+    const Dtype* top_diff, const Dtype* top_data, const Dtype* bottom_data,
+    const Dtype* scale_data, Dtype* bottom_diff) {
+  const int step = height_ * width_;
+  const int offset = scale_.offset(n) + begin;
+  const int count = end - begin;
+  const Dtype* in = bottom_data + offset;
+  const Dtype* out = top_data + offset;
+  const Dtype* out_diff = top_diff + offset;
+  const Dtype* scale = scale_data + offset;
+  Dtype* in_diff = bottom_diff + offset;
+  const Dtype cache_ratio_value = 2. * alpha_ * beta_ / size_;
+  const int post_pad = size_ - pre_pad_ - 1;
+  // Sum of diff_i * y_i / s_i over the window of the current channel
+  Dtype accum[kLRNTile];
+  caffe_set(count, Dtype(0), accum);
+  for (int c = 0; c < std::min(post_pad, channels_); ++c) {
+    for (int i = 0; i < count; ++i) {
+      const int j = c * step + i;
+      accum[i] += out_diff[j] * out[j] / scale[j];
+    }
+  }
+  for (int c = 0; c < channels_; ++c) {
+    const int head = c + post_pad;
+    if (head < channels_) {
+      for (int i = 0; i < count; ++i) {
+        const int j = head * step + i;
+        accum[i] += out_diff[j] * out[j] / scale[j];
+      }
+    }
+    const int tail = c - pre_pad_ - 1;
+    if (tail >= 0) {
+      for (int i = 0; i < count; ++i) {
+        const int j = tail * step + i;
+        accum[i] -= out_diff[j] * out[j] / scale[j];
+      }
     }
-    for (int c = 0; c < channels_; ++c) {
-      caffe_axpy<Dtype>(height_ * width_, 1.,
-          padded_ratio_data + padded_ratio.offset(0, c + size_ - 1),
-          accum_ratio_data);
-      // compute bottom diff
-      caffe_mul<Dtype>(height_ * width_,
-          bottom_data + top[0]->offset(n, c),
-          accum_ratio_data, accum_ratio_times_bottom);
-      caffe_axpy<Dtype>(height_ * width_, -cache_ratio_value,
-          accum_ratio_times_bottom, bottom_diff + top[0]->offset(n, c));
-      caffe_axpy<Dtype>(height_ * width_, -1.,
-          padded_ratio_data + padded_ratio.offset(0, c), accum_ratio_data);
+    for (int i = 0; i < count; ++i) {
+      const int j = c * step + i;
+      in_diff[j] = out_diff[j] * lrn_power(scale[j], beta_)
+          - cache_ratio_value * in[j] * accum[i];
     }
   }
 }
-
 template <typename Dtype>
 void LRNLayer<Dtype>::WithinChannelBackward(
     const vector<Blob<Dtype>*>& top, const vector<bool>& propagate_down,
@@ -246,6 +370,77 @@ void LRNLayer<Dtype>::WithinChannelBackward(
   }
 }
 
+template <typename Dtype>
+void LRNLayer<Dtype>::WithinChannelForward_cpu(
+    const vector<Blob<Dtype>*>& bottom, const vector<Blob<Dtype>*>& top) {
+  thread_row_sums_.Reshape(Caffe::cpu_threads(), height_ + 1, width_, 1);
+  CPUTask task(this, CPUTask::WITHIN_FORWARD, bottom[0]->cpu_data(), NULL,
+      NULL, top[0]->mutable_cpu_data());
+  task.Run();
+}
+
+template <typename Dtype>
+void LRNLayer<Dtype>::WithinChannelBackward_cpu(
+    const vector<Blob<Dtype>*>& top, const vector<bool>& propagate_down,
+    const vector<Blob<Dtype>*>& bottom) {
+  if (propagate_down[0]) {
+    thread_row_sums_.Reshape(Caffe::cpu_threads(), height_ + 1, width_, 1);
+    CPUTask task(this, CPUTask::WITHIN_BACKWARD, bottom[0]->cpu_data(),
+        top[0]->cpu_data(), top[0]->cpu_diff(),
+        bottom[0]->mutable_cpu_diff());
+    task.Run();
+  }
+}
+
+template <typename Dtype>
+void LRNLayer<Dtype>::within_channel_forward_cpu(int plane, Dtype* rows,
+    const Dtype* bottom_data, Dtype* scale_data, Dtype* top_data) {
+  const int step = height_ * width_;
+  const Dtype* in = bottom_data + plane * step;
+  Dtype* scale = scale_data + plane * step;
+  Dtype* out = top_data + plane * step;
+  Dtype* sum = rows + step;
+  // The scale plane holds the squares until the rows are summed
+  caffe_sqr(step, in, scale);
+  row_window_sums(scale, height_, width_, size_, pre_pad_, rows);
+  const Dtype alpha_over_size = alpha_ / (size_ * size_);
+  for (int h = 0; h < height_; ++h) {
+    column_window_sum(rows, height_, width_, size_, pre_pad_, h, sum);
+    for (int w = 0; w < width_; ++w) {
+      const int i = h * width_ + w;
+      scale[i] = Dtype(1) + alpha_over_size * sum[w];
+      out[i] = in[i] * lrn_power(scale[i], beta_);
+    }
+  }
+}
+
+template <typename Dtype>
+void LRNLayer<Dtype>::within_channel_backward_cpu(int plane, Dtype* rows,
+    const Dtype* top_diff, const Dtype* top_data, const Dtype* bottom_data,
+    const Dtype* scale_data, Dtype* bottom_diff) {
+  const int step = height_ * width_;
+  const Dtype* in = bottom_data + plane * step;
+  const Dtype* out = top_data + plane * step;
+  const Dtype* out_diff = top_diff + plane * step;
+  const Dtype* scale = scale_data + plane * step;
+  Dtype* in_diff = bottom_diff + plane * step;
+  Dtype* sum = rows + step;
+  // The bottom diff holds diff_i * y_i / s_i until the rows are summed
+  for (int i = 0; i < step; ++i) {
+    in_diff[i] = out_diff[i] * out[i] / scale[i];
+  }
+  row_window_sums(in_diff, height_, width_, size_, pre_pad_, rows);
+  const Dtype cache_ratio_value = 2. * alpha_ * beta_ / (size_ * size_);
+  for (int h = 0; h < height_; ++h) {
+    column_window_sum(rows, height_, width_, size_, pre_pad_, h, sum);
+    for (int w = 0; w < width_; ++w) {
+      const int i = h * width_ + w;
+      in_diff[i] = out_diff[i] * lrn_power(scale[i], beta_)
+          - cache_ratio_value * in[i] * sum[w];
+    }
+  }
+}
+
 #ifdef CPU_ONLY
 STUB_GPU(LRNLayer);
 STUB_GPU_FORWARD(LRNLayer, CrossChannelForward);
@@ -20,9 +20,12 @@
 #include "caffe/layers/base_data_layer.hpp"
 #include "caffe/layers/pair_window_data_layer.hpp"
 #include "caffe/util/benchmark.hpp"
+#include "caffe/util/image_cache.hpp"
 #include "caffe/util/io.hpp"
 #include "caffe/util/math_functions.hpp"
 #include "caffe/util/rng.hpp"
+#include "caffe/util/thread_pool.hpp"
+#include "caffe/util/window_file.hpp"
 
 // caffe.proto > LayerParameter > WindowDataParameter
 //   'source' field specifies the window_file
@@ -52,6 +55,8 @@ void PairWindowDataLayer<Dtype>::DataLayerSetUp(const vector<Blob<Dtype>*>& bott
   //    width
   //    num_windows
   //    class_index overlap x1 y1 x2 y2
+  // followed by PAIRS sections, or its binary form written by
+  // tools/convert_window_file (see WindowFile)
 
   LOG(INFO) << "Window data layer:" << std::endl
       << "  foreground (object) overlap threshold: "
@@ -66,6 +71,11 @@ void PairWindowDataLayer<Dtype>::DataLayerSetUp(const vector<Blob<Dtype>*>& bott
       << this->layer_param_.pair_window_data_param().root_folder();
 
   cache_images_ = this->layer_param_.pair_window_data_param().cache_images();
+  const uint64_t image_cache_bytes =
+      this->layer_param_.pair_window_data_param().image_cache_bytes();
+  if (image_cache_bytes > 0) {
+    image_cache_.reset(new ImageCache(image_cache_bytes));
+  }
   string root_folder = this->layer_param_.pair_window_data_param().root_folder();
 
   const bool prefetch_needs_rand =
@@ -78,9 +88,9 @@ void PairWindowDataLayer<Dtype>::DataLayerSetUp(const vector<Blob<Dtype>*>& bott
     prefetch_rng_.reset();
   }
 
-  std::ifstream infile(this->layer_param_.pair_window_data_param().source().c_str());
-  CHECK(infile.good()) << "Failed to open window file "
-      << this->layer_param_.pair_window_data_param().source() << std::endl;
+  // Text window files are parsed, binary ones are memory mapped
+  WindowFile window_file;
+  window_file.Open(this->layer_param_.pair_window_data_param().source());
 
   map<int, int> label_hist;
   label_hist.insert(std::make_pair(0, 0));
@@ -93,142 +103,126 @@ void PairWindowDataLayer<Dtype>::DataLayerSetUp(const vector<Blob<Dtype>*>& bott
   sim_hist.insert(std::make_pair(0, 0));
   sim_hist.insert(std::make_pair(1, 0));
 
-  string hashtag, type;
-  int index=0, image_index=0, channels=0, num_pairs=0;
-  if (!(infile >> hashtag >> type >> index)) {
-    LOG(FATAL) << "Window file is empty";
+  int channels=0;
+  const int num_pairs = window_file.num_pairs();
+  for (int image_index = 0; image_index < window_file.num_images(); ++image_index) {
+    // read image path
+    string image_path = root_folder + window_file.image_path(image_index);
+    // read image dimensions
+    vector<int> image_size(window_file.image_size(image_index),
+        window_file.image_size(image_index) + 3);
+    channels = image_size[0];
+    image_database_.push_back(std::make_pair(image_path, image_size));
+
+    if (cache_images_) {
+      Datum datum;
+      if (!ReadFileToDatum(image_path, &datum)) {
+        LOG(ERROR) << "Could not open or find file " << image_path;
+        return;
+      }
+      image_database_cache_.push_back(std::make_pair(image_path, datum));
+    }
+    // read each box
+    const int num_windows = window_file.num_windows(image_index);
+    const WindowFile::Window* file_windows = window_file.windows(image_index);
+    const float fg_threshold =
+        this->layer_param_.pair_window_data_param().fg_threshold();
+    const float bg_threshold =
+        this->layer_param_.pair_window_data_param().bg_threshold();
+    for (int i = 0; i < num_windows; ++i) {
+      const WindowFile::Window& file_window = file_windows[i];
+      const int bb_index = file_window.bb_index;
+      const float overlap = file_window.overlap;
+
+      vector<float> window(PairWindowDataLayer::NUM_WIN_FIELDS);
+      window[PairWindowDataLayer::IMAGE_INDEX] = image_index;
+      window[PairWindowDataLayer::BB_INDEX] = bb_index;
+      window[PairWindowDataLayer::LABEL] = file_window.label;
+      window[PairWindowDataLayer::OVERLAP] = overlap;
+      window[PairWindowDataLayer::X1] = file_window.x1;
+      window[PairWindowDataLayer::Y1] = file_window.y1;
+      window[PairWindowDataLayer::X2] = file_window.x2;
+      window[PairWindowDataLayer::Y2] = file_window.y2;
+
+      // add window to foreground list or background list
+      if (overlap >= fg_threshold) {
+        int label = window[PairWindowDataLayer::LABEL];
+        CHECK_GT(label, 0);
+        label_hist.insert(std::make_pair(label, 0));
+        label_hist[label]++;
+
+        map<int,vector<float> > inner;
+        pair<map<int, map<int, vector<float> > >::iterator,bool> ret;
+        ret = windows_.insert(std::make_pair(image_index, inner));
+        ret.first->second.insert(std::make_pair(bb_index, window));
+
+      } else if (overlap < bg_threshold) {
+        // background window, force label and overlap to 0
+        window[PairWindowDataLayer::LABEL] = 0;
+        window[PairWindowDataLayer::OVERLAP] = 0;
+        label_hist[0]++;
+
+        map<int,vector<float> > inner;
+        pair<map<int, map<int, vector<float> > >::iterator,bool> ret;
+        ret = windows_.insert(std::make_pair(image_index, inner));
+        ret.first->second.insert(std::make_pair(bb_index, window));
+      }
+    }
+
+    if (image_index % 100 == 0) {
+      LOG(INFO) << "num: " << image_index << " "
+          << image_path << " "
+          << image_size[0] << " "
+          << image_size[1] << " "
+          << image_size[2] << " "
+          << "windows to process: " << num_windows;
+    }
   }
-  do {
-    CHECK_EQ(hashtag, "#");
-
-    if(boost::iequals(type, "FULL_IMAGES")){
-            image_index = index;
-	    // read image path
-	    string image_path;
-	    infile >> image_path;
-	    image_path = root_folder + image_path;
-	    // read image dimensions
-	    vector<int> image_size(3);
-	    infile >> image_size[0] >> image_size[1] >> image_size[2];
-	    channels = image_size[0];
-	    image_database_.push_back(std::make_pair(image_path, image_size));
-
-	    if (cache_images_) {
-	      Datum datum;
-	      if (!ReadFileToDatum(image_path, &datum)) {
-		LOG(ERROR) << "Could not open or find file " << image_path;
-		return;
-	      }
-	      image_database_cache_.push_back(std::make_pair(image_path, datum));
-	    }
-	    // read each box
-	    int num_windows;
-	    infile >> num_windows;
-	    const float fg_threshold =
-		this->layer_param_.pair_window_data_param().fg_threshold();
-	    const float bg_threshold =
-		this->layer_param_.pair_window_data_param().bg_threshold();
-	    for (int i = 0; i < num_windows; ++i) {
-	      int bb_index, label, x1, y1, x2, y2;
-	      float overlap;
-	      infile >> bb_index >> label >> overlap >> x1 >> y1 >> x2 >> y2;
-
-	      vector<float> window(PairWindowDataLayer::NUM_WIN_FIELDS);
-	      window[PairWindowDataLayer::IMAGE_INDEX] = image_index;
-	      window[PairWindowDataLayer::BB_INDEX] = bb_index;
-	      window[PairWindowDataLayer::LABEL] = label;
-	      window[PairWindowDataLayer::OVERLAP] = overlap;
-	      window[PairWindowDataLayer::X1] = x1;
-	      window[PairWindowDataLayer::Y1] = y1;
-	      window[PairWindowDataLayer::X2] = x2;
-	      window[PairWindowDataLayer::Y2] = y2;
-
-	      // add window to foreground list or background list
-	      if (overlap >= fg_threshold) {
-		int label = window[PairWindowDataLayer::LABEL];
-		CHECK_GT(label, 0);				
-		label_hist.insert(std::make_pair(label, 0));
-		label_hist[label]++;
-		
-		map<int,vector<float> > inner;
-                pair<map<int, map<int, vector<float> > >::iterator,bool> ret;
-		ret = windows_.insert(std::make_pair(image_index, inner));
-		ret.first->second.insert(std::make_pair(bb_index, window));
-		
-//		windows_.insert(std::make_pair(image_index, map<int, vector<float> > inner));
-//		windows_[image_index].insert(std::make_pair(bb_index, window));
-
-	      } else if (overlap < bg_threshold) {
-		// background window, force label and overlap to 0
-		window[PairWindowDataLayer::LABEL] = 0;
-		window[PairWindowDataLayer::OVERLAP] = 0;		
-		label_hist[0]++;
-
-		map<int,vector<float> > inner;
-                pair<map<int, map<int, vector<float> > >::iterator,bool> ret;
-		ret = windows_.insert(std::make_pair(image_index, inner));
-		ret.first->second.insert(std::make_pair(bb_index, window));
-
-//		windows_.insert(std::make_pair(image_index, map<int,vector<float> > inner));
-//		windows_[image_index].insert(std::make_pair(bb_index, window));
-	      }
-	    }
-
-	    if (image_index % 100 == 0) {
-	      LOG(INFO) << "num: " << image_index << " "
-		  << image_path << " "
-		  << image_size[0] << " "
-		  << image_size[1] << " "
-		  << image_size[2] << " "
-		  << "windows to process: " << num_windows;
-	    }
-    }else if(boost::iequals(type, "PAIRS")){
-    	
-         num_pairs = num_pairs + index;
-	 for (int i = 0; i < index; ++i) {
-	    int pair_index, image_index_1, bb_index_1, image_index_2, bb_index_2, sim;
-            infile >> pair_index >> image_index_1 >> bb_index_1 >> image_index_2 >> bb_index_2 >> sim;
-         
-            vector<int> pair(PairWindowDataLayer::NUM_PAIR_FIELDS);
-	    pair[PairWindowDataLayer::PAIR_INDEX] = pair_index;
-	    pair[PairWindowDataLayer::IMAGE_INDEX_1] = image_index_1;
-            pair[PairWindowDataLayer::BB_INDEX_1] = bb_index_1;
-            pair[PairWindowDataLayer::IMAGE_INDEX_2] = image_index_2;
-            pair[PairWindowDataLayer::BB_INDEX_2] = bb_index_2;
-            pair[PairWindowDataLayer::SIM] = sim;
-
-	    if(sim == 1){
-	        tg_pairs_.push_back(pair);
-	    }else{
-		ip_pairs_.push_back(pair);
-            }
-            sim_hist[sim]++;
-
-	    if(image_index_1 == image_index_2){
-               count_same_img++;
-
-               vector<float> window_a = windows_[image_index_1][bb_index_1];
-               vector<float> window_b = windows_[image_index_2][bb_index_2];
-               float XA1 = window_a[PairWindowDataLayer<Dtype>::X1]; float YA1 = window_a[PairWindowDataLayer<Dtype>::Y1]; 
-               float XA2 = window_a[PairWindowDataLayer<Dtype>::X2]; float YA2 = window_a[PairWindowDataLayer<Dtype>::Y2];
-
-               float XB1 = window_b[PairWindowDataLayer<Dtype>::X1]; float YB1 = window_b[PairWindowDataLayer<Dtype>::Y1]; 
-               float XB2 = window_b[PairWindowDataLayer<Dtype>::X2]; float YB2 = window_b[PairWindowDataLayer<Dtype>::Y2];
-
-               float sa = (XA2 - XA1) * (YA2 - YA1);
-               float sb = (XB2 - XB1) * (YB2 - YB1); 
-               float si = std::max(0.0f, std::min(XA2,XB2) - std::max(XA1,XB1)) * std::max(0.0f, std::min(YA2,YB2) - std::max(YA1,YB1));
-               if(si > 0.0f){
-                   pair_stat_acc(si/(sa+sb-si));
-               }
-            }
-	 }         	
+
+  // pair_index image_index_1 bb_index_1 image_index_2 bb_index_2 sim
+  if (num_pairs > 0) {
+    CHECK_EQ(window_file.pair_size(), PairWindowDataLayer::NUM_PAIR_FIELDS)
+        << "Pairs must have " << PairWindowDataLayer::NUM_PAIR_FIELDS
+        << " fields";
+  }
+  for (int i = 0; i < num_pairs; ++i) {
+    const int* file_pair = window_file.pair(i);
+    vector<int> pair(file_pair, file_pair + PairWindowDataLayer::NUM_PAIR_FIELDS);
+    const int image_index_1 = pair[PairWindowDataLayer::IMAGE_INDEX_1];
+    const int bb_index_1 = pair[PairWindowDataLayer::BB_INDEX_1];
+    const int image_index_2 = pair[PairWindowDataLayer::IMAGE_INDEX_2];
+    const int bb_index_2 = pair[PairWindowDataLayer::BB_INDEX_2];
+    const int sim = pair[PairWindowDataLayer::SIM];
+
+    if(sim == 1){
+      tg_pairs_.push_back(pair);
+    }else{
+      ip_pairs_.push_back(pair);
     }
-    
-  } while (infile >> hashtag >> type >> index);
+    sim_hist[sim]++;
+
+    if(image_index_1 == image_index_2){
+      count_same_img++;
 
+      const vector<float>& window_a = window(image_index_1, bb_index_1);
+      const vector<float>& window_b = window(image_index_2, bb_index_2);
+      float XA1 = window_a[PairWindowDataLayer<Dtype>::X1]; float YA1 = window_a[PairWindowDataLayer<Dtype>::Y1]; 
+      float XA2 = window_a[PairWindowDataLayer<Dtype>::X2]; float YA2 = window_a[PairWindowDataLayer<Dtype>::Y2];
 
-  LOG(INFO) << "Number of images: " << image_index+1;
+      float XB1 = window_b[PairWindowDataLayer<Dtype>::X1]; float YB1 = window_b[PairWindowDataLayer<Dtype>::Y1]; 
+      float XB2 = window_b[PairWindowDataLayer<Dtype>::X2]; float YB2 = window_b[PairWindowDataLayer<Dtype>::Y2];
+
+      float sa = (XA2 - XA1) * (YA2 - YA1);
+      float sb = (XB2 - XB1) * (YB2 - YB1); 
+      float si = std::max(0.0f, std::min(XA2,XB2) - std::max(XA1,XB1)) * std::max(0.0f, std::min(YA2,YB2) - std::max(YA1,YB1));
+      if(si > 0.0f){
+        pair_stat_acc(si/(sa+sb-si));
+      }
+    }
+  }
+
+
+  LOG(INFO) << "Number of images: " << window_file.num_images();
   for (map<int, int>::iterator it = label_hist.begin();
       it != label_hist.end(); ++it) {
     LOG(INFO) << "class " << it->first << " has " << label_hist[it->first]
@@ -265,8 +259,8 @@ void PairWindowDataLayer<Dtype>::DataLayerSetUp(const vector<Blob<Dtype>*>& bott
   CHECK_GT(crop_size, 0);
   const int batch_size = this->layer_param_.pair_window_data_param().batch_size();
   top[0]->Reshape(batch_size, 2*channels, crop_size, crop_size);
-  for (int i = 0; i < this->PREFETCH_COUNT; ++i)
-    this->prefetch_[i].data_.Reshape(
+  for (int i = 0; i < this->prefetch_.size(); ++i)
+    this->prefetch_[i]->data_.Reshape(
         batch_size, 2*channels, crop_size, crop_size);
 
   LOG(INFO) << "output data size: " << top[0]->num() << ","
@@ -275,8 +269,8 @@ void PairWindowDataLayer<Dtype>::DataLayerSetUp(const vector<Blob<Dtype>*>& bott
   // label
   vector<int> label_shape(1, batch_size);
   top[1]->Reshape(label_shape);
-  for (int i = 0; i < this->PREFETCH_COUNT; ++i) {
-    this->prefetch_[i].label_.Reshape(label_shape);
+  for (int i = 0; i < this->prefetch_.size(); ++i) {
+    this->prefetch_[i]->label_.Reshape(label_shape);
   }
 
   // data mean
@@ -307,6 +301,20 @@ void PairWindowDataLayer<Dtype>::DataLayerSetUp(const vector<Blob<Dtype>*>& bott
   }
 }
 
+template <typename Dtype>
+const vector<float>& PairWindowDataLayer<Dtype>::window(int image_index,
+    int bb_index) const {
+  map<int, map<int, vector<float> > >::const_iterator image =
+      windows_.find(image_index);
+  CHECK(image != windows_.end()) << "No window read for image "
+      << image_index;
+  map<int, vector<float> >::const_iterator box =
+      image->second.find(bb_index);
+  CHECK(box != image->second.end()) << "No window read for image "
+      << image_index << " box " << bb_index;
+  return box->second;
+}
+
 template <typename Dtype>
 unsigned int PairWindowDataLayer<Dtype>::PrefetchRand() {
   CHECK(prefetch_rng_);
@@ -315,6 +323,47 @@ unsigned int PairWindowDataLayer<Dtype>::PrefetchRand() {
   return (*prefetch_rng)();
 }
 
+// This function is called on prefetch and transform threads
+template <typename Dtype>
+bool PairWindowDataLayer<Dtype>::load_image(int image_index,
+    cv::Mat* cv_img) {
+  // decoded images are shared with the cache and must not be modified
+  if (this->image_cache_ && this->image_cache_->Get(image_index, cv_img)) {
+    return true;
+  }
+  if (this->cache_images_) {
+    *cv_img = DecodeDatumToCVMat(image_database_cache_[image_index].second,
+        true);
+  } else {
+    const string& image_path = image_database_[image_index].first;
+    *cv_img = cv::imread(image_path, CV_LOAD_IMAGE_COLOR);
+    if (!cv_img->data) {
+      LOG(ERROR) << "Could not open or find file " << image_path;
+      return false;
+    }
+  }
+  if (this->image_cache_) {
+    this->image_cache_->Put(image_index, *cv_img);
+  }
+  return true;
+}
+
+template <typename Dtype>
+class PairWindowDataLayer<Dtype>::LoadImages : public ThreadPool::Task {
+ public:
+  explicit LoadImages(PairWindowDataLayer<Dtype>* layer)
+      : layer_(layer) {}
+  virtual void Run(int thread, int begin, int end) {
+    for (int i = begin; i < end; ++i) {
+      layer_->load_image(layer_->batch_image_indices_[i],
+          &layer_->batch_images_[i]);
+    }
+  }
+
+ protected:
+  PairWindowDataLayer<Dtype>* layer_;
+};
+
 // This function is called on prefetch thread
 template <typename Dtype>
 void PairWindowDataLayer<Dtype>::load_batch(Batch<Dtype>* batch) {
@@ -325,28 +374,12 @@ void PairWindowDataLayer<Dtype>::load_batch(Batch<Dtype>* batch) {
   double trans_time = 0;
   CPUTimer timer;
   Dtype* top_data = batch->data_.mutable_cpu_data();
-  Dtype* top_label = batch->label_.mutable_cpu_data();
-  const Dtype scale = this->layer_param_.pair_window_data_param().scale();
+  // Resolved here as load_item runs on the transform threads
+  mean_data_ = this->has_mean_file_ ? data_mean_.cpu_data() : NULL;
   const int batch_size = this->layer_param_.pair_window_data_param().batch_size();
-  const int context_pad = this->layer_param_.pair_window_data_param().context_pad();
-  const int crop_size = this->transform_param_.crop_size();
   const bool mirror = this->transform_param_.mirror();
   const float fg_fraction =
       this->layer_param_.pair_window_data_param().fg_fraction();
-  Dtype* mean = NULL;
-  int mean_off = 0;
-  int mean_width = 0;
-  int mean_height = 0;
-  if (this->has_mean_file_) {
-    mean = this->data_mean_.mutable_cpu_data();
-    mean_off = (this->data_mean_.width() - crop_size) / 2;
-    mean_width = this->data_mean_.width();
-    mean_height = this->data_mean_.height();
-  }
-  //cv::Size cv_crop_size(crop_size, crop_size);
-  const string& crop_mode = this->layer_param_.pair_window_data_param().crop_mode();
-
-  bool use_square = (crop_mode == "square") ? true : false;
 
   // zero out batch
   caffe_set(batch->data_.count(), Dtype(0), top_data);
@@ -355,183 +388,244 @@ void PairWindowDataLayer<Dtype>::load_batch(Batch<Dtype>* batch) {
       * fg_fraction);
   const int num_samples[2] = { batch_size - num_fg, num_fg };
 
+  // Sample the pairs, and whether to mirror their windows, on this thread so
+  // the random sequence does not depend on the number of transform threads
+  item_pairs_.resize(batch_size);
+  item_windows_.resize(2 * batch_size);
+  item_mirrors_.resize(2 * batch_size);
   int item_id = 0;
   // sample from bg set then fg set
   for (int is_tg = 0; is_tg < 2; ++is_tg) {
     for (int dummy = 0; dummy < num_samples[is_tg]; ++dummy) {
       // sample a window
-      timer.Start();
       const unsigned int rand_index = PrefetchRand();
-      vector<int> pair = (is_tg) ?
+      item_pairs_[item_id] = (is_tg) ?
           tg_pairs_[rand_index % tg_pairs_.size()] :
           ip_pairs_[rand_index % ip_pairs_.size()];
+      const vector<int>& pair = item_pairs_[item_id];
+      item_windows_[2 * item_id] = window(pair[PairWindowDataLayer<Dtype>::IMAGE_INDEX_1], pair[PairWindowDataLayer<Dtype>::BB_INDEX_1]);
+      item_windows_[2 * item_id + 1] = window(pair[PairWindowDataLayer<Dtype>::IMAGE_INDEX_2], pair[PairWindowDataLayer<Dtype>::BB_INDEX_2]);
+      item_mirrors_[2 * item_id] = mirror && PrefetchRand() % 2;
+      item_mirrors_[2 * item_id + 1] = mirror && PrefetchRand() % 2;
+      item_id++;
+    }
+  }
+  // Group the windows by image, decode each image once, then load, crop and
+  // warp the windows from the decoded images. The items are loaded in parts
+  // needing at most batch_images distinct images, so that a batch does not
+  // hold all of its decoded images at once.
+  timer.Start();
+  const int max_images =
+      this->layer_param_.pair_window_data_param().batch_images();
+  CHECK_GT(max_images, 0) << "batch_images must be positive";
+  item_images_.resize(2 * batch_size);
+  int item_begin = 0;
+  while (item_begin < batch_size) {
+    map<int, int> image_slots; // image index => index in batch_images_
+    batch_image_indices_.clear();
+    int item_end = item_begin;
+    for (; item_end < batch_size; ++item_end) {
+      const int image_a =
+          item_windows_[2 * item_end][PairWindowDataLayer<Dtype>::IMAGE_INDEX];
+      const int image_b =
+          item_windows_[2 * item_end + 1][PairWindowDataLayer<Dtype>::IMAGE_INDEX];
+      const int new_images = (image_slots.count(image_a) == 0) +
+          (image_b != image_a && image_slots.count(image_b) == 0);
+      // a part takes at least one item
+      if (item_end > item_begin &&
+          static_cast<int>(image_slots.size()) + new_images > max_images) {
+        break;
+      }
+      for (int i = 2 * item_end; i < 2 * item_end + 2; ++i) {
+        const int image_index = item_windows_[i][PairWindowDataLayer<Dtype>::IMAGE_INDEX];
+        std::pair<map<int, int>::iterator, bool> slot = image_slots.insert(
+            std::make_pair(image_index, batch_image_indices_.size()));
+        if (slot.second) {
+          batch_image_indices_.push_back(image_index);
+        }
+        item_images_[i] = slot.first->second;
+      }
+    }
+    batch_images_.resize(batch_image_indices_.size());
+    LoadImages task(this);
+    this->transform_pool_->Run(&task, batch_image_indices_.size());
+    this->load_items(batch, item_begin, item_end);
+    // Release the images, the cache keeps the ones it holds
+    for (int i = 0; i < batch_images_.size(); ++i) {
+      batch_images_[i].release();
+    }
+    item_begin = item_end;
+  }
+  trans_time += timer.MicroSeconds();
+  batch_timer.Stop();
+  DLOG(INFO) << "Prefetch batch: " << batch_timer.MilliSeconds() << " ms.";  
+  DLOG(INFO) << "Transform time: " << trans_time / 1000 << " ms.";
+}
 
-      vector<float> window_a = windows_[pair[PairWindowDataLayer<Dtype>::IMAGE_INDEX_1]][pair[PairWindowDataLayer<Dtype>::BB_INDEX_1]];
-      vector<float> window_b = windows_[pair[PairWindowDataLayer<Dtype>::IMAGE_INDEX_2]][pair[PairWindowDataLayer<Dtype>::BB_INDEX_2]];
-      
+// This function is called on prefetch and transform threads
+template <typename Dtype>
+void PairWindowDataLayer<Dtype>::load_item(Batch<Dtype>* batch,
+    Dtype* top_data, Dtype* top_label, int item_id, int thread) {
+  const Dtype scale = this->layer_param_.pair_window_data_param().scale();
+  const int context_pad = this->layer_param_.pair_window_data_param().context_pad();
+  const int crop_size = this->transform_param_.crop_size();
+  const Dtype* mean = NULL;
+  int mean_off = 0;
+  int mean_width = 0;
+  int mean_height = 0;
+  if (this->has_mean_file_) {
+    mean = mean_data_;
+    mean_off = (this->data_mean_.width() - crop_size) / 2;
+    mean_width = this->data_mean_.width();
+    mean_height = this->data_mean_.height();
+  }
+  const string& crop_mode = this->layer_param_.pair_window_data_param().crop_mode();
+
+  bool use_square = (crop_mode == "square") ? true : false;
 
-      //prepare windows
-      int pad_wa=0, pad_ha=0, pad_wb=0, pad_hb=0;
-      bool do_mirrora = false, do_mirrorb = false;
-      cv::Mat cv_cropped_img_a, cv_cropped_img_b; 
-      bool isImage_aPrep = this->prepare_window(cv_cropped_img_a, pad_wa, pad_ha, do_mirrora, window_a, mirror, context_pad, use_square, crop_size);
-      bool isImage_bPrep = this->prepare_window(cv_cropped_img_b, pad_wb, pad_hb, do_mirrorb, window_b, mirror, context_pad, use_square, crop_size);
-      if(!isImage_aPrep || !isImage_bPrep)
-	return;
-
-      CHECK_EQ(cv_cropped_img_a.channels(), cv_cropped_img_b.channels());
-      const int channels = cv_cropped_img_a.channels();
-
-      // copy the warped window a into top_data
-      for (int h = 0; h < cv_cropped_img_a.rows; ++h) {
-        const uchar* ptr = cv_cropped_img_a.ptr<uchar>(h);
-        int img_index = 0;
-        for (int w = 0; w < cv_cropped_img_a.cols; ++w) {
-          for (int c = 0; c < channels; ++c) {
-            int top_index = ((item_id * (2*channels) + c) * crop_size + h + pad_ha)
-                     * crop_size + w + pad_wa;
-            // int top_index = (c * height + h) * width + w;
-            Dtype pixel = static_cast<Dtype>(ptr[img_index++]);
-            if (this->has_mean_file_) {
-              int mean_index = (c * mean_height + h + mean_off + pad_ha)
-                           * mean_width + w + mean_off + pad_wa;
-              top_data[top_index] = (pixel - mean[mean_index]) * scale;
-            } else {
-              if (this->has_mean_values_) {
-                top_data[top_index] = (pixel - this->mean_values_[c]) * scale;
-              } else {
-                top_data[top_index] = pixel * scale;
-              }
-            }
+  const vector<int>& pair = item_pairs_[item_id];
+  const bool do_mirrora = item_mirrors_[2 * item_id];
+  const bool do_mirrorb = item_mirrors_[2 * item_id + 1];
+  const vector<float>& window_a = item_windows_[2 * item_id];
+  const vector<float>& window_b = item_windows_[2 * item_id + 1];
+
+  //prepare windows
+  int pad_wa=0, pad_ha=0, pad_wb=0, pad_hb=0;
+  cv::Mat cv_cropped_img_a, cv_cropped_img_b; 
+  bool isImage_aPrep = this->prepare_window(cv_cropped_img_a, pad_wa, pad_ha, do_mirrora, batch_images_[item_images_[2 * item_id + 0]], window_a, context_pad, use_square, crop_size);
+  bool isImage_bPrep = this->prepare_window(cv_cropped_img_b, pad_wb, pad_hb, do_mirrorb, batch_images_[item_images_[2 * item_id + 1]], window_b, context_pad, use_square, crop_size);
+  if(!isImage_aPrep || !isImage_bPrep)
+    return;
+
+  CHECK_EQ(cv_cropped_img_a.channels(), cv_cropped_img_b.channels());
+  const int channels = cv_cropped_img_a.channels();
+
+  // copy the warped window a into top_data
+  for (int h = 0; h < cv_cropped_img_a.rows; ++h) {
+    const uchar* ptr = cv_cropped_img_a.ptr<uchar>(h);
+    int img_index = 0;
+    for (int w = 0; w < cv_cropped_img_a.cols; ++w) {
+      for (int c = 0; c < channels; ++c) {
+        int top_index = ((item_id * (2*channels) + c) * crop_size + h + pad_ha)
+                 * crop_size + w + pad_wa;
+        // int top_index = (c * height + h) * width + w;
+        Dtype pixel = static_cast<Dtype>(ptr[img_index++]);
+        if (this->has_mean_file_) {
+          int mean_index = (c * mean_height + h + mean_off + pad_ha)
+                       * mean_width + w + mean_off + pad_wa;
+          top_data[top_index] = (pixel - mean[mean_index]) * scale;
+        } else {
+          if (this->has_mean_values_) {
+            top_data[top_index] = (pixel - this->mean_values_[c]) * scale;
+          } else {
+            top_data[top_index] = pixel * scale;
           }
         }
       }
+    }
+  }
 
-      // copy the warped window b into top_data
-      for (int h = 0; h < cv_cropped_img_b.rows; ++h) {
-        const uchar* ptr = cv_cropped_img_b.ptr<uchar>(h);
-        int img_index = 0;
-        for (int w = 0; w < cv_cropped_img_b.cols; ++w) {
-          for (int c = channels; c < 2*channels; ++c) {
-            int top_index = ((item_id * (2*channels) + c) * crop_size + h + pad_hb)
-                     * crop_size + w + pad_wb;
-            // int top_index = (c * height + h) * width + w;
-            Dtype pixel = static_cast<Dtype>(ptr[img_index++]);
-            int mean_c = c % channels;
-            if (this->has_mean_file_) {
-              int mean_index = (mean_c * mean_height + h + mean_off + pad_hb)
-                           * mean_width + w + mean_off + pad_wb;
-              top_data[top_index] = (pixel - mean[mean_index]) * scale;
-            } else {
-              if (this->has_mean_values_) {
-                top_data[top_index] = (pixel - this->mean_values_[mean_c]) * scale;
-              } else {
-                top_data[top_index] = pixel * scale;
-              }
-            }
+  // copy the warped window b into top_data
+  for (int h = 0; h < cv_cropped_img_b.rows; ++h) {
+    const uchar* ptr = cv_cropped_img_b.ptr<uchar>(h);
+    int img_index = 0;
+    for (int w = 0; w < cv_cropped_img_b.cols; ++w) {
+      for (int c = channels; c < 2*channels; ++c) {
+        int top_index = ((item_id * (2*channels) + c) * crop_size + h + pad_hb)
+                 * crop_size + w + pad_wb;
+        // int top_index = (c * height + h) * width + w;
+        Dtype pixel = static_cast<Dtype>(ptr[img_index++]);
+        int mean_c = c % channels;
+        if (this->has_mean_file_) {
+          int mean_index = (mean_c * mean_height + h + mean_off + pad_hb)
+                       * mean_width + w + mean_off + pad_wb;
+          top_data[top_index] = (pixel - mean[mean_index]) * scale;
+        } else {
+          if (this->has_mean_values_) {
+            top_data[top_index] = (pixel - this->mean_values_[mean_c]) * scale;
+          } else {
+            top_data[top_index] = pixel * scale;
           }
         }
       }
+    }
+  }
 
+  //get window label
+  if(window_a[PairWindowDataLayer<Dtype>::LABEL] == window_b[PairWindowDataLayer<Dtype>::LABEL]){
+    CHECK_EQ(pair[PairWindowDataLayer<Dtype>::SIM], 1);
+    top_label[item_id] = 1;
+  }else{
+   CHECK_EQ(pair[PairWindowDataLayer<Dtype>::SIM], 0);
+   top_label[item_id] = 0;
+  }
 
+  // get window label - temporary for unsupervised exps
+  //if(pair[PairWindowDataLayer<Dtype>::SIM] == 1){       
+  //top_label[item_id] = 1;
+  //}else{       
+  //top_label[item_id] = 0;
+  //}
+
+ 
+  // useful debugging code for dumping transformed windows to disk
+  #if 0
+  std::pair<std::string, vector<int> > image_debug_a = image_database_[window_a[PairWindowDataLayer<Dtype>::IMAGE_INDEX]];
+
+  std::pair<std::string, vector<int> > image_debug_b = image_database_[window_b[PairWindowDataLayer<Dtype>::IMAGE_INDEX]];
+
+  string file_id;
+  std::stringstream ss;
+  ss << PrefetchRand();
+  ss >> file_id;
+  std::ofstream inf((string("dump/") + file_id +
+      string("_info.txt")).c_str(), std::ofstream::out);
+  inf << "Pair_ID = " << pair[PairWindowDataLayer<Dtype>::PAIR_INDEX] << std::endl;
+
+  inf << image_debug_a.first << std::endl;
+  inf << window_a[PairWindowDataLayer<Dtype>::X1]+1 << std::endl;
+  inf << window_a[PairWindowDataLayer<Dtype>::Y1]+1 << std::endl;
+  inf << window_a[PairWindowDataLayer<Dtype>::X2]+1 << std::endl;
+  inf << window_a[PairWindowDataLayer<Dtype>::Y2]+1 << std::endl;
+  inf << window_a[PairWindowDataLayer<Dtype>::LABEL] << std::endl;
+  inf << do_mirrora << std::endl;
+  
+  inf << image_debug_b.first << std::endl;
+  inf << window_b[PairWindowDataLayer<Dtype>::X1]+1 << std::endl;
+  inf << window_b[PairWindowDataLayer<Dtype>::Y1]+1 << std::endl;
+  inf << window_b[PairWindowDataLayer<Dtype>::X2]+1 << std::endl;
+  inf << window_b[PairWindowDataLayer<Dtype>::Y2]+1 << std::endl;
+  inf << window_b[PairWindowDataLayer<Dtype>::LABEL] << std::endl;
+  inf << do_mirrorb << std::endl;
       
-      trans_time += timer.MicroSeconds();
-      //get window label
-      if(window_a[PairWindowDataLayer<Dtype>::LABEL] == window_b[PairWindowDataLayer<Dtype>::LABEL]){
-        CHECK_EQ(pair[PairWindowDataLayer<Dtype>::SIM], 1);
-        top_label[item_id] = 1;
-      }else{
-       CHECK_EQ(pair[PairWindowDataLayer<Dtype>::SIM], 0);
-       top_label[item_id] = 0;
-      }
-
-      // get window label - temporary for unsupervised exps
-      //if(pair[PairWindowDataLayer<Dtype>::SIM] == 1){       
-      //top_label[item_id] = 1;
-      //}else{       
-      //top_label[item_id] = 0;
-      //}
-
-     
-      // useful debugging code for dumping transformed windows to disk
-      #if 0
-      std::pair<std::string, vector<int> > image_debug_a = image_database_[window_a[PairWindowDataLayer<Dtype>::IMAGE_INDEX]];
-
-      std::pair<std::string, vector<int> > image_debug_b = image_database_[window_b[PairWindowDataLayer<Dtype>::IMAGE_INDEX]];
-
-      string file_id;
-      std::stringstream ss;
-      ss << PrefetchRand();
-      ss >> file_id;
-      std::ofstream inf((string("dump/") + file_id +
-          string("_info.txt")).c_str(), std::ofstream::out);
-      inf << "Pair_ID = " << pair[PairWindowDataLayer<Dtype>::PAIR_INDEX] << std::endl;
-
-      inf << image_debug_a.first << std::endl;
-      inf << window_a[PairWindowDataLayer<Dtype>::X1]+1 << std::endl;
-      inf << window_a[PairWindowDataLayer<Dtype>::Y1]+1 << std::endl;
-      inf << window_a[PairWindowDataLayer<Dtype>::X2]+1 << std::endl;
-      inf << window_a[PairWindowDataLayer<Dtype>::Y2]+1 << std::endl;
-      inf << window_a[PairWindowDataLayer<Dtype>::LABEL] << std::endl;
-      inf << do_mirrora << std::endl;
-      
-      inf << image_debug_b.first << std::endl;
-      inf << window_b[PairWindowDataLayer<Dtype>::X1]+1 << std::endl;
-      inf << window_b[PairWindowDataLayer<Dtype>::Y1]+1 << std::endl;
-      inf << window_b[PairWindowDataLayer<Dtype>::X2]+1 << std::endl;
-      inf << window_b[PairWindowDataLayer<Dtype>::Y2]+1 << std::endl;
-      inf << window_b[PairWindowDataLayer<Dtype>::LABEL] << std::endl;
-      inf << do_mirrorb << std::endl;
-          
-      inf << top_label[item_id] << std::endl;
-      inf << is_tg << std::endl;      
-      inf.close();
-
-      std::ofstream top_data_file_a((string("dump/") + file_id +
-          string("_data.txt")).c_str(),
-          std::ofstream::out | std::ofstream::binary);
-      for (int c = 0; c < 2*channels; ++c) {
-        for (int h = 0; h < crop_size; ++h) {
-          for (int w = 0; w < crop_size; ++w) {
-            top_data_file_a.write(reinterpret_cast<char*>(
-                &top_data[((item_id * (2*channels) + c) * crop_size + h)
-                          * crop_size + w]),
-                sizeof(Dtype));
-          }
-        }
+  inf << top_label[item_id] << std::endl;
+  inf << pair[PairWindowDataLayer<Dtype>::SIM] << std::endl;      
+  inf.close();
+
+  std::ofstream top_data_file_a((string("dump/") + file_id +
+      string("_data.txt")).c_str(),
+      std::ofstream::out | std::ofstream::binary);
+  for (int c = 0; c < 2*channels; ++c) {
+    for (int h = 0; h < crop_size; ++h) {
+      for (int w = 0; w < crop_size; ++w) {
+        top_data_file_a.write(reinterpret_cast<char*>(
+            &top_data[((item_id * (2*channels) + c) * crop_size + h)
+                      * crop_size + w]),
+            sizeof(Dtype));
       }
-      top_data_file_a.close();
-      #endif
-
-      item_id++;
     }
   }
-  batch_timer.Stop();
-  DLOG(INFO) << "Prefetch batch: " << batch_timer.MilliSeconds() << " ms.";  
-  DLOG(INFO) << "Transform time: " << trans_time / 1000 << " ms.";
+  top_data_file_a.close();
+  #endif
 }
 
 template <typename Dtype>
-bool PairWindowDataLayer<Dtype>::prepare_window(cv::Mat &warpimg, int &pad_w, int &pad_h, bool &do_mirror, const vector<float> &window, const bool mirror, const int context_pad, const bool use_square, const int crop_size){
+bool PairWindowDataLayer<Dtype>::prepare_window(cv::Mat &warpimg, int &pad_w, int &pad_h, const bool do_mirror, const cv::Mat &cv_img, const vector<float> &window, const int context_pad, const bool use_square, const int crop_size){
 
       cv::Size cv_crop_size(crop_size, crop_size);
-      do_mirror = mirror && PrefetchRand() % 2;
-
-      // load the image containing the window
-      pair<std::string, vector<int> > image =
-          image_database_[window[PairWindowDataLayer<Dtype>::IMAGE_INDEX]];   
-
-      cv::Mat cv_img;
-      if (this->cache_images_) {
-        pair<std::string, Datum> image_cached =
-          image_database_cache_[window[PairWindowDataLayer<Dtype>::IMAGE_INDEX]];
-        cv_img = DecodeDatumToCVMat(image_cached.second, true);
-      } else {
-        cv_img = cv::imread(image.first, CV_LOAD_IMAGE_COLOR);
-        if (!cv_img.data) {
-          LOG(ERROR) << "Could not open or find file " << image.first;
-          return false;
-        }
+
+      if (!cv_img.data) {
+        return false;
       }
 
       // crop window out of image and warp it
@@ -624,8 +718,9 @@ bool PairWindowDataLayer<Dtype>::prepare_window(cv::Mat &warpimg, int &pad_w, in
       }
 
       cv::Rect roi(x1, y1, x2-x1+1, y2-y1+1);
-      cv::Mat cv_cropped_img = cv_img(roi);
-      cv::resize(cv_cropped_img, cv_cropped_img,
+      // resize into a new image, cv_img may be in the cache
+      cv::Mat cv_cropped_img;
+      cv::resize(cv_img(roi), cv_cropped_img,
           cv_crop_size, 0, 0, cv::INTER_LINEAR);
      
       // horizontal flip at random
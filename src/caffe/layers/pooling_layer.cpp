@@ -4,6 +4,7 @@
 
 #include "caffe/layers/pooling_layer.hpp"
 #include "caffe/util/math_functions.hpp"
+#include "caffe/util/thread_pool.hpp"
 
 namespace caffe {
 
@@ -121,102 +122,261 @@ void PoolingLayer<Dtype>::Reshape(const vector<Blob<Dtype>*>& bottom,
       pooled_width_);
   }
 }
+// Keeps the first largest value of a window and its index in the plane
+template <typename Dtype>
+inline void take_max(Dtype value, int index, Dtype* best, int* best_index) {
+  if (value > *best) {
+    *best = value;
+    *best_index = index;
+  }
+}
 
-// TODO(Yangqing): Is there a faster way to do pooling in the channel-first
-// case?
+// Max pooling of the windows [0, count) of a row of outputs, whose kernel_h x
+// kernel_w windows with stride 2 start at column 0 of row `row` of the plane
+// and lie inside it. The cases are unrolled so that the columns of the window
+// are straight-line code.
 template <typename Dtype>
-void PoolingLayer<Dtype>::Forward_cpu(const vector<Blob<Dtype>*>& bottom,
-      const vector<Blob<Dtype>*>& top) {
-  const Dtype* bottom_data = bottom[0]->cpu_data();
-  Dtype* top_data = top[0]->mutable_cpu_data();
-  const int top_count = top[0]->count();
-  // We'll output the mask to top[1] if it's of size >1.
-  const bool use_top_mask = top.size() > 1;
-  int* mask = NULL;  // suppress warnings about uninitalized variables
-  Dtype* top_mask = NULL;
-  // Different pooling methods. We explicitly do the switch outside the for
-  // loop to save time, although this results in more code.
-  switch (this->layer_param_.pooling_param().pool()) {
-  case PoolingParameter_PoolMethod_MAX:
-    // Initialize
-    if (use_top_mask) {
-      top_mask = top[1]->mutable_cpu_data();
-      caffe_set(top_count, Dtype(-1), top_mask);
+static void max_pool_row_s2(const Dtype* data, int width, int row,
+    int kernel, int count, Dtype* top, int* mask, Dtype* top_mask) {
+  const int offset = row * width;
+  const Dtype* r0 = data + offset;
+  const Dtype* r1 = r0 + width;
+  const Dtype* r2 = r1 + width;
+  for (int pw = 0; pw < count; ++pw) {
+    const int w = 2 * pw;
+    Dtype best = -FLT_MAX;
+    int index = -1;
+    take_max(r0[w], offset + w, &best, &index);
+    take_max(r0[w + 1], offset + w + 1, &best, &index);
+    if (kernel == 3) {
+      take_max(r0[w + 2], offset + w + 2, &best, &index);
+    }
+    take_max(r1[w], offset + width + w, &best, &index);
+    take_max(r1[w + 1], offset + width + w + 1, &best, &index);
+    if (kernel == 3) {
+      take_max(r1[w + 2], offset + width + w + 2, &best, &index);
+      take_max(r2[w], offset + 2 * width + w, &best, &index);
+      take_max(r2[w + 1], offset + 2 * width + w + 1, &best, &index);
+      take_max(r2[w + 2], offset + 2 * width + w + 2, &best, &index);
+    }
+    top[pw] = best;
+    if (mask) {
+      mask[pw] = index;
     } else {
-      mask = max_idx_.mutable_cpu_data();
-      caffe_set(top_count, -1, mask);
+      top_mask[pw] = static_cast<Dtype>(index);
+    }
+  }
+}
+
+// Average pooling counterpart of max_pool_row_s2, summing in the same order
+// as the general loop.
+template <typename Dtype>
+static void ave_pool_row_s2(const Dtype* data, int width, int row,
+    int kernel, int count, Dtype* top) {
+  const Dtype* r0 = data + row * width;
+  const Dtype* r1 = r0 + width;
+  const Dtype* r2 = r1 + width;
+  if (kernel == 2) {
+    for (int pw = 0; pw < count; ++pw) {
+      const int w = 2 * pw;
+      top[pw] = (r0[w] + r0[w + 1] + r1[w] + r1[w + 1]) / Dtype(4);
+    }
+  } else {
+    for (int pw = 0; pw < count; ++pw) {
+      const int w = 2 * pw;
+      top[pw] = (r0[w] + r0[w + 1] + r0[w + 2] + r1[w] + r1[w + 1]
+          + r1[w + 2] + r2[w] + r2[w + 1] + r2[w + 2]) / Dtype(9);
+    }
+  }
+}
+
+template <typename Dtype>
+void PoolingLayer<Dtype>::forward_cpu_plane(const Dtype* bottom_data,
+      Dtype* top_data, int* mask, Dtype* top_mask) {
+  const PoolingParameter_PoolMethod pool =
+      this->layer_param_.pooling_param().pool();
+  // The 2x2 and 3x3 windows with stride 2 and no padding of the rows and
+  // columns [0, full_h) x [0, full_w) of the output lie inside the plane,
+  // and are pooled without bounds checks.
+  int full_h = 0;
+  int full_w = 0;
+  if (kernel_h_ == kernel_w_ && (kernel_h_ == 2 || kernel_h_ == 3)
+      && stride_h_ == 2 && stride_w_ == 2 && pad_h_ == 0 && pad_w_ == 0
+      && height_ >= kernel_h_ && width_ >= kernel_w_) {
+    full_h = (height_ - kernel_h_) / 2 + 1;
+    full_w = (width_ - kernel_w_) / 2 + 1;
+  }
+  for (int ph = 0; ph < pooled_height_; ++ph) {
+    const int pool_row = ph * pooled_width_;
+    int pw = 0;
+    if (ph < full_h) {
+      if (pool == PoolingParameter_PoolMethod_MAX) {
+        max_pool_row_s2(bottom_data, width_, ph * 2, kernel_h_, full_w,
+            top_data + pool_row, mask ? mask + pool_row : NULL,
+            mask ? NULL : top_mask + pool_row);
+      } else {
+        ave_pool_row_s2(bottom_data, width_, ph * 2, kernel_h_, full_w,
+            top_data + pool_row);
+      }
+      pw = full_w;
     }
-    caffe_set(top_count, Dtype(-FLT_MAX), top_data);
-    // The main loop
-    for (int n = 0; n < bottom[0]->num(); ++n) {
-      for (int c = 0; c < channels_; ++c) {
-        for (int ph = 0; ph < pooled_height_; ++ph) {
-          for (int pw = 0; pw < pooled_width_; ++pw) {
-            int hstart = ph * stride_h_ - pad_h_;
-            int wstart = pw * stride_w_ - pad_w_;
-            int hend = min(hstart + kernel_h_, height_);
-            int wend = min(wstart + kernel_w_, width_);
-            hstart = max(hstart, 0);
-            wstart = max(wstart, 0);
-            const int pool_index = ph * pooled_width_ + pw;
-            for (int h = hstart; h < hend; ++h) {
-              for (int w = wstart; w < wend; ++w) {
-                const int index = h * width_ + w;
-                if (bottom_data[index] > top_data[pool_index]) {
-                  top_data[pool_index] = bottom_data[index];
-                  if (use_top_mask) {
-                    top_mask[pool_index] = static_cast<Dtype>(index);
-                  } else {
-                    mask[pool_index] = index;
-                  }
-                }
-              }
-            }
+    for (; pw < pooled_width_; ++pw) {
+      int hstart = ph * stride_h_ - pad_h_;
+      int wstart = pw * stride_w_ - pad_w_;
+      const int pool_index = pool_row + pw;
+      if (pool == PoolingParameter_PoolMethod_MAX) {
+        const int hend = min(hstart + kernel_h_, height_);
+        const int wend = min(wstart + kernel_w_, width_);
+        hstart = max(hstart, 0);
+        wstart = max(wstart, 0);
+        Dtype best = -FLT_MAX;
+        int index = -1;
+        for (int h = hstart; h < hend; ++h) {
+          for (int w = wstart; w < wend; ++w) {
+            take_max(bottom_data[h * width_ + w], h * width_ + w, &best,
+                &index);
           }
         }
-        // compute offset
-        bottom_data += bottom[0]->offset(0, 1);
-        top_data += top[0]->offset(0, 1);
-        if (use_top_mask) {
-          top_mask += top[0]->offset(0, 1);
+        top_data[pool_index] = best;
+        if (mask) {
+          mask[pool_index] = index;
         } else {
-          mask += top[0]->offset(0, 1);
+          top_mask[pool_index] = static_cast<Dtype>(index);
         }
+      } else {
+        int hend = min(hstart + kernel_h_, height_ + pad_h_);
+        int wend = min(wstart + kernel_w_, width_ + pad_w_);
+        const int pool_size = (hend - hstart) * (wend - wstart);
+        hstart = max(hstart, 0);
+        wstart = max(wstart, 0);
+        hend = min(hend, height_);
+        wend = min(wend, width_);
+        Dtype sum = 0;
+        for (int h = hstart; h < hend; ++h) {
+          for (int w = wstart; w < wend; ++w) {
+            sum += bottom_data[h * width_ + w];
+          }
+        }
+        top_data[pool_index] = sum / pool_size;
       }
     }
-    break;
-  case PoolingParameter_PoolMethod_AVE:
-    for (int i = 0; i < top_count; ++i) {
-      top_data[i] = 0;
+  }
+}
+
+template <typename Dtype>
+void PoolingLayer<Dtype>::backward_cpu_plane(const Dtype* top_diff,
+      const int* mask, const Dtype* top_mask, Dtype* bottom_diff) {
+  caffe_set(height_ * width_, Dtype(0), bottom_diff);
+  const int pooled_count = pooled_height_ * pooled_width_;
+  if (this->layer_param_.pooling_param().pool() ==
+      PoolingParameter_PoolMethod_MAX) {
+    // Each output sends its gradient to the input it took
+    if (mask) {
+      for (int i = 0; i < pooled_count; ++i) {
+        bottom_diff[mask[i]] += top_diff[i];
+      }
+    } else {
+      for (int i = 0; i < pooled_count; ++i) {
+        bottom_diff[static_cast<int>(top_mask[i])] += top_diff[i];
+      }
     }
-    // The main loop
-    for (int n = 0; n < bottom[0]->num(); ++n) {
-      for (int c = 0; c < channels_; ++c) {
-        for (int ph = 0; ph < pooled_height_; ++ph) {
-          for (int pw = 0; pw < pooled_width_; ++pw) {
-            int hstart = ph * stride_h_ - pad_h_;
-            int wstart = pw * stride_w_ - pad_w_;
-            int hend = min(hstart + kernel_h_, height_ + pad_h_);
-            int wend = min(wstart + kernel_w_, width_ + pad_w_);
-            int pool_size = (hend - hstart) * (wend - wstart);
-            hstart = max(hstart, 0);
-            wstart = max(wstart, 0);
-            hend = min(hend, height_);
-            wend = min(wend, width_);
-            for (int h = hstart; h < hend; ++h) {
-              for (int w = wstart; w < wend; ++w) {
-                top_data[ph * pooled_width_ + pw] +=
-                    bottom_data[h * width_ + w];
-              }
-            }
-            top_data[ph * pooled_width_ + pw] /= pool_size;
-          }
+    return;
+  }
+  for (int ph = 0; ph < pooled_height_; ++ph) {
+    for (int pw = 0; pw < pooled_width_; ++pw) {
+      int hstart = ph * stride_h_ - pad_h_;
+      int wstart = pw * stride_w_ - pad_w_;
+      int hend = min(hstart + kernel_h_, height_ + pad_h_);
+      int wend = min(wstart + kernel_w_, width_ + pad_w_);
+      const int pool_size = (hend - hstart) * (wend - wstart);
+      hstart = max(hstart, 0);
+      wstart = max(wstart, 0);
+      hend = min(hend, height_);
+      wend = min(wend, width_);
+      const Dtype diff = top_diff[ph * pooled_width_ + pw] / pool_size;
+      for (int h = hstart; h < hend; ++h) {
+        for (int w = wstart; w < wend; ++w) {
+          bottom_diff[h * width_ + w] += diff;
         }
-        // compute offset
-        bottom_data += bottom[0]->offset(0, 1);
-        top_data += top[0]->offset(0, 1);
       }
     }
+  }
+}
+
+// Pools the channels [begin, end) of all images, each of them a plane of the
+// bottom and top blobs
+template <typename Dtype>
+class PoolingLayer<Dtype>::ForwardPlanes : public ThreadPool::Task {
+ public:
+  ForwardPlanes(PoolingLayer<Dtype>* layer, const Dtype* bottom_data,
+      Dtype* top_data, int* mask, Dtype* top_mask)
+      : layer_(layer), bottom_data_(bottom_data), top_data_(top_data),
+        mask_(mask), top_mask_(top_mask) {}
+  virtual void Run(int thread, int begin, int end) {
+    const int bottom_plane = layer_->height_ * layer_->width_;
+    const int top_plane = layer_->pooled_height_ * layer_->pooled_width_;
+    for (int plane = begin; plane < end; ++plane) {
+      layer_->forward_cpu_plane(bottom_data_ + plane * bottom_plane,
+          top_data_ + plane * top_plane,
+          mask_ ? mask_ + plane * top_plane : NULL,
+          top_mask_ ? top_mask_ + plane * top_plane : NULL);
+    }
+  }
+
+ protected:
+  PoolingLayer<Dtype>* layer_;
+  const Dtype* bottom_data_;
+  Dtype* top_data_;
+  int* mask_;
+  Dtype* top_mask_;
+};
+
+// Computes the gradient of the planes [begin, end), which only receive the
+// gradient of their own outputs
+template <typename Dtype>
+class PoolingLayer<Dtype>::BackwardPlanes : public ThreadPool::Task {
+ public:
+  BackwardPlanes(PoolingLayer<Dtype>* layer, const Dtype* top_diff,
+      const int* mask, const Dtype* top_mask, Dtype* bottom_diff)
+      : layer_(layer), top_diff_(top_diff), mask_(mask), top_mask_(top_mask),
+        bottom_diff_(bottom_diff) {}
+  virtual void Run(int thread, int begin, int end) {
+    const int bottom_plane = layer_->height_ * layer_->width_;
+    const int top_plane = layer_->pooled_height_ * layer_->pooled_width_;
+    for (int plane = begin; plane < end; ++plane) {
+      layer_->backward_cpu_plane(top_diff_ + plane * top_plane,
+          mask_ ? mask_ + plane * top_plane : NULL,
+          top_mask_ ? top_mask_ + plane * top_plane : NULL,
+          bottom_diff_ + plane * bottom_plane);
+    }
+  }
+
+ protected:
+  PoolingLayer<Dtype>* layer_;
+  const Dtype* top_diff_;
+  const int* mask_;
+  const Dtype* top_mask_;
+  Dtype* bottom_diff_;
+};
+
+// Number of inputs below which the planes are pooled on the calling thread
+const int kPoolingMinParallelCount = 1 << 16;
+
+template <typename Dtype>
+void PoolingLayer<Dtype>::Forward_cpu(const vector<Blob<Dtype>*>& bottom,
+      const vector<Blob<Dtype>*>& top) {
+  // We'll output the mask to top[1] if it's of size >1.
+  int* mask = NULL;
+  Dtype* top_mask = NULL;
+  switch (this->layer_param_.pooling_param().pool()) {
+  case PoolingParameter_PoolMethod_MAX:
+    if (top.size() > 1) {
+      top_mask = top[1]->mutable_cpu_data();
+    } else {
+      mask = max_idx_.mutable_cpu_data();
+    }
+    break;
+  case PoolingParameter_PoolMethod_AVE:
     break;
   case PoolingParameter_PoolMethod_STOCHASTIC:
     NOT_IMPLEMENTED;
@@ -224,6 +384,15 @@ void PoolingLayer<Dtype>::Forward_cpu(const vector<Blob<Dtype>*>& bottom,
   default:
     LOG(FATAL) << "Unknown pooling method.";
   }
+  ForwardPlanes task(this, bottom[0]->cpu_data(), top[0]->mutable_cpu_data(),
+      mask, top_mask);
+  const int planes = bottom[0]->num() * channels_;
+  if (Caffe::cpu_threads() == 1 ||
+      bottom[0]->count() < kPoolingMinParallelCount) {
+    task.Run(0, 0, planes);
+  } else {
+    Caffe::cpu_pool().Run(&task, planes);
+  }
 }
 
 template <typename Dtype>
@@ -232,71 +401,17 @@ void PoolingLayer<Dtype>::Backward_cpu(const vector<Blob<Dtype>*>& top,
   if (!propagate_down[0]) {
     return;
   }
-  const Dtype* top_diff = top[0]->cpu_diff();
-  Dtype* bottom_diff = bottom[0]->mutable_cpu_diff();
-  // Different pooling methods. We explicitly do the switch outside the for
-  // loop to save time, although this results in more codes.
-  caffe_set(bottom[0]->count(), Dtype(0), bottom_diff);
-  // We'll output the mask to top[1] if it's of size >1.
-  const bool use_top_mask = top.size() > 1;
-  const int* mask = NULL;  // suppress warnings about uninitialized variables
+  const int* mask = NULL;
   const Dtype* top_mask = NULL;
   switch (this->layer_param_.pooling_param().pool()) {
   case PoolingParameter_PoolMethod_MAX:
-    // The main loop
-    if (use_top_mask) {
+    if (top.size() > 1) {
       top_mask = top[1]->cpu_data();
     } else {
       mask = max_idx_.cpu_data();
     }
-    for (int n = 0; n < top[0]->num(); ++n) {
-      for (int c = 0; c < channels_; ++c) {
-        for (int ph = 0; ph < pooled_height_; ++ph) {
-          for (int pw = 0; pw < pooled_width_; ++pw) {
-            const int index = ph * pooled_width_ + pw;
-            const int bottom_index =
-                use_top_mask ? top_mask[index] : mask[index];
-            bottom_diff[bottom_index] += top_diff[index];
-          }
-        }
-        bottom_diff += bottom[0]->offset(0, 1);
-        top_diff += top[0]->offset(0, 1);
-        if (use_top_mask) {
-          top_mask += top[0]->offset(0, 1);
-        } else {
-          mask += top[0]->offset(0, 1);
-        }
-      }
-    }
     break;
   case PoolingParameter_PoolMethod_AVE:
-    // The main loop
-    for (int n = 0; n < top[0]->num(); ++n) {
-      for (int c = 0; c < channels_; ++c) {
-        for (int ph = 0; ph < pooled_height_; ++ph) {
-          for (int pw = 0; pw < pooled_width_; ++pw) {
-            int hstart = ph * stride_h_ - pad_h_;
-            int wstart = pw * stride_w_ - pad_w_;
-            int hend = min(hstart + kernel_h_, height_ + pad_h_);
-            int wend = min(wstart + kernel_w_, width_ + pad_w_);
-            int pool_size = (hend - hstart) * (wend - wstart);
-            hstart = max(hstart, 0);
-            wstart = max(wstart, 0);
-            hend = min(hend, height_);
-            wend = min(wend, width_);
-            for (int h = hstart; h < hend; ++h) {
-              for (int w = wstart; w < wend; ++w) {
-                bottom_diff[h * width_ + w] +=
-                  top_diff[ph * pooled_width_ + pw] / pool_size;
-              }
-            }
-          }
-        }
-        // offset
-        bottom_diff += bottom[0]->offset(0, 1);
-        top_diff += top[0]->offset(0, 1);
-      }
-    }
     break;
   case PoolingParameter_PoolMethod_STOCHASTIC:
     NOT_IMPLEMENTED;
@@ -304,6 +419,15 @@ void PoolingLayer<Dtype>::Backward_cpu(const vector<Blob<Dtype>*>& top,
   default:
     LOG(FATAL) << "Unknown pooling method.";
   }
+  BackwardPlanes task(this, top[0]->cpu_diff(), mask, top_mask,
+      bottom[0]->mutable_cpu_diff());
+  const int planes = bottom[0]->num() * channels_;
+  if (Caffe::cpu_threads() == 1 ||
+      bottom[0]->count() < kPoolingMinParallelCount) {
+    task.Run(0, 0, planes);
+  } else {
+    Caffe::cpu_pool().Run(&task, planes);
+  }
 }
 
 
@@ -19,6 +19,9 @@ void SplitLayer<Dtype>::Reshape(const vector<Blob<Dtype>*>& bottom,
         "allow in-place computation.";
     top[i]->ReshapeLike(*bottom[0]);
     CHECK_EQ(count_, top[i]->count());
+    // Shared here as well so that the Net sees the tops alias the bottom
+    // before Forward
+    top[i]->ShareData(*bottom[0]);
   }
 }
 
@@ -14,10 +14,24 @@ namespace caffe {
 //bottom 1 -> target
 //bottom 2 -> impostor
 
+//when mining:
+//bottom 0 -> embeddings
+//bottom 1 -> labels
+
 template <typename Dtype>
 void TripletClsLossLayer<Dtype>::LayerSetUp(
   const vector<Blob<Dtype>*>& bottom, const vector<Blob<Dtype>*>& top) {
   LossLayer<Dtype>::LayerSetUp(bottom, top);
+  margin_ = this->layer_param_.triplet_cls_loss_param().margin();
+  if (mining_ != TripletClsLossParameter_Mining_NONE) {
+    CHECK_EQ(bottom.size(), 2)
+        << "Mining takes the embeddings and their labels as bottoms.";
+    CHECK_EQ(bottom[1]->count(), bottom[1]->num())
+        << "Mining takes one label per embedding.";
+    return;
+  }
+  CHECK_EQ(bottom.size(), 3)
+      << "Without mining, the bottoms are samples, targets and impostors.";
   //check channel size must be the same for all branches
   CHECK_EQ(bottom[0]->channels(), bottom[1]->channels());
   CHECK_EQ(bottom[1]->channels(), bottom[2]->channels());
@@ -29,52 +43,72 @@ void TripletClsLossLayer<Dtype>::LayerSetUp(
   CHECK_EQ(bottom[1]->width(), 1);
   CHECK_EQ(bottom[2]->height(), 1);
   CHECK_EQ(bottom[2]->width(), 1);
+}
 
-  //caches for backward pass
-  diff_impostor_target.Reshape(bottom[0]->num(), bottom[0]->channels(), 1, 1);
-  diff_sample_target.Reshape(bottom[0]->num(), bottom[0]->channels(), 1, 1);
-  diff_sample_impostor.Reshape(bottom[0]->num(), bottom[0]->channels(), 1, 1);  
-  const_.Reshape(bottom[0]->num(), 1, 1, 1);
+template <typename Dtype>
+void TripletClsLossLayer<Dtype>::Reshape(
+  const vector<Blob<Dtype>*>& bottom, const vector<Blob<Dtype>*>& top) {
+  LossLayer<Dtype>::Reshape(bottom, top);
+  if (mining_ != TripletClsLossParameter_Mining_NONE) {
+    distances_.Reshape(bottom[0]->num(), bottom[0]->num(), 1, 1);
+  } else {
+    //cache for backward pass
+    const_.Reshape(bottom[0]->num(), 1, 1, 1);
+  }
 }
 
+// Distances and gradients are computed in one pass over the channels of each
+// triplet, instead of from full num x channels difference blobs.
 template <typename Dtype>
 void TripletClsLossLayer<Dtype>::Forward_cpu(const vector<Blob<Dtype>*>& bottom,
       const vector<Blob<Dtype>*>& top) {
+  if (mining_ != TripletClsLossParameter_Mining_NONE) {
+    Forward_mining(bottom, top);
+    return;
+  }
   
   //read image, target and impostor
   const Dtype* sample_data = bottom[0]->cpu_data();
   const Dtype* target_sample_data = bottom[1]->cpu_data();
   const Dtype* impostor_sample_data = bottom[2]->cpu_data();
+  Dtype* violations = const_.mutable_cpu_data();
     
   //compute sizes  
   int num = bottom[0]->num();
-  int count = bottom[0]->count();
   int channels = bottom[0]->channels();
 
-  //computing differences
-  caffe_sub(count, impostor_sample_data, target_sample_data, diff_impostor_target.mutable_cpu_data());
-  caffe_sub(count, target_sample_data, sample_data, diff_sample_target.mutable_cpu_data());
-  caffe_sub(count, impostor_sample_data, sample_data, diff_sample_impostor.mutable_cpu_data());
-
   Dtype loss_hinge = 0;
-  Dtype sample_target_distance;
-  Dtype sample_impostor_distance;
-
   for (int i = 0; i < num; ++i) {
+    const Dtype* sample = sample_data + i * channels;
+    const Dtype* target = target_sample_data + i * channels;
+    const Dtype* impostor = impostor_sample_data + i * channels;
+    // Four partial sums per distance keep the additions independent
+    Dtype target_sums[4] = {0, 0, 0, 0};
+    Dtype impostor_sums[4] = {0, 0, 0, 0};
+    int j = 0;
+    for (; j + 4 <= channels; j += 4) {
+      for (int k = 0; k < 4; ++k) {
+        const Dtype diff_target = target[j + k] - sample[j + k];
+        const Dtype diff_impostor = impostor[j + k] - sample[j + k];
+        target_sums[k] += diff_target * diff_target;
+        impostor_sums[k] += diff_impostor * diff_impostor;
+      }
+    }
+    for (; j < channels; ++j) {
+      const Dtype diff_target = target[j] - sample[j];
+      const Dtype diff_impostor = impostor[j] - sample[j];
+      target_sums[0] += diff_target * diff_target;
+      impostor_sums[0] += diff_impostor * diff_impostor;
+    }
+    Dtype sample_target_distance = (target_sums[0] + target_sums[1])
+        + (target_sums[2] + target_sums[3]);
+    Dtype sample_impostor_distance = (impostor_sums[0] + impostor_sums[1])
+        + (impostor_sums[2] + impostor_sums[3]);
 
-      sample_target_distance = caffe_cpu_dot(
-          channels, diff_sample_target.cpu_data() + bottom[0]->offset(i),
-          diff_sample_target.cpu_data() + bottom[0]->offset(i));
+    Dtype violation = std::max(Dtype(0.0), sample_target_distance -
+                sample_impostor_distance + margin_);
 
-      sample_impostor_distance = caffe_cpu_dot(
-          channels, diff_sample_impostor.cpu_data() + bottom[0]->offset(i),
-          diff_sample_impostor.cpu_data() + bottom[0]->offset(i));
-
-      Dtype violation = std::max(Dtype(0.0), sample_target_distance -
-                  sample_impostor_distance + 1);
-
-      loss_hinge += violation; const_.mutable_cpu_data()[i] = violation;	      
-      
+    loss_hinge += violation; violations[i] = violation;
   }
 
   Dtype loss = 0.0;  
@@ -86,42 +120,172 @@ void TripletClsLossLayer<Dtype>::Forward_cpu(const vector<Blob<Dtype>*>& bottom,
 template <typename Dtype>
 void TripletClsLossLayer<Dtype>::Backward_cpu(const vector<Blob<Dtype>*>& top,
       const vector<bool>& propagate_down, const vector<Blob<Dtype>*>& bottom){
+  if (mining_ != TripletClsLossParameter_Mining_NONE) {
+    Backward_mining(top, propagate_down, bottom);
+    return;
+  }
          
+  if (!propagate_down[0]) {
+    return;
+  }
   int num = bottom[0]->num();  
   int channels = bottom[0]->channels();
+  const Dtype scale = Dtype(2.) / num;
+  const Dtype* violations = const_.cpu_data();
 
   for (int n = 0; n < num; ++n) {
-    if (propagate_down[0]) {                                           
-	    if(const_.cpu_data()[n] > Dtype(0.0)){
-		
-               //derivative in relation to image                
-                 caffe_cpu_axpby(channels, Dtype( 2./num), diff_impostor_target.cpu_data() + bottom[0]->offset(n), Dtype(0.0),
-                                bottom[0]->mutable_cpu_diff() + bottom[0]->offset(n));
-
-		//derivative in relation to target                
-                caffe_cpu_axpby(channels, Dtype( 2./num), diff_sample_target.cpu_data() + bottom[1]->offset(n), Dtype(0.0),
-                                bottom[1]->mutable_cpu_diff() + bottom[1]->offset(n));                 
-
-		//derivative in relation to impostor
-                caffe_cpu_axpby(channels, Dtype( -2./num), diff_sample_impostor.cpu_data() + bottom[2]->offset(n), Dtype(0.0),
-                                bottom[2]->mutable_cpu_diff() + bottom[2]->offset(n));     
-
-		           
-            }else{
-
-		caffe_set(channels, Dtype(0.0), bottom[0]->mutable_cpu_diff() + bottom[0]->offset(n));
-                caffe_set(channels, Dtype(0.0), bottom[1]->mutable_cpu_diff() + bottom[1]->offset(n));
-                caffe_set(channels, Dtype(0.0), bottom[2]->mutable_cpu_diff() + bottom[2]->offset(n));
-
-	    }
-    }           
- }
+    const int offset = n * channels;
+    Dtype* sample_diff = bottom[0]->mutable_cpu_diff() + offset;
+    Dtype* target_diff = bottom[1]->mutable_cpu_diff() + offset;
+    Dtype* impostor_diff = bottom[2]->mutable_cpu_diff() + offset;
+    if (violations[n] > Dtype(0.0)) {
+      const Dtype* sample = bottom[0]->cpu_data() + offset;
+      const Dtype* target = bottom[1]->cpu_data() + offset;
+      const Dtype* impostor = bottom[2]->cpu_data() + offset;
+      for (int j = 0; j < channels; ++j) {
+        //derivatives in relation to image, target and impostor
+        sample_diff[j] = scale * (impostor[j] - target[j]);
+        target_diff[j] = scale * (target[j] - sample[j]);
+        impostor_diff[j] = scale * (sample[j] - impostor[j]);
+      }
+    } else {
+      caffe_set(channels, Dtype(0.0), sample_diff);
+      caffe_set(channels, Dtype(0.0), target_diff);
+      caffe_set(channels, Dtype(0.0), impostor_diff);
+    }
+  }
 }
 
+template <typename Dtype>
+Dtype TripletClsLossLayer<Dtype>::add_triplet(int anchor, int positive,
+    int negative) {
+  const int num = distances_.num();
+  const Dtype* distances = distances_.cpu_data() + anchor * num;
+  ++num_triplets_;
+  const Dtype violation = distances[positive] - distances[negative] + margin_;
+  if (violation <= 0) {
+    return 0;
+  }
+  triplets_.push_back(anchor);
+  triplets_.push_back(positive);
+  triplets_.push_back(negative);
+  return violation;
+}
 
-#ifdef CPU_ONLY
-STUB_GPU(TripletClsLossLayer);
-#endif
+// The squared distances ||a||^2 + ||b||^2 - 2 a.b between all the embeddings
+// of the batch come from one matrix product. The triplets are then picked
+// from the rows of the distance matrix.
+template <typename Dtype>
+void TripletClsLossLayer<Dtype>::Forward_mining(
+    const vector<Blob<Dtype>*>& bottom, const vector<Blob<Dtype>*>& top) {
+  const int num = bottom[0]->num();
+  const int channels = bottom[0]->count() / num;
+  const Dtype* labels = bottom[1]->cpu_data();
+  Dtype* distances = distances_.mutable_cpu_data();
+  caffe_cpu_gemm<Dtype>(CblasNoTrans, CblasTrans, num, num, channels,
+      Dtype(1), bottom[0]->cpu_data(), bottom[0]->cpu_data(), Dtype(0),
+      distances);
+  for (int i = 0; i < num; ++i) {
+    for (int j = i + 1; j < num; ++j) {
+      const Dtype distance = std::max(Dtype(0), distances[i * num + i]
+          + distances[j * num + j] - 2 * distances[i * num + j]);
+      distances[i * num + j] = distance;
+      distances[j * num + i] = distance;
+    }
+  }
+  for (int i = 0; i < num; ++i) {
+    distances[i * num + i] = 0;
+  }
+
+  triplets_.clear();
+  num_triplets_ = 0;
+  Dtype loss_hinge = 0;
+  for (int a = 0; a < num; ++a) {
+    const Dtype* anchor_distances = distances + a * num;
+    // Hardest positive and hardest negative of the anchor
+    int positive = -1;
+    int negative = -1;
+    for (int j = 0; j < num; ++j) {
+      if (j == a) {
+        continue;
+      }
+      if (labels[j] == labels[a]) {
+        if (positive < 0 ||
+            anchor_distances[j] > anchor_distances[positive]) {
+          positive = j;
+        }
+      } else if (negative < 0 ||
+          anchor_distances[j] < anchor_distances[negative]) {
+        negative = j;
+      }
+    }
+    if (positive < 0 || negative < 0) {
+      continue;
+    }
+    if (mining_ == TripletClsLossParameter_Mining_BATCH_HARD) {
+      loss_hinge += add_triplet(a, positive, negative);
+      continue;
+    }
+    for (int p = 0; p < num; ++p) {
+      if (p == a || labels[p] != labels[a]) {
+        continue;
+      }
+      // Closest negative farther than the positive, else the farthest one
+      int semi_hard = -1;
+      int easiest = -1;
+      for (int n = 0; n < num; ++n) {
+        if (labels[n] == labels[a]) {
+          continue;
+        }
+        if (anchor_distances[n] > anchor_distances[p] && (semi_hard < 0 ||
+            anchor_distances[n] < anchor_distances[semi_hard])) {
+          semi_hard = n;
+        }
+        if (easiest < 0 || anchor_distances[n] > anchor_distances[easiest]) {
+          easiest = n;
+        }
+      }
+      loss_hinge += add_triplet(a, p, semi_hard >= 0 ? semi_hard : easiest);
+    }
+  }
+  top[0]->mutable_cpu_data()[0] = num_triplets_ > 0 ?
+      loss_hinge / static_cast<Dtype>(2.0 * num_triplets_) : Dtype(0);
+}
+
+template <typename Dtype>
+void TripletClsLossLayer<Dtype>::Backward_mining(
+    const vector<Blob<Dtype>*>& top, const vector<bool>& propagate_down,
+    const vector<Blob<Dtype>*>& bottom) {
+  if (propagate_down[1]) {
+    LOG(FATAL) << this->type()
+               << " Layer cannot backpropagate to label inputs.";
+  }
+  if (!propagate_down[0]) {
+    return;
+  }
+  const int channels = bottom[0]->count() / bottom[0]->num();
+  const Dtype* data = bottom[0]->cpu_data();
+  Dtype* diff = bottom[0]->mutable_cpu_diff();
+  caffe_set(bottom[0]->count(), Dtype(0), diff);
+  if (num_triplets_ == 0) {
+    return;
+  }
+  // d/da = 2 (n - p), d/dp = 2 (p - a), d/dn = 2 (a - n)
+  const Dtype scale = top[0]->cpu_diff()[0] / num_triplets_;
+  for (int t = 0; t < triplets_.size(); t += 3) {
+    const Dtype* anchor = data + triplets_[t] * channels;
+    const Dtype* positive = data + triplets_[t + 1] * channels;
+    const Dtype* negative = data + triplets_[t + 2] * channels;
+    Dtype* anchor_diff = diff + triplets_[t] * channels;
+    Dtype* positive_diff = diff + triplets_[t + 1] * channels;
+    Dtype* negative_diff = diff + triplets_[t + 2] * channels;
+    for (int j = 0; j < channels; ++j) {
+      anchor_diff[j] += scale * (negative[j] - positive[j]);
+      positive_diff[j] += scale * (positive[j] - anchor[j]);
+      negative_diff[j] += scale * (anchor[j] - negative[j]);
+    }
+  }
+}
 
 INSTANTIATE_CLASS(TripletClsLossLayer);
 REGISTER_LAYER_CLASS(TripletClsLoss);
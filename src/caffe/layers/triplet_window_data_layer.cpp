@@ -20,9 +20,12 @@
 #include "caffe/layers/triplet_window_data_layer.hpp"
 #include "caffe/layer.hpp"
 #include "caffe/util/benchmark.hpp"
+#include "caffe/util/image_cache.hpp"
 #include "caffe/util/io.hpp"
 #include "caffe/util/math_functions.hpp"
 #include "caffe/util/rng.hpp"
+#include "caffe/util/thread_pool.hpp"
+#include "caffe/util/window_file.hpp"
 
 // caffe.proto > LayerParameter > TripletWindowDataParameter
 //   'source' field specifies the window_file
@@ -35,6 +38,88 @@ TripletWindowDataLayer<Dtype>::~TripletWindowDataLayer<Dtype>() {
   this->StopInternalThread();
 }
 
+// Orders the windows of the last image read by box index, keeping the first
+// one read of duplicated boxes, and appends them to the index.
+template <typename Dtype>
+void TripletWindowDataLayer<Dtype>::add_image_windows(
+    const vector<Window>& windows) {
+  const int num_windows = windows.size();
+  vector<std::pair<int, int> > order(num_windows);
+  for (int i = 0; i < num_windows; ++i) {
+    order[i] = std::make_pair(windows[i].bb_index, i);
+  }
+  std::sort(order.begin(), order.end());
+  for (int i = 0; i < num_windows; ++i) {
+    if (i > 0 && order[i].first == order[i - 1].first) {
+      continue;
+    }
+    windows_.push_back(windows[order[i].second]);
+  }
+  image_windows_.push_back(windows_.size());
+}
+
+template <typename Dtype>
+int TripletWindowDataLayer<Dtype>::find_window(int image_index,
+    int bb_index) const {
+  if (image_index < 0 || image_index + 1 >= int(image_windows_.size())) {
+    return -1;
+  }
+  int begin = image_windows_[image_index];
+  int end = image_windows_[image_index + 1];
+  while (begin < end) {
+    const int middle = begin + (end - begin) / 2;
+    if (window(middle).bb_index < bb_index) {
+      begin = middle + 1;
+    } else {
+      end = middle;
+    }
+  }
+  if (begin < image_windows_[image_index + 1] &&
+      window(begin).bb_index == bb_index) {
+    return begin;
+  }
+  return -1;
+}
+
+// Groups the triplets by the class of their sample, in increasing class
+// order, and shuffles each group.
+template <typename Dtype>
+void TripletWindowDataLayer<Dtype>::set_triplets(const vector<int>& triplets,
+    const vector<int>& triplet_cls) {
+  const int num_triplets = triplet_cls.size();
+  cls_keys_ = triplet_cls;
+  std::sort(cls_keys_.begin(), cls_keys_.end());
+  cls_keys_.erase(std::unique(cls_keys_.begin(), cls_keys_.end()),
+      cls_keys_.end());
+  const int num_cls = cls_keys_.size();
+  cls_triplets_.assign(num_cls + 1, 0);
+  vector<int> cls_of(num_triplets);
+  for (int t = 0; t < num_triplets; ++t) {
+    cls_of[t] = std::lower_bound(cls_keys_.begin(), cls_keys_.end(),
+        triplet_cls[t]) - cls_keys_.begin();
+    cls_triplets_[cls_of[t] + 1]++;
+  }
+  for (int c = 0; c < num_cls; ++c) {
+    cls_triplets_[c + 1] += cls_triplets_[c];
+  }
+  vector<int> order(num_triplets);
+  vector<int> next(cls_triplets_.begin(), cls_triplets_.end() - 1);
+  for (int t = 0; t < num_triplets; ++t) {
+    order[next[cls_of[t]]++] = t;
+  }
+  for (int c = 0; c < num_cls; ++c) {
+    std::random_shuffle(order.begin() + cls_triplets_[c],
+        order.begin() + cls_triplets_[c + 1]);
+  }
+  triplets_.resize(num_triplets * NUM_TRIPLET_FIELDS);
+  for (int t = 0; t < num_triplets; ++t) {
+    std::copy(&triplets[order[t] * NUM_TRIPLET_FIELDS],
+        &triplets[order[t] * NUM_TRIPLET_FIELDS] + NUM_TRIPLET_FIELDS,
+        &triplets_[t * NUM_TRIPLET_FIELDS]);
+  }
+  cls_idx_.assign(num_cls, 0);
+}
+
 template <typename Dtype>
 void TripletWindowDataLayer<Dtype>::DataLayerSetUp(const vector<Blob<Dtype>*>& bottom,
       const vector<Blob<Dtype>*>& top) {
@@ -52,6 +137,8 @@ void TripletWindowDataLayer<Dtype>::DataLayerSetUp(const vector<Blob<Dtype>*>& b
   //    width
   //    num_windows
   //    class_index overlap x1 y1 x2 y2
+  // followed by PAIRS sections, or its binary form written by
+  // tools/convert_window_file (see WindowFile)
 
   LOG(INFO) << "Triplet Window data layer:" << std::endl
       << "  foreground (object) overlap threshold: "
@@ -64,6 +151,11 @@ void TripletWindowDataLayer<Dtype>::DataLayerSetUp(const vector<Blob<Dtype>*>& b
       << this->layer_param_.triplet_window_data_param().root_folder();
 
   cache_images_ = this->layer_param_.triplet_window_data_param().cache_images();
+  const uint64_t image_cache_bytes =
+      this->layer_param_.triplet_window_data_param().image_cache_bytes();
+  if (image_cache_bytes > 0) {
+    image_cache_.reset(new ImageCache(image_cache_bytes));
+  }
   string root_folder = this->layer_param_.triplet_window_data_param().root_folder();
 
   const bool prefetch_needs_rand =
@@ -76,9 +168,9 @@ void TripletWindowDataLayer<Dtype>::DataLayerSetUp(const vector<Blob<Dtype>*>& b
     prefetch_rng_.reset();
   }
 
-  std::ifstream infile(this->layer_param_.triplet_window_data_param().source().c_str());
-  CHECK(infile.good()) << "Failed to open window file "
-      << this->layer_param_.triplet_window_data_param().source() << std::endl;
+  // Text window files are parsed, binary ones are memory mapped
+  WindowFile window_file;
+  window_file.Open(this->layer_param_.triplet_window_data_param().source());
 
   map<int, int> label_hist, sample_hist, tg_hist, imp_hist;
   label_hist.insert(std::make_pair(0, 0)); sample_hist.insert(std::make_pair(0, 0)); tg_hist.insert(std::make_pair(0, 0)); imp_hist.insert(std::make_pair(0, 0));
@@ -87,162 +179,146 @@ void TripletWindowDataLayer<Dtype>::DataLayerSetUp(const vector<Blob<Dtype>*>& b
   int count_same_img = 0;
   boost::accumulators::accumulator_set<float, boost::accumulators::features<boost::accumulators::tag::count, boost::accumulators::tag::mean, boost::accumulators::tag::variance > > pair_stat_acc;
 
-  string hashtag, type;
-  int index=0, image_index=0, channels=0, num_pairs=0;
-  if (!(infile >> hashtag >> type >> index)) {
-    LOG(FATAL) << "Window file is empty";
-  }
-  do {
-    CHECK_EQ(hashtag, "#");
-
-    if(boost::iequals(type, "FULL_IMAGES")){
-            image_index = index;
-	    // read image path
-	    string image_path;
-	    infile >> image_path;
-	    image_path = root_folder + image_path;
-	    // read image dimensions
-	    vector<int> image_size(3);
-	    infile >> image_size[0] >> image_size[1] >> image_size[2];
-	    channels = image_size[0];
-	    image_database_.push_back(std::make_pair(image_path, image_size));
-
-	    if (cache_images_) {
-	      Datum datum;
-	      if (!ReadFileToDatum(image_path, &datum)) {
-		LOG(ERROR) << "Could not open or find file " << image_path;
-		return;
-	      }
-	      image_database_cache_.push_back(std::make_pair(image_path, datum));
-	    }
-	    // read each box
-	    int num_windows;
-	    infile >> num_windows;
-	    const float fg_threshold =
-		this->layer_param_.triplet_window_data_param().fg_threshold();
-	    const float bg_threshold =
-		this->layer_param_.triplet_window_data_param().bg_threshold();
-	    for (int i = 0; i < num_windows; ++i) {
-	      int bb_index, label, x1, y1, x2, y2;
-	      float overlap;
-	      infile >> bb_index >> label >> overlap >> x1 >> y1 >> x2 >> y2;
-
-	      vector<float> window(TripletWindowDataLayer::NUM_WIN_FIELDS);
-	      window[TripletWindowDataLayer::IMAGE_INDEX] = image_index;
-	      window[TripletWindowDataLayer::BB_INDEX] = bb_index;
-	      window[TripletWindowDataLayer::LABEL] = label;
-	      window[TripletWindowDataLayer::OVERLAP] = overlap;
-	      window[TripletWindowDataLayer::X1] = x1;
-	      window[TripletWindowDataLayer::Y1] = y1;
-	      window[TripletWindowDataLayer::X2] = x2;
-	      window[TripletWindowDataLayer::Y2] = y2;
-
-	      // add window to foreground list or background list
-	      if (overlap >= fg_threshold) {
-		int label = window[TripletWindowDataLayer::LABEL];
-		CHECK_GT(label, 0);				
-		label_hist.insert(std::make_pair(label, 0));
-		label_hist[label]++;
-		
-		map<int,vector<float> > inner;
-                pair<map<int, map<int, vector<float> > >::iterator,bool> ret;
-		ret = windows_.insert(std::make_pair(image_index, inner));
-		ret.first->second.insert(std::make_pair(bb_index, window));
-		
-
-	      } else if (overlap < bg_threshold) {
-		// background window, force label and overlap to 0
-		window[TripletWindowDataLayer::LABEL] = 0;
-		window[TripletWindowDataLayer::OVERLAP] = 0;		
-		label_hist[0]++;
-
-		map<int,vector<float> > inner;
-                pair<map<int, map<int, vector<float> > >::iterator,bool> ret;
-		ret = windows_.insert(std::make_pair(image_index, inner));
-		ret.first->second.insert(std::make_pair(bb_index, window));
-
-	      }
-	    }
-
-	    if (image_index % 100 == 0) {
-	      LOG(INFO) << "num: " << image_index << " "
-		  << image_path << " "
-		  << image_size[0] << " "
-		  << image_size[1] << " "
-		  << image_size[2] << " "
-		  << "windows to process: " << num_windows;
-	    }
-    }else if(boost::iequals(type, "PAIRS")){
-    	
-         num_pairs = num_pairs + index;
-	 for (int i = 0; i < index; ++i) {
-	    int pair_index, image_index_1, bb_index_1, image_index_2, bb_index_2, image_index_3, bb_index_3;
-            infile >> pair_index >> image_index_1 >> bb_index_1 >> image_index_2 >> bb_index_2 >> image_index_3 >> bb_index_3;
-         
-            vector<int> pair(TripletWindowDataLayer::NUM_PAIR_FIELDS);
-	    pair[TripletWindowDataLayer::PAIR_INDEX] = pair_index;
-	    pair[TripletWindowDataLayer::IMAGE_INDEX_1] = image_index_1;
-            pair[TripletWindowDataLayer::BB_INDEX_1] = bb_index_1;
-            pair[TripletWindowDataLayer::IMAGE_INDEX_2] = image_index_2;
-            pair[TripletWindowDataLayer::BB_INDEX_2] = bb_index_2;
-	    pair[TripletWindowDataLayer::IMAGE_INDEX_3] = image_index_3;
-            pair[TripletWindowDataLayer::BB_INDEX_3] = bb_index_3;	    	    
-            int cls = windows_[image_index_1][bb_index_1][TripletWindowDataLayer::LABEL];
-
-            //cache triplets
-	    vector<vector<int> > inner;
-            std::pair<std::map<int, vector<vector<int> > >::iterator, bool> ret;
-	    ret = triplets_.insert(std::make_pair(cls, inner));
-	    ret.first->second.push_back(pair);
-
-	    //compute distribution of classes in the triplets
-            int sample_label, tg_label, imp_label;
-            sample_label = windows_[image_index_1][bb_index_1][TripletWindowDataLayer::LABEL];
-	    sample_hist.insert(std::make_pair(sample_label, 0));
-            sample_hist[sample_label]++;
-
-            tg_label = windows_[image_index_2][bb_index_2][TripletWindowDataLayer::LABEL];
-	    tg_hist.insert(std::make_pair(tg_label, 0));
-            tg_hist[tg_label]++;
-
-            imp_label = windows_[image_index_3][bb_index_3][TripletWindowDataLayer::LABEL];
-            imp_hist.insert(std::make_pair(imp_label, 0));
-            imp_hist[imp_label]++;
-	    
-	    //compute overlap between target and sample
-	    if(image_index_1 == image_index_2){
-               count_same_img++;
-
-               vector<float> window_a = windows_[image_index_1][bb_index_1];
-               vector<float> window_b = windows_[image_index_2][bb_index_2];
-               float XA1 = window_a[TripletWindowDataLayer<Dtype>::X1]; float YA1 = window_a[TripletWindowDataLayer<Dtype>::Y1]; 
-               float XA2 = window_a[TripletWindowDataLayer<Dtype>::X2]; float YA2 = window_a[TripletWindowDataLayer<Dtype>::Y2];
-
-               float XB1 = window_b[TripletWindowDataLayer<Dtype>::X1]; float YB1 = window_b[TripletWindowDataLayer<Dtype>::Y1]; 
-               float XB2 = window_b[TripletWindowDataLayer<Dtype>::X2]; float YB2 = window_b[TripletWindowDataLayer<Dtype>::Y2];
-
-               float sa = (XA2 - XA1) * (YA2 - YA1);
-               float sb = (XB2 - XB1) * (YB2 - YB1); 
-               float si = std::max(0.0f, std::min(XA2,XB2) - std::max(XA1,XB1)) * std::max(0.0f, std::min(YA2,YB2) - std::max(YA1,YB1));
-               if(si > 0.0f){
-                   pair_stat_acc(si/(sa+sb-si));
-               }
-            }
-	 }         	
+  int channels=0;
+  const int num_pairs = window_file.num_pairs();
+  // Triplets as read, and the class of their sample
+  vector<int> triplets;
+  vector<int> triplet_cls;
+  image_windows_.push_back(0);
+  for (int image_index = 0; image_index < window_file.num_images(); ++image_index) {
+    // read image path
+    string image_path = root_folder + window_file.image_path(image_index);
+    // read image dimensions
+    vector<int> image_size(window_file.image_size(image_index),
+        window_file.image_size(image_index) + 3);
+    channels = image_size[0];
+    image_database_.push_back(std::make_pair(image_path, image_size));
+
+    if (cache_images_) {
+      Datum datum;
+      if (!ReadFileToDatum(image_path, &datum)) {
+        LOG(ERROR) << "Could not open or find file " << image_path;
+        return;
+      }
+      image_database_cache_.push_back(std::make_pair(image_path, datum));
     }
-    
-  } while (infile >> hashtag >> type >> index);
+    // read each box
+    const int num_windows = window_file.num_windows(image_index);
+    const WindowFile::Window* file_windows = window_file.windows(image_index);
+    const float fg_threshold =
+        this->layer_param_.triplet_window_data_param().fg_threshold();
+    const float bg_threshold =
+        this->layer_param_.triplet_window_data_param().bg_threshold();
+    vector<Window> windows;
+    for (int i = 0; i < num_windows; ++i) {
+      const WindowFile::Window& file_window = file_windows[i];
+      const int label = file_window.label;
+      const float overlap = file_window.overlap;
+
+      Window window;
+      window.image_index = image_index;
+      window.bb_index = file_window.bb_index;
+      window.label = label;
+      window.overlap = overlap;
+      window.x1 = file_window.x1;
+      window.y1 = file_window.y1;
+      window.x2 = file_window.x2;
+      window.y2 = file_window.y2;
+
+      // keep foreground and background windows
+      if (overlap >= fg_threshold) {
+        CHECK_GT(label, 0);
+        label_hist.insert(std::make_pair(label, 0));
+        label_hist[label]++;
+      } else if (overlap < bg_threshold) {
+        // background window, force label and overlap to 0
+        window.label = 0;
+        window.overlap = 0;
+        label_hist[0]++;
+      } else {
+        continue;
+      }
+      windows.push_back(window);
+    }
+    add_image_windows(windows);
+
+    if (image_index % 100 == 0) {
+      LOG(INFO) << "num: " << image_index << " "
+          << image_path << " "
+          << image_size[0] << " "
+          << image_size[1] << " "
+          << image_size[2] << " "
+          << "windows to process: " << num_windows;
+    }
+  }
 
-  //shuffle triplets and create vector of keys
-  LOG(INFO) << "Shuffling triplets";
-  for(std::map<int, vector<vector<int> > >::iterator it = triplets_.begin(); it != triplets_.end(); it++) {
-     std::random_shuffle(it->second.begin(), it->second.end());
-     cls_keys_.push_back(it->first);
-     cls_idx_.insert(std::make_pair(it->first, 0)); 
-  }  
+  // pair_index image_index_1 bb_index_1 image_index_2 bb_index_2 image_index_3 bb_index_3
+  if (num_pairs > 0) {
+    CHECK_EQ(window_file.pair_size(), 7) << "Triplets must have 7 fields";
+  }
+  for (int i = 0; i < num_pairs; ++i) {
+    const int* pair = window_file.pair(i);
+    const int pair_index = pair[0];
+    const int image_index_1 = pair[1];
+    const int image_index_2 = pair[3];
+
+    int triplet[TripletWindowDataLayer::NUM_TRIPLET_FIELDS];
+    triplet[TripletWindowDataLayer::TRIPLET_INDEX] = pair_index;
+    triplet[TripletWindowDataLayer::WINDOW_1] = find_window(pair[1], pair[2]);
+    triplet[TripletWindowDataLayer::WINDOW_2] = find_window(pair[3], pair[4]);
+    triplet[TripletWindowDataLayer::WINDOW_3] = find_window(pair[5], pair[6]);
+    for (int j = TripletWindowDataLayer::WINDOW_1; j <= TripletWindowDataLayer::WINDOW_3; ++j) {
+      CHECK_GE(triplet[j], 0) << "Triplet " << pair_index
+          << " refers to a window that is not read or kept";
+    }
+    const Window& window_a = window(triplet[TripletWindowDataLayer::WINDOW_1]);
+    const Window& window_b = window(triplet[TripletWindowDataLayer::WINDOW_2]);
+    const Window& window_c = window(triplet[TripletWindowDataLayer::WINDOW_3]);
+    int cls = window_a.label;
+
+    //cache triplets
+    triplets.insert(triplets.end(), triplet,
+        triplet + TripletWindowDataLayer::NUM_TRIPLET_FIELDS);
+    triplet_cls.push_back(cls);
+
+    //compute distribution of classes in the triplets
+    int sample_label, tg_label, imp_label;
+    sample_label = window_a.label;
+    sample_hist.insert(std::make_pair(sample_label, 0));
+    sample_hist[sample_label]++;
+
+    tg_label = window_b.label;
+    tg_hist.insert(std::make_pair(tg_label, 0));
+    tg_hist[tg_label]++;
+
+    imp_label = window_c.label;
+    imp_hist.insert(std::make_pair(imp_label, 0));
+    imp_hist[imp_label]++;
+
+    //compute overlap between target and sample
+    if(image_index_1 == image_index_2){
+      count_same_img++;
+
+      float XA1 = window_a.x1; float YA1 = window_a.y1;
+      float XA2 = window_a.x2; float YA2 = window_a.y2;
+
+      float XB1 = window_b.x1; float YB1 = window_b.y1;
+      float XB2 = window_b.x2; float YB2 = window_b.y2;
+
+      float sa = (XA2 - XA1) * (YA2 - YA1);
+      float sb = (XB2 - XB1) * (YB2 - YB1);
+      float si = std::max(0.0f, std::min(XA2,XB2) - std::max(XA1,XB1)) * std::max(0.0f, std::min(YA2,YB2) - std::max(YA1,YB1));
+      if(si > 0.0f){
+        pair_stat_acc(si/(sa+sb-si));
+      }
+    }
+  }
 
+  //group triplets by class and shuffle them
+  LOG(INFO) << "Shuffling triplets";
+  set_triplets(triplets, triplet_cls);
 
-  LOG(INFO) << "Number of images: " << image_index+1;
+  LOG(INFO) << "Number of images: " << window_file.num_images();
   LOG(INFO) << "Number of classes with instances: " << cls_keys_.size();
   for (map<int, int>::iterator it = label_hist.begin();
       it != label_hist.end(); ++it) {
@@ -298,8 +374,8 @@ void TripletWindowDataLayer<Dtype>::DataLayerSetUp(const vector<Blob<Dtype>*>& b
   CHECK_GT(crop_size, 0);
   const int batch_size = this->layer_param_.triplet_window_data_param().batch_size();
   top[0]->Reshape(batch_size, 3*channels, crop_size, crop_size);
-  for (int i = 0; i < this->PREFETCH_COUNT; ++i)
-    this->prefetch_[i].data_.Reshape(
+  for (int i = 0; i < this->prefetch_.size(); ++i)
+    this->prefetch_[i]->data_.Reshape(
         batch_size, 3*channels, crop_size, crop_size);
 
   LOG(INFO) << "output data size: images grouped as " << top[0]->num() << ","
@@ -309,8 +385,8 @@ void TripletWindowDataLayer<Dtype>::DataLayerSetUp(const vector<Blob<Dtype>*>& b
  // label
   vector<int> label_shape(3, batch_size);
   top[1]->Reshape(label_shape);
-  for (int i = 0; i < this->PREFETCH_COUNT; ++i) {
-    this->prefetch_[i].label_.Reshape(label_shape);
+  for (int i = 0; i < this->prefetch_.size(); ++i) {
+    this->prefetch_[i]->label_.Reshape(label_shape);
   }
     
   // data mean
@@ -350,6 +426,47 @@ unsigned int TripletWindowDataLayer<Dtype>::PrefetchRand() {
   return (*prefetch_rng)();
 }
 
+// This function is called on prefetch and transform threads
+template <typename Dtype>
+bool TripletWindowDataLayer<Dtype>::load_image(int image_index,
+    cv::Mat* cv_img) {
+  // decoded images are shared with the cache and must not be modified
+  if (this->image_cache_ && this->image_cache_->Get(image_index, cv_img)) {
+    return true;
+  }
+  if (this->cache_images_) {
+    *cv_img = DecodeDatumToCVMat(image_database_cache_[image_index].second,
+        true);
+  } else {
+    const string& image_path = image_database_[image_index].first;
+    *cv_img = cv::imread(image_path, CV_LOAD_IMAGE_COLOR);
+    if (!cv_img->data) {
+      LOG(ERROR) << "Could not open or find file " << image_path;
+      return false;
+    }
+  }
+  if (this->image_cache_) {
+    this->image_cache_->Put(image_index, *cv_img);
+  }
+  return true;
+}
+
+template <typename Dtype>
+class TripletWindowDataLayer<Dtype>::LoadImages : public ThreadPool::Task {
+ public:
+  explicit LoadImages(TripletWindowDataLayer<Dtype>* layer)
+      : layer_(layer) {}
+  virtual void Run(int thread, int begin, int end) {
+    for (int i = begin; i < end; ++i) {
+      layer_->load_image(layer_->batch_image_indices_[i],
+          &layer_->batch_images_[i]);
+    }
+  }
+
+ protected:
+  TripletWindowDataLayer<Dtype>* layer_;
+};
+
 // This function is called on prefetch thread
 template <typename Dtype>
 void TripletWindowDataLayer<Dtype>::load_batch(Batch<Dtype>* batch) {
@@ -359,269 +476,316 @@ void TripletWindowDataLayer<Dtype>::load_batch(Batch<Dtype>* batch) {
   double trans_time = 0;
   CPUTimer timer;
   Dtype* top_data = batch->data_.mutable_cpu_data();
-  Dtype* top_label = batch->label_.mutable_cpu_data();
-  const Dtype scale = this->layer_param_.triplet_window_data_param().scale();
+  // Resolved here as load_item runs on the transform threads
+  mean_data_ = this->has_mean_file_ ? data_mean_.cpu_data() : NULL;
   const int batch_size = this->layer_param_.triplet_window_data_param().batch_size();
-  const int context_pad = this->layer_param_.triplet_window_data_param().context_pad();
-  const int crop_size = this->transform_param_.crop_size();
   const bool mirror = this->transform_param_.mirror();
 
-  Dtype* mean = NULL;
-  int mean_off = 0;
-  int mean_width = 0;
-  int mean_height = 0;
-  if (this->has_mean_file_) {
-    mean = this->data_mean_.mutable_cpu_data();
-    mean_off = (this->data_mean_.width() - crop_size) / 2;
-    mean_width = this->data_mean_.width();
-    mean_height = this->data_mean_.height();
-  }
-  //cv::Size cv_crop_size(crop_size, crop_size);
-  const string& crop_mode = this->layer_param_.triplet_window_data_param().crop_mode();
-
-  bool use_square = (crop_mode == "square") ? true : false;
-
   // zero out batch
   caffe_set(batch->data_.count(), Dtype(0), top_data);
 
 
   //configure to sample triplets uniformly
-  map<int, int> cls_numSamp; // cls -> qtd
-  for(int cls = 0; cls < cls_keys_.size(); cls++) {
-     cls_numSamp.insert(std::make_pair(cls_keys_[cls], batch_size/cls_keys_.size()));
-  }
-  const int rest = batch_size % triplets_.size();
+  const int num_cls = cls_keys_.size();
+  vector<int> cls_numSamp(num_cls, batch_size / num_cls); // cls -> qtd
+  const int rest = batch_size % num_cls;
   for(int r=0; r < rest; r++) {
      const unsigned int rand_index = PrefetchRand();
-     int sort_key = cls_keys_[rand_index % cls_keys_.size()];
-     cls_numSamp[sort_key]++;
+     cls_numSamp[rand_index % num_cls]++;
   }
 
-  //check if the sampling is correct
-  int total_samp = 0;
-  for(int cls = 0; cls < cls_keys_.size(); cls++) {
-     total_samp += cls_numSamp[cls_keys_[cls]];
-  }  
-  CHECK_EQ(batch_size, total_samp);
-
+  // Sample the triplets, and whether to mirror their windows, on this thread
+  // so the random sequence does not depend on the number of transform threads
+  item_triplets_.resize(batch_size);
+  item_mirrors_.resize(3 * batch_size);
   int item_id = 0;
   //sample in each class
-  for (int cls = 0; cls < cls_keys_.size(); cls++) {
-    int cls_key = cls_keys_[cls];
-    for (int dummy = 0; dummy < cls_numSamp[cls_key]; ++dummy) {
+  for (int cls = 0; cls < num_cls; cls++) {
+    const int cls_begin = cls_triplets_[cls];
+    const int cls_size = cls_triplets_[cls + 1] - cls_begin;
+    for (int dummy = 0; dummy < cls_numSamp[cls]; ++dummy) {
       // sample a triplet
-      timer.Start();
       //const unsigned int rand_index = PrefetchRand();
-      vector<int> pair = triplets_[cls_key][cls_idx_[cls_key] % triplets_[cls_key].size()]; cls_idx_[cls_key]++;
+      item_triplets_[item_id] = cls_begin + cls_idx_[cls] % cls_size; cls_idx_[cls]++;
+      const int* triplet = this->triplet(item_triplets_[item_id]);
 
       //a - sample, b - target, c - impostor
-      vector<float> window_a = windows_[pair[TripletWindowDataLayer<Dtype>::IMAGE_INDEX_1]][pair[TripletWindowDataLayer<Dtype>::BB_INDEX_1]];
-      vector<float> window_b = windows_[pair[TripletWindowDataLayer<Dtype>::IMAGE_INDEX_2]][pair[TripletWindowDataLayer<Dtype>::BB_INDEX_2]];
-      vector<float> window_c = windows_[pair[TripletWindowDataLayer<Dtype>::IMAGE_INDEX_3]][pair[TripletWindowDataLayer<Dtype>::BB_INDEX_3]];
+      const Window& window_a = window(triplet[TripletWindowDataLayer<Dtype>::WINDOW_1]);
+      const Window& window_b = window(triplet[TripletWindowDataLayer<Dtype>::WINDOW_2]);
+      const Window& window_c = window(triplet[TripletWindowDataLayer<Dtype>::WINDOW_3]);
 
       //check target and impostor roles-- uncomented for unsuperv exps
-      CHECK_EQ(window_a[TripletWindowDataLayer::LABEL] , window_b[TripletWindowDataLayer::LABEL]);        
-      CHECK_NE(window_a[TripletWindowDataLayer::LABEL], window_c[TripletWindowDataLayer::LABEL]);
-      
-
-      //prepare windows
-      int pad_wa=0, pad_ha=0, pad_wb=0, pad_hb=0, pad_wc=0, pad_hc=0;
-      bool do_mirrora = false, do_mirrorb = false, do_mirrorc = false;
-      cv::Mat cv_cropped_img_a, cv_cropped_img_b, cv_cropped_img_c; 
-      bool isImage_aPrep = this->prepare_window(cv_cropped_img_a, pad_wa, pad_ha, do_mirrora, window_a, mirror, context_pad, use_square, crop_size);
-      bool isImage_bPrep = this->prepare_window(cv_cropped_img_b, pad_wb, pad_hb, do_mirrorb, window_b, mirror, context_pad, use_square, crop_size);
-      bool isImage_cPrep = this->prepare_window(cv_cropped_img_c, pad_wc, pad_hc, do_mirrorc, window_c, mirror, context_pad, use_square, crop_size);
-      if(!isImage_aPrep || !isImage_bPrep || !isImage_cPrep)
-	return;
-
-      CHECK_EQ(cv_cropped_img_a.channels(), cv_cropped_img_b.channels());
-      CHECK_EQ(cv_cropped_img_a.channels(), cv_cropped_img_c.channels());
-      const int channels = cv_cropped_img_a.channels();
-
-      // copy the warped window a into top_data
-      for (int h = 0; h < cv_cropped_img_a.rows; ++h) {
-        const uchar* ptr = cv_cropped_img_a.ptr<uchar>(h);
-        int img_index = 0;
-        for (int w = 0; w < cv_cropped_img_a.cols; ++w) {
-          for (int c = 0; c < channels; ++c) {
-            int top_index = ((item_id * (3*channels) + c) * crop_size + h + pad_ha)
-                     * crop_size + w + pad_wa;
-            // int top_index = (c * height + h) * width + w;
-            Dtype pixel = static_cast<Dtype>(ptr[img_index++]);
-            if (this->has_mean_file_) {
-              int mean_index = (c * mean_height + h + mean_off + pad_ha)
-                           * mean_width + w + mean_off + pad_wa;
-              top_data[top_index] = (pixel - mean[mean_index]) * scale;
-            } else {
-              if (this->has_mean_values_) {
-                top_data[top_index] = (pixel - this->mean_values_[c]) * scale;
-              } else {
-                top_data[top_index] = pixel * scale;
-              }
-            }
-          }
+      CHECK_EQ(window_a.label , window_b.label);        
+      CHECK_NE(window_a.label, window_c.label);
+
+      for (int i = 0; i < 3; ++i) {
+        item_mirrors_[3 * item_id + i] = mirror && PrefetchRand() % 2;
+      }
+      item_id++;
+    }
+  }
+  // Group the windows by image, decode each image once, then load, crop and
+  // warp the windows from the decoded images. The items are loaded in parts
+  // needing at most batch_images distinct images, so that a batch does not
+  // hold all of its decoded images at once.
+  timer.Start();
+  const int max_images =
+      this->layer_param_.triplet_window_data_param().batch_images();
+  CHECK_GT(max_images, 0) << "batch_images must be positive";
+  item_images_.resize(3 * batch_size);
+  int item_begin = 0;
+  while (item_begin < batch_size) {
+    map<int, int> image_slots; // image index => index in batch_images_
+    batch_image_indices_.clear();
+    int item_end = item_begin;
+    for (; item_end < batch_size; ++item_end) {
+      const int* triplet = this->triplet(item_triplets_[item_end]);
+      int image_indices[3];
+      int new_images = 0;
+      for (int i = 0; i < 3; ++i) {
+        image_indices[i] = this->window(
+            triplet[TripletWindowDataLayer<Dtype>::WINDOW_1 + i]).image_index;
+        if (image_slots.count(image_indices[i]) == 0 &&
+            std::find(image_indices, image_indices + i, image_indices[i]) ==
+            image_indices + i) {
+          ++new_images;
         }
       }
+      // a part takes at least one item
+      if (item_end > item_begin &&
+          static_cast<int>(image_slots.size()) + new_images > max_images) {
+        break;
+      }
+      for (int i = 0; i < 3; ++i) {
+        std::pair<map<int, int>::iterator, bool> slot = image_slots.insert(
+            std::make_pair(image_indices[i], batch_image_indices_.size()));
+        if (slot.second) {
+          batch_image_indices_.push_back(image_indices[i]);
+        }
+        item_images_[3 * item_end + i] = slot.first->second;
+      }
+    }
+    batch_images_.resize(batch_image_indices_.size());
+    LoadImages task(this);
+    this->transform_pool_->Run(&task, batch_image_indices_.size());
+    this->load_items(batch, item_begin, item_end);
+    // Release the images, the cache keeps the ones it holds
+    for (int i = 0; i < batch_images_.size(); ++i) {
+      batch_images_[i].release();
+    }
+    item_begin = item_end;
+  }
+  trans_time += timer.MicroSeconds();
+  batch_timer.Stop();
+  DLOG(INFO) << "Prefetch batch: " << batch_timer.MilliSeconds() << " ms.";  
+  DLOG(INFO) << "Transform time: " << trans_time / 1000 << " ms.";
+}
+
+// This function is called on prefetch and transform threads
+template <typename Dtype>
+void TripletWindowDataLayer<Dtype>::load_item(Batch<Dtype>* batch,
+    Dtype* top_data, Dtype* top_label, int item_id, int thread) {
+  const Dtype scale = this->layer_param_.triplet_window_data_param().scale();
+  const int context_pad = this->layer_param_.triplet_window_data_param().context_pad();
+  const int crop_size = this->transform_param_.crop_size();
+
+  const Dtype* mean = NULL;
+  int mean_off = 0;
+  int mean_width = 0;
+  int mean_height = 0;
+  if (this->has_mean_file_) {
+    mean = mean_data_;
+    mean_off = (this->data_mean_.width() - crop_size) / 2;
+    mean_width = this->data_mean_.width();
+    mean_height = this->data_mean_.height();
+  }
+  const string& crop_mode = this->layer_param_.triplet_window_data_param().crop_mode();
+
+  bool use_square = (crop_mode == "square") ? true : false;
 
-      // copy the warped window b into top_data
-      for (int h = 0; h < cv_cropped_img_b.rows; ++h) {
-        const uchar* ptr = cv_cropped_img_b.ptr<uchar>(h);
-        int img_index = 0;
-        for (int w = 0; w < cv_cropped_img_b.cols; ++w) {
-          for (int c = channels; c < 2*channels; ++c) {
-            int top_index = ((item_id * (3*channels) + c) * crop_size + h + pad_hb)
-                     * crop_size + w + pad_wb;
-            // int top_index = (c * height + h) * width + w;
-            Dtype pixel = static_cast<Dtype>(ptr[img_index++]);
-            int mean_c = c % channels;
-            if (this->has_mean_file_) {
-              int mean_index = (mean_c * mean_height + h + mean_off + pad_hb)
-                           * mean_width + w + mean_off + pad_wb;
-              top_data[top_index] = (pixel - mean[mean_index]) * scale;
-            } else {
-              if (this->has_mean_values_) {
-                top_data[top_index] = (pixel - this->mean_values_[mean_c]) * scale;
-              } else {
-                top_data[top_index] = pixel * scale;
-              }
-            }
+  const int* triplet = this->triplet(item_triplets_[item_id]);
+  const Window& window_a = window(triplet[TripletWindowDataLayer<Dtype>::WINDOW_1]);
+  const Window& window_b = window(triplet[TripletWindowDataLayer<Dtype>::WINDOW_2]);
+  const Window& window_c = window(triplet[TripletWindowDataLayer<Dtype>::WINDOW_3]);
+  const bool do_mirrora = item_mirrors_[3 * item_id + 0];
+  const bool do_mirrorb = item_mirrors_[3 * item_id + 1];
+  const bool do_mirrorc = item_mirrors_[3 * item_id + 2];
+
+  //prepare windows
+  int pad_wa=0, pad_ha=0, pad_wb=0, pad_hb=0, pad_wc=0, pad_hc=0;
+  cv::Mat cv_cropped_img_a, cv_cropped_img_b, cv_cropped_img_c; 
+  bool isImage_aPrep = this->prepare_window(cv_cropped_img_a, pad_wa, pad_ha, do_mirrora, batch_images_[item_images_[3 * item_id + 0]], window_a, context_pad, use_square, crop_size);
+  bool isImage_bPrep = this->prepare_window(cv_cropped_img_b, pad_wb, pad_hb, do_mirrorb, batch_images_[item_images_[3 * item_id + 1]], window_b, context_pad, use_square, crop_size);
+  bool isImage_cPrep = this->prepare_window(cv_cropped_img_c, pad_wc, pad_hc, do_mirrorc, batch_images_[item_images_[3 * item_id + 2]], window_c, context_pad, use_square, crop_size);
+  if(!isImage_aPrep || !isImage_bPrep || !isImage_cPrep)
+    return;
+
+  CHECK_EQ(cv_cropped_img_a.channels(), cv_cropped_img_b.channels());
+  CHECK_EQ(cv_cropped_img_a.channels(), cv_cropped_img_c.channels());
+  const int channels = cv_cropped_img_a.channels();
+
+  // copy the warped window a into top_data
+  for (int h = 0; h < cv_cropped_img_a.rows; ++h) {
+    const uchar* ptr = cv_cropped_img_a.ptr<uchar>(h);
+    int img_index = 0;
+    for (int w = 0; w < cv_cropped_img_a.cols; ++w) {
+      for (int c = 0; c < channels; ++c) {
+        int top_index = ((item_id * (3*channels) + c) * crop_size + h + pad_ha)
+                 * crop_size + w + pad_wa;
+        // int top_index = (c * height + h) * width + w;
+        Dtype pixel = static_cast<Dtype>(ptr[img_index++]);
+        if (this->has_mean_file_) {
+          int mean_index = (c * mean_height + h + mean_off + pad_ha)
+                       * mean_width + w + mean_off + pad_wa;
+          top_data[top_index] = (pixel - mean[mean_index]) * scale;
+        } else {
+          if (this->has_mean_values_) {
+            top_data[top_index] = (pixel - this->mean_values_[c]) * scale;
+          } else {
+            top_data[top_index] = pixel * scale;
           }
         }
       }
+    }
+  }
 
-      // copy the warped window c into top_data
-      for (int h = 0; h < cv_cropped_img_c.rows; ++h) {
-        const uchar* ptr = cv_cropped_img_c.ptr<uchar>(h);
-        int img_index = 0;
-        for (int w = 0; w < cv_cropped_img_c.cols; ++w) {
-          for (int c = 2*channels; c < 3*channels; ++c) {
-            int top_index = ((item_id * (3*channels) + c) * crop_size + h + pad_hc)
-                     * crop_size + w + pad_wc;
-            // int top_index = (c * height + h) * width + w;
-            Dtype pixel = static_cast<Dtype>(ptr[img_index++]);
-            int mean_c = c % channels;
-            if (this->has_mean_file_) {
-              int mean_index = (mean_c * mean_height + h + mean_off + pad_hc)
-                           * mean_width + w + mean_off + pad_wc;
-              top_data[top_index] = (pixel - mean[mean_index]) * scale;
-            } else {
-              if (this->has_mean_values_) {
-                top_data[top_index] = (pixel - this->mean_values_[mean_c]) * scale;
-              } else {
-                top_data[top_index] = pixel * scale;
-              }
-            }
+  // copy the warped window b into top_data
+  for (int h = 0; h < cv_cropped_img_b.rows; ++h) {
+    const uchar* ptr = cv_cropped_img_b.ptr<uchar>(h);
+    int img_index = 0;
+    for (int w = 0; w < cv_cropped_img_b.cols; ++w) {
+      for (int c = channels; c < 2*channels; ++c) {
+        int top_index = ((item_id * (3*channels) + c) * crop_size + h + pad_hb)
+                 * crop_size + w + pad_wb;
+        // int top_index = (c * height + h) * width + w;
+        Dtype pixel = static_cast<Dtype>(ptr[img_index++]);
+        int mean_c = c % channels;
+        if (this->has_mean_file_) {
+          int mean_index = (mean_c * mean_height + h + mean_off + pad_hb)
+                       * mean_width + w + mean_off + pad_wb;
+          top_data[top_index] = (pixel - mean[mean_index]) * scale;
+        } else {
+          if (this->has_mean_values_) {
+            top_data[top_index] = (pixel - this->mean_values_[mean_c]) * scale;
+          } else {
+            top_data[top_index] = pixel * scale;
           }
         }
       }
+    }
+  }
 
-      // get window labels      
-      trans_time += timer.MicroSeconds();
-      top_label[item_id * 3 + 0] = window_a[TripletWindowDataLayer<Dtype>::LABEL];
-      top_label[item_id * 3 + 1] = window_b[TripletWindowDataLayer<Dtype>::LABEL];
-      top_label[item_id * 3 + 2] = window_c[TripletWindowDataLayer<Dtype>::LABEL];
-      
-
-     
-      // useful debugging code for dumping transformed windows to disk
-      #if 0
-      std::pair<std::string, vector<int> > image_debug_a = image_database_[window_a[TripletWindowDataLayer<Dtype>::IMAGE_INDEX]];
-
-      std::pair<std::string, vector<int> > image_debug_b = image_database_[window_b[TripletWindowDataLayer<Dtype>::IMAGE_INDEX]];
-
-      std::pair<std::string, vector<int> > image_debug_c = image_database_[window_c[TripletWindowDataLayer<Dtype>::IMAGE_INDEX]];
-
-      string file_id;
-      std::stringstream ss;
-      ss << PrefetchRand();
-      ss >> file_id;
-      std::ofstream inf((string("dump/") + file_id +
-          string("_info.txt")).c_str(), std::ofstream::out);
-      inf << "Pair_ID = " << pair[TripletWindowDataLayer<Dtype>::PAIR_INDEX] << std::endl;
-      
-      inf << "Sample" << std::endl;
-      inf << image_debug_a.first << std::endl;
-      inf << window_a[TripletWindowDataLayer<Dtype>::X1]+1 << std::endl;
-      inf << window_a[TripletWindowDataLayer<Dtype>::Y1]+1 << std::endl;
-      inf << window_a[TripletWindowDataLayer<Dtype>::X2]+1 << std::endl;
-      inf << window_a[TripletWindowDataLayer<Dtype>::Y2]+1 << std::endl;
-      inf << window_a[TripletWindowDataLayer<Dtype>::LABEL] << std::endl;
-      inf << do_mirrora << std::endl;
-      inf << top_label[item_id * 3 + 0] << std::endl;      
-
-      inf << "Target" << std::endl;
-      inf << image_debug_b.first << std::endl;
-      inf << window_b[TripletWindowDataLayer<Dtype>::X1]+1 << std::endl;
-      inf << window_b[TripletWindowDataLayer<Dtype>::Y1]+1 << std::endl;
-      inf << window_b[TripletWindowDataLayer<Dtype>::X2]+1 << std::endl;
-      inf << window_b[TripletWindowDataLayer<Dtype>::Y2]+1 << std::endl;
-      inf << window_b[TripletWindowDataLayer<Dtype>::LABEL] << std::endl;
-      inf << do_mirrorb << std::endl;
-      inf << top_label[item_id * 3 + 1] << std::endl;
-
-      inf << "Imposto" << std::endl;
-      inf << image_debug_c.first << std::endl;
-      inf << window_c[TripletWindowDataLayer<Dtype>::X1]+1 << std::endl;
-      inf << window_c[TripletWindowDataLayer<Dtype>::Y1]+1 << std::endl;
-      inf << window_c[TripletWindowDataLayer<Dtype>::X2]+1 << std::endl;
-      inf << window_c[TripletWindowDataLayer<Dtype>::Y2]+1 << std::endl;
-      inf << window_c[TripletWindowDataLayer<Dtype>::LABEL] << std::endl;
-      inf << do_mirrorc << std::endl;          
-      inf << top_label[item_id * 3 + 2] << std::endl;      
-      inf.close();
-
-      std::ofstream top_data_file_a((string("dump/") + file_id +
-          string("_data.txt")).c_str(),
-          std::ofstream::out | std::ofstream::binary);
-      for (int c = 0; c < 3*channels; ++c) {
-        for (int h = 0; h < crop_size; ++h) {
-          for (int w = 0; w < crop_size; ++w) {
-            top_data_file_a.write(reinterpret_cast<char*>(
-                &top_data[((item_id * (3*channels) + c) * crop_size + h)
-                          * crop_size + w]),
-                sizeof(Dtype));
+  // copy the warped window c into top_data
+  for (int h = 0; h < cv_cropped_img_c.rows; ++h) {
+    const uchar* ptr = cv_cropped_img_c.ptr<uchar>(h);
+    int img_index = 0;
+    for (int w = 0; w < cv_cropped_img_c.cols; ++w) {
+      for (int c = 2*channels; c < 3*channels; ++c) {
+        int top_index = ((item_id * (3*channels) + c) * crop_size + h + pad_hc)
+                 * crop_size + w + pad_wc;
+        // int top_index = (c * height + h) * width + w;
+        Dtype pixel = static_cast<Dtype>(ptr[img_index++]);
+        int mean_c = c % channels;
+        if (this->has_mean_file_) {
+          int mean_index = (mean_c * mean_height + h + mean_off + pad_hc)
+                       * mean_width + w + mean_off + pad_wc;
+          top_data[top_index] = (pixel - mean[mean_index]) * scale;
+        } else {
+          if (this->has_mean_values_) {
+            top_data[top_index] = (pixel - this->mean_values_[mean_c]) * scale;
+          } else {
+            top_data[top_index] = pixel * scale;
           }
         }
       }
-      top_data_file_a.close();
-      #endif
+    }
+  }
 
-      item_id++;
+  // get window labels      
+  top_label[item_id * 3 + 0] = window_a.label;
+  top_label[item_id * 3 + 1] = window_b.label;
+  top_label[item_id * 3 + 2] = window_c.label;
+  
+
+ 
+  // useful debugging code for dumping transformed windows to disk
+  #if 0
+  std::pair<std::string, vector<int> > image_debug_a = image_database_[window_a.image_index];
+
+  std::pair<std::string, vector<int> > image_debug_b = image_database_[window_b.image_index];
+
+  std::pair<std::string, vector<int> > image_debug_c = image_database_[window_c.image_index];
+
+  string file_id;
+  std::stringstream ss;
+  ss << PrefetchRand();
+  ss >> file_id;
+  std::ofstream inf((string("dump/") + file_id +
+      string("_info.txt")).c_str(), std::ofstream::out);
+  inf << "Pair_ID = " << triplet[TripletWindowDataLayer<Dtype>::TRIPLET_INDEX] << std::endl;
+  
+  inf << "Sample" << std::endl;
+  inf << image_debug_a.first << std::endl;
+  inf << window_a.x1+1 << std::endl;
+  inf << window_a.y1+1 << std::endl;
+  inf << window_a.x2+1 << std::endl;
+  inf << window_a.y2+1 << std::endl;
+  inf << window_a.label << std::endl;
+  inf << do_mirrora << std::endl;
+  inf << top_label[item_id * 3 + 0] << std::endl;      
+
+  inf << "Target" << std::endl;
+  inf << image_debug_b.first << std::endl;
+  inf << window_b.x1+1 << std::endl;
+  inf << window_b.y1+1 << std::endl;
+  inf << window_b.x2+1 << std::endl;
+  inf << window_b.y2+1 << std::endl;
+  inf << window_b.label << std::endl;
+  inf << do_mirrorb << std::endl;
+  inf << top_label[item_id * 3 + 1] << std::endl;
+
+  inf << "Imposto" << std::endl;
+  inf << image_debug_c.first << std::endl;
+  inf << window_c.x1+1 << std::endl;
+  inf << window_c.y1+1 << std::endl;
+  inf << window_c.x2+1 << std::endl;
+  inf << window_c.y2+1 << std::endl;
+  inf << window_c.label << std::endl;
+  inf << do_mirrorc << std::endl;          
+  inf << top_label[item_id * 3 + 2] << std::endl;      
+  inf.close();
+
+  std::ofstream top_data_file_a((string("dump/") + file_id +
+      string("_data.txt")).c_str(),
+      std::ofstream::out | std::ofstream::binary);
+  for (int c = 0; c < 3*channels; ++c) {
+    for (int h = 0; h < crop_size; ++h) {
+      for (int w = 0; w < crop_size; ++w) {
+        top_data_file_a.write(reinterpret_cast<char*>(
+            &top_data[((item_id * (3*channels) + c) * crop_size + h)
+                      * crop_size + w]),
+            sizeof(Dtype));
+      }
     }
-  }  
-  batch_timer.Stop();
-  DLOG(INFO) << "Prefetch batch: " << batch_timer.MilliSeconds() << " ms.";  
-  DLOG(INFO) << "Transform time: " << trans_time / 1000 << " ms.";
+  }
+  top_data_file_a.close();
+  #endif
 }
 
 template <typename Dtype>
-bool TripletWindowDataLayer<Dtype>::prepare_window(cv::Mat &warpimg, int &pad_w, int &pad_h, bool &do_mirror, const vector<float> &window, const bool mirror, const int context_pad, const bool use_square, const int crop_size){
+bool TripletWindowDataLayer<Dtype>::prepare_window(cv::Mat &warpimg, int &pad_w, int &pad_h, const bool do_mirror, const cv::Mat &cv_img, const Window& window, const int context_pad, const bool use_square, const int crop_size){
 
       cv::Size cv_crop_size(crop_size, crop_size);
-      do_mirror = mirror && PrefetchRand() % 2;
-
-      // load the image containing the window
-      pair<std::string, vector<int> > image =
-          image_database_[window[TripletWindowDataLayer<Dtype>::IMAGE_INDEX]];   
 
-      cv::Mat cv_img;
-      if (this->cache_images_) {
-        pair<std::string, Datum> image_cached =
-          image_database_cache_[window[TripletWindowDataLayer<Dtype>::IMAGE_INDEX]];
-        cv_img = DecodeDatumToCVMat(image_cached.second, true);
-      } else {
-        cv_img = cv::imread(image.first, CV_LOAD_IMAGE_COLOR);
-        if (!cv_img.data) {
-          LOG(ERROR) << "Could not open or find file " << image.first;
-          return false;
-        }
+      if (!cv_img.data) {
+        return false;
       }
 
       // crop window out of image and warp it
-      int x1 = window[TripletWindowDataLayer<Dtype>::X1];
-      int y1 = window[TripletWindowDataLayer<Dtype>::Y1];
-      int x2 = window[TripletWindowDataLayer<Dtype>::X2];
-      int y2 = window[TripletWindowDataLayer<Dtype>::Y2];
+      int x1 = window.x1;
+      int y1 = window.y1;
+      int x2 = window.x2;
+      int y2 = window.y2;
 
       pad_w = 0;
       pad_h = 0;
@@ -707,8 +871,9 @@ bool TripletWindowDataLayer<Dtype>::prepare_window(cv::Mat &warpimg, int &pad_w,
       }
 
       cv::Rect roi(x1, y1, x2-x1+1, y2-y1+1);
-      cv::Mat cv_cropped_img = cv_img(roi);
-      cv::resize(cv_cropped_img, cv_cropped_img,
+      // resize into a new image, cv_img may be in the cache
+      cv::Mat cv_cropped_img;
+      cv::resize(cv_img(roi), cv_cropped_img,
           cv_crop_size, 0, 0, cv::INTER_LINEAR);
      
       // horizontal flip at random
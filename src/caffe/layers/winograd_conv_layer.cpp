@@ -0,0 +1,22 @@
+#include <vector>
+
+#include "caffe/layers/winograd_conv_layer.hpp"
+
+namespace caffe {
+
+template <typename Dtype>
+void WinogradConvolutionLayer<Dtype>::LayerSetUp(
+    const vector<Blob<Dtype>*>& bottom, const vector<Blob<Dtype>*>& top) {
+  ConvolutionLayer<Dtype>::LayerSetUp(bottom, top);
+  if (this->winograd_supported()) {
+    this->cpu_algorithm_ = ConvolutionAlgorithmCache_Algorithm_WINOGRAD;
+  } else {
+    LOG(INFO) << "Layer " << this->layer_param_.name() << " falls back to "
+        << "the CAFFE engine, the WINOGRAD engine only convolves 2D 3x3 "
+        << "filters with stride 1 and dilation 1.";
+  }
+}
+
+INSTANTIATE_CLASS(WinogradConvolutionLayer);
+
+}  // namespace caffe
@@ -9,6 +9,7 @@
 
 #include "caffe/common.hpp"
 #include "caffe/layer.hpp"
+#include "caffe/layers/fused_elementwise_layer.hpp"
 #include "caffe/net.hpp"
 #include "caffe/parallel.hpp"
 #include "caffe/proto/caffe.pb.h"
@@ -280,9 +281,245 @@ void Net<Dtype>::Init(const NetParameter& in_param) {
   }
   ShareWeights();
   debug_info_ = param.debug_info();
+  fused_layers_.assign(layers_.size(), shared_ptr<Layer<Dtype> >());
+  fused_first_.assign(layers_.size(), -1);
+  fused_last_.assign(layers_.size(), -1);
+  if (param.fuse_elementwise()) {
+    FuseElementwiseLayers();
+  }
+  share_activation_memory_ =
+      param.share_activation_memory() && phase_ == TEST;
+  pinned_blob_ids_.clear();
+  for (int i = 0; i < param.pinned_blob_size(); ++i) {
+    const string& blob_name = param.pinned_blob(i);
+    CHECK(has_blob(blob_name)) << "Unknown pinned blob " << blob_name;
+    pinned_blob_ids_.push_back(blob_names_index_[blob_name]);
+  }
+  if (share_activation_memory_) {
+    ShareActivationMemory();
+  }
   LOG_IF(INFO, Caffe::root_solver()) << "Network initialization done.";
 }
 
+template <typename Dtype>
+void Net<Dtype>::FuseElementwiseLayers() {
+  // Whether each layer computes its only top from its only bottom value by
+  // value, without a loss
+  vector<bool> elementwise(layers_.size());
+  for (int layer_id = 0; layer_id < layers_.size(); ++layer_id) {
+    elementwise[layer_id] =
+        FusedElementwiseLayer<Dtype>::CanFuse(*layers_[layer_id]) &&
+        bottom_vecs_[layer_id].size() == 1 &&
+        top_vecs_[layer_id].size() == 1 &&
+        layers_[layer_id]->loss(0) == Dtype(0);
+  }
+  for (int first = 0; first < layers_.size(); ++first) {
+    if (!elementwise[first]) {
+      continue;
+    }
+    // Extends the chain while the top of its last layer is only consumed by
+    // the next layer
+    int last = first;
+    while (last + 1 < layers_.size() && elementwise[last + 1]) {
+      const int next = last + 1;
+      const int blob_id = top_id_vecs_[last][0];
+      if (bottom_id_vecs_[next][0] != blob_id ||
+          layer_need_backward_[next] != layer_need_backward_[first]) {
+        break;
+      }
+      int consumers = 0;
+      for (int layer_id = next; layer_id < layers_.size(); ++layer_id) {
+        const vector<int>& bottom_ids = bottom_id_vecs_[layer_id];
+        consumers += std::count(bottom_ids.begin(), bottom_ids.end(),
+            blob_id);
+        const vector<int>& top_ids = top_id_vecs_[layer_id];
+        if (std::count(top_ids.begin(), top_ids.end(), blob_id) > 0) {
+          break;
+        }
+      }
+      if (consumers != 1) {
+        break;
+      }
+      last = next;
+    }
+    // A chain computed in place only saves its bottom for Backward in TRAIN
+    const bool in_place = bottom_id_vecs_[first][0] == top_id_vecs_[last][0];
+    if (last == first ||
+        (in_place && phase_ == TEST && layer_need_backward_[first])) {
+      continue;
+    }
+    LayerParameter fused_param;
+    fused_param.set_type("FusedElementwise");
+    fused_param.set_phase(phase_);
+    string name = layer_names_[first];
+    for (int layer_id = first + 1; layer_id <= last; ++layer_id) {
+      name += "+" + layer_names_[layer_id];
+    }
+    fused_param.set_name(name);
+    vector<shared_ptr<Layer<Dtype> > > chain(layers_.begin() + first,
+        layers_.begin() + last + 1);
+    fused_layers_[first].reset(
+        new FusedElementwiseLayer<Dtype>(fused_param, chain));
+    fused_layers_[first]->SetUp(bottom_vecs_[first], top_vecs_[last]);
+    fused_first_[last] = first;
+    fused_last_[first] = last;
+    LOG_IF(INFO, Caffe::root_solver()) << "Fusing layers " << name;
+    first = last;
+  }
+}
+
+template <typename Dtype>
+int Net<Dtype>::FusedChainFirst(const int layer_id) const {
+  for (int i = layer_id; i >= 0; --i) {
+    if (fused_last_[i] >= 0) {
+      return fused_last_[i] >= layer_id ? i : -1;
+    }
+  }
+  return -1;
+}
+
+template <typename Dtype>
+void Net<Dtype>::ForwardFusedChain(const int first) {
+  const int last = fused_last_[first];
+  // The bottom of a chain in place is overwritten by its fused Forward
+  CHECK_NE(bottom_id_vecs_[first][0], top_id_vecs_[last][0])
+      << "Backward cannot start or stop inside " << fused_layers_[first]->
+      layer_param().name() << ", fused in place. Set fuse_elementwise: false.";
+  for (int i = first; i <= last; ++i) {
+    layers_[i]->Forward(bottom_vecs_[i], top_vecs_[i]);
+  }
+}
+
+template <typename Dtype>
+void Net<Dtype>::ShareActivationMemory() {
+  // The layers of each fused chain run at once, at its first layer
+  vector<int> steps(layers_.size());
+  for (int layer_id = 0; layer_id < layers_.size(); ++layer_id) {
+    steps[layer_id] = layer_id;
+  }
+  for (int layer_id = 0; layer_id < layers_.size(); ++layer_id) {
+    for (int i = layer_id + 1; i <= fused_last_[layer_id]; ++i) {
+      steps[i] = layer_id;
+    }
+  }
+  // The blobs that already share their data, as the tops of Split or Flatten
+  // layers do with their bottom, live and move together
+  map<SyncedMemory*, int> group_ids;
+  vector<int> blob_groups(blobs_.size());
+  for (int blob_id = 0; blob_id < blobs_.size(); ++blob_id) {
+    SyncedMemory* data = blobs_[blob_id]->data().get();
+    if (group_ids.find(data) == group_ids.end()) {
+      const int group_id = group_ids.size();
+      group_ids[data] = group_id;
+    }
+    blob_groups[blob_id] = group_ids[data];
+  }
+  const int num_groups = group_ids.size();
+  vector<size_t> sizes(num_groups, 0);
+  for (int blob_id = 0; blob_id < blobs_.size(); ++blob_id) {
+    sizes[blob_groups[blob_id]] = std::max(sizes[blob_groups[blob_id]],
+        blobs_[blob_id]->count() * sizeof(Dtype));
+  }
+  // The inputs and outputs of the net, the pinned blobs, and the tops of the
+  // layers without bottoms, such as data layers which set the data of their
+  // tops, keep their own memory
+  vector<bool> pinned(num_groups, false);
+  for (int i = 0; i < net_input_blob_indices_.size(); ++i) {
+    pinned[blob_groups[net_input_blob_indices_[i]]] = true;
+  }
+  for (int i = 0; i < net_output_blob_indices_.size(); ++i) {
+    pinned[blob_groups[net_output_blob_indices_[i]]] = true;
+  }
+  for (int i = 0; i < pinned_blob_ids_.size(); ++i) {
+    pinned[blob_groups[pinned_blob_ids_[i]]] = true;
+  }
+  // Each group lives from the first step writing it to the last step
+  // reading or writing it
+  vector<int> first_steps(num_groups, layers_.size());
+  vector<int> last_steps(num_groups, -1);
+  for (int layer_id = 0; layer_id < layers_.size(); ++layer_id) {
+    const int step = steps[layer_id];
+    for (int i = 0; i < top_id_vecs_[layer_id].size(); ++i) {
+      const int group_id = blob_groups[top_id_vecs_[layer_id][i]];
+      first_steps[group_id] = std::min(first_steps[group_id], step);
+      last_steps[group_id] = std::max(last_steps[group_id], step);
+      pinned[group_id] = pinned[group_id] || bottom_id_vecs_[layer_id].empty();
+    }
+    for (int i = 0; i < bottom_id_vecs_[layer_id].size(); ++i) {
+      const int group_id = blob_groups[bottom_id_vecs_[layer_id][i]];
+      last_steps[group_id] = std::max(last_steps[group_id], step);
+    }
+  }
+  vector<pair<int, int> > groups_by_first_step;
+  for (int group_id = 0; group_id < num_groups; ++group_id) {
+    if (!pinned[group_id] && sizes[group_id] > 0) {
+      groups_by_first_step.push_back(
+          make_pair(first_steps[group_id], group_id));
+    }
+  }
+  std::sort(groups_by_first_step.begin(), groups_by_first_step.end());
+  // Each group takes the smallest buffer it fits in among those free since
+  // before its first step, or else grows the largest of them
+  vector<int> group_buffers(num_groups, -1);
+  vector<size_t> buffer_sizes;
+  vector<int> buffer_last_steps;
+  size_t shared_bytes = 0;
+  for (int i = 0; i < groups_by_first_step.size(); ++i) {
+    const int group_id = groups_by_first_step[i].second;
+    const size_t size = sizes[group_id];
+    int buffer_id = -1;
+    for (int j = 0; j < buffer_sizes.size(); ++j) {
+      if (buffer_last_steps[j] >= first_steps[group_id]) {
+        continue;
+      }
+      const bool fits = buffer_sizes[j] >= size;
+      const bool best_fits = buffer_id >= 0 && buffer_sizes[buffer_id] >= size;
+      if (buffer_id < 0 ||
+          (fits && (!best_fits || buffer_sizes[j] < buffer_sizes[buffer_id])) ||
+          (!fits && !best_fits && buffer_sizes[j] > buffer_sizes[buffer_id])) {
+        buffer_id = j;
+      }
+    }
+    if (buffer_id < 0) {
+      buffer_id = buffer_sizes.size();
+      buffer_sizes.push_back(0);
+      buffer_last_steps.push_back(-1);
+    }
+    buffer_sizes[buffer_id] = std::max(buffer_sizes[buffer_id], size);
+    buffer_last_steps[buffer_id] = last_steps[group_id];
+    group_buffers[group_id] = buffer_id;
+    shared_bytes += size;
+  }
+  activation_memory_.clear();
+  size_t buffer_bytes = 0;
+  for (int buffer_id = 0; buffer_id < buffer_sizes.size(); ++buffer_id) {
+    activation_memory_.push_back(shared_ptr<SyncedMemory>(
+        new SyncedMemory(buffer_sizes[buffer_id])));
+    buffer_bytes += buffer_sizes[buffer_id];
+  }
+  activation_memory_blob_ids_.clear();
+  for (int blob_id = 0; blob_id < blobs_.size(); ++blob_id) {
+    const int buffer_id = group_buffers[blob_groups[blob_id]];
+    if (buffer_id >= 0) {
+      blobs_[blob_id]->ShareData(activation_memory_[buffer_id]);
+      activation_memory_blob_ids_.push_back(blob_id);
+    }
+  }
+  size_t pinned_bytes = 0;
+  for (int group_id = 0; group_id < num_groups; ++group_id) {
+    if (group_buffers[group_id] < 0) {
+      pinned_bytes += sizes[group_id];
+    }
+  }
+  LOG_IF(INFO, Caffe::root_solver())
+      << "Sharing " << shared_bytes << " bytes of blobs in "
+      << buffer_sizes.size() << " buffers of " << buffer_bytes << " bytes";
+  LOG_IF(INFO, Caffe::root_solver())
+      << "Memory required for data with sharing: "
+      << pinned_bytes + buffer_bytes << " instead of "
+      << pinned_bytes + shared_bytes;
+}
+
 template <typename Dtype>
 void Net<Dtype>::FilterNet(const NetParameter& param,
     NetParameter* param_filtered) {
@@ -571,7 +808,22 @@ Dtype Net<Dtype>::ForwardFromTo(int start, int end) {
       InputDebugInfo(i);
     }
   }
+  const bool fused = Caffe::mode() == Caffe::CPU && !debug_info_;
+  if (fused) {
+    // The blobs inside a fused chain are not computed: starting inside a
+    // chain that is not in place runs it from its first layer
+    const int first = FusedChainFirst(start);
+    if (first >= 0 && first < start &&
+        bottom_id_vecs_[first][0] != top_id_vecs_[fused_last_[first]][0]) {
+      start = first;
+    }
+  }
   for (int i = start; i <= end; ++i) {
+    if (fused && fused_last_[i] >= 0 && fused_last_[i] <= end) {
+      fused_layers_[i]->Forward(bottom_vecs_[i], top_vecs_[fused_last_[i]]);
+      i = fused_last_[i];
+      continue;
+    }
     // LOG(ERROR) << "Forwarding " << layer_names_[i];
     Dtype layer_loss = layers_[i]->Forward(bottom_vecs_[i], top_vecs_[i]);
     loss += layer_loss;
@@ -635,8 +887,34 @@ template <typename Dtype>
 void Net<Dtype>::BackwardFromTo(int start, int end) {
   CHECK_GE(end, 0);
   CHECK_LT(start, layers_.size());
+  CHECK(!share_activation_memory_)
+      << "Backward needs the blobs that share their memory after Forward";
+  const bool fused = Caffe::mode() == Caffe::CPU && !debug_info_;
+  if (fused) {
+    // The layers of a chain run one by one when Backward starts or stops
+    // inside it, from the blobs inside it
+    int computed = -1;
+    const int start_first = FusedChainFirst(start);
+    if (start_first >= 0 && start < fused_last_[start_first] &&
+        layer_need_backward_[start_first]) {
+      ForwardFusedChain(start_first);
+      computed = start_first;
+    }
+    const int end_first = FusedChainFirst(end);
+    if (end_first >= 0 && end_first < end && end_first != computed &&
+        layer_need_backward_[end_first]) {
+      ForwardFusedChain(end_first);
+    }
+  }
   for (int i = start; i >= end; --i) {
-    if (layer_need_backward_[i]) {
+    const int first = fused_first_[i];
+    if (fused && first >= end) {
+      if (layer_need_backward_[i]) {
+        fused_layers_[first]->Backward(
+            top_vecs_[i], bottom_need_backward_[first], bottom_vecs_[first]);
+      }
+      i = first;
+    } else if (layer_need_backward_[i]) {
       layers_[i]->Backward(
           top_vecs_[i], bottom_need_backward_[i], bottom_vecs_[i]);
       if (debug_info_) { BackwardDebugInfo(i); }
@@ -796,9 +1074,19 @@ void Net<Dtype>::Backward() {
 
 template <typename Dtype>
 void Net<Dtype>::Reshape() {
+  // The blobs sharing memory take their own back, which the layers sharing
+  // data between their bottoms and tops share again as they reshape
+  for (int i = 0; i < activation_memory_blob_ids_.size(); ++i) {
+    Blob<Dtype>* blob = blobs_[activation_memory_blob_ids_[i]].get();
+    blob->ShareData(shared_ptr<SyncedMemory>(
+        new SyncedMemory(blob->count() * sizeof(Dtype))));
+  }
   for (int i = 0; i < layers_.size(); ++i) {
     layers_[i]->Reshape(bottom_vecs_[i], top_vecs_[i]);
   }
+  if (share_activation_memory_) {
+    ShareActivationMemory();
+  }
 }
 
 template <typename Dtype>
@@ -67,7 +67,7 @@ class DataLayerTest : public MultiDeviceTest<TypeParam> {
     db->Close();
   }
 
-  void TestRead() {
+  void TestRead(bool zero_copy = false) {
     const Dtype scale = 3;
     LayerParameter param;
     param.set_phase(TRAIN);
@@ -79,6 +79,7 @@ class DataLayerTest : public MultiDeviceTest<TypeParam> {
     TransformationParameter* transform_param =
         param.mutable_transform_param();
     transform_param->set_scale(scale);
+    param.mutable_prefetch_param()->set_zero_copy(zero_copy);
 
     DataLayer<Dtype> layer(param);
     layer.SetUp(blob_bottom_vec_, blob_top_vec_);
@@ -91,6 +92,7 @@ class DataLayerTest : public MultiDeviceTest<TypeParam> {
     EXPECT_EQ(blob_top_label_->height(), 1);
     EXPECT_EQ(blob_top_label_->width(), 1);
 
+    const Dtype* last_data = NULL;
     for (int iter = 0; iter < 100; ++iter) {
       layer.Forward(blob_bottom_vec_, blob_top_vec_);
       for (int i = 0; i < 5; ++i) {
@@ -102,6 +104,107 @@ class DataLayerTest : public MultiDeviceTest<TypeParam> {
               << "debug: iter " << iter << " i " << i << " j " << j;
         }
       }
+      // Without copies, the top is backed by a different batch each time
+      if (zero_copy && last_data) {
+        EXPECT_NE(last_data, blob_top_data_->cpu_data());
+      }
+      last_data = blob_top_data_->cpu_data();
+    }
+  }
+
+  // Parsing records on several threads must not change the order in which
+  // they reach the batch, also when batches straddle the end of the database.
+  void TestReadParserThreads() {
+    const int batch_size = 7;
+    LayerParameter param;
+    param.set_phase(TRAIN);
+    DataParameter* data_param = param.mutable_data_param();
+    data_param->set_batch_size(batch_size);
+    data_param->set_source(filename_->c_str());
+    data_param->set_backend(backend_);
+    data_param->set_parser_threads(3);
+
+    DataLayer<Dtype> layer(param);
+    layer.SetUp(blob_bottom_vec_, blob_top_vec_);
+    EXPECT_EQ(blob_top_data_->num(), batch_size);
+    EXPECT_EQ(blob_top_label_->num(), batch_size);
+
+    for (int iter = 0; iter < 100; ++iter) {
+      layer.Forward(blob_bottom_vec_, blob_top_vec_);
+      for (int i = 0; i < batch_size; ++i) {
+        const int record = (iter * batch_size + i) % 5;
+        EXPECT_EQ(record, blob_top_label_->cpu_data()[i])
+            << "debug: iter " << iter << " i " << i;
+        for (int j = 0; j < 24; ++j) {
+          EXPECT_EQ(record, blob_top_data_->cpu_data()[i * 24 + j])
+              << "debug: iter " << iter << " i " << i << " j " << j;
+        }
+      }
+    }
+  }
+
+  // The prefetch depth is set by prefetch_param, or by the byte budget of
+  // the batches, and the queue occupancy is counted for each batch taken.
+  void TestPrefetchDepth() {
+    LayerParameter param;
+    param.set_phase(TRAIN);
+    DataParameter* data_param = param.mutable_data_param();
+    data_param->set_batch_size(5);
+    data_param->set_source(filename_->c_str());
+    data_param->set_backend(backend_);
+    // 5 items of 2x3x4 data and 1 label
+    const uint64_t batch_bytes = 5 * (24 + 1) * sizeof(Dtype);
+
+    PrefetchParameter* prefetch_param = param.mutable_prefetch_param();
+    prefetch_param->set_depth(5);
+    {
+      DataLayer<Dtype> layer(param);
+      layer.SetUp(blob_bottom_vec_, blob_top_vec_);
+      EXPECT_EQ(5, layer.prefetch_depth());
+      for (int iter = 0; iter < 10; ++iter) {
+        layer.Forward(blob_bottom_vec_, blob_top_vec_);
+        for (int i = 0; i < 5; ++i) {
+          EXPECT_EQ(i, blob_top_label_->cpu_data()[i]);
+        }
+      }
+      EXPECT_EQ(10, layer.prefetch_batches_taken());
+      EXPECT_LE(layer.prefetch_batches_starved(), 10);
+      EXPECT_GE(layer.prefetch_mean_occupancy(), 0);
+      EXPECT_LE(layer.prefetch_mean_occupancy(), 5);
+    }
+    // The budget is bounded by the depth when both are set
+    prefetch_param->set_max_bytes(2 * batch_bytes + 1);
+    {
+      DataLayer<Dtype> layer(param);
+      layer.SetUp(blob_bottom_vec_, blob_top_vec_);
+      EXPECT_EQ(2, layer.prefetch_depth());
+    }
+    prefetch_param->set_max_bytes(10 * batch_bytes);
+    {
+      DataLayer<Dtype> layer(param);
+      layer.SetUp(blob_bottom_vec_, blob_top_vec_);
+      EXPECT_EQ(5, layer.prefetch_depth());
+    }
+    // Otherwise the budget alone sets the depth, keeping at least one batch
+    prefetch_param->clear_depth();
+    {
+      DataLayer<Dtype> layer(param);
+      layer.SetUp(blob_bottom_vec_, blob_top_vec_);
+      EXPECT_EQ(10, layer.prefetch_depth());
+      for (int iter = 0; iter < 3; ++iter) {
+        layer.Forward(blob_bottom_vec_, blob_top_vec_);
+        for (int i = 0; i < 5; ++i) {
+          EXPECT_EQ(i, blob_top_label_->cpu_data()[i]);
+        }
+      }
+    }
+    prefetch_param->set_max_bytes(1);
+    {
+      DataLayer<Dtype> layer(param);
+      layer.SetUp(blob_bottom_vec_, blob_top_vec_);
+      EXPECT_EQ(1, layer.prefetch_depth());
+      layer.Forward(blob_bottom_vec_, blob_top_vec_);
+      EXPECT_EQ(1, layer.prefetch_batches_taken());
     }
   }
 
@@ -224,7 +327,7 @@ class DataLayerTest : public MultiDeviceTest<TypeParam> {
     }
   }
 
-  void TestReadCropTrainSequenceSeeded() {
+  void TestReadCropTrainSequenceSeeded(int transform_threads = 1) {
     LayerParameter param;
     param.set_phase(TRAIN);
     DataParameter* data_param = param.mutable_data_param();
@@ -236,6 +339,7 @@ class DataLayerTest : public MultiDeviceTest<TypeParam> {
         param.mutable_transform_param();
     transform_param->set_crop_size(1);
     transform_param->set_mirror(true);
+    transform_param->set_threads(transform_threads);
 
     // Get crop sequence with Caffe seed 1701.
     Caffe::set_random_seed(seed_);
@@ -356,6 +460,24 @@ TYPED_TEST(DataLayerTest, TestReadLevelDB) {
   this->TestRead();
 }
 
+TYPED_TEST(DataLayerTest, TestReadZeroCopyLevelDB) {
+  const bool unique_pixels = false;  // all pixels the same; images different
+  this->Fill(unique_pixels, DataParameter_DB_LEVELDB);
+  this->TestRead(true);
+}
+
+TYPED_TEST(DataLayerTest, TestReadParserThreadsLevelDB) {
+  const bool unique_pixels = false;  // all pixels the same; images different
+  this->Fill(unique_pixels, DataParameter_DB_LEVELDB);
+  this->TestReadParserThreads();
+}
+
+TYPED_TEST(DataLayerTest, TestPrefetchDepthLevelDB) {
+  const bool unique_pixels = false;  // all pixels the same; images different
+  this->Fill(unique_pixels, DataParameter_DB_LEVELDB);
+  this->TestPrefetchDepth();
+}
+
 TYPED_TEST(DataLayerTest, TestReshapeLevelDB) {
   this->TestReshape(DataParameter_DB_LEVELDB);
 }
@@ -374,6 +496,12 @@ TYPED_TEST(DataLayerTest, TestReadCropTrainSequenceSeededLevelDB) {
   this->TestReadCropTrainSequenceSeeded();
 }
 
+TYPED_TEST(DataLayerTest, TestReadCropTrainTransformThreadsLevelDB) {
+  const bool unique_pixels = true;  // all images the same; pixels different
+  this->Fill(unique_pixels, DataParameter_DB_LEVELDB);
+  this->TestReadCropTrainSequenceSeeded(3);
+}
+
 // Test that the sequence of random crops differs across iterations when
 // Caffe::set_random_seed isn't called (and seeds from srand are ignored).
 TYPED_TEST(DataLayerTest, TestReadCropTrainSequenceUnseededLevelDB) {
@@ -396,6 +524,24 @@ TYPED_TEST(DataLayerTest, TestReadLMDB) {
   this->TestRead();
 }
 
+TYPED_TEST(DataLayerTest, TestReadZeroCopyLMDB) {
+  const bool unique_pixels = false;  // all pixels the same; images different
+  this->Fill(unique_pixels, DataParameter_DB_LMDB);
+  this->TestRead(true);
+}
+
+TYPED_TEST(DataLayerTest, TestReadParserThreadsLMDB) {
+  const bool unique_pixels = false;  // all pixels the same; images different
+  this->Fill(unique_pixels, DataParameter_DB_LMDB);
+  this->TestReadParserThreads();
+}
+
+TYPED_TEST(DataLayerTest, TestPrefetchDepthLMDB) {
+  const bool unique_pixels = false;  // all pixels the same; images different
+  this->Fill(unique_pixels, DataParameter_DB_LMDB);
+  this->TestPrefetchDepth();
+}
+
 TYPED_TEST(DataLayerTest, TestReshapeLMDB) {
   this->TestReshape(DataParameter_DB_LMDB);
 }
@@ -414,6 +560,12 @@ TYPED_TEST(DataLayerTest, TestReadCropTrainSequenceSeededLMDB) {
   this->TestReadCropTrainSequenceSeeded();
 }
 
+TYPED_TEST(DataLayerTest, TestReadCropTrainTransformThreadsLMDB) {
+  const bool unique_pixels = true;  // all images the same; pixels different
+  this->Fill(unique_pixels, DataParameter_DB_LMDB);
+  this->TestReadCropTrainSequenceSeeded(3);
+}
+
 // Test that the sequence of random crops differs across iterations when
 // Caffe::set_random_seed isn't called (and seeds from srand are ignored).
 TYPED_TEST(DataLayerTest, TestReadCropTrainSequenceUnseededLMDB) {
@@ -122,6 +122,29 @@ TYPED_TEST(DataTransformTest, TestEmptyTransformUniquePixels) {
   }
 }
 
+TYPED_TEST(DataTransformTest, TestEmptyTransformExternalPixels) {
+  TransformationParameter transform_param;
+  const bool unique_pixels = true;  // pixels are consecutive ints [0,size]
+  const int label = 0;
+  const int channels = 3;
+  const int height = 4;
+  const int width = 5;
+
+  // Pixels are read from the given buffer, e.g. a database memory map, not
+  // from the datum itself.
+  Datum datum;
+  FillDatum(label, channels, height, width, unique_pixels, &datum);
+  const string pixels = datum.data();
+  datum.clear_data();
+  Blob<TypeParam> blob(1, 3, 4, 5);
+  DataTransformer<TypeParam> transformer(transform_param, TEST);
+  transformer.InitRand();
+  transformer.Transform(datum, pixels.data(), pixels.size(), &blob);
+  for (int j = 0; j < blob.count(); ++j) {
+    EXPECT_EQ(blob.cpu_data()[j], j);
+  }
+}
+
 TYPED_TEST(DataTransformTest, TestCropSize) {
   TransformationParameter transform_param;
   const bool unique_pixels = false;  // all pixels the same equal to label
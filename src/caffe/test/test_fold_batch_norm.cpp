@@ -0,0 +1,223 @@
+#include <algorithm>
+#include <cmath>
+#include <string>
+#include <vector>
+
+#include "google/protobuf/text_format.h"
+#include "gtest/gtest.h"
+
+#include "caffe/blob.hpp"
+#include "caffe/common.hpp"
+#include "caffe/filler.hpp"
+#include "caffe/net.hpp"
+#include "caffe/proto/caffe.pb.h"
+#include "caffe/util/fold_batch_norm.hpp"
+#include "caffe/util/math_functions.hpp"
+
+#include "caffe/test/test_caffe_main.hpp"
+
+namespace caffe {
+
+template <typename Dtype>
+class FoldBatchNormTest : public ::testing::Test {
+ protected:
+  // Checks that folding the layers of the net of input_param removes the
+  // layers named folded, and gives the same outputs from its trained weights
+  void RunFoldBatchNormTest(const string& input_param_string,
+      const vector<string>& folded) {
+    Caffe::set_mode(Caffe::CPU);
+    Caffe::set_random_seed(1701);
+    NetParameter param;
+    CHECK(google::protobuf::TextFormat::ParseFromString(
+        input_param_string, &param));
+    Net<Dtype> net(param);
+    // Trained statistics of the BatchNorm layers, summed with a weight of 2
+    FillerParameter filler_param;
+    GaussianFiller<Dtype> filler(filler_param);
+    for (int i = 0; i < net.layers().size(); ++i) {
+      if (string(net.layers()[i]->type()) == "BatchNorm") {
+        const vector<shared_ptr<Blob<Dtype> > >& stats =
+            net.layers()[i]->blobs();
+        filler.Fill(stats[0].get());
+        caffe_rng_uniform<Dtype>(stats[1]->count(), 1, 3,
+            stats[1]->mutable_cpu_data());
+        stats[2]->mutable_cpu_data()[0] = 2;
+      }
+    }
+    NetParameter weights;
+    net.ToProto(&weights);
+    NetParameter param_folded, weights_folded;
+    FoldBatchNorm(param, weights, &param_folded, &weights_folded);
+
+    EXPECT_EQ(param.layer_size() - folded.size(), param_folded.layer_size());
+    EXPECT_EQ(param_folded.layer_size(), weights_folded.layer_size());
+    for (int i = 0; i < param_folded.layer_size(); ++i) {
+      EXPECT_EQ(0, param_folded.layer(i).blobs_size());
+      EXPECT_EQ(param_folded.layer(i).name(), weights_folded.layer(i).name());
+      EXPECT_TRUE(std::find(folded.begin(), folded.end(),
+          param_folded.layer(i).name()) == folded.end());
+    }
+    Net<Dtype> net_folded(param_folded);
+    net_folded.CopyTrainedLayersFrom(weights_folded);
+    filler.Fill(net.input_blobs()[0]);
+    net_folded.input_blobs()[0]->CopyFrom(*net.input_blobs()[0]);
+    net.ForwardPrefilled();
+    net_folded.ForwardPrefilled();
+    ASSERT_EQ(net.output_blobs().size(), net_folded.output_blobs().size());
+    const Dtype kTolerance = 1e-4;
+    for (int i = 0; i < net.output_blobs().size(); ++i) {
+      const Blob<Dtype>& output = *net.output_blobs()[i];
+      const Blob<Dtype>& output_folded = *net_folded.output_blobs()[i];
+      ASSERT_EQ(output.count(), output_folded.count());
+      for (int j = 0; j < output.count(); ++j) {
+        const Dtype value = output.cpu_data()[j];
+        EXPECT_NEAR(value, output_folded.cpu_data()[j],
+            kTolerance * std::max(Dtype(1), std::fabs(value)));
+      }
+    }
+  }
+};
+
+TYPED_TEST_CASE(FoldBatchNormTest, TestDtypes);
+
+TYPED_TEST(FoldBatchNormTest, TestFoldConvolution) {
+  const string& input_proto =
+      "name: 'TestNetwork' "
+      "input: 'data' "
+      "input_shape { dim: 2 dim: 3 dim: 9 dim: 9 } "
+      "layer { "
+      "  name: 'conv1' "
+      "  type: 'Convolution' "
+      "  convolution_param { "
+      "    num_output: 4 "
+      "    kernel_size: 3 "
+      "    weight_filler { type: 'gaussian' std: 0.5 } "
+      "    bias_filler { type: 'gaussian' std: 0.5 } "
+      "  } "
+      "  bottom: 'data' "
+      "  top: 'conv1' "
+      "} "
+      "layer { "
+      "  name: 'bn1' "
+      "  type: 'BatchNorm' "
+      "  bottom: 'conv1' "
+      "  top: 'conv1' "
+      "} "
+      "layer { "
+      "  name: 'scale1' "
+      "  type: 'Scale' "
+      "  scale_param { "
+      "    bias_term: true "
+      "    filler { type: 'uniform' min: 0.5 max: 1.5 } "
+      "    bias_filler { type: 'gaussian' std: 0.5 } "
+      "  } "
+      "  bottom: 'conv1' "
+      "  top: 'conv1' "
+      "} "
+      "layer { "
+      "  name: 'relu1' "
+      "  type: 'ReLU' "
+      "  bottom: 'conv1' "
+      "  top: 'conv1' "
+      "} "
+      "layer { "
+      "  name: 'conv2' "
+      "  type: 'Convolution' "
+      "  convolution_param { "
+      "    num_output: 4 "
+      "    group: 4 "
+      "    kernel_size: 3 "
+      "    bias_term: false "
+      "    weight_filler { type: 'gaussian' std: 0.5 } "
+      "  } "
+      "  bottom: 'conv1' "
+      "  top: 'conv2' "
+      "} "
+      "layer { "
+      "  name: 'bn2' "
+      "  type: 'BatchNorm' "
+      "  bottom: 'conv2' "
+      "  top: 'bn2' "
+      "} "
+      "layer { "
+      "  name: 'bias2' "
+      "  type: 'Bias' "
+      "  bias_param { filler { type: 'gaussian' std: 0.5 } } "
+      "  bottom: 'bn2' "
+      "  top: 'bias2' "
+      "} "
+      "layer { "
+      "  name: 'scale2' "
+      "  type: 'Scale' "
+      "  scale_param { "
+      "    num_axes: 0 "
+      "    filler { type: 'uniform' min: 0.5 max: 1.5 } "
+      "  } "
+      "  bottom: 'bias2' "
+      "  top: 'bias2' "
+      "} ";
+  vector<string> folded;
+  folded.push_back("bn1");
+  folded.push_back("scale1");
+  folded.push_back("bn2");
+  folded.push_back("bias2");
+  folded.push_back("scale2");
+  this->RunFoldBatchNormTest(input_proto, folded);
+}
+
+TYPED_TEST(FoldBatchNormTest, TestFoldInnerProduct) {
+  const string& input_proto =
+      "name: 'TestNetwork' "
+      "input: 'data' "
+      "input_shape { dim: 2 dim: 3 dim: 4 dim: 5 } "
+      "layer { "
+      "  name: 'ip1' "
+      "  type: 'InnerProduct' "
+      "  inner_product_param { "
+      "    num_output: 6 "
+      "    weight_filler { type: 'gaussian' std: 0.5 } "
+      "    bias_filler { type: 'gaussian' std: 0.5 } "
+      "  } "
+      "  bottom: 'data' "
+      "  top: 'ip1' "
+      "} "
+      "layer { "
+      "  name: 'bn1' "
+      "  type: 'BatchNorm' "
+      "  bottom: 'ip1' "
+      "  top: 'ip1' "
+      "} "
+      "layer { "
+      "  name: 'ip2' "
+      "  type: 'InnerProduct' "
+      "  inner_product_param { "
+      "    num_output: 3 "
+      "    weight_filler { type: 'gaussian' std: 0.5 } "
+      "    bias_filler { type: 'gaussian' std: 0.5 } "
+      "  } "
+      "  bottom: 'ip1' "
+      "  top: 'ip2' "
+      "} "
+      "layer { "
+      "  name: 'scale2' "
+      "  type: 'Scale' "
+      "  scale_param { "
+      "    filler { type: 'uniform' min: 0.5 max: 1.5 } "
+      "  } "
+      "  bottom: 'ip2' "
+      "  top: 'scale2' "
+      "} "
+      "layer { "
+      "  name: 'sum' "
+      "  type: 'Eltwise' "
+      "  bottom: 'ip2' "
+      "  bottom: 'scale2' "
+      "  top: 'sum' "
+      "} ";
+  // scale2 stays as ip2 has another consumer
+  vector<string> folded;
+  folded.push_back("bn1");
+  this->RunFoldBatchNormTest(input_proto, folded);
+}
+
+}  // namespace caffe
@@ -6,6 +6,7 @@
 #include "caffe/common.hpp"
 #include "caffe/filler.hpp"
 #include "caffe/layers/im2col_layer.hpp"
+#include "caffe/util/math_functions.hpp"
 
 #include "caffe/test/test_caffe_main.hpp"
 #include "caffe/test/test_gradient_check_util.hpp"
@@ -175,4 +176,81 @@ TYPED_TEST(Im2colLayerTest, TestRectGradient) {
       this->blob_top_vec_);
 }
 
+TYPED_TEST(Im2colLayerTest, TestPadThreads) {
+  typedef typename TypeParam::Dtype Dtype;
+  // Large enough for the CPU conversions to be split between threads
+  vector<int> bottom_shape;
+  bottom_shape.push_back(2);
+  bottom_shape.push_back(16);
+  bottom_shape.push_back(31);
+  bottom_shape.push_back(33);
+  this->blob_bottom_->Reshape(bottom_shape);
+  FillerParameter filler_param;
+  GaussianFiller<Dtype> filler(filler_param);
+  filler.Fill(this->blob_bottom_);
+  const int kernel = 3;
+  const int strides[] = {1, 2};
+  const int pads[] = {1, 2};
+  const int dilations[] = {1, 2};
+  const int threads[] = {1, 4};
+  const int cpu_threads = Caffe::cpu_threads();
+  for (int config = 0; config < 2; ++config) {
+    for (int force_nd = 0; force_nd < 2; ++force_nd) {
+      for (int t = 0; t < 2; ++t) {
+        Caffe::set_cpu_threads(threads[t]);
+        LayerParameter layer_param;
+        ConvolutionParameter* convolution_param =
+            layer_param.mutable_convolution_param();
+        convolution_param->add_kernel_size(kernel);
+        convolution_param->add_stride(strides[config]);
+        convolution_param->add_pad(pads[config]);
+        convolution_param->add_dilation(dilations[config]);
+        convolution_param->set_force_nd_im2col(force_nd);
+        Im2colLayer<Dtype> layer(layer_param);
+        layer.SetUp(this->blob_bottom_vec_, this->blob_top_vec_);
+        layer.Forward(this->blob_bottom_vec_, this->blob_top_vec_);
+        caffe_copy(this->blob_top_->count(), this->blob_top_->cpu_data(),
+            this->blob_top_->mutable_cpu_diff());
+        vector<bool> propagate_down(1, true);
+        layer.Backward(this->blob_top_vec_, propagate_down,
+            this->blob_bottom_vec_);
+        // Compare to a direct computation, which also accumulates the top
+        // into the bottom diff.
+        const Blob<Dtype>& top = *this->blob_top_;
+        Blob<Dtype> bottom_diff(bottom_shape);
+        caffe_set(bottom_diff.count(), Dtype(0),
+            bottom_diff.mutable_cpu_data());
+        for (int n = 0; n < top.num(); ++n) {
+          for (int c = 0; c < top.channels(); ++c) {
+            const int channel = c / (kernel * kernel);
+            const int kernel_row = c / kernel % kernel;
+            const int kernel_col = c % kernel;
+            for (int h = 0; h < top.height(); ++h) {
+              for (int w = 0; w < top.width(); ++w) {
+                const int row = h * strides[config] - pads[config]
+                    + kernel_row * dilations[config];
+                const int col = w * strides[config] - pads[config]
+                    + kernel_col * dilations[config];
+                const bool inside = row >= 0 && row < bottom_shape[2]
+                    && col >= 0 && col < bottom_shape[3];
+                ASSERT_EQ(top.data_at(n, c, h, w), inside ?
+                    this->blob_bottom_->data_at(n, channel, row, col) : 0);
+                if (inside) {
+                  bottom_diff.mutable_cpu_data()[bottom_diff.offset(
+                      n, channel, row, col)] += top.data_at(n, c, h, w);
+                }
+              }
+            }
+          }
+        }
+        for (int i = 0; i < bottom_diff.count(); ++i) {
+          EXPECT_NEAR(this->blob_bottom_->cpu_diff()[i],
+              bottom_diff.cpu_data()[i], 1e-5);
+        }
+      }
+    }
+  }
+  Caffe::set_cpu_threads(cpu_threads);
+}
+
 }  // namespace caffe
@@ -0,0 +1,58 @@
+#ifdef USE_OPENCV
+#include <opencv2/core/core.hpp>
+
+#include "gtest/gtest.h"
+
+#include "caffe/common.hpp"
+#include "caffe/util/image_cache.hpp"
+
+#include "caffe/test/test_caffe_main.hpp"
+
+namespace caffe {
+
+class ImageCacheTest : public ::testing::Test {};
+
+TEST_F(ImageCacheTest, TestGetPut) {
+  ImageCache cache(1000);
+  cv::Mat image;
+  EXPECT_FALSE(cache.Get(0, &image));
+  cv::Mat image0(10, 10, CV_8UC3);
+  image0.ptr<uchar>(0)[0] = 42;
+  cache.Put(0, image0);
+  EXPECT_EQ(cache.bytes(), 300);
+  EXPECT_TRUE(cache.Get(0, &image));
+  EXPECT_EQ(image.data, image0.data);
+  EXPECT_EQ(image.ptr<uchar>(0)[0], 42);
+  EXPECT_EQ(cache.hits(), 1);
+  EXPECT_EQ(cache.misses(), 1);
+}
+
+TEST_F(ImageCacheTest, TestEvictLeastRecentlyUsed) {
+  ImageCache cache(1000);
+  for (int i = 0; i < 3; ++i) {
+    cache.Put(i, cv::Mat(10, 10, CV_8UC3));
+  }
+  EXPECT_EQ(cache.bytes(), 900);
+  cv::Mat image;
+  // Use image 0, so that 1 is the least recently used
+  EXPECT_TRUE(cache.Get(0, &image));
+  cache.Put(3, cv::Mat(10, 10, CV_8UC3));
+  EXPECT_EQ(cache.bytes(), 900);
+  EXPECT_TRUE(cache.Get(0, &image));
+  EXPECT_FALSE(cache.Get(1, &image));
+  EXPECT_TRUE(cache.Get(2, &image));
+  EXPECT_TRUE(cache.Get(3, &image));
+}
+
+TEST_F(ImageCacheTest, TestSkipLargeImages) {
+  ImageCache cache(1000);
+  cache.Put(0, cv::Mat(10, 10, CV_8UC3));
+  cache.Put(1, cv::Mat(20, 20, CV_8UC3));
+  cv::Mat image;
+  EXPECT_TRUE(cache.Get(0, &image));
+  EXPECT_FALSE(cache.Get(1, &image));
+  EXPECT_EQ(cache.bytes(), 300);
+}
+
+}  // namespace caffe
+#endif  // USE_OPENCV
@@ -1,8 +1,11 @@
+#include <boost/thread.hpp>
+
 #include "glog/logging.h"
 #include "gtest/gtest.h"
 
 #include "caffe/internal_thread.hpp"
 #include "caffe/util/math_functions.hpp"
+#include "caffe/util/thread_pool.hpp"
 
 #include "caffe/test/test_caffe_main.hpp"
 
@@ -49,5 +52,51 @@ TEST_F(InternalThreadTest, TestRandomSeed) {
   t3.StopInternalThread();
 }
 
+TEST_F(InternalThreadTest, TestThreadPoolRandomSeed) {
+  // Starting the threads of a pool does not draw from the Caffe RNG
+  Caffe::set_random_seed(1701);
+  const unsigned int expected = caffe_rng_rand();
+  Caffe::set_random_seed(1701);
+  ThreadPool pool(4);
+  EXPECT_EQ(expected, caffe_rng_rand());
+}
+
+class TestThreadCpuThreads : public InternalThread {
+  void InternalThreadEntry() {
+    EXPECT_EQ(3, Caffe::cpu_threads());
+  }
+};
+
+TEST_F(InternalThreadTest, TestCpuThreads) {
+  const int cpu_threads = Caffe::cpu_threads();
+  Caffe::set_cpu_threads(3);
+  TestThreadCpuThreads thread;
+  thread.StartInternalThread();
+  thread.StopInternalThread();
+  Caffe::set_cpu_threads(cpu_threads);
+}
+
+static void CheckDefaultCpuThreads() {
+  EXPECT_EQ(1, Caffe::cpu_threads());
+}
+
+TEST_F(InternalThreadTest, TestDefaultCpuThreads) {
+  // Threads other than the main one do not default to all hardware threads
+  boost::thread thread(&CheckDefaultCpuThreads);
+  thread.join();
+}
+
+TEST_F(InternalThreadTest, TestCpuPoolRandomSeed) {
+  // Creating the pool of the CPU kernels does not draw from the Caffe RNG
+  const int cpu_threads = Caffe::cpu_threads();
+  Caffe::set_cpu_threads(4);
+  Caffe::set_random_seed(1701);
+  const unsigned int expected = caffe_rng_rand();
+  Caffe::set_random_seed(1701);
+  EXPECT_EQ(4, Caffe::cpu_pool().size());
+  EXPECT_EQ(expected, caffe_rng_rand());
+  Caffe::set_cpu_threads(cpu_threads);
+}
+
 }  // namespace caffe
 
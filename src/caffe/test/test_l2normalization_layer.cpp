@@ -9,6 +9,7 @@
 #include "caffe/common.hpp"
 #include "caffe/filler.hpp"
 #include "caffe/layers/l2_normalization_layer.hpp"
+#include "caffe/util/math_functions.hpp"
 
 #include "caffe/test/test_caffe_main.hpp"
 #include "caffe/test/test_gradient_check_util.hpp"
@@ -87,4 +88,36 @@ TYPED_TEST(L2NormalizationLayerTest, TestGradient) {
       this->blob_top_vec_);
 }
 
+TYPED_TEST(L2NormalizationLayerTest, TestInPlace) {
+  typedef typename TypeParam::Dtype Dtype;
+  Blob<Dtype> top_diff(10, 4, 2, 3);
+  FillerParameter filler_param;
+  GaussianFiller<Dtype> filler(filler_param);
+  filler.Fill(&top_diff);
+  vector<bool> propagate_down(1, true);
+  LayerParameter layer_param;
+  L2NormalizationLayer<Dtype> layer(layer_param);
+  layer.SetUp(this->blob_bottom_vec_, this->blob_top_vec_);
+  layer.Forward(this->blob_bottom_vec_, this->blob_top_vec_);
+  caffe_copy(top_diff.count(), top_diff.cpu_data(),
+      this->blob_top_->mutable_cpu_diff());
+  layer.Backward(this->blob_top_vec_, propagate_down, this->blob_bottom_vec_);
+  // Same computation, in place on a copy of the bottom
+  Blob<Dtype> blob_in_place;
+  blob_in_place.CopyFrom(*this->blob_bottom_, false, true);
+  vector<Blob<Dtype>*> in_place_vec(1, &blob_in_place);
+  L2NormalizationLayer<Dtype> layer_in_place(layer_param);
+  layer_in_place.SetUp(in_place_vec, in_place_vec);
+  layer_in_place.Forward(in_place_vec, in_place_vec);
+  caffe_copy(top_diff.count(), top_diff.cpu_data(),
+      blob_in_place.mutable_cpu_diff());
+  layer_in_place.Backward(in_place_vec, propagate_down, in_place_vec);
+  for (int i = 0; i < blob_in_place.count(); ++i) {
+    EXPECT_NEAR(blob_in_place.cpu_data()[i], this->blob_top_->cpu_data()[i],
+        1e-6);
+    EXPECT_NEAR(blob_in_place.cpu_diff()[i],
+        this->blob_bottom_->cpu_diff()[i], 1e-6);
+  }
+}
+
 }  // namespace caffe
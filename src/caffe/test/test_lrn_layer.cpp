@@ -7,6 +7,7 @@
 #include "caffe/common.hpp"
 #include "caffe/filler.hpp"
 #include "caffe/layers/lrn_layer.hpp"
+#include "caffe/util/math_functions.hpp"
 
 #ifdef USE_CUDNN
 #include "caffe/layers/cudnn_lcn_layer.hpp"
@@ -250,6 +251,60 @@ TYPED_TEST(LRNLayerTest, TestGradientWithinChannel) {
       this->blob_top_vec_);
 }
 
+TYPED_TEST(LRNLayerTest, TestThreads) {
+  typedef typename TypeParam::Dtype Dtype;
+  // Large enough for the CPU passes to be split between threads, with
+  // several tiles of positions per image
+  this->blob_bottom_->Reshape(2, 16, 45, 47);
+  FillerParameter filler_param;
+  GaussianFiller<Dtype> filler(filler_param);
+  filler.Fill(this->blob_bottom_);
+  const LRNParameter_NormRegion regions[] = {
+      LRNParameter_NormRegion_ACROSS_CHANNELS,
+      LRNParameter_NormRegion_WITHIN_CHANNEL};
+  const float betas[] = {0.75, 1.5};
+  const int threads[] = {1, 4};
+  const int cpu_threads = Caffe::cpu_threads();
+  for (int r = 0; r < 2; ++r) {
+    for (int b = 0; b < 2; ++b) {
+      Blob<Dtype> bottom_diff;
+      for (int t = 0; t < 2; ++t) {
+        Caffe::set_cpu_threads(threads[t]);
+        LayerParameter layer_param;
+        layer_param.mutable_lrn_param()->set_norm_region(regions[r]);
+        layer_param.mutable_lrn_param()->set_beta(betas[b]);
+        LRNLayer<Dtype> layer(layer_param);
+        layer.SetUp(this->blob_bottom_vec_, this->blob_top_vec_);
+        layer.Forward(this->blob_bottom_vec_, this->blob_top_vec_);
+        Blob<Dtype> top_reference;
+        this->ReferenceLRNForward(*(this->blob_bottom_), layer_param,
+            &top_reference);
+        for (int i = 0; i < this->blob_top_->count(); ++i) {
+          EXPECT_NEAR(this->blob_top_->cpu_data()[i],
+              top_reference.cpu_data()[i], this->epsilon_);
+        }
+        caffe_copy(this->blob_top_->count(), this->blob_top_->cpu_data(),
+            this->blob_top_->mutable_cpu_diff());
+        vector<bool> propagate_down(1, true);
+        layer.Backward(this->blob_top_vec_, propagate_down,
+            this->blob_bottom_vec_);
+        // The threads process whole images or planes, in the same order
+        if (t == 0) {
+          bottom_diff.ReshapeLike(*this->blob_bottom_);
+          caffe_copy(bottom_diff.count(), this->blob_bottom_->cpu_diff(),
+              bottom_diff.mutable_cpu_data());
+        } else {
+          for (int i = 0; i < bottom_diff.count(); ++i) {
+            EXPECT_EQ(this->blob_bottom_->cpu_diff()[i],
+                bottom_diff.cpu_data()[i]);
+          }
+        }
+      }
+    }
+  }
+  Caffe::set_cpu_threads(cpu_threads);
+}
+
 #ifdef USE_CUDNN
 template <typename Dtype>
 class CuDNNLRNLayerTest : public GPUDeviceTest<Dtype> {
@@ -1,6 +1,8 @@
 #include <stdint.h>  // for uint32_t & uint64_t
 #include <time.h>
 #include <cmath>  // for std::fabs
+#include <limits>
+#include <vector>
 
 #include "gtest/gtest.h"
 
@@ -8,6 +10,7 @@
 #include "caffe/common.hpp"
 #include "caffe/filler.hpp"
 #include "caffe/util/math_functions.hpp"
+#include "caffe/util/simd.hpp"
 
 #include "caffe/test/test_caffe_main.hpp"
 
@@ -119,6 +122,147 @@ TYPED_TEST(CPUMathFunctionsTest, TestCopy) {
   }
 }
 
+TYPED_TEST(CPUMathFunctionsTest, TestSimdLevels) {
+  // Large enough for the kernels to be split between threads, with values
+  // left after the last vector
+  const int n = this->blob_bottom_->count() * 4 + 3;
+  vector<TypeParam> a(n), b(n), y(n), expected(n);
+  caffe_rng_gaussian<TypeParam>(n, 0, 1, &a[0]);
+  caffe_rng_gaussian<TypeParam>(n, 0, 1, &b[0]);
+  a[0] = 0;
+  a[1] = -TypeParam(0);
+  const TypeParam alpha = 1.5;
+  const int threads[] = {1, 4};
+  const int cpu_threads = Caffe::cpu_threads();
+  for (int level = SIMD_GENERIC; level <= simd_cpu_level(); ++level) {
+    set_simd_level(static_cast<SimdLevel>(level));
+    for (int t = 0; t < 2; ++t) {
+      Caffe::set_cpu_threads(threads[t]);
+      for (int op = 0; op < 9; ++op) {
+        for (int i = 0; i < n; ++i) {
+          switch (op) {
+          case 0: expected[i] = a[i] + b[i]; break;
+          case 1: expected[i] = a[i] - b[i]; break;
+          case 2: expected[i] = a[i] * b[i]; break;
+          case 3: expected[i] = a[i] / b[i]; break;
+          case 4: expected[i] = a[i] * a[i]; break;
+          case 5: expected[i] = std::fabs(a[i]); break;
+          case 6: expected[i] = a[i] > 0 ? 1 : (a[i] < 0 ? -1 : 0); break;
+          case 7: expected[i] = a[i] * alpha; break;
+          case 8: expected[i] = a[i] + alpha; break;
+          }
+        }
+        switch (op) {
+        case 0: caffe_add(n, &a[0], &b[0], &y[0]); break;
+        case 1: caffe_sub(n, &a[0], &b[0], &y[0]); break;
+        case 2: caffe_mul(n, &a[0], &b[0], &y[0]); break;
+        case 3: caffe_div(n, &a[0], &b[0], &y[0]); break;
+        case 4: caffe_sqr(n, &a[0], &y[0]); break;
+        case 5: caffe_cpu_fabs(n, &a[0], &y[0]); break;
+        case 6: caffe_cpu_sign(n, &a[0], &y[0]); break;
+        case 7: caffe_cpu_scale(n, alpha, &a[0], &y[0]); break;
+        case 8:
+          // In place
+          y = a;
+          caffe_add_scalar(n, alpha, &y[0]);
+          break;
+        }
+        for (int i = 0; i < n; ++i) {
+          ASSERT_EQ(y[i], expected[i]) << simd_level_name(simd_level())
+              << ", " << threads[t] << " threads, operation " << op
+              << ", index " << i;
+        }
+        if (op == 5) {
+          EXPECT_FALSE(std::signbit(y[1]));
+        }
+      }
+    }
+  }
+  set_simd_level(simd_cpu_level());
+  Caffe::set_cpu_threads(cpu_threads);
+}
+
+TYPED_TEST(CPUMathFunctionsTest, TestSimdTranscendental) {
+  typedef TypeParam Dtype;
+  const int n = this->blob_bottom_->count() * 4 + 3;
+  vector<Dtype> a(n), b(n), y(n);
+  caffe_rng_gaussian<Dtype>(n, 0, 10, &a[0]);
+  caffe_rng_gaussian<Dtype>(n, 0, 1, &b[0]);
+  // Values where libm is exact or special
+  const Dtype kSpecial[] = {0, -Dtype(0), std::numeric_limits<Dtype>::min() / 3,
+      std::numeric_limits<Dtype>::infinity(),
+      -std::numeric_limits<Dtype>::infinity(),
+      std::numeric_limits<Dtype>::quiet_NaN(), 1000, -1000};
+  const int num_special = sizeof(kSpecial) / sizeof(kSpecial[0]);
+  for (int i = 0; i < num_special; ++i) {
+    a[i] = kSpecial[i];
+  }
+  const Dtype alpha = 0.5;
+  // 4 ulp from the exact results, and rounding the results of libm
+  const Dtype kTolerance = 5 * std::numeric_limits<Dtype>::epsilon();
+  const int threads[] = {1, 4};
+  const int cpu_threads = Caffe::cpu_threads();
+  for (int level = SIMD_GENERIC; level <= simd_cpu_level(); ++level) {
+    set_simd_level(static_cast<SimdLevel>(level));
+    for (int t = 0; t < 2; ++t) {
+      Caffe::set_cpu_threads(threads[t]);
+      for (int op = 0; op < 7; ++op) {
+        vector<Dtype> x(a);
+        if (op == 1) {
+          caffe_abs(n, &a[0], &x[0]);
+        }
+        switch (op) {
+        case 0: simd_exp(n, &x[0], &y[0]); break;
+        case 1: simd_log(n, &x[0], &y[0]); break;
+        case 2: simd_tanh(n, &x[0], &y[0]); break;
+        case 3: simd_sigmoid(n, &x[0], &y[0]); break;
+        case 4: simd_elu(n, alpha, &x[0], &y[0]); break;
+        case 5: simd_bnll(n, &x[0], &y[0]); break;
+        case 6: simd_bnll_backward(n, &x[0], &b[0], &y[0]); break;
+        }
+        for (int i = 0; i < n; ++i) {
+          Dtype expected = 0;
+          switch (op) {
+          case 0: expected = std::exp(x[i]); break;
+          case 1: expected = std::log(x[i]); break;
+          case 2: expected = std::tanh(x[i]); break;
+          case 3: expected = 1 / (1 + std::exp(-x[i])); break;
+          case 4:
+            expected = x[i] > 0 ? x[i] : alpha * std::expm1(x[i]);
+            if (x[i] != x[i]) { expected = x[i]; }
+            break;
+          case 5:
+            expected = x[i] > 0 ? x[i] + std::log1p(std::exp(-x[i])) :
+                std::log1p(std::exp(x[i]));
+            break;
+          case 6: expected = b[i] / (1 + std::exp(-x[i])); break;
+          }
+          if (i < num_special || std::isinf(expected)) {
+            if (expected != expected) {
+              ASSERT_NE(y[i], y[i]) << "operation " << op << " of " << x[i];
+            } else {
+              ASSERT_EQ(expected, y[i]) << "operation " << op << " of "
+                  << x[i];
+              // The signs of zeros, but for the sums of ELU and BNLL
+              if (op < 4) {
+                ASSERT_EQ(std::signbit(expected), std::signbit(y[i]))
+                    << "operation " << op << " of " << x[i];
+              }
+            }
+          } else {
+            ASSERT_NEAR(expected, y[i], kTolerance * std::fabs(expected)
+                + std::numeric_limits<Dtype>::denorm_min())
+                << simd_level_name(simd_level()) << ", " << threads[t]
+                << " threads, operation " << op << " of " << x[i];
+          }
+        }
+      }
+    }
+  }
+  set_simd_level(simd_cpu_level());
+  Caffe::set_cpu_threads(cpu_threads);
+}
+
 #ifndef CPU_ONLY
 
 template <typename Dtype>
@@ -1,3 +1,6 @@
+#include <algorithm>
+#include <cmath>
+#include <set>
 #include <string>
 #include <utility>
 #include <vector>
@@ -713,6 +716,220 @@ class NetTest : public MultiDeviceTest<TypeParam> {
     InitNetFromProtoString(proto);
   }
 
+  // Initializes a net computing layers in turn from its input 'data', in
+  // place or not, with a Euclidean loss to its input 'target'
+  virtual void InitElementwiseNet(const vector<string>& layers,
+      const bool in_place, const bool fuse) {
+    string proto =
+        "name: 'ElementwiseTestNetwork' "
+        "input: 'data' "
+        "input_shape { dim: 4 dim: 8 dim: 47 dim: 49 } "
+        "input: 'target' "
+        "input_shape { dim: 4 dim: 8 dim: 47 dim: 49 } "
+        "state { phase: TRAIN } "
+        "force_backward: true ";
+    if (fuse) {
+      proto += "fuse_elementwise: true ";
+    }
+    string bottom = "data";
+    for (int i = 0; i < layers.size(); ++i) {
+      const string id(1, '0' + i);
+      const string top = in_place ? bottom : "top" + id;
+      proto += "layer { name: 'layer" + id + "' " + layers[i] +
+          " bottom: '" + bottom + "' top: '" + top + "' } ";
+      bottom = top;
+    }
+    proto +=
+        "layer { "
+        "  name: 'loss' "
+        "  type: 'EuclideanLoss' "
+        "  bottom: '" + bottom + "' "
+        "  bottom: 'target' "
+        "  top: 'loss' "
+        "} ";
+    InitNetFromProtoString(proto);
+  }
+
+  // Checks that the net of InitElementwiseNet gives the same outputs and
+  // gradients with its layers fused, on 1 and 4 CPU threads, and that it
+  // does not compute the blobs between them then
+  virtual void TestFuseElementwise(const vector<string>& layers,
+      const bool in_place) {
+    // Layers are only fused on the CPU
+    if (Caffe::mode() != Caffe::CPU) {
+      return;
+    }
+    const Dtype kTolerance = 1e-4;
+    const int threads[] = {1, 4};
+    const int cpu_threads = Caffe::cpu_threads();
+    for (int t = 0; t < 2; ++t) {
+      Caffe::set_cpu_threads(threads[t]);
+      vector<shared_ptr<Blob<Dtype> > > blobs[2];
+      vector<shared_ptr<Blob<Dtype> > > params[2];
+      for (int fuse = 0; fuse < 2; ++fuse) {
+        Caffe::set_random_seed(this->seed_);
+        InitElementwiseNet(layers, in_place, fuse);
+        FillerParameter filler_param;
+        GaussianFiller<Dtype> filler(filler_param);
+        filler.Fill(net_->input_blobs()[0]);
+        filler.Fill(net_->input_blobs()[1]);
+        for (int i = 0; i < net_->layers().size(); ++i) {
+          if (string(net_->layers()[i]->type()) == "BatchNorm") {
+            // Statistics summed with a weight of 2
+            const vector<shared_ptr<Blob<Dtype> > >& stats =
+                net_->layers()[i]->blobs();
+            filler.Fill(stats[0].get());
+            caffe_rng_uniform<Dtype>(stats[1]->count(), 1, 3,
+                stats[1]->mutable_cpu_data());
+            stats[2]->mutable_cpu_data()[0] = 2;
+          }
+        }
+        net_->ForwardPrefilled();
+        net_->Backward();
+        CopyNetBlobs(true, &blobs[fuse]);
+        CopyNetParams(true, &params[fuse]);
+      }
+      const string output(in_place ? "data" : "top" + string(1,
+          static_cast<char>('0' + layers.size() - 1)));
+      for (int i = 0; i < blobs[0].size(); ++i) {
+        const string& name = net_->blob_names()[i];
+        if (name.find("top") == 0 && name != output) {
+          // Computed by the fused layer alone
+          EXPECT_EQ(0, blobs[1][i]->asum_data()) << name;
+          continue;
+        }
+        for (int j = 0; j < blobs[0][i]->count(); ++j) {
+          const Dtype data = blobs[0][i]->cpu_data()[j];
+          const Dtype diff = blobs[0][i]->cpu_diff()[j];
+          EXPECT_NEAR(data, blobs[1][i]->cpu_data()[j],
+              kTolerance * std::max(Dtype(1), std::fabs(data))) << name;
+          EXPECT_NEAR(diff, blobs[1][i]->cpu_diff()[j],
+              kTolerance * std::max(Dtype(1), std::fabs(diff))) << name;
+        }
+      }
+      for (int i = 0; i < params[0].size(); ++i) {
+        for (int j = 0; j < params[0][i]->count(); ++j) {
+          const Dtype diff = params[0][i]->cpu_diff()[j];
+          EXPECT_NEAR(diff, params[1][i]->cpu_diff()[j],
+              kTolerance * std::max(Dtype(1), std::fabs(diff)));
+        }
+      }
+    }
+    Caffe::set_cpu_threads(cpu_threads);
+  }
+
+  virtual void InitActivationMemoryNet(const bool share,
+      const string& pinned_blob = "") {
+    string proto =
+        "name: 'ActivationMemoryTestNetwork' "
+        "input: 'data' "
+        "input_shape { dim: 2 dim: 3 dim: 10 dim: 10 } "
+        "state { phase: TEST } ";
+    if (share) {
+      proto += "share_activation_memory: true ";
+    }
+    if (!pinned_blob.empty()) {
+      proto += "pinned_blob: '" + pinned_blob + "' ";
+    }
+    proto +=
+        "layer { "
+        "  name: 'conv1' "
+        "  type: 'Convolution' "
+        "  bottom: 'data' "
+        "  top: 'conv1' "
+        "  convolution_param { "
+        "    num_output: 4 "
+        "    kernel_size: 3 "
+        "    weight_filler { type: 'gaussian' std: 0.5 } "
+        "    bias_filler { type: 'gaussian' std: 0.5 } "
+        "  } "
+        "} "
+        "layer { "
+        "  name: 'relu1' "
+        "  type: 'ReLU' "
+        "  bottom: 'conv1' "
+        "  top: 'conv1' "
+        "} "
+        "layer { "
+        "  name: 'pool1' "
+        "  type: 'Pooling' "
+        "  bottom: 'conv1' "
+        "  top: 'pool1' "
+        "  pooling_param { pool: MAX kernel_size: 2 stride: 2 } "
+        "} "
+        "layer { "
+        "  name: 'conv2' "
+        "  type: 'Convolution' "
+        "  bottom: 'pool1' "
+        "  top: 'conv2' "
+        "  convolution_param { "
+        "    num_output: 4 "
+        "    kernel_size: 1 "
+        "    weight_filler { type: 'gaussian' std: 0.5 } "
+        "  } "
+        "} "
+        "layer { "
+        "  name: 'scale2' "
+        "  type: 'Scale' "
+        "  bottom: 'conv2' "
+        "  top: 'scale2' "
+        "  scale_param { "
+        "    bias_term: true "
+        "    filler { type: 'uniform' min: 0.5 max: 1.5 } "
+        "    bias_filler { type: 'gaussian' std: 0.5 } "
+        "  } "
+        "} "
+        "layer { "
+        "  name: 'relu2' "
+        "  type: 'ReLU' "
+        "  bottom: 'scale2' "
+        "  top: 'relu2' "
+        "} "
+        "layer { "
+        "  name: 'sum' "
+        "  type: 'Eltwise' "
+        "  bottom: 'pool1' "
+        "  bottom: 'relu2' "
+        "  top: 'sum' "
+        "} "
+        "layer { "
+        "  name: 'flatten' "
+        "  type: 'Flatten' "
+        "  bottom: 'sum' "
+        "  top: 'flatten' "
+        "} "
+        "layer { "
+        "  name: 'ip' "
+        "  type: 'InnerProduct' "
+        "  bottom: 'flatten' "
+        "  top: 'ip' "
+        "  inner_product_param { "
+        "    num_output: 5 "
+        "    weight_filler { type: 'gaussian' std: 0.5 } "
+        "  } "
+        "} "
+        "layer { "
+        "  name: 'prob' "
+        "  type: 'Softmax' "
+        "  bottom: 'ip' "
+        "  top: 'prob' "
+        "} ";
+    InitNetFromProtoString(proto);
+  }
+
+  // Bytes of the distinct memory holding the data of the blobs of the net
+  virtual size_t DataMemory() {
+    set<SyncedMemory*> data;
+    size_t bytes = 0;
+    for (int i = 0; i < net_->blobs().size(); ++i) {
+      SyncedMemory* blob_data = net_->blobs()[i]->data().get();
+      if (data.insert(blob_data).second) {
+        bytes += blob_data->size();
+      }
+    }
+    return bytes;
+  }
+
   int seed_;
   shared_ptr<Net<Dtype> > net_;
 };
@@ -2379,4 +2596,180 @@ TYPED_TEST(NetTest, TestSkipPropagateDown) {
   }
 }
 
+TYPED_TEST(NetTest, TestFuseScaleBiasReLU) {
+  vector<string> layers;
+  layers.push_back("type: 'Scale' scale_param { bias_term: true "
+      "filler { type: 'uniform' min: 0.5 max: 1.5 } "
+      "bias_filler { type: 'gaussian' std: 0.5 } }");
+  layers.push_back("type: 'Bias' bias_param { "
+      "filler { type: 'gaussian' std: 0.5 } }");
+  layers.push_back("type: 'ReLU' relu_param { negative_slope: 0.1 }");
+  this->TestFuseElementwise(layers, false);
+  this->TestFuseElementwise(layers, true);
+  // Only the last layer may compute its gradient from its output in place
+  layers.push_back("type: 'Sigmoid'");
+  this->TestFuseElementwise(layers, false);
+}
+
+TYPED_TEST(NetTest, TestFuseBatchNormScaleELU) {
+  vector<string> layers;
+  layers.push_back("type: 'BatchNorm' "
+      "batch_norm_param { use_global_stats: true }");
+  layers.push_back("type: 'Scale' scale_param { "
+      "filler { type: 'uniform' min: 0.5 max: 1.5 } }");
+  layers.push_back("type: 'ELU' elu_param { alpha: 0.5 }");
+  this->TestFuseElementwise(layers, false);
+  this->TestFuseElementwise(layers, true);
+  layers.push_back("type: 'TanH'");
+  layers.push_back("type: 'Exp' exp_param { base: 2 scale: 0.5 shift: 0.25 }");
+  this->TestFuseElementwise(layers, false);
+}
+
+TYPED_TEST(NetTest, TestFusePowerExpLog) {
+  vector<string> layers;
+  layers.push_back("type: 'Power' "
+      "power_param { power: 1.5 scale: 0.1 shift: 2 }");
+  layers.push_back("type: 'Power' "
+      "power_param { power: 2 scale: 0.5 shift: 0.1 }");
+  layers.push_back("type: 'AbsVal'");
+  layers.push_back("type: 'BNLL'");
+  layers.push_back("type: 'Exp' exp_param { scale: -1 }");
+  layers.push_back("type: 'Log' log_param { base: 10 scale: 2 shift: 1 }");
+  this->TestFuseElementwise(layers, false);
+}
+
+TYPED_TEST(NetTest, TestFuseElementwiseFromTo) {
+  typedef typename TypeParam::Dtype Dtype;
+  if (Caffe::mode() != Caffe::CPU) {
+    return;
+  }
+  // Runs Forward from the middle of the fused chain of layers 0 to 2, then
+  // Backward from the loss to its middle, and checks the net gives the same
+  // blobs and gradients as without fusion
+  vector<string> layers;
+  layers.push_back("type: 'Scale' scale_param { bias_term: true "
+      "filler { type: 'uniform' min: 0.5 max: 1.5 } "
+      "bias_filler { type: 'gaussian' std: 0.5 } }");
+  layers.push_back("type: 'Bias' bias_param { "
+      "filler { type: 'gaussian' std: 0.5 } }");
+  layers.push_back("type: 'Sigmoid'");
+  const Dtype kTolerance = 1e-4;
+  vector<shared_ptr<Blob<Dtype> > > blobs[2];
+  vector<shared_ptr<Blob<Dtype> > > params[2];
+  Dtype loss[2];
+  for (int fuse = 0; fuse < 2; ++fuse) {
+    Caffe::set_random_seed(this->seed_);
+    this->InitElementwiseNet(layers, false, fuse);
+    FillerParameter filler_param;
+    GaussianFiller<Dtype> filler(filler_param);
+    filler.Fill(this->net_->input_blobs()[0]);
+    filler.Fill(this->net_->input_blobs()[1]);
+    // Without fusion the blobs inside the chain are computed from the start
+    loss[fuse] = this->net_->ForwardFrom(fuse ? 1 : 0);
+    this->net_->BackwardFromTo(this->net_->layers().size() - 1, 1);
+    this->CopyNetBlobs(true, &blobs[fuse]);
+    this->CopyNetParams(true, &params[fuse]);
+  }
+  EXPECT_NEAR(loss[0], loss[1], kTolerance * std::max(Dtype(1), loss[0]));
+  for (int i = 0; i < blobs[0].size(); ++i) {
+    const string& name = this->net_->blob_names()[i];
+    for (int j = 0; j < blobs[0][i]->count(); ++j) {
+      const Dtype data = blobs[0][i]->cpu_data()[j];
+      const Dtype diff = blobs[0][i]->cpu_diff()[j];
+      EXPECT_NEAR(data, blobs[1][i]->cpu_data()[j],
+          kTolerance * std::max(Dtype(1), std::fabs(data))) << name;
+      EXPECT_NEAR(diff, blobs[1][i]->cpu_diff()[j],
+          kTolerance * std::max(Dtype(1), std::fabs(diff))) << name;
+    }
+  }
+  for (int i = 0; i < params[0].size(); ++i) {
+    for (int j = 0; j < params[0][i]->count(); ++j) {
+      const Dtype diff = params[0][i]->cpu_diff()[j];
+      EXPECT_NEAR(diff, params[1][i]->cpu_diff()[j],
+          kTolerance * std::max(Dtype(1), std::fabs(diff)));
+    }
+  }
+}
+
+TYPED_TEST(NetTest, TestShareActivationMemory) {
+  typedef typename TypeParam::Dtype Dtype;
+  // Runs the net with and without sharing memory on inputs of two sizes, and
+  // checks that it gives the same outputs with less memory
+  FillerParameter filler_param;
+  GaussianFiller<Dtype> filler(filler_param);
+  Blob<Dtype> blob1(2, 3, 10, 10);
+  Blob<Dtype> blob2(5, 3, 10, 10);
+  Caffe::set_random_seed(this->seed_);
+  filler.Fill(&blob1);
+  filler.Fill(&blob2);
+  Blob<Dtype>* inputs[] = {&blob1, &blob2, &blob1};
+  vector<shared_ptr<Blob<Dtype> > > outputs[2][3];
+  size_t memory[2][3];
+  for (int share = 0; share < 2; ++share) {
+    Caffe::set_random_seed(this->seed_);
+    this->InitActivationMemoryNet(share);
+    for (int i = 0; i < 3; ++i) {
+      Blob<Dtype>* input_blob = this->net_->input_blobs()[0];
+      input_blob->ReshapeLike(*inputs[i]);
+      input_blob->CopyFrom(*inputs[i]);
+      this->net_->Reshape();
+      this->net_->ForwardPrefilled();
+      memory[share][i] = this->DataMemory();
+      const vector<Blob<Dtype>*>& output_blobs = this->net_->output_blobs();
+      for (int j = 0; j < output_blobs.size(); ++j) {
+        outputs[share][i].push_back(shared_ptr<Blob<Dtype> >(new Blob<Dtype>));
+        outputs[share][i][j]->CopyFrom(*output_blobs[j], false, true);
+      }
+    }
+    if (share) {
+      // The output keeps its own memory
+      const vector<shared_ptr<Blob<Dtype> > >& blobs = this->net_->blobs();
+      const Blob<Dtype>* prob = this->net_->blob_by_name("prob").get();
+      for (int i = 0; i < blobs.size(); ++i) {
+        EXPECT_TRUE(blobs[i].get() == prob ||
+            blobs[i]->data() != prob->data()) << this->net_->blob_names()[i];
+      }
+    }
+  }
+  for (int i = 0; i < 3; ++i) {
+    EXPECT_LT(memory[1][i], memory[0][i]);
+    ASSERT_EQ(outputs[0][i].size(), outputs[1][i].size());
+    for (int j = 0; j < outputs[0][i].size(); ++j) {
+      ASSERT_TRUE(outputs[0][i][j]->shape() == outputs[1][i][j]->shape());
+      for (int k = 0; k < outputs[0][i][j]->count(); ++k) {
+        EXPECT_EQ(outputs[0][i][j]->cpu_data()[k],
+            outputs[1][i][j]->cpu_data()[k]);
+      }
+    }
+  }
+}
+
+TYPED_TEST(NetTest, TestShareActivationMemoryPinnedBlob) {
+  typedef typename TypeParam::Dtype Dtype;
+  // A pinned blob keeps its own memory, and its values after Forward
+  FillerParameter filler_param;
+  GaussianFiller<Dtype> filler(filler_param);
+  Blob<Dtype> input(2, 3, 10, 10);
+  Caffe::set_random_seed(this->seed_);
+  filler.Fill(&input);
+  Blob<Dtype> relu2[2];
+  for (int share = 0; share < 2; ++share) {
+    Caffe::set_random_seed(this->seed_);
+    this->InitActivationMemoryNet(share, "relu2");
+    this->net_->input_blobs()[0]->CopyFrom(input);
+    this->net_->ForwardPrefilled();
+    relu2[share].CopyFrom(*this->net_->blob_by_name("relu2"), false, true);
+  }
+  const vector<shared_ptr<Blob<Dtype> > >& blobs = this->net_->blobs();
+  const Blob<Dtype>* pinned = this->net_->blob_by_name("relu2").get();
+  for (int i = 0; i < blobs.size(); ++i) {
+    EXPECT_TRUE(blobs[i].get() == pinned ||
+        blobs[i]->data() != pinned->data()) << this->net_->blob_names()[i];
+  }
+  ASSERT_EQ(relu2[0].count(), relu2[1].count());
+  for (int i = 0; i < relu2[0].count(); ++i) {
+    EXPECT_EQ(relu2[0].cpu_data()[i], relu2[1].cpu_data()[i]);
+  }
+}
+
 }  // namespace caffe
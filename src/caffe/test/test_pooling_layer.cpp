@@ -1,3 +1,4 @@
+#include <algorithm>
 #include <vector>
 
 #include "gtest/gtest.h"
@@ -6,6 +7,7 @@
 #include "caffe/common.hpp"
 #include "caffe/filler.hpp"
 #include "caffe/layers/pooling_layer.hpp"
+#include "caffe/util/math_functions.hpp"
 
 #ifdef USE_CUDNN
 #include "caffe/layers/cudnn_pooling_layer.hpp"
@@ -609,6 +611,120 @@ TYPED_TEST(PoolingLayerTest, TestGradientAvePadded) {
   }
 }
 
+TYPED_TEST(PoolingLayerTest, TestStride2Threads) {
+  typedef typename TypeParam::Dtype Dtype;
+  // Large enough for the CPU passes to be split between threads, with odd
+  // sizes so that the last windows are clipped
+  this->blob_bottom_->Reshape(2, 16, 45, 47);
+  FillerParameter filler_param;
+  GaussianFiller<Dtype> filler(filler_param);
+  filler.Fill(this->blob_bottom_);
+  const PoolingParameter_PoolMethod pools[] = {
+      PoolingParameter_PoolMethod_MAX, PoolingParameter_PoolMethod_AVE};
+  const int threads[] = {1, 4};
+  const int cpu_threads = Caffe::cpu_threads();
+  for (int kernel = 2; kernel <= 3; ++kernel) {
+    for (int pad = 0; pad < kernel - 1; ++pad) {
+      for (int p = 0; p < 2; ++p) {
+        for (int top_mask = 0; top_mask < 2; ++top_mask) {
+          for (int t = 0; t < 2; ++t) {
+            Caffe::set_cpu_threads(threads[t]);
+            LayerParameter layer_param;
+            PoolingParameter* pooling_param =
+                layer_param.mutable_pooling_param();
+            pooling_param->set_kernel_size(kernel);
+            pooling_param->set_stride(2);
+            pooling_param->set_pad(pad);
+            pooling_param->set_pool(pools[p]);
+            vector<Blob<Dtype>*> top_vec(this->blob_top_vec_);
+            if (top_mask && p == 0) {
+              top_vec.push_back(this->blob_top_mask_);
+            }
+            PoolingLayer<Dtype> layer(layer_param);
+            layer.SetUp(this->blob_bottom_vec_, top_vec);
+            layer.Forward(this->blob_bottom_vec_, top_vec);
+            caffe_copy(this->blob_top_->count(), this->blob_top_->cpu_data(),
+                this->blob_top_->mutable_cpu_diff());
+            vector<bool> propagate_down(1, true);
+            layer.Backward(top_vec, propagate_down, this->blob_bottom_vec_);
+            // Compare to a direct computation of the windows, which also
+            // accumulates the top into the bottom diff.
+            const Blob<Dtype>& bottom = *this->blob_bottom_;
+            const Blob<Dtype>& top = *this->blob_top_;
+            Blob<Dtype> bottom_diff;
+            bottom_diff.ReshapeLike(bottom);
+            caffe_set(bottom_diff.count(), Dtype(0),
+                bottom_diff.mutable_cpu_data());
+            for (int n = 0; n < top.num(); ++n) {
+              for (int c = 0; c < top.channels(); ++c) {
+                for (int ph = 0; ph < top.height(); ++ph) {
+                  for (int pw = 0; pw < top.width(); ++pw) {
+                    const int hstart = ph * 2 - pad;
+                    const int wstart = pw * 2 - pad;
+                    int pool_size = 0;
+                    int best_h = -1;
+                    int best_w = -1;
+                    Dtype sum = 0;
+                    for (int h = hstart; h < hstart + kernel; ++h) {
+                      for (int w = wstart; w < wstart + kernel; ++w) {
+                        if (h >= bottom.height() + pad
+                            || w >= bottom.width() + pad) {
+                          continue;
+                        }
+                        ++pool_size;
+                        if (h < 0 || w < 0 || h >= bottom.height()
+                            || w >= bottom.width()) {
+                          continue;
+                        }
+                        const Dtype value = bottom.data_at(n, c, h, w);
+                        sum += value;
+                        if (best_h < 0
+                            || value > bottom.data_at(n, c, best_h, best_w)) {
+                          best_h = h;
+                          best_w = w;
+                        }
+                      }
+                    }
+                    const Dtype diff = top.diff_at(n, c, ph, pw);
+                    if (p == 0) {
+                      ASSERT_EQ(top.data_at(n, c, ph, pw),
+                          bottom.data_at(n, c, best_h, best_w));
+                      if (top_mask) {
+                        ASSERT_EQ(this->blob_top_mask_->data_at(n, c, ph, pw),
+                            best_h * bottom.width() + best_w);
+                      }
+                      bottom_diff.mutable_cpu_data()[bottom_diff.offset(
+                          n, c, best_h, best_w)] += diff;
+                    } else {
+                      EXPECT_NEAR(top.data_at(n, c, ph, pw), sum / pool_size,
+                          1e-5);
+                      const int hend =
+                          std::min(hstart + kernel, bottom.height());
+                      const int wend =
+                          std::min(wstart + kernel, bottom.width());
+                      for (int h = std::max(hstart, 0); h < hend; ++h) {
+                        for (int w = std::max(wstart, 0); w < wend; ++w) {
+                          bottom_diff.mutable_cpu_data()[bottom_diff.offset(
+                              n, c, h, w)] += diff / pool_size;
+                        }
+                      }
+                    }
+                  }
+                }
+              }
+            }
+            for (int i = 0; i < bottom_diff.count(); ++i) {
+              EXPECT_NEAR(bottom.cpu_diff()[i], bottom_diff.cpu_data()[i],
+                  1e-5);
+            }
+          }
+        }
+      }
+    }
+  }
+  Caffe::set_cpu_threads(cpu_threads);
+}
+
 #ifdef USE_CUDNN
 template <typename Dtype>
 class CuDNNPoolingLayerTest : public GPUDeviceTest<Dtype> {
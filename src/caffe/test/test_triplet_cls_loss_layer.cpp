@@ -1,4 +1,5 @@
 #include <algorithm>
+#include <cfloat>
 #include <cmath>
 #include <cstdlib>
 #include <cstring>
@@ -25,6 +26,8 @@ class TripletClsLossLayerTest : public MultiDeviceTest<TypeParam> {
       : blob_bottom_data_i_(new Blob<Dtype>(128, 10, 1, 1)),
         blob_bottom_data_j_(new Blob<Dtype>(128, 10, 1, 1)),
         blob_bottom_data_k_(new Blob<Dtype>(128, 10, 1, 1)),
+        blob_bottom_embeddings_(new Blob<Dtype>(12, 10, 1, 1)),
+        blob_bottom_labels_(new Blob<Dtype>(12, 1, 1, 1)),
         blob_top_loss_(new Blob<Dtype>()) {
     // fill the values
     FillerParameter filler_param;
@@ -38,20 +41,64 @@ class TripletClsLossLayerTest : public MultiDeviceTest<TypeParam> {
     filler.Fill(this->blob_bottom_data_k_);
     blob_bottom_vec_.push_back(blob_bottom_data_k_);        
     blob_top_vec_.push_back(blob_top_loss_);
+    // embeddings of 4 classes for mining
+    filler.Fill(this->blob_bottom_embeddings_);
+    for (int i = 0; i < blob_bottom_labels_->count(); ++i) {
+      blob_bottom_labels_->mutable_cpu_data()[i] = i % 4;
+    }
+    blob_bottom_mining_vec_.push_back(blob_bottom_embeddings_);
+    blob_bottom_mining_vec_.push_back(blob_bottom_labels_);
   }
   virtual ~TripletClsLossLayerTest() {
     delete blob_bottom_data_i_;
     delete blob_bottom_data_j_;
     delete blob_bottom_data_k_;
+    delete blob_bottom_embeddings_;
+    delete blob_bottom_labels_;
     delete blob_top_loss_;
   }
 
   Blob<Dtype>* const blob_bottom_data_i_;
   Blob<Dtype>* const blob_bottom_data_j_;
   Blob<Dtype>* const blob_bottom_data_k_;
+  Blob<Dtype>* const blob_bottom_embeddings_;
+  Blob<Dtype>* const blob_bottom_labels_;
   Blob<Dtype>* const blob_top_loss_;
   vector<Blob<Dtype>*> blob_bottom_vec_;
+  vector<Blob<Dtype>*> blob_bottom_mining_vec_;
   vector<Blob<Dtype>*> blob_top_vec_;
+
+  Dtype Distance(int i, int j) {
+    const int channels = blob_bottom_embeddings_->channels();
+    const Dtype* data = blob_bottom_embeddings_->cpu_data();
+    Dtype distance(0);
+    for (int c = 0; c < channels; ++c) {
+      Dtype diff = data[i * channels + c] - data[j * channels + c];
+      distance += diff * diff;
+    }
+    return distance;
+  }
+
+  // Loss of the samples, targets and impostors with a margin of 1
+  Dtype TripletLoss() {
+    const int num = blob_bottom_data_i_->num();
+    const int channels = blob_bottom_data_i_->channels();
+    const Dtype* data_i = blob_bottom_data_i_->cpu_data();
+    const Dtype* data_j = blob_bottom_data_j_->cpu_data();
+    const Dtype* data_k = blob_bottom_data_k_->cpu_data();
+    Dtype loss(0);
+    for (int i = 0; i < num; ++i) {
+      Dtype dist_sq_pos(0), dist_sq_neg(0);
+      for (int c = 0; c < channels; ++c) {
+        Dtype diff_pos = data_i[i * channels + c] - data_j[i * channels + c];
+        Dtype diff_neg = data_i[i * channels + c] - data_k[i * channels + c];
+        dist_sq_pos += diff_pos * diff_pos;
+        dist_sq_neg += diff_neg * diff_neg;
+      }
+      loss += std::max(Dtype(0), dist_sq_pos - dist_sq_neg + 1);
+    }
+    return loss / static_cast<Dtype>(2. * num);
+  }
 };
 
 TYPED_TEST_CASE(TripletClsLossLayerTest, TestDtypesAndDevices);
@@ -84,6 +131,27 @@ TYPED_TEST(TripletClsLossLayerTest, TestForward) {
   EXPECT_NEAR(this->blob_top_loss_->cpu_data()[0], loss, 1e-6);
 }
 
+TYPED_TEST(TripletClsLossLayerTest, TestForwardReshape) {
+  typedef typename TypeParam::Dtype Dtype;
+  LayerParameter layer_param;
+  TripletClsLossLayer<Dtype> layer(layer_param);
+  layer.SetUp(this->blob_bottom_vec_, this->blob_top_vec_);
+  // a larger batch after set up
+  FillerParameter filler_param;
+  filler_param.set_std(0.3);
+  GaussianFiller<Dtype> filler(filler_param);
+  for (int i = 0; i < this->blob_bottom_vec_.size(); ++i) {
+    this->blob_bottom_vec_[i]->Reshape(200, 10, 1, 1);
+    filler.Fill(this->blob_bottom_vec_[i]);
+  }
+  layer.Reshape(this->blob_bottom_vec_, this->blob_top_vec_);
+  layer.Forward(this->blob_bottom_vec_, this->blob_top_vec_);
+  EXPECT_NEAR(this->TripletLoss(), this->blob_top_loss_->cpu_data()[0], 1e-6);
+  GradientChecker<Dtype> checker(1e-2, 1e-2, 1701);
+  checker.CheckGradientSingle(&layer, this->blob_bottom_vec_,
+      this->blob_top_vec_, 0, 0, 0);
+}
+
 TYPED_TEST(TripletClsLossLayerTest, TestGradient) {
   typedef typename TypeParam::Dtype Dtype;
   LayerParameter layer_param;
@@ -97,4 +165,95 @@ TYPED_TEST(TripletClsLossLayerTest, TestGradient) {
       this->blob_top_vec_, 1);
 }
 
+TYPED_TEST(TripletClsLossLayerTest, TestForwardBatchHard) {
+  typedef typename TypeParam::Dtype Dtype;
+  LayerParameter layer_param;
+  layer_param.mutable_triplet_cls_loss_param()->set_mining(
+      TripletClsLossParameter_Mining_BATCH_HARD);
+  TripletClsLossLayer<Dtype> layer(layer_param);
+  layer.SetUp(this->blob_bottom_mining_vec_, this->blob_top_vec_);
+  layer.Forward(this->blob_bottom_mining_vec_, this->blob_top_vec_);
+  const int num = this->blob_bottom_embeddings_->num();
+  const Dtype* labels = this->blob_bottom_labels_->cpu_data();
+  Dtype loss(0);
+  for (int a = 0; a < num; ++a) {
+    Dtype dist_sq_pos(0); Dtype dist_sq_neg(FLT_MAX);
+    for (int j = 0; j < num; ++j) {
+      if (j != a && labels[j] == labels[a]) {
+        dist_sq_pos = std::max(dist_sq_pos, this->Distance(a, j));
+      } else if (labels[j] != labels[a]) {
+        dist_sq_neg = std::min(dist_sq_neg, this->Distance(a, j));
+      }
+    }
+    loss += std::max(Dtype(0.0), dist_sq_pos - dist_sq_neg + 1);
+  }
+  loss /= static_cast<Dtype>(2.*num);
+  EXPECT_NEAR(this->blob_top_loss_->cpu_data()[0], loss, 1e-5);
+}
+
+TYPED_TEST(TripletClsLossLayerTest, TestForwardSemiHard) {
+  typedef typename TypeParam::Dtype Dtype;
+  LayerParameter layer_param;
+  layer_param.mutable_triplet_cls_loss_param()->set_mining(
+      TripletClsLossParameter_Mining_SEMI_HARD);
+  layer_param.mutable_triplet_cls_loss_param()->set_margin(0.5);
+  TripletClsLossLayer<Dtype> layer(layer_param);
+  layer.SetUp(this->blob_bottom_mining_vec_, this->blob_top_vec_);
+  layer.Forward(this->blob_bottom_mining_vec_, this->blob_top_vec_);
+  const int num = this->blob_bottom_embeddings_->num();
+  const Dtype* labels = this->blob_bottom_labels_->cpu_data();
+  Dtype loss(0);
+  int num_triplets = 0;
+  for (int a = 0; a < num; ++a) {
+    for (int p = 0; p < num; ++p) {
+      if (p == a || labels[p] != labels[a]) {
+        continue;
+      }
+      const Dtype dist_sq_pos = this->Distance(a, p);
+      Dtype dist_sq_semi_hard(FLT_MAX); Dtype dist_sq_easiest(0);
+      for (int n = 0; n < num; ++n) {
+        if (labels[n] == labels[a]) {
+          continue;
+        }
+        const Dtype dist_sq_neg = this->Distance(a, n);
+        if (dist_sq_neg > dist_sq_pos) {
+          dist_sq_semi_hard = std::min(dist_sq_semi_hard, dist_sq_neg);
+        }
+        dist_sq_easiest = std::max(dist_sq_easiest, dist_sq_neg);
+      }
+      const Dtype dist_sq_neg = dist_sq_semi_hard < FLT_MAX ?
+          dist_sq_semi_hard : dist_sq_easiest;
+      loss += std::max(Dtype(0.0), dist_sq_pos - dist_sq_neg + Dtype(0.5));
+      ++num_triplets;
+    }
+  }
+  EXPECT_EQ(num_triplets, 24);
+  loss /= static_cast<Dtype>(2.*num_triplets);
+  EXPECT_NEAR(this->blob_top_loss_->cpu_data()[0], loss, 1e-5);
+}
+
+TYPED_TEST(TripletClsLossLayerTest, TestGradientBatchHard) {
+  typedef typename TypeParam::Dtype Dtype;
+  LayerParameter layer_param;
+  layer_param.mutable_triplet_cls_loss_param()->set_mining(
+      TripletClsLossParameter_Mining_BATCH_HARD);
+  TripletClsLossLayer<Dtype> layer(layer_param);
+  layer.SetUp(this->blob_bottom_mining_vec_, this->blob_top_vec_);
+  GradientChecker<Dtype> checker(1e-4, 1e-2, 1701);
+  checker.CheckGradientExhaustive(&layer, this->blob_bottom_mining_vec_,
+      this->blob_top_vec_, 0);
+}
+
+TYPED_TEST(TripletClsLossLayerTest, TestGradientSemiHard) {
+  typedef typename TypeParam::Dtype Dtype;
+  LayerParameter layer_param;
+  layer_param.mutable_triplet_cls_loss_param()->set_mining(
+      TripletClsLossParameter_Mining_SEMI_HARD);
+  TripletClsLossLayer<Dtype> layer(layer_param);
+  layer.SetUp(this->blob_bottom_mining_vec_, this->blob_top_vec_);
+  GradientChecker<Dtype> checker(1e-4, 1e-2, 1701);
+  checker.CheckGradientExhaustive(&layer, this->blob_bottom_mining_vec_,
+      this->blob_top_vec_, 0);
+}
+
 }  // namespace caffe
@@ -0,0 +1,138 @@
+#ifdef USE_OPENCV
+#include <vector>
+
+#include "gtest/gtest.h"
+
+#include "caffe/common.hpp"
+#include "caffe/layers/triplet_window_data_layer.hpp"
+#include "caffe/proto/caffe.pb.h"
+
+#include "caffe/test/test_caffe_main.hpp"
+
+namespace caffe {
+
+// Exposes the window and triplet index of the layer
+template <typename Dtype>
+class TripletWindowIndexLayer : public TripletWindowDataLayer<Dtype> {
+ public:
+  typedef typename TripletWindowDataLayer<Dtype>::Window Window;
+  explicit TripletWindowIndexLayer(const LayerParameter& param)
+      : TripletWindowDataLayer<Dtype>(param) {
+    this->image_windows_.push_back(0);
+  }
+  using TripletWindowDataLayer<Dtype>::add_image_windows;
+  using TripletWindowDataLayer<Dtype>::find_window;
+  using TripletWindowDataLayer<Dtype>::set_triplets;
+  using TripletWindowDataLayer<Dtype>::window;
+  using TripletWindowDataLayer<Dtype>::triplet;
+  using TripletWindowDataLayer<Dtype>::image_windows_;
+  using TripletWindowDataLayer<Dtype>::cls_keys_;
+  using TripletWindowDataLayer<Dtype>::cls_triplets_;
+  using TripletWindowDataLayer<Dtype>::cls_idx_;
+};
+
+template <typename Dtype>
+class TripletWindowDataLayerTest : public ::testing::Test {
+ protected:
+  typedef typename TripletWindowIndexLayer<Dtype>::Window Window;
+
+  TripletWindowDataLayerTest() : layer_(LayerParameter()) {}
+
+  static Window MakeWindow(int image_index, int bb_index, int label) {
+    Window window;
+    window.image_index = image_index;
+    window.bb_index = bb_index;
+    window.label = label;
+    window.overlap = 1;
+    window.x1 = 0;
+    window.y1 = 0;
+    window.x2 = 10;
+    window.y2 = 10;
+    return window;
+  }
+
+  TripletWindowIndexLayer<Dtype> layer_;
+};
+
+TYPED_TEST_CASE(TripletWindowDataLayerTest, TestDtypes);
+
+TYPED_TEST(TripletWindowDataLayerTest, TestFindWindow) {
+  typedef typename TestFixture::Window Window;
+  // Indices past 2^24, which a float does not hold exactly
+  const int kIndex = (1 << 24) + 1;
+  vector<Window> windows;
+  windows.push_back(this->MakeWindow(kIndex, kIndex, 1));
+  windows.push_back(this->MakeWindow(kIndex, 3, 2));
+  windows.push_back(this->MakeWindow(kIndex, kIndex - 1, 1));
+  // The first window read of a box is kept
+  windows.push_back(this->MakeWindow(kIndex, 3, 3));
+  this->layer_.add_image_windows(windows);
+  this->layer_.add_image_windows(vector<Window>());
+  windows.assign(1, this->MakeWindow(2, 7, 4));
+  this->layer_.add_image_windows(windows);
+
+  ASSERT_EQ(4, this->layer_.image_windows_.size());
+  EXPECT_EQ(0, this->layer_.image_windows_[0]);
+  EXPECT_EQ(3, this->layer_.image_windows_[1]);
+  EXPECT_EQ(3, this->layer_.image_windows_[2]);
+  EXPECT_EQ(4, this->layer_.image_windows_[3]);
+  EXPECT_EQ(0, this->layer_.find_window(0, 3));
+  EXPECT_EQ(2, this->layer_.window(0).label);
+  EXPECT_EQ(1, this->layer_.find_window(0, kIndex - 1));
+  EXPECT_EQ(2, this->layer_.find_window(0, kIndex));
+  EXPECT_EQ(kIndex, this->layer_.window(2).image_index);
+  EXPECT_EQ(kIndex, this->layer_.window(2).bb_index);
+  EXPECT_EQ(-1, this->layer_.find_window(0, kIndex + 1));
+  EXPECT_EQ(-1, this->layer_.find_window(0, 4));
+  EXPECT_EQ(-1, this->layer_.find_window(1, 3));
+  EXPECT_EQ(3, this->layer_.find_window(2, 7));
+  EXPECT_EQ(-1, this->layer_.find_window(2, 6));
+  EXPECT_EQ(-1, this->layer_.find_window(3, 0));
+  EXPECT_EQ(-1, this->layer_.find_window(-1, 0));
+}
+
+TYPED_TEST(TripletWindowDataLayerTest, TestSetTriplets) {
+  const int kNumFields = 4;
+  const int cls[] = {5, 2, 5, 9, 2, 5};
+  const int num_triplets = 6;
+  vector<int> triplets, triplet_cls;
+  for (int t = 0; t < num_triplets; ++t) {
+    triplets.push_back(t);
+    for (int i = 1; i < kNumFields; ++i) {
+      triplets.push_back((1 << 24) + kNumFields * t + i);
+    }
+    triplet_cls.push_back(cls[t]);
+  }
+  this->layer_.set_triplets(triplets, triplet_cls);
+
+  ASSERT_EQ(3, this->layer_.cls_keys_.size());
+  EXPECT_EQ(2, this->layer_.cls_keys_[0]);
+  EXPECT_EQ(5, this->layer_.cls_keys_[1]);
+  EXPECT_EQ(9, this->layer_.cls_keys_[2]);
+  ASSERT_EQ(4, this->layer_.cls_triplets_.size());
+  EXPECT_EQ(0, this->layer_.cls_triplets_[0]);
+  EXPECT_EQ(2, this->layer_.cls_triplets_[1]);
+  EXPECT_EQ(5, this->layer_.cls_triplets_[2]);
+  EXPECT_EQ(6, this->layer_.cls_triplets_[3]);
+  EXPECT_EQ(vector<int>(3, 0), this->layer_.cls_idx_);
+  // Each triplet is kept whole, once, in the group of its class
+  vector<int> seen(num_triplets, 0);
+  for (int c = 0; c < 3; ++c) {
+    for (int i = this->layer_.cls_triplets_[c];
+        i < this->layer_.cls_triplets_[c + 1]; ++i) {
+      const int* triplet = this->layer_.triplet(i);
+      const int t = triplet[0];
+      ASSERT_GE(t, 0);
+      ASSERT_LT(t, num_triplets);
+      EXPECT_EQ(cls[t], this->layer_.cls_keys_[c]);
+      for (int j = 1; j < kNumFields; ++j) {
+        EXPECT_EQ((1 << 24) + kNumFields * t + j, triplet[j]);
+      }
+      ++seen[t];
+    }
+  }
+  EXPECT_EQ(vector<int>(num_triplets, 1), seen);
+}
+
+}  // namespace caffe
+#endif  // USE_OPENCV
@@ -0,0 +1,107 @@
+#include <fstream>  // NOLINT(readability/streams)
+#include <string>
+
+#include "gtest/gtest.h"
+
+#include "caffe/common.hpp"
+#include "caffe/util/io.hpp"
+#include "caffe/util/window_file.hpp"
+
+#include "caffe/test/test_caffe_main.hpp"
+
+namespace caffe {
+
+class WindowFileTest : public ::testing::Test {
+ protected:
+  virtual void SetUp() {
+    MakeTempFilename(&text_filename_);
+    MakeTempFilename(&binary_filename_);
+    std::ofstream outfile(text_filename_.c_str());
+    outfile << "# FULL_IMAGES 0\n"
+        << "a.jpg\n3\n100\n200\n2\n"
+        << "3 1 0.9 1 2 50 60\n"
+        << "1 0 0.1 5 5 10 10\n"
+        << "# PAIRS 1\n"
+        << "0 0 3 1 0 1\n"
+        << "# FULL_IMAGES 1\n"
+        << "dir/b.jpg\n1\n20\n30\n0\n"
+        << "# PAIRS 2\n"
+        << "1 0 1 0 3 0\n"
+        << "2 1 0 0 1 1\n";
+  }
+
+  void CheckContents(const WindowFile& window_file) {
+    EXPECT_EQ(window_file.num_images(), 2);
+    EXPECT_EQ(string(window_file.image_path(0)), "a.jpg");
+    EXPECT_EQ(string(window_file.image_path(1)), "dir/b.jpg");
+    EXPECT_EQ(window_file.image_size(0)[0], 3);
+    EXPECT_EQ(window_file.image_size(0)[1], 100);
+    EXPECT_EQ(window_file.image_size(0)[2], 200);
+    EXPECT_EQ(window_file.image_size(1)[0], 1);
+    EXPECT_EQ(window_file.num_windows(0), 2);
+    EXPECT_EQ(window_file.num_windows(1), 0);
+    const WindowFile::Window& window = window_file.windows(0)[0];
+    EXPECT_EQ(window.bb_index, 3);
+    EXPECT_EQ(window.label, 1);
+    EXPECT_FLOAT_EQ(window.overlap, 0.9);
+    EXPECT_EQ(window.x1, 1);
+    EXPECT_EQ(window.y1, 2);
+    EXPECT_EQ(window.x2, 50);
+    EXPECT_EQ(window.y2, 60);
+    EXPECT_EQ(window_file.windows(0)[1].bb_index, 1);
+    EXPECT_FLOAT_EQ(window_file.windows(0)[1].overlap, 0.1);
+    EXPECT_EQ(window_file.num_pairs(), 3);
+    EXPECT_EQ(window_file.pair_size(), 6);
+    const int pairs[] = {0, 0, 3, 1, 0, 1, 1, 0, 1, 0, 3, 0, 2, 1, 0, 0, 1, 1};
+    for (int i = 0; i < 3; ++i) {
+      for (int j = 0; j < 6; ++j) {
+        EXPECT_EQ(window_file.pair(i)[j], pairs[i * 6 + j]);
+      }
+    }
+  }
+
+  string text_filename_;
+  string binary_filename_;
+};
+
+TEST_F(WindowFileTest, TestReadText) {
+  WindowFile window_file;
+  window_file.Open(text_filename_);
+  EXPECT_FALSE(window_file.binary());
+  CheckContents(window_file);
+}
+
+TEST_F(WindowFileTest, TestWriteBinary) {
+  WindowFile text_file;
+  text_file.Open(text_filename_);
+  text_file.Write(binary_filename_);
+  WindowFile binary_file;
+  binary_file.Open(binary_filename_);
+  EXPECT_TRUE(binary_file.binary());
+  CheckContents(binary_file);
+  binary_file.Close();
+  EXPECT_EQ(binary_file.num_images(), 0);
+  EXPECT_EQ(binary_file.num_pairs(), 0);
+}
+
+TEST_F(WindowFileTest, TestReadTextPairTokens) {
+  // Pairs are whitespace separated integers, whatever the lines
+  std::ofstream outfile(text_filename_.c_str());
+  outfile << "# FULL_IMAGES 0\n"
+      << "a.jpg\n3\n100\n200\n2\n"
+      << "3 1 0.9 1 2 50 60\n"
+      << "1 0 0.1 5 5 10 10\n"
+      << "# PAIRS 1\n"
+      << "0 0 3\n1 0 1\n"
+      << "# FULL_IMAGES 1\n"
+      << "dir/b.jpg\n1\n20\n30\n0\n"
+      << "# PAIRS 0\n"
+      << "# PAIRS 2\n"
+      << "1 0 1 0 3 0 2 1 0 0 1 1";
+  outfile.close();
+  WindowFile window_file;
+  window_file.Open(text_filename_);
+  CheckContents(window_file);
+}
+
+}  // namespace caffe
@@ -0,0 +1,85 @@
+#include <boost/thread.hpp>
+#include <google/protobuf/text_format.h>
+
+#include <cstdio>
+#include <fstream>  // NOLINT(readability/streams)
+#include <string>
+
+#include "caffe/common.hpp"
+#include "caffe/util/conv_algorithm_cache.hpp"
+#include "caffe/util/io.hpp"
+
+namespace caffe {
+
+static boost::mutex cache_mutex_;
+static ConvolutionAlgorithmCache cache_;
+static std::string cache_file_;
+static bool cache_loaded_ = false;
+
+// Reads the file of the cache on first use, with cache_mutex_ held.
+static void LoadConvolutionAlgorithmCache() {
+  if (cache_loaded_) {
+    return;
+  }
+  cache_loaded_ = true;
+  if (cache_file_.empty() || !std::ifstream(cache_file_.c_str()).good()) {
+    return;
+  }
+  ConvolutionAlgorithmCache cache;
+  if (ReadProtoFromTextFile(cache_file_, &cache)) {
+    cache_.MergeFrom(cache);
+  } else {
+    LOG(WARNING) << "Ignoring the convolution algorithms of " << cache_file_
+        << ", which cannot be parsed.";
+  }
+}
+
+void SetConvolutionAlgorithmCacheFile(const std::string& filename) {
+  boost::mutex::scoped_lock lock(cache_mutex_);
+  cache_file_ = filename;
+  cache_loaded_ = false;
+  cache_.Clear();
+}
+
+bool FindConvolutionAlgorithm(const std::string& key,
+    ConvolutionAlgorithmCache::Entry* entry) {
+  boost::mutex::scoped_lock lock(cache_mutex_);
+  LoadConvolutionAlgorithmCache();
+  for (int i = 0; i < cache_.entry_size(); ++i) {
+    if (cache_.entry(i).key() == key) {
+      entry->CopyFrom(cache_.entry(i));
+      return true;
+    }
+  }
+  return false;
+}
+
+void AddConvolutionAlgorithm(const ConvolutionAlgorithmCache::Entry& entry) {
+  boost::mutex::scoped_lock lock(cache_mutex_);
+  LoadConvolutionAlgorithmCache();
+  int i = 0;
+  while (i < cache_.entry_size() && cache_.entry(i).key() != entry.key()) {
+    ++i;
+  }
+  if (i == cache_.entry_size()) {
+    cache_.add_entry();
+  }
+  cache_.mutable_entry(i)->CopyFrom(entry);
+  if (!cache_file_.empty()) {
+    // Replace the file at once, for other processes reading it. The entry
+    // stays in memory for this run if the file cannot be written.
+    const std::string temp_file = cache_file_ + ".tmp";
+    std::string text;
+    google::protobuf::TextFormat::PrintToString(cache_, &text);
+    std::ofstream output(temp_file.c_str());
+    output << text;
+    output.close();
+    if (!output || std::rename(temp_file.c_str(), cache_file_.c_str()) != 0) {
+      LOG(WARNING) << "Cannot write the convolution algorithms to "
+          << cache_file_;
+      std::remove(temp_file.c_str());
+    }
+  }
+}
+
+}  // namespace caffe
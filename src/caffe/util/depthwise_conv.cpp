@@ -0,0 +1,290 @@
+#include <stdint.h>
+
+#include <algorithm>
+
+#include "caffe/common.hpp"
+#include "caffe/util/depthwise_conv.hpp"
+#include "caffe/util/math_functions.hpp"
+#include "caffe/util/thread_pool.hpp"
+
+namespace caffe {
+
+// Outputs [*begin, *end) whose input offset + i * stride is inside [0, size),
+// out of count outputs.
+inline void valid_outputs(int offset, int stride, int size, int count,
+    int* begin, int* end) {
+  *begin = offset >= 0 ? 0 : (-offset + stride - 1) / stride;
+  *end = offset >= size ? 0 : (size - offset + stride - 1) / stride;
+  *end = std::max(*begin, std::min(*end, count));
+  *begin = std::min(*begin, *end);
+}
+
+// Runs one pass of the convolution over planes: output channels of an image
+// for FORWARD, input channels of an image for BACKWARD_DATA, and filters for
+// BACKWARD_WEIGHT, so that each value written belongs to one plane. The
+// taps of the filter are applied one output row at a time, which stays in
+// cache, the inner loop running along a row of the input and of the output.
+template <typename Dtype>
+class DepthwiseConvTask : public ThreadPool::Task {
+ public:
+  enum Pass { FORWARD, BACKWARD_DATA, BACKWARD_WEIGHT };
+
+  DepthwiseConvTask(Pass pass, int num, int channels, int height, int width,
+      int multiplier, int kernel_h, int kernel_w, int pad_h, int pad_w,
+      int stride_h, int stride_w, int dilation_h, int dilation_w,
+      const Dtype* input, const Dtype* weight, const Dtype* output_diff,
+      Dtype* result)
+      : pass_(pass), num_(num), channels_(channels), height_(height),
+        width_(width), multiplier_(multiplier), kernel_h_(kernel_h),
+        kernel_w_(kernel_w), pad_h_(pad_h), pad_w_(pad_w),
+        stride_h_(stride_h), stride_w_(stride_w), dilation_h_(dilation_h),
+        dilation_w_(dilation_w),
+        output_h_((height + 2 * pad_h - (dilation_h * (kernel_h - 1) + 1))
+            / stride_h + 1),
+        output_w_((width + 2 * pad_w - (dilation_w * (kernel_w - 1) + 1))
+            / stride_w + 1),
+        input_(input), weight_(weight), output_diff_(output_diff),
+        result_(result) {}
+
+  // Number of planes of the pass, and multiply-adds of the whole pass
+  inline int planes() const {
+    return pass_ == FORWARD ? num_ * channels_ * multiplier_ :
+        pass_ == BACKWARD_DATA ? num_ * channels_ : channels_ * multiplier_;
+  }
+  inline int64_t work() const {
+    return static_cast<int64_t>(num_) * channels_ * multiplier_ * kernel_h_
+        * kernel_w_ * output_h_ * output_w_;
+  }
+
+  virtual void Run(int thread, int begin, int end) {
+    const int output_channels = channels_ * multiplier_;
+    const int input_dim = height_ * width_;
+    const int output_dim = output_h_ * output_w_;
+    for (int plane = begin; plane < end; ++plane) {
+      if (pass_ == FORWARD) {
+        const int n = plane / output_channels;
+        const int c = plane % output_channels / multiplier_;
+        Dtype* output = result_ + static_cast<size_t>(plane) * output_dim;
+        caffe_set(output_dim, Dtype(0), output);
+        accumulate(input_ + (static_cast<size_t>(n) * channels_ + c)
+            * input_dim, plane % output_channels, output);
+      } else if (pass_ == BACKWARD_DATA) {
+        const int n = plane / channels_;
+        const int c = plane % channels_;
+        Dtype* input_diff = result_ + static_cast<size_t>(plane) * input_dim;
+        caffe_set(input_dim, Dtype(0), input_diff);
+        for (int m = 0; m < multiplier_; ++m) {
+          const int o = c * multiplier_ + m;
+          scatter(output_diff_ + (static_cast<size_t>(n) * output_channels
+              + o) * output_dim, o, input_diff);
+        }
+      } else {
+        const int c = plane / multiplier_;
+        for (int n = 0; n < num_; ++n) {
+          correlate(input_ + (static_cast<size_t>(n) * channels_ + c)
+              * input_dim, output_diff_ + (static_cast<size_t>(n)
+              * output_channels + plane) * output_dim,
+              result_ + plane * kernel_h_ * kernel_w_);
+        }
+      }
+    }
+  }
+
+ protected:
+  // output += input convolved with filter o
+  void accumulate(const Dtype* input, int o, Dtype* output) {
+    const Dtype* weight = weight_ + o * kernel_h_ * kernel_w_;
+    for (int y = 0; y < output_h_; ++y) {
+      Dtype* out = output + y * output_w_;
+      for (int i = 0; i < kernel_h_; ++i) {
+        const int row = y * stride_h_ + i * dilation_h_ - pad_h_;
+        if (row < 0 || row >= height_) {
+          continue;
+        }
+        for (int j = 0; j < kernel_w_; ++j) {
+          const Dtype w = weight[i * kernel_w_ + j];
+          const int col = j * dilation_w_ - pad_w_;
+          int col_begin, col_end;
+          valid_outputs(col, stride_w_, width_, output_w_, &col_begin,
+              &col_end);
+          const Dtype* in = input + row * width_ + col;
+          if (stride_w_ == 1) {
+            for (int x = col_begin; x < col_end; ++x) {
+              out[x] += w * in[x];
+            }
+          } else {
+            for (int x = col_begin; x < col_end; ++x) {
+              out[x] += w * in[x * stride_w_];
+            }
+          }
+        }
+      }
+    }
+  }
+
+  // input_diff += output_diff convolved back with filter o
+  void scatter(const Dtype* output_diff, int o, Dtype* input_diff) {
+    const Dtype* weight = weight_ + o * kernel_h_ * kernel_w_;
+    for (int y = 0; y < output_h_; ++y) {
+      const Dtype* out = output_diff + y * output_w_;
+      for (int i = 0; i < kernel_h_; ++i) {
+        const int row = y * stride_h_ + i * dilation_h_ - pad_h_;
+        if (row < 0 || row >= height_) {
+          continue;
+        }
+        for (int j = 0; j < kernel_w_; ++j) {
+          const Dtype w = weight[i * kernel_w_ + j];
+          const int col = j * dilation_w_ - pad_w_;
+          int col_begin, col_end;
+          valid_outputs(col, stride_w_, width_, output_w_, &col_begin,
+              &col_end);
+          Dtype* in = input_diff + row * width_ + col;
+          if (stride_w_ == 1) {
+            for (int x = col_begin; x < col_end; ++x) {
+              in[x] += w * out[x];
+            }
+          } else {
+            for (int x = col_begin; x < col_end; ++x) {
+              in[x * stride_w_] += w * out[x];
+            }
+          }
+        }
+      }
+    }
+  }
+
+  // weight_diff += correlation of the input with output_diff, per tap
+  void correlate(const Dtype* input, const Dtype* output_diff,
+      Dtype* weight_diff) {
+    for (int y = 0; y < output_h_; ++y) {
+      const Dtype* out = output_diff + y * output_w_;
+      for (int i = 0; i < kernel_h_; ++i) {
+        const int row = y * stride_h_ + i * dilation_h_ - pad_h_;
+        if (row < 0 || row >= height_) {
+          continue;
+        }
+        for (int j = 0; j < kernel_w_; ++j) {
+          const int col = j * dilation_w_ - pad_w_;
+          int col_begin, col_end;
+          valid_outputs(col, stride_w_, width_, output_w_, &col_begin,
+              &col_end);
+          const Dtype* in = input + row * width_ + col;
+          Dtype sum = 0;
+          if (stride_w_ == 1) {
+            for (int x = col_begin; x < col_end; ++x) {
+              sum += out[x] * in[x];
+            }
+          } else {
+            for (int x = col_begin; x < col_end; ++x) {
+              sum += out[x] * in[x * stride_w_];
+            }
+          }
+          weight_diff[i * kernel_w_ + j] += sum;
+        }
+      }
+    }
+  }
+
+  const Pass pass_;
+  const int num_, channels_, height_, width_, multiplier_;
+  const int kernel_h_, kernel_w_, pad_h_, pad_w_, stride_h_, stride_w_;
+  const int dilation_h_, dilation_w_, output_h_, output_w_;
+  const Dtype* input_;
+  const Dtype* weight_;
+  const Dtype* output_diff_;
+  Dtype* result_;
+};
+
+// Number of multiply-adds below which the passes run on the calling thread
+const int kDepthwiseMinParallelCount = 1 << 16;
+
+template <typename Dtype>
+static void run_depthwise_conv(DepthwiseConvTask<Dtype>* task) {
+  if (Caffe::cpu_threads() == 1 ||
+      task->work() < kDepthwiseMinParallelCount) {
+    task->Run(0, 0, task->planes());
+  } else {
+    Caffe::cpu_pool().Run(task, task->planes());
+  }
+}
+
+template <typename Dtype>
+void depthwise_conv_cpu(const Dtype* input, const int num,
+    const int channels, const int height, const int width,
+    const int multiplier, const int kernel_h, const int kernel_w,
+    const int pad_h, const int pad_w, const int stride_h, const int stride_w,
+    const int dilation_h, const int dilation_w, const Dtype* weight,
+    Dtype* output) {
+  DepthwiseConvTask<Dtype> task(DepthwiseConvTask<Dtype>::FORWARD, num,
+      channels, height, width, multiplier, kernel_h, kernel_w, pad_h, pad_w,
+      stride_h, stride_w, dilation_h, dilation_w, input, weight, NULL,
+      output);
+  run_depthwise_conv(&task);
+}
+
+template <typename Dtype>
+void depthwise_conv_backward_cpu(const Dtype* output_diff, const int num,
+    const int channels, const int height, const int width,
+    const int multiplier, const int kernel_h, const int kernel_w,
+    const int pad_h, const int pad_w, const int stride_h, const int stride_w,
+    const int dilation_h, const int dilation_w, const Dtype* weight,
+    Dtype* input_diff) {
+  DepthwiseConvTask<Dtype> task(DepthwiseConvTask<Dtype>::BACKWARD_DATA,
+      num, channels, height, width, multiplier, kernel_h, kernel_w, pad_h,
+      pad_w, stride_h, stride_w, dilation_h, dilation_w, NULL, weight,
+      output_diff, input_diff);
+  run_depthwise_conv(&task);
+}
+
+template <typename Dtype>
+void depthwise_conv_weight_cpu(const Dtype* input, const Dtype* output_diff,
+    const int num, const int channels, const int height, const int width,
+    const int multiplier, const int kernel_h, const int kernel_w,
+    const int pad_h, const int pad_w, const int stride_h, const int stride_w,
+    const int dilation_h, const int dilation_w, Dtype* weight_diff) {
+  DepthwiseConvTask<Dtype> task(DepthwiseConvTask<Dtype>::BACKWARD_WEIGHT,
+      num, channels, height, width, multiplier, kernel_h, kernel_w, pad_h,
+      pad_w, stride_h, stride_w, dilation_h, dilation_w, input, NULL,
+      output_diff, weight_diff);
+  run_depthwise_conv(&task);
+}
+
+// Explicit instantiation
+template void depthwise_conv_cpu<float>(const float* input, const int num,
+    const int channels, const int height, const int width,
+    const int multiplier, const int kernel_h, const int kernel_w,
+    const int pad_h, const int pad_w, const int stride_h, const int stride_w,
+    const int dilation_h, const int dilation_w, const float* weight,
+    float* output);
+template void depthwise_conv_cpu<double>(const double* input, const int num,
+    const int channels, const int height, const int width,
+    const int multiplier, const int kernel_h, const int kernel_w,
+    const int pad_h, const int pad_w, const int stride_h, const int stride_w,
+    const int dilation_h, const int dilation_w, const double* weight,
+    double* output);
+template void depthwise_conv_backward_cpu<float>(const float* output_diff,
+    const int num, const int channels, const int height, const int width,
+    const int multiplier, const int kernel_h, const int kernel_w,
+    const int pad_h, const int pad_w, const int stride_h, const int stride_w,
+    const int dilation_h, const int dilation_w, const float* weight,
+    float* input_diff);
+template void depthwise_conv_backward_cpu<double>(const double* output_diff,
+    const int num, const int channels, const int height, const int width,
+    const int multiplier, const int kernel_h, const int kernel_w,
+    const int pad_h, const int pad_w, const int stride_h, const int stride_w,
+    const int dilation_h, const int dilation_w, const double* weight,
+    double* input_diff);
+template void depthwise_conv_weight_cpu<float>(const float* input,
+    const float* output_diff, const int num, const int channels,
+    const int height, const int width, const int multiplier,
+    const int kernel_h, const int kernel_w, const int pad_h, const int pad_w,
+    const int stride_h, const int stride_w, const int dilation_h,
+    const int dilation_w, float* weight_diff);
+template void depthwise_conv_weight_cpu<double>(const double* input,
+    const double* output_diff, const int num, const int channels,
+    const int height, const int width, const int multiplier,
+    const int kernel_h, const int kernel_w, const int pad_h, const int pad_w,
+    const int stride_h, const int stride_w, const int dilation_h,
+    const int dilation_w, double* weight_diff);
+
+}  // namespace caffe
@@ -0,0 +1,228 @@
+#include <cmath>
+#include <map>
+#include <string>
+#include <vector>
+
+#include "caffe/common.hpp"
+#include "caffe/util/fold_batch_norm.hpp"
+
+namespace caffe {
+
+// Values of a blob, whether it is stored in float or in double
+static void GetBlobValues(const BlobProto& blob, vector<double>* values) {
+  if (blob.double_data_size() > 0) {
+    values->assign(blob.double_data().begin(), blob.double_data().end());
+  } else {
+    values->assign(blob.data().begin(), blob.data().end());
+  }
+}
+
+static void SetBlobValues(const vector<double>& values, bool double_data,
+    BlobProto* blob) {
+  blob->clear_data();
+  blob->clear_double_data();
+  for (int i = 0; i < values.size(); ++i) {
+    if (double_data) {
+      blob->add_double_data(values[i]);
+    } else {
+      blob->add_data(values[i]);
+    }
+  }
+}
+
+// Number of outputs of a layer whose weights can take the scale and shift of
+// each of them, or 0
+static int FoldableOutputs(const LayerParameter& layer) {
+  if (layer.top_size() != 1 || layer.blobs_size() == 0) {
+    return 0;
+  }
+  if (layer.type() == "Convolution" &&
+      layer.convolution_param().axis() == 1) {
+    return layer.convolution_param().num_output();
+  }
+  if (layer.type() == "InnerProduct" &&
+      layer.inner_product_param().axis() == 1) {
+    return layer.inner_product_param().num_output();
+  }
+  return 0;
+}
+
+// Whether layer scales and shifts each of the channels of its bottom, or all
+// of them alike, with its trained blobs
+static bool IsChannelAffine(const LayerParameter& layer, int channels) {
+  if (layer.bottom_size() != 1 || layer.top_size() != 1 ||
+      layer.loss_weight_size() > 0) {
+    return false;
+  }
+  if (layer.type() == "BatchNorm") {
+    const BatchNormParameter& param = layer.batch_norm_param();
+    return (!param.has_use_global_stats() || param.use_global_stats()) &&
+        layer.blobs_size() == 3 && layer.blobs(0).data_size() +
+        layer.blobs(0).double_data_size() == channels;
+  }
+  int axis, num_axes;
+  if (layer.type() == "Scale") {
+    axis = layer.scale_param().axis();
+    num_axes = layer.scale_param().num_axes();
+  } else if (layer.type() == "Bias") {
+    axis = layer.bias_param().axis();
+    num_axes = layer.bias_param().num_axes();
+  } else {
+    return false;
+  }
+  if (layer.blobs_size() == 0 || !(num_axes == 0 ||
+      (num_axes == 1 && axis == 1))) {
+    return false;
+  }
+  for (int i = 0; i < layer.blobs_size(); ++i) {
+    const int count =
+        layer.blobs(i).data_size() + layer.blobs(i).double_data_size();
+    if (count != (num_axes == 0 ? 1 : channels)) {
+      return false;
+    }
+  }
+  return true;
+}
+
+// Composes the scale and shift of each channel with those of layer
+static void ComposeChannelAffine(const LayerParameter& layer,
+    vector<double>* scale, vector<double>* shift) {
+  const int channels = scale->size();
+  vector<double> a, b;
+  if (layer.type() == "BatchNorm") {
+    // As in BatchNormLayer with global statistics, for the statistics scaled
+    // by their weight
+    vector<double> mean, variance, weight;
+    GetBlobValues(layer.blobs(0), &mean);
+    GetBlobValues(layer.blobs(1), &variance);
+    GetBlobValues(layer.blobs(2), &weight);
+    const double factor = weight[0] == 0 ? 0 : 1 / weight[0];
+    const double eps = layer.batch_norm_param().eps();
+    for (int c = 0; c < channels; ++c) {
+      a.push_back(1 / std::sqrt(variance[c] * factor + eps));
+      b.push_back(-mean[c] * factor * a[c]);
+    }
+  } else {
+    vector<double> values;
+    a.assign(channels, 1);
+    b.assign(channels, 0);
+    for (int i = 0; i < layer.blobs_size(); ++i) {
+      GetBlobValues(layer.blobs(i), &values);
+      vector<double>& coefficients =
+          (layer.type() == "Scale" && i == 0) ? a : b;
+      for (int c = 0; c < channels; ++c) {
+        coefficients[c] = values[values.size() == 1 ? 0 : c];
+      }
+    }
+  }
+  for (int c = 0; c < channels; ++c) {
+    (*scale)[c] *= a[c];
+    (*shift)[c] = a[c] * (*shift)[c] + b[c];
+  }
+}
+
+// Scales and shifts the outputs of a Convolution or InnerProduct layer
+static void FoldChannelAffine(const vector<double>& scale,
+    const vector<double>& shift, LayerParameter* layer) {
+  const int channels = scale.size();
+  const bool double_data = layer->blobs(0).double_data_size() > 0;
+  vector<double> weights;
+  GetBlobValues(layer->blobs(0), &weights);
+  CHECK_EQ(weights.size() % channels, 0) << "Weights of " << layer->name()
+      << " do not match its " << channels << " outputs";
+  // The weights of each output come in turn
+  const int size = weights.size() / channels;
+  for (int i = 0; i < weights.size(); ++i) {
+    weights[i] *= scale[i / size];
+  }
+  SetBlobValues(weights, double_data, layer->mutable_blobs(0));
+  bool bias_term = layer->type() == "Convolution" ?
+      layer->convolution_param().bias_term() :
+      layer->inner_product_param().bias_term();
+  vector<double> bias(channels, 0);
+  if (bias_term) {
+    CHECK_GE(layer->blobs_size(), 2) << "Missing bias of " << layer->name();
+    GetBlobValues(layer->blobs(1), &bias);
+    CHECK_EQ(bias.size(), channels) << "Bias of " << layer->name()
+        << " does not match its " << channels << " outputs";
+  } else if (layer->type() == "Convolution") {
+    layer->mutable_convolution_param()->set_bias_term(true);
+  } else {
+    layer->mutable_inner_product_param()->set_bias_term(true);
+  }
+  if (layer->blobs_size() < 2) {
+    layer->add_blobs()->mutable_shape()->add_dim(channels);
+  }
+  for (int c = 0; c < channels; ++c) {
+    bias[c] = scale[c] * bias[c] + shift[c];
+  }
+  SetBlobValues(bias, double_data, layer->mutable_blobs(1));
+}
+
+void FoldBatchNorm(const NetParameter& param, const NetParameter& weights,
+    NetParameter* param_folded, NetParameter* weights_folded) {
+  CHECK_EQ(param.state().phase(), TEST)
+      << "Only the layers of TEST nets can be folded";
+  map<string, const LayerParameter*> trained_layers;
+  for (int i = 0; i < weights.layer_size(); ++i) {
+    trained_layers[weights.layer(i).name()] = &weights.layer(i);
+  }
+  // The layers of the net with their trained blobs
+  vector<LayerParameter> layers(param.layer_size());
+  for (int i = 0; i < param.layer_size(); ++i) {
+    layers[i].CopyFrom(param.layer(i));
+    layers[i].clear_blobs();
+    if (trained_layers.count(param.layer(i).name())) {
+      layers[i].mutable_blobs()->CopyFrom(
+          trained_layers[param.layer(i).name()]->blobs());
+    }
+  }
+  param_folded->CopyFrom(param);
+  param_folded->clear_layer();
+  weights_folded->CopyFrom(param);
+  weights_folded->clear_layer();
+  for (int i = 0; i < layers.size(); ++i) {
+    LayerParameter& layer = layers[i];
+    const int channels = FoldableOutputs(layer);
+    int last = i;
+    vector<double> scale(channels, 1), shift(channels, 0);
+    while (channels > 0 && last + 1 < layers.size() &&
+        IsChannelAffine(layers[last + 1], channels)) {
+      // The top of the last layer must only be consumed by the next one
+      const string& top = layers[last].top(0);
+      if (layers[last + 1].bottom(0) != top) {
+        break;
+      }
+      int consumers = 0;
+      for (int j = last + 1; j < layers.size(); ++j) {
+        for (int k = 0; k < layers[j].bottom_size(); ++k) {
+          consumers += layers[j].bottom(k) == top;
+        }
+        bool overwritten = false;
+        for (int k = 0; k < layers[j].top_size(); ++k) {
+          overwritten = overwritten || layers[j].top(k) == top;
+        }
+        if (overwritten) {
+          break;
+        }
+      }
+      if (consumers != 1) {
+        break;
+      }
+      ++last;
+      ComposeChannelAffine(layers[last], &scale, &shift);
+      LOG(INFO) << "Folding " << layers[last].name() << " into "
+          << layer.name();
+    }
+    if (last > i) {
+      FoldChannelAffine(scale, shift, &layer);
+      layer.set_top(0, layers[last].top(0));
+    }
+    weights_folded->add_layer()->CopyFrom(layer);
+    layer.clear_blobs();
+    param_folded->add_layer()->CopyFrom(layer);
+    i = last;
+  }
+}
+
+}  // namespace caffe
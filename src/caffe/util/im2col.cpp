@@ -1,7 +1,12 @@
+#include <stdint.h>
+#include <algorithm>
+#include <cstring>
 #include <vector>
 
+#include "caffe/common.hpp"
 #include "caffe/util/im2col.hpp"
 #include "caffe/util/math_functions.hpp"
+#include "caffe/util/thread_pool.hpp"
 
 namespace caffe {
 
@@ -15,6 +20,78 @@ inline bool is_a_ge_zero_and_a_lt_b(int a, int b) {
   return static_cast<unsigned>(a) < static_cast<unsigned>(b);
 }
 
+// Output columns [*begin, *end) of a row of the column buffer, whose input
+// columns input_col + i * stride are inside the image. Columns outside of
+// that range are padding.
+inline void valid_output_cols(int input_col, int stride, int width,
+    int output_w, int* begin, int* end) {
+  *begin = input_col >= 0 ? 0 : (-input_col + stride - 1) / stride;
+  *end = input_col >= width ? 0 : (width - input_col + stride - 1) / stride;
+  *end = std::max(*begin, std::min(*end, output_w));
+  *begin = std::min(*begin, *end);
+}
+
+// The column buffer is split in rows of output_w values, one per channel,
+// kernel offset and output row, which are filled independently.
+template <typename Dtype>
+class Im2colTask : public ThreadPool::Task {
+ public:
+  Im2colTask(const Dtype* data_im, const int height, const int width,
+      const int kernel_h, const int kernel_w, const int pad_h,
+      const int pad_w, const int stride_h, const int stride_w,
+      const int dilation_h, const int dilation_w, const int output_h,
+      const int output_w, const int col_stride, Dtype* data_col)
+      : data_im_(data_im), height_(height), width_(width),
+        kernel_h_(kernel_h), kernel_w_(kernel_w), pad_h_(pad_h),
+        pad_w_(pad_w), stride_h_(stride_h), stride_w_(stride_w),
+        dilation_h_(dilation_h), dilation_w_(dilation_w),
+        output_h_(output_h), output_w_(output_w), col_stride_(col_stride),
+        data_col_(data_col) {}
+
+  virtual void Run(int thread, int begin, int end) {
+    for (int row = begin; row < end; ++row) {
+      const int output_row = row % output_h_;
+      const int kernel_col = row / output_h_ % kernel_w_;
+      const int kernel_row = row / output_h_ / kernel_w_ % kernel_h_;
+      const int channel = row / output_h_ / kernel_w_ / kernel_h_;
+      const int input_row = -pad_h_ + kernel_row * dilation_h_
+          + output_row * stride_h_;
+      Dtype* col = data_col_ + static_cast<size_t>(row / output_h_)
+          * col_stride_ + output_row * output_w_;
+      if (!is_a_ge_zero_and_a_lt_b(input_row, height_)) {
+        memset(col, 0, sizeof(Dtype) * output_w_);
+        continue;
+      }
+      const int input_col = -pad_w_ + kernel_col * dilation_w_;
+      int col_begin, col_end;
+      valid_output_cols(input_col, stride_w_, width_, output_w_, &col_begin,
+          &col_end);
+      const Dtype* im = data_im_ + (static_cast<size_t>(channel) * height_
+          + input_row) * width_ + input_col;
+      memset(col, 0, sizeof(Dtype) * col_begin);
+      if (stride_w_ == 1) {
+        memcpy(col + col_begin, im + col_begin,
+            sizeof(Dtype) * (col_end - col_begin));
+      } else {
+        for (int i = col_begin; i < col_end; ++i) {
+          col[i] = im[i * stride_w_];
+        }
+      }
+      memset(col + col_end, 0, sizeof(Dtype) * (output_w_ - col_end));
+    }
+  }
+
+ protected:
+  const Dtype* data_im_;
+  const int height_, width_, kernel_h_, kernel_w_, pad_h_, pad_w_;
+  const int stride_h_, stride_w_, dilation_h_, dilation_w_;
+  const int output_h_, output_w_, col_stride_;
+  Dtype* data_col_;
+};
+
+// Number of values below which the conversions run on the calling thread
+const int kIm2colMinParallelCount = 1 << 16;
+
 template <typename Dtype>
 void im2col_cpu(const Dtype* data_im, const int channels,
     const int height, const int width, const int kernel_h, const int kernel_w,
@@ -26,31 +103,31 @@ void im2col_cpu(const Dtype* data_im, const int channels,
     (dilation_h * (kernel_h - 1) + 1)) / stride_h + 1;
   const int output_w = (width + 2 * pad_w -
     (dilation_w * (kernel_w - 1) + 1)) / stride_w + 1;
-  const int channel_size = height * width;
-  for (int channel = channels; channel--; data_im += channel_size) {
-    for (int kernel_row = 0; kernel_row < kernel_h; kernel_row++) {
-      for (int kernel_col = 0; kernel_col < kernel_w; kernel_col++) {
-        int input_row = -pad_h + kernel_row * dilation_h;
-        for (int output_rows = output_h; output_rows; output_rows--) {
-          if (!is_a_ge_zero_and_a_lt_b(input_row, height)) {
-            for (int output_cols = output_w; output_cols; output_cols--) {
-              *(data_col++) = 0;
-            }
-          } else {
-            int input_col = -pad_w + kernel_col * dilation_w;
-            for (int output_col = output_w; output_col; output_col--) {
-              if (is_a_ge_zero_and_a_lt_b(input_col, width)) {
-                *(data_col++) = data_im[input_row * width + input_col];
-              } else {
-                *(data_col++) = 0;
-              }
-              input_col += stride_w;
-            }
-          }
-          input_row += stride_h;
-        }
-      }
-    }
+  im2col_cpu(data_im, channels, height, width, kernel_h, kernel_w, pad_h,
+      pad_w, stride_h, stride_w, dilation_h, dilation_w, output_h * output_w,
+      data_col);
+}
+
+template <typename Dtype>
+void im2col_cpu(const Dtype* data_im, const int channels,
+    const int height, const int width, const int kernel_h, const int kernel_w,
+    const int pad_h, const int pad_w,
+    const int stride_h, const int stride_w,
+    const int dilation_h, const int dilation_w,
+    const int col_stride, Dtype* data_col) {
+  const int output_h = (height + 2 * pad_h -
+    (dilation_h * (kernel_h - 1) + 1)) / stride_h + 1;
+  const int output_w = (width + 2 * pad_w -
+    (dilation_w * (kernel_w - 1) + 1)) / stride_w + 1;
+  const int rows = channels * kernel_h * kernel_w * output_h;
+  Im2colTask<Dtype> task(data_im, height, width, kernel_h, kernel_w, pad_h,
+      pad_w, stride_h, stride_w, dilation_h, dilation_w, output_h, output_w,
+      col_stride, data_col);
+  if (Caffe::cpu_threads() == 1 ||
+      static_cast<int64_t>(rows) * output_w < kIm2colMinParallelCount) {
+    task.Run(0, 0, rows);
+  } else {
+    Caffe::cpu_pool().Run(&task, rows);
   }
 }
 
@@ -65,27 +142,39 @@ template void im2col_cpu<double>(const double* data_im, const int channels,
     const int pad_h, const int pad_w, const int stride_h,
     const int stride_w, const int dilation_h, const int dilation_w,
     double* data_col);
+template void im2col_cpu<float>(const float* data_im, const int channels,
+    const int height, const int width, const int kernel_h, const int kernel_w,
+    const int pad_h, const int pad_w, const int stride_h,
+    const int stride_w, const int dilation_h, const int dilation_w,
+    const int col_stride, float* data_col);
+template void im2col_cpu<double>(const double* data_im, const int channels,
+    const int height, const int width, const int kernel_h, const int kernel_w,
+    const int pad_h, const int pad_w, const int stride_h,
+    const int stride_w, const int dilation_h, const int dilation_w,
+    const int col_stride, double* data_col);
 
 template <typename Dtype>
 inline void im2col_nd_core_cpu(const Dtype* data_input, const bool im2col,
     const int num_spatial_axes, const int* im_shape, const int* col_shape,
     const int* kernel_shape, const int* pad, const int* stride,
-    const int* dilation, Dtype* data_output) {
+    const int* dilation, const int channel_begin, const int channel_end,
+    Dtype* data_output) {
+  int kernel_size = 1;
+  for (int i = 0; i < num_spatial_axes; ++i) {
+    kernel_size *= kernel_shape[i];
+  }
   if (!im2col) {
-    int im_size = im_shape[0];
+    int im_size = 1;
     for (int i = 0; i < num_spatial_axes; ++i) {
       im_size *= im_shape[1 + i];
     }
-    caffe_set(im_size, Dtype(0), data_output);
-  }
-  int kernel_size = 1;
-  for (int i = 0; i < num_spatial_axes; ++i) {
-    kernel_size *= kernel_shape[i];
+    caffe_set((channel_end - channel_begin) * im_size, Dtype(0),
+        data_output + channel_begin * im_size);
   }
-  const int channels_col = col_shape[0];
   vector<int> d_offset(num_spatial_axes, 0);
   vector<int> d_iter(num_spatial_axes, 0);
-  for (int c_col = 0; c_col < channels_col; ++c_col) {
+  for (int c_col = channel_begin * kernel_size;
+      c_col < channel_end * kernel_size; ++c_col) {
     // Loop over spatial axes in reverse order to compute a per-axis offset.
     int offset = c_col;
     for (int d_i = num_spatial_axes - 1; d_i >= 0; --d_i) {
@@ -137,14 +226,60 @@ inline void im2col_nd_core_cpu(const Dtype* data_input, const bool im2col,
   }  // for (int c = 0; c < channels_col; ++c) {
 }
 
+// Runs im2col_nd_core_cpu over ranges of image channels, which read or
+// write separate parts of the image and of the column buffer.
+template <typename Dtype>
+class Im2colNdTask : public ThreadPool::Task {
+ public:
+  Im2colNdTask(const Dtype* data_input, const bool im2col,
+      const int num_spatial_axes, const int* im_shape, const int* col_shape,
+      const int* kernel_shape, const int* pad, const int* stride,
+      const int* dilation, Dtype* data_output)
+      : data_input_(data_input), im2col_(im2col),
+        num_spatial_axes_(num_spatial_axes), im_shape_(im_shape),
+        col_shape_(col_shape), kernel_shape_(kernel_shape), pad_(pad),
+        stride_(stride), dilation_(dilation), data_output_(data_output) {}
+
+  void Start(const int channels) {
+    int64_t col_count = col_shape_[0];
+    for (int i = 0; i < num_spatial_axes_; ++i) {
+      col_count *= col_shape_[1 + i];
+    }
+    if (Caffe::cpu_threads() == 1 || col_count < kIm2colMinParallelCount) {
+      Run(0, 0, channels);
+    } else {
+      Caffe::cpu_pool().Run(this, channels);
+    }
+  }
+
+  virtual void Run(int thread, int begin, int end) {
+    im2col_nd_core_cpu(data_input_, im2col_, num_spatial_axes_, im_shape_,
+        col_shape_, kernel_shape_, pad_, stride_, dilation_, begin, end,
+        data_output_);
+  }
+
+ protected:
+  const Dtype* data_input_;
+  const bool im2col_;
+  const int num_spatial_axes_;
+  const int* im_shape_;
+  const int* col_shape_;
+  const int* kernel_shape_;
+  const int* pad_;
+  const int* stride_;
+  const int* dilation_;
+  Dtype* data_output_;
+};
+
 template <typename Dtype>
 void im2col_nd_cpu(const Dtype* data_im, const int num_spatial_axes,
     const int* im_shape, const int* col_shape,
     const int* kernel_shape, const int* pad, const int* stride,
     const int* dilation, Dtype* data_col) {
   const bool kIm2Col = true;
-  im2col_nd_core_cpu(data_im, kIm2Col, num_spatial_axes, im_shape, col_shape,
-                  kernel_shape, pad, stride, dilation, data_col);
+  Im2colNdTask<Dtype> task(data_im, kIm2Col, num_spatial_axes, im_shape,
+      col_shape, kernel_shape, pad, stride, dilation, data_col);
+  task.Start(im_shape[0]);
 }
 
 // Explicit instantiation
@@ -159,6 +294,68 @@ template void im2col_nd_cpu<double>(const double* data_im,
     const int* kernel_shape, const int* pad, const int* stride,
     const int* dilation, double* data_col);
 
+// Each channel of the image only receives values from its own rows of the
+// column buffer, so channels are accumulated independently.
+template <typename Dtype>
+class Col2imTask : public ThreadPool::Task {
+ public:
+  Col2imTask(const Dtype* data_col, const int height, const int width,
+      const int kernel_h, const int kernel_w, const int pad_h,
+      const int pad_w, const int stride_h, const int stride_w,
+      const int dilation_h, const int dilation_w, const int output_h,
+      const int output_w, const int col_stride, Dtype* data_im)
+      : data_col_(data_col), height_(height), width_(width),
+        kernel_h_(kernel_h), kernel_w_(kernel_w), pad_h_(pad_h),
+        pad_w_(pad_w), stride_h_(stride_h), stride_w_(stride_w),
+        dilation_h_(dilation_h), dilation_w_(dilation_w),
+        output_h_(output_h), output_w_(output_w), col_stride_(col_stride),
+        data_im_(data_im) {}
+
+  virtual void Run(int thread, int begin, int end) {
+    const int channel_size = height_ * width_;
+    for (int channel = begin; channel < end; ++channel) {
+      Dtype* data_im = data_im_ + static_cast<size_t>(channel) * channel_size;
+      const Dtype* col_row = data_col_ + static_cast<size_t>(channel)
+          * kernel_h_ * kernel_w_ * col_stride_;
+      memset(data_im, 0, sizeof(Dtype) * channel_size);
+      for (int kernel_row = 0; kernel_row < kernel_h_; kernel_row++) {
+        for (int kernel_col = 0; kernel_col < kernel_w_; kernel_col++) {
+          const int input_col = -pad_w_ + kernel_col * dilation_w_;
+          int col_begin, col_end;
+          valid_output_cols(input_col, stride_w_, width_, output_w_,
+              &col_begin, &col_end);
+          const Dtype* col = col_row;
+          col_row += col_stride_;
+          int input_row = -pad_h_ + kernel_row * dilation_h_;
+          for (int output_row = 0; output_row < output_h_;
+              ++output_row, input_row += stride_h_, col += output_w_) {
+            if (!is_a_ge_zero_and_a_lt_b(input_row, height_)) {
+              continue;
+            }
+            Dtype* im = data_im + input_row * width_ + input_col;
+            if (stride_w_ == 1) {
+              for (int i = col_begin; i < col_end; ++i) {
+                im[i] += col[i];
+              }
+            } else {
+              for (int i = col_begin; i < col_end; ++i) {
+                im[i * stride_w_] += col[i];
+              }
+            }
+          }
+        }
+      }
+    }
+  }
+
+ protected:
+  const Dtype* data_col_;
+  const int height_, width_, kernel_h_, kernel_w_, pad_h_, pad_w_;
+  const int stride_h_, stride_w_, dilation_h_, dilation_w_;
+  const int output_h_, output_w_, col_stride_;
+  Dtype* data_im_;
+};
+
 template <typename Dtype>
 void col2im_cpu(const Dtype* data_col, const int channels,
     const int height, const int width, const int kernel_h, const int kernel_w,
@@ -166,33 +363,34 @@ void col2im_cpu(const Dtype* data_col, const int channels,
     const int stride_h, const int stride_w,
     const int dilation_h, const int dilation_w,
     Dtype* data_im) {
-  caffe_set(height * width * channels, Dtype(0), data_im);
   const int output_h = (height + 2 * pad_h -
     (dilation_h * (kernel_h - 1) + 1)) / stride_h + 1;
   const int output_w = (width + 2 * pad_w -
     (dilation_w * (kernel_w - 1) + 1)) / stride_w + 1;
-  const int channel_size = height * width;
-  for (int channel = channels; channel--; data_im += channel_size) {
-    for (int kernel_row = 0; kernel_row < kernel_h; kernel_row++) {
-      for (int kernel_col = 0; kernel_col < kernel_w; kernel_col++) {
-        int input_row = -pad_h + kernel_row * dilation_h;
-        for (int output_rows = output_h; output_rows; output_rows--) {
-          if (!is_a_ge_zero_and_a_lt_b(input_row, height)) {
-            data_col += output_w;
-          } else {
-            int input_col = -pad_w + kernel_col * dilation_w;
-            for (int output_col = output_w; output_col; output_col--) {
-              if (is_a_ge_zero_and_a_lt_b(input_col, width)) {
-                data_im[input_row * width + input_col] += *data_col;
-              }
-              data_col++;
-              input_col += stride_w;
-            }
-          }
-          input_row += stride_h;
-        }
-      }
-    }
+  col2im_cpu(data_col, channels, height, width, kernel_h, kernel_w, pad_h,
+      pad_w, stride_h, stride_w, dilation_h, dilation_w, output_h * output_w,
+      data_im);
+}
+
+template <typename Dtype>
+void col2im_cpu(const Dtype* data_col, const int channels,
+    const int height, const int width, const int kernel_h, const int kernel_w,
+    const int pad_h, const int pad_w,
+    const int stride_h, const int stride_w,
+    const int dilation_h, const int dilation_w,
+    const int col_stride, Dtype* data_im) {
+  const int output_h = (height + 2 * pad_h -
+    (dilation_h * (kernel_h - 1) + 1)) / stride_h + 1;
+  const int output_w = (width + 2 * pad_w -
+    (dilation_w * (kernel_w - 1) + 1)) / stride_w + 1;
+  Col2imTask<Dtype> task(data_col, height, width, kernel_h, kernel_w, pad_h,
+      pad_w, stride_h, stride_w, dilation_h, dilation_w, output_h, output_w,
+      col_stride, data_im);
+  if (Caffe::cpu_threads() == 1 || static_cast<int64_t>(channels) * kernel_h
+      * kernel_w * output_h * output_w < kIm2colMinParallelCount) {
+    task.Run(0, 0, channels);
+  } else {
+    Caffe::cpu_pool().Run(&task, channels);
   }
 }
 
@@ -207,6 +405,16 @@ template void col2im_cpu<double>(const double* data_col, const int channels,
     const int pad_h, const int pad_w, const int stride_h,
     const int stride_w, const int dilation_h, const int dilation_w,
     double* data_im);
+template void col2im_cpu<float>(const float* data_col, const int channels,
+    const int height, const int width, const int kernel_h, const int kernel_w,
+    const int pad_h, const int pad_w, const int stride_h,
+    const int stride_w, const int dilation_h, const int dilation_w,
+    const int col_stride, float* data_im);
+template void col2im_cpu<double>(const double* data_col, const int channels,
+    const int height, const int width, const int kernel_h, const int kernel_w,
+    const int pad_h, const int pad_w, const int stride_h,
+    const int stride_w, const int dilation_h, const int dilation_w,
+    const int col_stride, double* data_im);
 
 template <typename Dtype>
 void col2im_nd_cpu(const Dtype* data_col, const int num_spatial_axes,
@@ -214,8 +422,9 @@ void col2im_nd_cpu(const Dtype* data_col, const int num_spatial_axes,
     const int* kernel_shape, const int* pad, const int* stride,
     const int* dilation, Dtype* data_im) {
   const bool kIm2Col = false;
-  im2col_nd_core_cpu(data_col, kIm2Col, num_spatial_axes, im_shape, col_shape,
-                     kernel_shape, pad, stride, dilation, data_im);
+  Im2colNdTask<Dtype> task(data_col, kIm2Col, num_spatial_axes, im_shape,
+      col_shape, kernel_shape, pad, stride, dilation, data_im);
+  task.Start(im_shape[0]);
 }
 
 // Explicit instantiation
@@ -0,0 +1,94 @@
+#ifdef USE_OPENCV
+#include <boost/thread.hpp>
+
+#include <list>
+#include <map>
+
+#include "caffe/util/image_cache.hpp"
+
+namespace caffe {
+
+ImageCache::ImageCache(size_t max_bytes, int log_interval)
+    : max_bytes_(max_bytes), log_interval_(log_interval), bytes_(0),
+      hits_(0), misses_(0), evictions_(0), mutex_(new boost::mutex()) {
+}
+
+ImageCache::~ImageCache() {
+  if (hits_ + misses_ > 0) {
+    LogStats();
+  }
+}
+
+bool ImageCache::Get(int key, cv::Mat* image) {
+  bool hit;
+  bool log;
+  {
+    boost::mutex::scoped_lock lock(*mutex_);
+    std::map<int, Entry>::iterator it = entries_.find(key);
+    hit = it != entries_.end();
+    if (hit) {
+      ++hits_;
+      *image = it->second.image;
+      uses_.splice(uses_.begin(), uses_, it->second.use);
+    } else {
+      ++misses_;
+    }
+    log = log_interval_ > 0 && (hits_ + misses_) % log_interval_ == 0;
+  }
+  if (log) {
+    LogStats();
+  }
+  return hit;
+}
+
+void ImageCache::Put(int key, const cv::Mat& image) {
+  const size_t bytes = image.step * image.rows;
+  if (bytes > max_bytes_) {
+    return;
+  }
+  boost::mutex::scoped_lock lock(*mutex_);
+  // Another thread may have added the image since it was looked up
+  if (entries_.count(key)) {
+    return;
+  }
+  while (bytes_ + bytes > max_bytes_) {
+    std::map<int, Entry>::iterator lru = entries_.find(uses_.back());
+    bytes_ -= lru->second.bytes;
+    entries_.erase(lru);
+    uses_.pop_back();
+    ++evictions_;
+  }
+  uses_.push_front(key);
+  Entry& entry = entries_[key];
+  entry.image = image;
+  entry.bytes = bytes;
+  entry.use = uses_.begin();
+  bytes_ += bytes;
+}
+
+size_t ImageCache::bytes() const {
+  boost::mutex::scoped_lock lock(*mutex_);
+  return bytes_;
+}
+
+uint64_t ImageCache::hits() const {
+  boost::mutex::scoped_lock lock(*mutex_);
+  return hits_;
+}
+
+uint64_t ImageCache::misses() const {
+  boost::mutex::scoped_lock lock(*mutex_);
+  return misses_;
+}
+
+void ImageCache::LogStats() const {
+  boost::mutex::scoped_lock lock(*mutex_);
+  const uint64_t lookups = hits_ + misses_;
+  LOG(INFO) << "Image cache: " << entries_.size() << " images, "
+      << bytes_ / (1024 * 1024) << " of " << max_bytes_ / (1024 * 1024)
+      << " MB, hit rate " << (lookups ? 100.0 * hits_ / lookups : 0.0)
+      << "% of " << lookups << " lookups, " << evictions_ << " evictions";
+}
+
+}  // namespace caffe
+#endif  // USE_OPENCV
@@ -70,16 +70,12 @@ template void caffe_set<double>(const int N, const double alpha, double* Y);
 
 template <>
 void caffe_add_scalar(const int N, const float alpha, float* Y) {
-  for (int i = 0; i < N; ++i) {
-    Y[i] += alpha;
-  }
+  simd_add_scalar(N, alpha, Y, Y);
 }
 
 template <>
 void caffe_add_scalar(const int N, const double alpha, double* Y) {
-  for (int i = 0; i < N; ++i) {
-    Y[i] += alpha;
-  }
+  simd_add_scalar(N, alpha, Y, Y);
 }
 
 template <typename Dtype>
@@ -361,15 +357,13 @@ double caffe_cpu_asum<double>(const int n, const double* x) {
 template <>
 void caffe_cpu_scale<float>(const int n, const float alpha, const float *x,
                             float* y) {
-  cblas_scopy(n, x, 1, y, 1);
-  cblas_sscal(n, alpha, y, 1);
+  simd_scale(n, alpha, x, y);
 }
 
 template <>
 void caffe_cpu_scale<double>(const int n, const double alpha, const double *x,
                              double* y) {
-  cblas_dcopy(n, x, 1, y, 1);
-  cblas_dscal(n, alpha, y, 1);
+  simd_scale(n, alpha, x, y);
 }
 
 }  // namespace caffe
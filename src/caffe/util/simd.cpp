@@ -0,0 +1,688 @@
+#include <stdint.h>
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+#include <limits>
+
+#include "caffe/common.hpp"
+#include "caffe/util/simd.hpp"
+#include "caffe/util/thread_pool.hpp"
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#define CAFFE_SIMD_X86
+#endif
+
+// Inlines the operations in the kernels, which compiles them for the
+// instruction set of the kernel
+#define SIMD_INLINE inline __attribute__((always_inline))
+
+namespace caffe {
+
+// Constants of the transcendental functions for each type
+template <typename Dtype> struct SimdMath;
+
+template <> struct SimdMath<float> {
+  typedef int32_t Int;
+  static const int kMantissaBits = 23;
+  static const int kExponentBias = 127;
+  static const int kExpTerms = 8;
+  static const int kLogTerms = 5;
+  // exp is clamped to [kExpMin, kExpMax], where it is 0 and infinite
+  static const float kExpMin, kExpMax;
+  static const float kLog2e, kLn2Hi, kLn2Lo;
+  // Adding and subtracting kRound rounds to an integer, whose bits are those
+  // of kRound plus the integer
+  static const float kRound;
+  // Subnormal values are scaled by kNormalize, of exponent kNormalizeBits
+  static const float kMinNormal, kNormalize;
+  static const int kNormalizeBits = 25;
+  static const float kSqrt2;
+  // Taylor series of exp, 1 / k!, and of atanh, 1 / (2 k + 1)
+  static const float kExp[kExpTerms];
+  static const float kLog[kLogTerms];
+};
+
+const float SimdMath<float>::kExpMin = -104.f;
+const float SimdMath<float>::kExpMax = 89.f;
+const float SimdMath<float>::kLog2e = 1.44269504088896341f;
+const float SimdMath<float>::kLn2Hi = 0.693359375f;
+const float SimdMath<float>::kLn2Lo = -2.12194440e-4f;
+const float SimdMath<float>::kRound = 12582912.f;
+const float SimdMath<float>::kMinNormal = 1.17549435e-38f;
+const float SimdMath<float>::kNormalize = 33554432.f;
+const float SimdMath<float>::kSqrt2 = 1.41421356237309505f;
+const float SimdMath<float>::kExp[] = {1.f, 1.f, 1.f / 2, 1.f / 6, 1.f / 24,
+    1.f / 120, 1.f / 720, 1.f / 5040};
+const float SimdMath<float>::kLog[] = {1.f, 1.f / 3, 1.f / 5, 1.f / 7,
+    1.f / 9};
+
+template <> struct SimdMath<double> {
+  typedef int64_t Int;
+  static const int kMantissaBits = 52;
+  static const int kExponentBias = 1023;
+  static const int kExpTerms = 14;
+  static const int kLogTerms = 11;
+  static const double kExpMin, kExpMax;
+  static const double kLog2e, kLn2Hi, kLn2Lo;
+  static const double kRound;
+  static const double kMinNormal, kNormalize;
+  static const int kNormalizeBits = 54;
+  static const double kSqrt2;
+  static const double kExp[kExpTerms];
+  static const double kLog[kLogTerms];
+};
+
+const double SimdMath<double>::kExpMin = -746.;
+const double SimdMath<double>::kExpMax = 710.;
+const double SimdMath<double>::kLog2e = 1.44269504088896338700e+00;
+const double SimdMath<double>::kLn2Hi = 6.93147180369123816490e-01;
+const double SimdMath<double>::kLn2Lo = 1.90821492927058770002e-10;
+const double SimdMath<double>::kRound = 6755399441055744.;
+const double SimdMath<double>::kMinNormal = 2.2250738585072014e-308;
+const double SimdMath<double>::kNormalize = 18014398509481984.;
+const double SimdMath<double>::kSqrt2 = 1.41421356237309504880;
+const double SimdMath<double>::kExp[] = {1., 1., 1. / 2, 1. / 6, 1. / 24,
+    1. / 120, 1. / 720, 1. / 5040, 1. / 40320, 1. / 362880, 1. / 3628800,
+    1. / 39916800, 1. / 479001600, 1. / 6227020800.};
+const double SimdMath<double>::kLog[] = {1., 1. / 3, 1. / 5, 1. / 7, 1. / 9,
+    1. / 11, 1. / 13, 1. / 15, 1. / 17, 1. / 19, 1. / 21};
+
+// Register of the instruction set the kernels load, of Bytes bytes, or Dtype
+// for the operations without vector code
+template <typename Dtype, int Bytes, bool Vector>
+struct SimdType {
+  typedef Dtype Type __attribute__((vector_size(Bytes)));
+};
+template <typename Dtype, int Bytes>
+struct SimdType<Dtype, Bytes, false> {
+  typedef Dtype Type;
+};
+
+// Vector functions y = f(x), for vectors T of Dtype, inlined in the kernels.
+// IntVector is the type of the masks of the comparisons, of which each lane
+// is all ones or all zeros, and which select lanes with the ?: operator.
+#define SIMD_INT_VECTOR(T) __typeof__(T() < T())
+
+// Clears the sign bits, as fabs does for zeros and NaNs
+template <typename Dtype, typename T>
+SIMD_INLINE void simd_vabs(const T& x, T* y) {
+  typedef SIMD_INT_VECTOR(T) IntVector;
+  *y = (T)((IntVector)x
+      & std::numeric_limits<typename SimdMath<Dtype>::Int>::max());
+}
+
+// 2^k for the integers k of the exponent range
+template <typename Dtype, typename T, typename IntVector>
+SIMD_INLINE void simd_vpow2(const IntVector& k, T* y) {
+  typedef SimdMath<Dtype> M;
+  *y = (T)((k + M::kExponentBias) << M::kMantissaBits);
+}
+
+// Reduces x, clamped to [kExpMin, kExpMax], to exp(x) = 2^(k1 + k2) (1 + q),
+// where q = exp(r) - 1 is the Taylor series of r = x - (k1 + k2) ln(2) and
+// |r| <= ln(2) / 2. The two powers of 2 keep to the exponents of Dtype where
+// exp(x) is subnormal or infinite. NaNs go through to q.
+template <typename Dtype, typename T>
+SIMD_INLINE void simd_vexp_reduce(const T& x, T* q, T* pow2_k1, T* pow2_k2) {
+  typedef SimdMath<Dtype> M;
+  typedef SIMD_INT_VECTOR(T) IntVector;
+  const T zero = T() + Dtype(0);
+  const T x_max = zero + M::kExpMax;
+  const T x_min = zero + M::kExpMin;
+  T xc = x > x_max ? x_max : x;
+  xc = xc < x_min ? x_min : xc;
+  const T t = xc * M::kLog2e + M::kRound;
+  const T n = t - M::kRound;
+  const IntVector k = (IntVector)t - (IntVector)(zero + M::kRound);
+  const T r = (xc - n * M::kLn2Hi) - n * M::kLn2Lo;
+  T p = zero + M::kExp[M::kExpTerms - 1];
+  for (int i = M::kExpTerms - 2; i > 0; --i) {
+    p = p * r + M::kExp[i];
+  }
+  *q = p * r;
+  const IntVector k1 = k >> 1;
+  simd_vpow2<Dtype>(k1, pow2_k1);
+  simd_vpow2<Dtype>(k - k1, pow2_k2);
+}
+
+template <typename Dtype, typename T>
+SIMD_INLINE void simd_vexp(const T& x, T* y) {
+  T q, pow2_k1, pow2_k2;
+  simd_vexp_reduce<Dtype>(x, &q, &pow2_k1, &pow2_k2);
+  *y = ((q + Dtype(1)) * pow2_k1) * pow2_k2;
+}
+
+// exp(x) - 1 for x <= 0, without the cancellation of the subtraction when x
+// is small
+template <typename Dtype, typename T>
+SIMD_INLINE void simd_vexpm1_negative(const T& x, T* y) {
+  T q, pow2_k1, pow2_k2;
+  simd_vexp_reduce<Dtype>(x, &q, &pow2_k1, &pow2_k2);
+  const T pow2_k = pow2_k1 * pow2_k2;
+  *y = pow2_k * q + (pow2_k - Dtype(1));
+}
+
+// log(x) = e ln(2) + log(m) for x = 2^e m with sqrt(1/2) <= m < sqrt(2),
+// where log(m) = 2 atanh(s) with s = (m - 1) / (m + 1) and |s| < 0.172
+template <typename Dtype, typename T>
+SIMD_INLINE void simd_vlog(const T& x, T* y) {
+  typedef SimdMath<Dtype> M;
+  typedef SIMD_INT_VECTOR(T) IntVector;
+  const T zero = T() + Dtype(0);
+  const T inf = zero + std::numeric_limits<Dtype>::infinity();
+  const IntVector subnormal = x < zero + M::kMinNormal;
+  const IntVector bits = (IntVector)(subnormal ? x * M::kNormalize : x);
+  IntVector e = (bits >> M::kMantissaBits) - M::kExponentBias
+      - (subnormal & M::kNormalizeBits);
+  const typename M::Int mantissa =
+      (typename M::Int(1) << M::kMantissaBits) - 1;
+  T m = (T)((bits & mantissa) | (IntVector)(zero + Dtype(1)));
+  const IntVector high = m > zero + M::kSqrt2;
+  m = high ? m * Dtype(0.5) : m;
+  e -= high;
+  const T s = (m - Dtype(1)) / (m + Dtype(1));
+  const T z = s * s;
+  T p = zero + M::kLog[M::kLogTerms - 1];
+  for (int i = M::kLogTerms - 2; i >= 0; --i) {
+    p = p * z + M::kLog[i];
+  }
+  const T log_m = Dtype(2) * s * p;
+  const T ef = (T)(e + (IntVector)(zero + M::kRound)) - M::kRound;
+  T log_x = ef * M::kLn2Hi + (log_m + ef * M::kLn2Lo);
+  log_x = x == inf ? inf : log_x;
+  log_x = x == zero ? -inf : log_x;
+  // NaN for the negative values and the NaNs
+  *y = x >= zero ? log_x : zero + std::numeric_limits<Dtype>::quiet_NaN();
+}
+
+// log(1 + x) for x >= 0, which scales log(u) by x / (u - 1) for the rounding
+// of u = 1 + x
+template <typename Dtype, typename T>
+SIMD_INLINE void simd_vlog1p_positive(const T& x, T* y) {
+  const T u = x + Dtype(1);
+  const T d = u - Dtype(1);
+  T log_u;
+  simd_vlog<Dtype>(u, &log_u);
+  *y = d == T() + Dtype(0) ? x : log_u * (x / d);
+}
+
+// tanh(|x|) = -expm1(-2 |x|) / (expm1(-2 |x|) + 2), with the sign of x
+template <typename Dtype, typename T>
+SIMD_INLINE void simd_vtanh(const T& x, T* y) {
+  typedef SIMD_INT_VECTOR(T) IntVector;
+  T abs_x, t, tanh_abs_x;
+  simd_vabs<Dtype>(x, &abs_x);
+  simd_vexpm1_negative<Dtype>(abs_x * Dtype(-2), &t);
+  // The magnitude, as -0 / 2 is -0
+  simd_vabs<Dtype>(t / (t + Dtype(2)), &tanh_abs_x);
+  *y = (T)((IntVector)tanh_abs_x | ((IntVector)x & ~(IntVector)abs_x));
+}
+
+// Elementwise operations y = op(a, b), on vectors or on single values for the
+// operations without vector code, which take vectors by reference as they
+// may be wider than the default ABI. Unary ones ignore their second operand,
+// which is their first.
+template <typename Dtype>
+struct AddOp {
+  static const bool kVector = true;
+  template <typename T>
+  SIMD_INLINE void operator()(const T& a, const T& b, T* y) const {
+    *y = a + b;
+  }
+};
+
+template <typename Dtype>
+struct SubOp {
+  static const bool kVector = true;
+  template <typename T>
+  SIMD_INLINE void operator()(const T& a, const T& b, T* y) const {
+    *y = a - b;
+  }
+};
+
+template <typename Dtype>
+struct MulOp {
+  static const bool kVector = true;
+  template <typename T>
+  SIMD_INLINE void operator()(const T& a, const T& b, T* y) const {
+    *y = a * b;
+  }
+};
+
+template <typename Dtype>
+struct DivOp {
+  static const bool kVector = true;
+  template <typename T>
+  SIMD_INLINE void operator()(const T& a, const T& b, T* y) const {
+    *y = a / b;
+  }
+};
+
+template <typename Dtype>
+struct SqrOp {
+  static const bool kVector = true;
+  template <typename T>
+  SIMD_INLINE void operator()(const T& a, const T&, T* y) const {
+    *y = a * a;
+  }
+};
+
+template <typename Dtype>
+struct InvOp {
+  static const bool kVector = true;
+  template <typename T>
+  SIMD_INLINE void operator()(const T& a, const T&, T* y) const {
+    *y = Dtype(1) / a;
+  }
+};
+
+template <typename Dtype>
+struct AbsOp {
+  static const bool kVector = true;
+  template <typename T>
+  SIMD_INLINE void operator()(const T& a, const T&, T* y) const {
+    simd_vabs<Dtype>(a, y);
+  }
+};
+
+template <typename Dtype>
+struct SignOp {
+  static const bool kVector = true;
+  template <typename T>
+  SIMD_INLINE void operator()(const T& a, const T&, T* y) const {
+    // Select the bits of 1 and -1 with the masks of the comparisons
+    typedef SIMD_INT_VECTOR(T) IntVector;
+    const T zero = T() + Dtype(0);
+    *y = (T)(((IntVector)(zero + Dtype(1)) & (a > zero))
+        | ((IntVector)(zero - Dtype(1)) & (a < zero)));
+  }
+};
+
+template <typename Dtype>
+struct ScaleOp {
+  static const bool kVector = true;
+  explicit ScaleOp(Dtype alpha) : alpha_(alpha) {}
+  template <typename T>
+  SIMD_INLINE void operator()(const T& a, const T&, T* y) const {
+    *y = a * alpha_;
+  }
+  const Dtype alpha_;
+};
+
+template <typename Dtype>
+struct AddScalarOp {
+  static const bool kVector = true;
+  explicit AddScalarOp(Dtype alpha) : alpha_(alpha) {}
+  template <typename T>
+  SIMD_INLINE void operator()(const T& a, const T&, T* y) const {
+    *y = a + alpha_;
+  }
+  const Dtype alpha_;
+};
+
+template <typename Dtype>
+struct ExpOp {
+  static const bool kVector = true;
+  template <typename T>
+  SIMD_INLINE void operator()(const T& a, const T&, T* y) const {
+    simd_vexp<Dtype>(a, y);
+  }
+};
+
+template <typename Dtype>
+struct LogOp {
+  static const bool kVector = true;
+  template <typename T>
+  SIMD_INLINE void operator()(const T& a, const T&, T* y) const {
+    simd_vlog<Dtype>(a, y);
+  }
+};
+
+template <typename Dtype>
+struct TanhOp {
+  static const bool kVector = true;
+  template <typename T>
+  SIMD_INLINE void operator()(const T& a, const T&, T* y) const {
+    simd_vtanh<Dtype>(a, y);
+  }
+};
+
+template <typename Dtype>
+struct SigmoidOp {
+  static const bool kVector = true;
+  template <typename T>
+  SIMD_INLINE void operator()(const T& a, const T&, T* y) const {
+    T exp_minus_a;
+    simd_vexp<Dtype>(-a, &exp_minus_a);
+    *y = Dtype(1) / (exp_minus_a + Dtype(1));
+  }
+};
+
+template <typename Dtype>
+struct ELUOp {
+  static const bool kVector = true;
+  explicit ELUOp(Dtype alpha) : alpha_(alpha) {}
+  template <typename T>
+  SIMD_INLINE void operator()(const T& a, const T&, T* y) const {
+    // As std::max and std::min, which keep a when it is NaN
+    const T zero = T() + Dtype(0);
+    T expm1_a;
+    simd_vexpm1_negative<Dtype>(zero < a ? zero : a, &expm1_a);
+    *y = (a < zero ? zero : a) + alpha_ * expm1_a;
+  }
+  const Dtype alpha_;
+};
+
+template <typename Dtype>
+struct BNLLOp {
+  static const bool kVector = true;
+  template <typename T>
+  SIMD_INLINE void operator()(const T& a, const T&, T* y) const {
+    // log(1 + exp(a)) = max(a, 0) + log(1 + exp(-|a|))
+    const T zero = T() + Dtype(0);
+    T abs_a, exp_minus_abs_a, log1p_exp;
+    simd_vabs<Dtype>(a, &abs_a);
+    simd_vexp<Dtype>(-abs_a, &exp_minus_abs_a);
+    simd_vlog1p_positive<Dtype>(exp_minus_abs_a, &log1p_exp);
+    *y = (a < zero ? zero : a) + log1p_exp;
+  }
+};
+
+template <typename Dtype>
+struct BNLLBackwardOp {
+  static const bool kVector = true;
+  template <typename T>
+  SIMD_INLINE void operator()(const T& a, const T& b, T* y) const {
+    T exp_minus_a;
+    simd_vexp<Dtype>(-a, &exp_minus_a);
+    *y = b / (exp_minus_a + Dtype(1));
+  }
+};
+
+template <typename Dtype>
+struct PowxOp {
+  static const bool kVector = false;
+  explicit PowxOp(Dtype b) : b_(b) {}
+  SIMD_INLINE void operator()(const Dtype& a, const Dtype&, Dtype* y) const {
+    *y = std::pow(a, b_);
+  }
+  const Dtype b_;
+};
+
+// y[i] = op(a[i], b[i]) over whole registers of Bytes bytes, then over the
+// last values padded with zeros
+template <int Bytes, typename Dtype, typename Op>
+SIMD_INLINE void simd_map(const int n, const Dtype* a, const Dtype* b,
+    Dtype* y, const Op& op) {
+  typedef typename SimdType<Dtype, Bytes, Op::kVector>::Type Vector;
+  const int width = sizeof(Vector) / sizeof(Dtype);
+  int i = 0;
+  for (; i + width <= n; i += width) {
+    Vector va, vb, vy;
+    memcpy(&va, a + i, sizeof(va));  // NOLINT(caffe/alt_fn)
+    memcpy(&vb, b + i, sizeof(vb));  // NOLINT(caffe/alt_fn)
+    op(va, vb, &vy);
+    memcpy(y + i, &vy, sizeof(vy));  // NOLINT(caffe/alt_fn)
+  }
+  if (i < n) {
+    const size_t bytes = (n - i) * sizeof(Dtype);
+    Vector va = Vector(), vb = Vector(), vy;
+    memcpy(&va, a + i, bytes);  // NOLINT(caffe/alt_fn)
+    memcpy(&vb, b + i, bytes);  // NOLINT(caffe/alt_fn)
+    op(va, vb, &vy);
+    memcpy(y + i, &vy, bytes);  // NOLINT(caffe/alt_fn)
+  }
+}
+
+// The kernel of each instruction set, with its registers. The generic one
+// uses the 16 bytes of SSE2 or of NEON.
+template <typename Dtype, typename Op>
+void simd_map_generic(const int n, const Dtype* a, const Dtype* b, Dtype* y,
+    const Op& op) {
+  simd_map<16>(n, a, b, y, op);
+}
+
+#ifdef CAFFE_SIMD_X86
+template <typename Dtype, typename Op>
+__attribute__((target("avx2")))
+void simd_map_avx2(const int n, const Dtype* a, const Dtype* b, Dtype* y,
+    const Op& op) {
+  simd_map<32>(n, a, b, y, op);
+}
+
+template <typename Dtype, typename Op>
+__attribute__((target("avx512f")))
+void simd_map_avx512(const int n, const Dtype* a, const Dtype* b, Dtype* y,
+    const Op& op) {
+  simd_map<64>(n, a, b, y, op);
+}
+#endif
+
+static SimdLevel detect_simd_level() {
+#ifdef CAFFE_SIMD_X86
+  __builtin_cpu_init();
+  if (__builtin_cpu_supports("avx512f")) {
+    return SIMD_AVX512;
+  }
+  if (__builtin_cpu_supports("avx2")) {
+    return SIMD_AVX2;
+  }
+#endif
+  return SIMD_GENERIC;
+}
+
+static SimdLevel& current_simd_level() {
+  static SimdLevel level = simd_cpu_level();
+  return level;
+}
+
+SimdLevel simd_cpu_level() {
+  static const SimdLevel level = detect_simd_level();
+  return level;
+}
+
+SimdLevel simd_level() {
+  return current_simd_level();
+}
+
+void set_simd_level(SimdLevel level) {
+  current_simd_level() = std::min(level, simd_cpu_level());
+}
+
+const char* simd_level_name(SimdLevel level) {
+  switch (level) {
+  case SIMD_AVX2:
+    return "AVX2";
+  case SIMD_AVX512:
+    return "AVX-512";
+  default:
+    return "generic";
+  }
+}
+
+// Number of values of the blocks of the kernels spread over the threads
+const int kSimdBlock = 4096;
+
+// Number of values below which the kernels run on the calling thread
+const int kSimdMinParallelCount = 1 << 18;
+
+// Runs the kernel of the current instruction set over blocks [begin, end)
+template <typename Dtype, typename Op>
+class SimdMapTask : public ThreadPool::Task {
+ public:
+  SimdMapTask(int n, const Dtype* a, const Dtype* b, Dtype* y, const Op& op)
+      : n_(n), a_(a), b_(b), y_(y), op_(op), level_(simd_level()) {}
+  virtual void Run(int thread, int begin, int end) {
+    const int offset = begin * kSimdBlock;
+    const int count = std::min(end * kSimdBlock, n_) - offset;
+    switch (level_) {
+#ifdef CAFFE_SIMD_X86
+    case SIMD_AVX512:
+      simd_map_avx512(count, a_ + offset, b_ + offset, y_ + offset, op_);
+      break;
+    case SIMD_AVX2:
+      simd_map_avx2(count, a_ + offset, b_ + offset, y_ + offset, op_);
+      break;
+#endif
+    default:
+      simd_map_generic(count, a_ + offset, b_ + offset, y_ + offset, op_);
+    }
+  }
+
+ protected:
+  const int n_;
+  const Dtype* a_;
+  const Dtype* b_;
+  Dtype* y_;
+  const Op& op_;
+  const SimdLevel level_;
+};
+
+template <typename Dtype, typename Op>
+static void run_simd_map(const int n, const Dtype* a, const Dtype* b,
+    Dtype* y, const Op& op) {
+  if (n <= 0) {
+    return;
+  }
+  SimdMapTask<Dtype, Op> task(n, a, b, y, op);
+  const int blocks = (n + kSimdBlock - 1) / kSimdBlock;
+  if (Caffe::cpu_threads() == 1 || n < kSimdMinParallelCount) {
+    task.Run(0, 0, blocks);
+  } else {
+    Caffe::cpu_pool().Run(&task, blocks);
+  }
+}
+
+template <typename Dtype>
+void simd_add(const int n, const Dtype* a, const Dtype* b, Dtype* y) {
+  run_simd_map(n, a, b, y, AddOp<Dtype>());
+}
+
+template <typename Dtype>
+void simd_sub(const int n, const Dtype* a, const Dtype* b, Dtype* y) {
+  run_simd_map(n, a, b, y, SubOp<Dtype>());
+}
+
+template <typename Dtype>
+void simd_mul(const int n, const Dtype* a, const Dtype* b, Dtype* y) {
+  run_simd_map(n, a, b, y, MulOp<Dtype>());
+}
+
+template <typename Dtype>
+void simd_div(const int n, const Dtype* a, const Dtype* b, Dtype* y) {
+  run_simd_map(n, a, b, y, DivOp<Dtype>());
+}
+
+template <typename Dtype>
+void simd_sqr(const int n, const Dtype* a, Dtype* y) {
+  run_simd_map(n, a, a, y, SqrOp<Dtype>());
+}
+
+template <typename Dtype>
+void simd_abs(const int n, const Dtype* a, Dtype* y) {
+  run_simd_map(n, a, a, y, AbsOp<Dtype>());
+}
+
+template <typename Dtype>
+void simd_sign(const int n, const Dtype* a, Dtype* y) {
+  run_simd_map(n, a, a, y, SignOp<Dtype>());
+}
+
+template <typename Dtype>
+void simd_scale(const int n, const Dtype alpha, const Dtype* a, Dtype* y) {
+  run_simd_map(n, a, a, y, ScaleOp<Dtype>(alpha));
+}
+
+template <typename Dtype>
+void simd_add_scalar(const int n, const Dtype alpha, const Dtype* a,
+    Dtype* y) {
+  run_simd_map(n, a, a, y, AddScalarOp<Dtype>(alpha));
+}
+
+template <typename Dtype>
+void simd_exp(const int n, const Dtype* a, Dtype* y) {
+  run_simd_map(n, a, a, y, ExpOp<Dtype>());
+}
+
+template <typename Dtype>
+void simd_log(const int n, const Dtype* a, Dtype* y) {
+  run_simd_map(n, a, a, y, LogOp<Dtype>());
+}
+
+template <typename Dtype>
+void simd_tanh(const int n, const Dtype* a, Dtype* y) {
+  run_simd_map(n, a, a, y, TanhOp<Dtype>());
+}
+
+template <typename Dtype>
+void simd_sigmoid(const int n, const Dtype* a, Dtype* y) {
+  run_simd_map(n, a, a, y, SigmoidOp<Dtype>());
+}
+
+template <typename Dtype>
+void simd_elu(const int n, const Dtype alpha, const Dtype* a, Dtype* y) {
+  run_simd_map(n, a, a, y, ELUOp<Dtype>(alpha));
+}
+
+template <typename Dtype>
+void simd_bnll(const int n, const Dtype* a, Dtype* y) {
+  run_simd_map(n, a, a, y, BNLLOp<Dtype>());
+}
+
+template <typename Dtype>
+void simd_bnll_backward(const int n, const Dtype* a, const Dtype* b,
+    Dtype* y) {
+  run_simd_map(n, a, b, y, BNLLBackwardOp<Dtype>());
+}
+
+template <typename Dtype>
+void simd_powx(const int n, const Dtype* a, const Dtype b, Dtype* y) {
+  // The powers pow computes exactly as arithmetic
+  if (b == Dtype(2)) {
+    run_simd_map(n, a, a, y, SqrOp<Dtype>());
+  } else if (b == Dtype(-1)) {
+    run_simd_map(n, a, a, y, InvOp<Dtype>());
+  } else {
+    run_simd_map(n, a, a, y, PowxOp<Dtype>(b));
+  }
+}
+
+#define INSTANTIATE_SIMD_BINARY(name) \
+  template void name<float>(const int n, const float* a, const float* b, \
+      float* y); \
+  template void name<double>(const int n, const double* a, \
+      const double* b, double* y)
+
+#define INSTANTIATE_SIMD_UNARY(name) \
+  template void name<float>(const int n, const float* a, float* y); \
+  template void name<double>(const int n, const double* a, double* y)
+
+#define INSTANTIATE_SIMD_SCALAR(name) \
+  template void name<float>(const int n, const float alpha, const float* a, \
+      float* y); \
+  template void name<double>(const int n, const double alpha, \
+      const double* a, double* y)
+
+INSTANTIATE_SIMD_BINARY(simd_add);
+INSTANTIATE_SIMD_BINARY(simd_sub);
+INSTANTIATE_SIMD_BINARY(simd_mul);
+INSTANTIATE_SIMD_BINARY(simd_div);
+INSTANTIATE_SIMD_BINARY(simd_bnll_backward);
+INSTANTIATE_SIMD_UNARY(simd_sqr);
+INSTANTIATE_SIMD_UNARY(simd_abs);
+INSTANTIATE_SIMD_UNARY(simd_sign);
+INSTANTIATE_SIMD_UNARY(simd_exp);
+INSTANTIATE_SIMD_UNARY(simd_log);
+INSTANTIATE_SIMD_UNARY(simd_tanh);
+INSTANTIATE_SIMD_UNARY(simd_sigmoid);
+INSTANTIATE_SIMD_UNARY(simd_bnll);
+INSTANTIATE_SIMD_SCALAR(simd_scale);
+INSTANTIATE_SIMD_SCALAR(simd_add_scalar);
+INSTANTIATE_SIMD_SCALAR(simd_elu);
+
+template void simd_powx<float>(const int n, const float* a, const float b,
+    float* y);
+template void simd_powx<double>(const int n, const double* a,
+    const double b, double* y);
+
+}  // namespace caffe
@@ -0,0 +1,111 @@
+#include <boost/thread.hpp>
+#include <stdint.h>
+
+#include <vector>
+
+#include "caffe/internal_thread.hpp"
+#include "caffe/util/thread_pool.hpp"
+
+namespace caffe {
+
+class ThreadPool::sync {
+ public:
+  boost::mutex mutex_;
+  boost::condition_variable start_;
+  boost::condition_variable done_;
+};
+
+class ThreadPool::Worker : public InternalThread {
+ public:
+  Worker(ThreadPool* pool, int index)
+      : pool_(pool), index_(index) {
+    // Seeded by index, creating a pool does not draw from the Caffe RNG
+    StartInternalThread(index);
+  }
+  virtual ~Worker() {
+    StopInternalThread();
+  }
+
+ protected:
+  void InternalThreadEntry() {
+    // Kernels called from tasks run on the pool thread only
+    Caffe::set_cpu_threads(1);
+    int generation = 0;
+    try {
+      while (!must_stop()) {
+        Task* task;
+        int count;
+        {
+          boost::mutex::scoped_lock lock(pool_->sync_->mutex_);
+          while (pool_->generation_ == generation) {
+            pool_->sync_->start_.wait(lock);
+          }
+          generation = pool_->generation_;
+          task = pool_->task_;
+          count = pool_->count_;
+        }
+        pool_->RunBlock(task, index_, count);
+        boost::mutex::scoped_lock lock(pool_->sync_->mutex_);
+        if (--pool_->pending_ == 0) {
+          pool_->sync_->done_.notify_one();
+        }
+      }
+    } catch (boost::thread_interrupted&) {
+      // Interrupted exception is expected on shutdown
+    }
+  }
+
+  ThreadPool* pool_;
+  int index_;
+};
+
+ThreadPool::ThreadPool(int size)
+    : sync_(new sync()), task_(NULL), count_(0), generation_(0),
+      pending_(0), running_(false) {
+  CHECK_GE(size, 1);
+  for (int i = 1; i < size; ++i) {
+    workers_.push_back(shared_ptr<Worker>(new Worker(this, i)));
+  }
+}
+
+ThreadPool::~ThreadPool() {
+  workers_.clear();
+}
+
+void ThreadPool::RunBlock(Task* task, int thread, int count) {
+  const int threads = size();
+  const int begin = static_cast<int64_t>(count) * thread / threads;
+  const int end = static_cast<int64_t>(count) * (thread + 1) / threads;
+  if (begin < end) {
+    task->Run(thread, begin, end);
+  }
+}
+
+void ThreadPool::Run(Task* task, int count) {
+  if (workers_.empty() || count <= 1 || running_) {
+    if (count > 0) {
+      task->Run(0, 0, count);
+    }
+    return;
+  }
+  {
+    boost::mutex::scoped_lock lock(sync_->mutex_);
+    task_ = task;
+    count_ = count;
+    pending_ = workers_.size();
+    ++generation_;
+  }
+  sync_->start_.notify_all();
+  running_ = true;
+  RunBlock(task, 0, count);
+  running_ = false;
+  // Workers use the task, do not let an interruption of this thread return
+  // before they are done.
+  boost::this_thread::disable_interruption no_interruption;
+  boost::mutex::scoped_lock lock(sync_->mutex_);
+  while (pending_ > 0) {
+    sync_->done_.wait(lock);
+  }
+}
+
+}  // namespace caffe
@@ -0,0 +1,249 @@
+#include <boost/algorithm/string/predicate.hpp>
+#include <fcntl.h>
+#include <stdint.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <cstring>
+#include <fstream>  // NOLINT(readability/streams)
+#include <string>
+#include <vector>
+
+#include "caffe/util/window_file.hpp"
+
+namespace caffe {
+
+const char kWindowFileMagic[8] = { 'C', 'A', 'F', 'F', 'E', 'W', 'I', 'N' };
+const int32_t kWindowFileVersion = 1;
+
+// The header is followed by the image sizes (3 * num_images integers), the
+// offsets of the windows and paths of each image (2 * (num_images + 1)
+// integers), the windows, the pairs and the NUL terminated image paths.
+struct WindowFileHeader {
+  char magic[8];
+  int32_t version;
+  int32_t pair_size;
+  int32_t num_images;
+  int32_t num_windows;
+  int32_t num_pairs;
+  int32_t paths_size;
+};
+
+template <typename T>
+static const T* data_or_null(const vector<T>& v) {
+  return v.empty() ? NULL : &v[0];
+}
+
+WindowFile::WindowFile()
+    : map_(NULL), map_size_(0) {
+  Close();
+}
+
+WindowFile::~WindowFile() {
+  Close();
+}
+
+void WindowFile::Open(const string& filename) {
+  Close();
+  int fd = open(filename.c_str(), O_RDONLY);
+  CHECK_GE(fd, 0) << "Failed to open window file " << filename;
+  struct stat st;
+  CHECK_EQ(fstat(fd, &st), 0) << "Failed to stat window file " << filename;
+  char magic[sizeof(kWindowFileMagic)];
+  const bool binary = st.st_size >= sizeof(WindowFileHeader) &&
+      read(fd, magic, sizeof(magic)) == sizeof(magic) &&
+      memcmp(magic, kWindowFileMagic, sizeof(magic)) == 0;
+  if (binary) {
+    Map(filename, fd, st.st_size);
+  }
+  close(fd);
+  if (!binary) {
+    ReadText(filename);
+  }
+}
+
+void WindowFile::Close() {
+  if (map_) {
+    munmap(map_, map_size_);
+    map_ = NULL;
+    map_size_ = 0;
+  }
+  text_image_sizes_.clear();
+  text_image_windows_.assign(1, 0);
+  text_image_paths_.assign(1, 0);
+  text_windows_.clear();
+  text_pairs_.clear();
+  text_paths_.clear();
+  num_images_ = 0;
+  num_pairs_ = 0;
+  pair_size_ = 0;
+  paths_size_ = 0;
+  image_sizes_ = NULL;
+  image_windows_ = &text_image_windows_[0];
+  image_paths_ = &text_image_paths_[0];
+  windows_ = NULL;
+  pairs_ = NULL;
+  paths_ = NULL;
+}
+
+void WindowFile::ReadText(const string& filename) {
+  std::ifstream infile(filename.c_str());
+  CHECK(infile.good()) << "Failed to open window file " << filename;
+  string hashtag, type;
+  int index;
+  if (!(infile >> hashtag >> type >> index)) {
+    LOG(FATAL) << "Window file is empty";
+  }
+  do {
+    CHECK_EQ(hashtag, "#");
+    if (boost::iequals(type, "FULL_IMAGES")) {
+      CHECK_EQ(index, num_images_) << "Images must be numbered in order from 0";
+      string image_path;
+      int channels, height, width, num_windows;
+      infile >> image_path >> channels >> height >> width >> num_windows;
+      text_paths_ += image_path;
+      text_paths_ += '\0';
+      text_image_paths_.push_back(text_paths_.size());
+      text_image_sizes_.push_back(channels);
+      text_image_sizes_.push_back(height);
+      text_image_sizes_.push_back(width);
+      for (int i = 0; i < num_windows; ++i) {
+        Window window;
+        infile >> window.bb_index >> window.label >> window.overlap
+            >> window.x1 >> window.y1 >> window.x2 >> window.y2;
+        text_windows_.push_back(window);
+      }
+      CHECK(infile) << "Invalid windows of image " << index;
+      text_image_windows_.push_back(text_windows_.size());
+      ++num_images_;
+    } else if (boost::iequals(type, "PAIRS")) {
+      // The integers of the pairs are read up to the next section, however
+      // they are split into lines, and the pair size is their number over
+      // the number of pairs
+      const int begin = text_pairs_.size();
+      int field;
+      while (infile >> field) {
+        text_pairs_.push_back(field);
+      }
+      if (!infile.eof()) {
+        infile.clear();
+      }
+      const int size = text_pairs_.size() - begin;
+      CHECK_GE(index, 0) << "Invalid number of pairs";
+      if (index > 0) {
+        CHECK_EQ(size % index, 0) << "Pairs of section with " << index
+            << " pairs must all have the same size";
+        if (num_pairs_ == 0) {
+          CHECK_GT(size, 0) << "Missing pairs";
+          pair_size_ = size / index;
+        }
+        CHECK_EQ(size / index, pair_size_)
+            << "Pairs must all have the same size";
+        num_pairs_ += index;
+      } else {
+        CHECK_EQ(size, 0) << "Pairs in a section of 0 pairs";
+      }
+    } else {
+      LOG(FATAL) << "Unknown window file section " << type;
+    }
+  } while (infile >> hashtag >> type >> index);
+
+  paths_size_ = text_paths_.size();
+  image_sizes_ = data_or_null(text_image_sizes_);
+  image_windows_ = &text_image_windows_[0];
+  image_paths_ = &text_image_paths_[0];
+  windows_ = data_or_null(text_windows_);
+  pairs_ = data_or_null(text_pairs_);
+  paths_ = text_paths_.data();
+}
+
+void WindowFile::Map(const string& filename, int fd, size_t size) {
+  CHECK_EQ(sizeof(Window), 7 * sizeof(int32_t));
+  map_ = mmap(NULL, size, PROT_READ, MAP_SHARED, fd, 0);
+  CHECK(map_ != MAP_FAILED) << "Failed to map window file " << filename;
+  map_size_ = size;
+  const WindowFileHeader* header =
+      static_cast<const WindowFileHeader*>(map_);
+  CHECK_EQ(header->version, kWindowFileVersion)
+      << "Unsupported window file version or byte order in " << filename;
+  CHECK_GE(header->num_images, 0);
+  CHECK_GE(header->num_windows, 0);
+  CHECK_GE(header->num_pairs, 0);
+  CHECK_GE(header->pair_size, 0);
+  CHECK_GE(header->paths_size, 0);
+  // Offsets in bytes of the sections, which cannot overflow a size_t as
+  // their sizes come from 32-bit counts, all within the mapped length
+  const size_t num_images = header->num_images;
+  const size_t image_sizes_offset = sizeof(WindowFileHeader);
+  const size_t image_windows_offset =
+      image_sizes_offset + 3 * num_images * sizeof(int32_t);
+  const size_t image_paths_offset =
+      image_windows_offset + (num_images + 1) * sizeof(int32_t);
+  const size_t windows_offset =
+      image_paths_offset + (num_images + 1) * sizeof(int32_t);
+  const size_t pairs_offset = windows_offset +
+      static_cast<size_t>(header->num_windows) * sizeof(Window);
+  const size_t paths_offset = pairs_offset +
+      static_cast<size_t>(header->num_pairs) * header->pair_size *
+      sizeof(int32_t);
+  const size_t expected = paths_offset + header->paths_size;
+  CHECK_EQ(size, expected) << "Truncated or invalid window file " << filename;
+
+  num_images_ = header->num_images;
+  num_pairs_ = header->num_pairs;
+  pair_size_ = header->pair_size;
+  paths_size_ = header->paths_size;
+  const char* data = static_cast<const char*>(map_);
+  image_sizes_ = reinterpret_cast<const int*>(data + image_sizes_offset);
+  image_windows_ = reinterpret_cast<const int*>(data + image_windows_offset);
+  image_paths_ = reinterpret_cast<const int*>(data + image_paths_offset);
+  windows_ = reinterpret_cast<const Window*>(data + windows_offset);
+  pairs_ = reinterpret_cast<const int*>(data + pairs_offset);
+  paths_ = data + paths_offset;
+
+  // Check offsets once here, so that accessors can be used without checks.
+  // Each one is bounded before it is used to index a section.
+  CHECK_EQ(image_windows_[0], 0);
+  CHECK_EQ(image_paths_[0], 0);
+  CHECK_EQ(image_windows_[num_images_], header->num_windows);
+  CHECK_EQ(image_paths_[num_images_], paths_size_);
+  for (int i = 0; i < num_images_; ++i) {
+    CHECK_LE(image_windows_[i], image_windows_[i + 1]);
+    CHECK_LE(image_windows_[i + 1], header->num_windows);
+    CHECK_LT(image_paths_[i], image_paths_[i + 1]);
+    CHECK_LE(image_paths_[i + 1], paths_size_);
+    CHECK_EQ(paths_[image_paths_[i + 1] - 1], '\0');
+  }
+}
+
+void WindowFile::Write(const string& filename) const {
+  WindowFileHeader header;
+  memcpy(header.magic, kWindowFileMagic, sizeof(header.magic));
+  header.version = kWindowFileVersion;
+  header.pair_size = pair_size_;
+  header.num_images = num_images_;
+  header.num_windows = image_windows_[num_images_];
+  header.num_pairs = num_pairs_;
+  header.paths_size = paths_size_;
+
+  std::ofstream outfile(filename.c_str(),
+      std::ios::out | std::ios::binary | std::ios::trunc);
+  CHECK(outfile.good()) << "Failed to open " << filename;
+  outfile.write(reinterpret_cast<const char*>(&header), sizeof(header));
+  outfile.write(reinterpret_cast<const char*>(image_sizes_),
+      3 * num_images_ * sizeof(int32_t));
+  outfile.write(reinterpret_cast<const char*>(image_windows_),
+      (num_images_ + 1) * sizeof(int32_t));
+  outfile.write(reinterpret_cast<const char*>(image_paths_),
+      (num_images_ + 1) * sizeof(int32_t));
+  outfile.write(reinterpret_cast<const char*>(windows_),
+      header.num_windows * sizeof(Window));
+  outfile.write(reinterpret_cast<const char*>(pairs_),
+      static_cast<size_t>(num_pairs_) * pair_size_ * sizeof(int32_t));
+  outfile.write(paths_, paths_size_);
+  outfile.close();
+  CHECK(outfile.good()) << "Failed to write " << filename;
+}
+
+}  // namespace caffe
@@ -0,0 +1,281 @@
+#include <algorithm>
+
+#include "caffe/common.hpp"
+#include "caffe/util/math_functions.hpp"
+#include "caffe/util/thread_pool.hpp"
+#include "caffe/util/winograd.hpp"
+
+namespace caffe {
+
+// Transforms a block of tiles of 4x4 input values to the 16 matrices of
+// channels x tiles, V = B^T d B, one channel at a time. The tiles of the
+// images follow each other and the matrices start every stride values.
+template <typename Dtype>
+class WinogradInputTask : public ThreadPool::Task {
+ public:
+  WinogradInputTask(const Dtype* input, int input_dim, int height, int width,
+      int pad_h, int pad_w, int tiles_h, int tiles_w, int tile_begin,
+      int tiles, int stride, Dtype* transformed)
+      : input_(input), input_dim_(input_dim), height_(height), width_(width),
+        pad_h_(pad_h), pad_w_(pad_w), tiles_h_(tiles_h), tiles_w_(tiles_w),
+        tile_begin_(tile_begin), tiles_(tiles), stride_(stride),
+        transformed_(transformed) {}
+
+  virtual void Run(int thread, int begin, int end) {
+    const int image_tiles = tiles_h_ * tiles_w_;
+    for (int c = begin; c < end; ++c) {
+      const Dtype* input = input_ + tile_begin_ / image_tiles * input_dim_
+          + c * height_ * width_;
+      int h = tile_begin_ % image_tiles / tiles_w_ * 2 - pad_h_;
+      int w = tile_begin_ % tiles_w_ * 2 - pad_w_;
+      for (int tile = 0; tile < tiles_; ++tile) {
+        Dtype d[4][4];
+        if (h >= 0 && h + 4 <= height_ && w >= 0 && w + 4 <= width_) {
+          const Dtype* row = input + h * width_ + w;
+          for (int i = 0; i < 4; ++i, row += width_) {
+            for (int j = 0; j < 4; ++j) {
+              d[i][j] = row[j];
+            }
+          }
+        } else {
+          for (int i = 0; i < 4; ++i) {
+            for (int j = 0; j < 4; ++j) {
+              d[i][j] = h + i >= 0 && h + i < height_ && w + j >= 0 &&
+                  w + j < width_ ? input[(h + i) * width_ + w + j] : 0;
+            }
+          }
+        }
+        transform(d, transformed_ + c * tiles_ + tile, stride_);
+        w += 2;
+        if (w + pad_w_ == tiles_w_ * 2) {
+          w = -pad_w_;
+          h += 2;
+          if (h + pad_h_ == tiles_h_ * 2) {
+            h = -pad_h_;
+            input += input_dim_;
+          }
+        }
+      }
+    }
+  }
+
+ protected:
+  // V = B^T d B, written to the 16 matrices
+  static inline void transform(const Dtype d[4][4], Dtype* v, int stride) {
+    Dtype t[4][4];
+    for (int j = 0; j < 4; ++j) {
+      t[0][j] = d[0][j] - d[2][j];
+      t[1][j] = d[1][j] + d[2][j];
+      t[2][j] = d[2][j] - d[1][j];
+      t[3][j] = d[1][j] - d[3][j];
+    }
+    for (int i = 0; i < 4; ++i) {
+      v[(i * 4) * stride] = t[i][0] - t[i][2];
+      v[(i * 4 + 1) * stride] = t[i][1] + t[i][2];
+      v[(i * 4 + 2) * stride] = t[i][2] - t[i][1];
+      v[(i * 4 + 3) * stride] = t[i][1] - t[i][3];
+    }
+  }
+
+  const Dtype* input_;
+  const int input_dim_, height_, width_, pad_h_, pad_w_, tiles_h_, tiles_w_;
+  const int tile_begin_, tiles_, stride_;
+  Dtype* transformed_;
+};
+
+// Transforms the 16 matrices of num_output x tiles of a block, which start
+// every stride values, back to tiles of 2x2 output values, Y = A^T M A, one
+// output channel at a time. The tiles of the last row and column of the
+// images may be cropped.
+template <typename Dtype>
+class WinogradOutputTask : public ThreadPool::Task {
+ public:
+  WinogradOutputTask(const Dtype* transformed, int output_dim, int output_h,
+      int output_w, int tiles_h, int tiles_w, int tile_begin, int tiles,
+      int stride, Dtype* output)
+      : transformed_(transformed), output_dim_(output_dim),
+        output_h_(output_h), output_w_(output_w), tiles_h_(tiles_h),
+        tiles_w_(tiles_w), tile_begin_(tile_begin), tiles_(tiles),
+        stride_(stride), output_(output) {}
+
+  virtual void Run(int thread, int begin, int end) {
+    const int image_tiles = tiles_h_ * tiles_w_;
+    for (int k = begin; k < end; ++k) {
+      const Dtype* m = transformed_ + k * tiles_;
+      Dtype* output = output_ + tile_begin_ / image_tiles * output_dim_
+          + k * output_h_ * output_w_;
+      int h = tile_begin_ % image_tiles / tiles_w_ * 2;
+      int w = tile_begin_ % tiles_w_ * 2;
+      for (int tile = 0; tile < tiles_; ++tile, ++m) {
+        Dtype t[2][4];
+        for (int j = 0; j < 4; ++j) {
+          const Dtype m0 = m[j * stride_];
+          const Dtype m1 = m[(4 + j) * stride_];
+          const Dtype m2 = m[(8 + j) * stride_];
+          const Dtype m3 = m[(12 + j) * stride_];
+          t[0][j] = m0 + m1 + m2;
+          t[1][j] = m1 - m2 - m3;
+        }
+        Dtype* y = output + h * output_w_ + w;
+        if (h + 2 <= output_h_ && w + 2 <= output_w_) {
+          for (int i = 0; i < 2; ++i, y += output_w_) {
+            y[0] = t[i][0] + t[i][1] + t[i][2];
+            y[1] = t[i][1] - t[i][2] - t[i][3];
+          }
+        } else {
+          for (int i = 0; i < 2 && h + i < output_h_; ++i, y += output_w_) {
+            y[0] = t[i][0] + t[i][1] + t[i][2];
+            if (w + 1 < output_w_) {
+              y[1] = t[i][1] - t[i][2] - t[i][3];
+            }
+          }
+        }
+        w += 2;
+        if (w == tiles_w_ * 2) {
+          w = 0;
+          h += 2;
+          if (h == tiles_h_ * 2) {
+            h = 0;
+            output += output_dim_;
+          }
+        }
+      }
+    }
+  }
+
+ protected:
+  const Dtype* transformed_;
+  const int output_dim_, output_h_, output_w_, tiles_h_, tiles_w_;
+  const int tile_begin_, tiles_, stride_;
+  Dtype* output_;
+};
+
+// Number of transformed values below which the transforms run on the calling
+// thread
+const int kWinogradMinParallelCount = 1 << 16;
+// Bytes of the transformed inputs and outputs of a block of tiles, which are
+// kept in cache from the input transform to the output transform, and least
+// number of tiles of a block for the GEMMs to stay efficient.
+const int kWinogradBlockBytes = 1 << 20;
+const int kWinogradMinBlockTiles = 256;
+// Values between the 16 matrices, so that the transforms, which read and write
+// the same position of each matrix, do not map them to the same cache sets
+const int kWinogradMatrixPadding = 16;
+
+template <typename Dtype>
+int winograd_block_tiles(int channels, int num_output, int tiles) {
+  const int block = kWinogradBlockBytes /
+      (16 * sizeof(Dtype) * (channels + num_output));
+  return std::min(tiles, std::max(block, kWinogradMinBlockTiles));
+}
+
+template int winograd_block_tiles<float>(int channels, int num_output,
+    int tiles);
+template int winograd_block_tiles<double>(int channels, int num_output,
+    int tiles);
+
+int winograd_weight_count(int channels, int num_output) {
+  return 16 * (channels * num_output + kWinogradMatrixPadding);
+}
+
+int winograd_buffer_count(int channels, int block_tiles) {
+  return 16 * (channels * block_tiles + kWinogradMatrixPadding);
+}
+
+template <typename Dtype>
+void winograd_transform_weight_cpu(const Dtype* weight, const int group,
+    const int channels, const int num_output, const bool flip,
+    Dtype* transformed_weight) {
+  const int stride = winograd_weight_count(channels, num_output) / 16;
+  for (int g = 0; g < group; ++g) {
+    for (int k = 0; k < num_output; ++k) {
+      for (int c = 0; c < channels; ++c) {
+        const Dtype* w = weight + ((g * num_output + k) * channels + c) * 9;
+        Dtype f[3][3];
+        for (int i = 0; i < 9; ++i) {
+          f[i / 3][i % 3] = flip ? w[8 - i] : w[i];
+        }
+        // U = G g G^T
+        Dtype t[4][3];
+        for (int j = 0; j < 3; ++j) {
+          t[0][j] = f[0][j];
+          t[1][j] = (f[0][j] + f[1][j] + f[2][j]) / 2;
+          t[2][j] = (f[0][j] - f[1][j] + f[2][j]) / 2;
+          t[3][j] = f[2][j];
+        }
+        Dtype* u = transformed_weight + g * 16 * stride +
+            (flip ? c * num_output + k : k * channels + c);
+        for (int i = 0; i < 4; ++i) {
+          u[(i * 4) * stride] = t[i][0];
+          u[(i * 4 + 1) * stride] = (t[i][0] + t[i][1] + t[i][2]) / 2;
+          u[(i * 4 + 2) * stride] = (t[i][0] - t[i][1] + t[i][2]) / 2;
+          u[(i * 4 + 3) * stride] = t[i][2];
+        }
+      }
+    }
+  }
+}
+
+template void winograd_transform_weight_cpu<float>(const float* weight,
+    const int group, const int channels, const int num_output,
+    const bool flip, float* transformed_weight);
+template void winograd_transform_weight_cpu<double>(const double* weight,
+    const int group, const int channels, const int num_output,
+    const bool flip, double* transformed_weight);
+
+template <typename Dtype>
+void winograd_cpu(const Dtype* input, const int num, const int input_dim,
+    const int channels, const int height, const int width, const int pad_h,
+    const int pad_w, const Dtype* transformed_weight, const int num_output,
+    const int output_dim, const int output_h, const int output_w,
+    Dtype* transformed_input, Dtype* transformed_output, Dtype* output) {
+  const int tiles_h = (output_h + 1) / 2;
+  const int tiles_w = (output_w + 1) / 2;
+  const int tiles = num * tiles_h * tiles_w;
+  const int block = winograd_block_tiles<Dtype>(channels, num_output, tiles);
+  const int weight_stride = winograd_weight_count(channels, num_output) / 16;
+  for (int tile_begin = 0; tile_begin < tiles; tile_begin += block) {
+    const int count = std::min(block, tiles - tile_begin);
+    const int input_stride = winograd_buffer_count(channels, count) / 16;
+    const int output_stride = winograd_buffer_count(num_output, count) / 16;
+    WinogradInputTask<Dtype> input_task(input, input_dim, height, width,
+        pad_h, pad_w, tiles_h, tiles_w, tile_begin, count, input_stride,
+        transformed_input);
+    if (Caffe::cpu_threads() == 1 ||
+        16 * channels * count < kWinogradMinParallelCount) {
+      input_task.Run(0, 0, channels);
+    } else {
+      Caffe::cpu_pool().Run(&input_task, channels);
+    }
+    for (int i = 0; i < 16; ++i) {
+      caffe_cpu_gemm<Dtype>(CblasNoTrans, CblasNoTrans, num_output, count,
+          channels, (Dtype)1., transformed_weight + i * weight_stride,
+          transformed_input + i * input_stride, (Dtype)0.,
+          transformed_output + i * output_stride);
+    }
+    WinogradOutputTask<Dtype> output_task(transformed_output, output_dim,
+        output_h, output_w, tiles_h, tiles_w, tile_begin, count,
+        output_stride, output);
+    if (Caffe::cpu_threads() == 1 ||
+        16 * num_output * count < kWinogradMinParallelCount) {
+      output_task.Run(0, 0, num_output);
+    } else {
+      Caffe::cpu_pool().Run(&output_task, num_output);
+    }
+  }
+}
+
+template void winograd_cpu<float>(const float* input, const int num,
+    const int input_dim, const int channels, const int height,
+    const int width, const int pad_h, const int pad_w,
+    const float* transformed_weight, const int num_output,
+    const int output_dim, const int output_h, const int output_w,
+    float* transformed_input, float* transformed_output, float* output);
+template void winograd_cpu<double>(const double* input, const int num,
+    const int input_dim, const int channels, const int height,
+    const int width, const int pad_h, const int pad_w,
+    const double* transformed_weight, const int num_output,
+    const int output_dim, const int output_h, const int output_w,
+    double* transformed_input, double* transformed_output, double* output);
+
+}  // namespace caffe
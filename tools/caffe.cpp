@@ -13,6 +13,7 @@ namespace bp = boost::python;
 
 #include "boost/algorithm/string.hpp"
 #include "caffe/caffe.hpp"
+#include "caffe/util/conv_algorithm_cache.hpp"
 #include "caffe/util/signal_handler.h"
 
 using caffe::Blob;
@@ -47,6 +48,12 @@ DEFINE_string(sigint_effect, "stop",
 DEFINE_string(sighup_effect, "snapshot",
              "Optional; action to take when a SIGHUP signal is received: "
              "snapshot, stop or none.");
+DEFINE_string(cpu_conv_cache, "",
+    "Optional; the file of the CPU convolution algorithms timed by the "
+    "layers with cpu_autotune, read and updated across runs.");
+DEFINE_int32(cpu_threads, 0,
+    "Optional; the number of threads of the CPU kernels, shared by the "
+    "threads caffe starts. Defaults to the number of hardware threads.");
 
 // A simple registry for caffe commands.
 typedef int (*BrewFunction)();
@@ -391,6 +398,10 @@ int main(int argc, char** argv) {
       "  time            benchmark model execution time");
   // Run tool or show usage.
   caffe::GlobalInit(&argc, &argv);
+  caffe::SetConvolutionAlgorithmCacheFile(FLAGS_cpu_conv_cache);
+  if (FLAGS_cpu_threads > 0) {
+    Caffe::set_cpu_threads(FLAGS_cpu_threads);
+  }
   if (argc == 2) {
 #ifdef WITH_PYTHON_LAYER
     try {
@@ -0,0 +1,185 @@
+// This program times the CPU kernels behind ConvolutionLayer on the layer
+// shapes of AlexNet and VGG-16: im2col and col2im for one image, the forward
+// and backward passes of a batch with and without cpu_batch_bytes, and of the
+// CAFFE and WINOGRAD engines for the 3x3 layers.
+// Usage:
+//    conv_benchmark [FLAGS]
+
+#include <stdint.h>
+
+#include <string>
+#include <vector>
+
+#include "gflags/gflags.h"
+#include "glog/logging.h"
+
+#include "caffe/blob.hpp"
+#include "caffe/common.hpp"
+#include "caffe/filler.hpp"
+#include "caffe/layer.hpp"
+#include "caffe/layer_factory.hpp"
+#include "caffe/util/benchmark.hpp"
+#include "caffe/util/im2col.hpp"
+#include "caffe/util/math_functions.hpp"
+
+using namespace caffe;  // NOLINT(build/namespaces)
+
+DEFINE_int32(threads, 0,
+    "Number of CPU threads to compare to one thread, 0 for all hardware "
+    "threads.");
+DEFINE_int32(iterations, 20, "Number of times each kernel is run.");
+DEFINE_int32(num, 16, "Number of images of the convolution layers.");
+DEFINE_int64(batch_bytes, 64 << 20,
+    "cpu_batch_bytes of the convolution layers compared to one image at a "
+    "time.");
+
+struct ConvShape {
+  const char* name;
+  int channels;  // per group
+  int height;
+  int width;
+  int kernel;
+  int stride;
+  int pad;
+  int num_output;  // per group
+};
+
+static const ConvShape kShapes[] = {
+  {"alexnet/conv1", 3, 227, 227, 11, 4, 0, 96},
+  {"alexnet/conv2", 48, 27, 27, 5, 1, 2, 128},
+  {"alexnet/conv3", 256, 13, 13, 3, 1, 1, 384},
+  {"alexnet/conv4", 192, 13, 13, 3, 1, 1, 192},
+  {"alexnet/conv5", 192, 13, 13, 3, 1, 1, 128},
+  {"vgg16/conv1_2", 64, 224, 224, 3, 1, 1, 64},
+  {"vgg16/conv2_2", 128, 112, 112, 3, 1, 1, 128},
+  {"vgg16/conv3_3", 256, 56, 56, 3, 1, 1, 256},
+  {"vgg16/conv4_3", 512, 28, 28, 3, 1, 1, 512},
+  {"vgg16/conv5_3", 512, 14, 14, 3, 1, 1, 512},
+};
+
+// Average time of im2col and col2im over FLAGS_iterations, in ms.
+static void TimeIm2col(const ConvShape& shape, int threads, float* im2col_ms,
+    float* col2im_ms) {
+  Caffe::set_cpu_threads(threads);
+  const int output_h = (shape.height + 2 * shape.pad - shape.kernel)
+      / shape.stride + 1;
+  const int output_w = (shape.width + 2 * shape.pad - shape.kernel)
+      / shape.stride + 1;
+  vector<float> im(shape.channels * shape.height * shape.width);
+  vector<float> col(shape.channels * shape.kernel * shape.kernel * output_h
+      * output_w);
+  caffe_rng_uniform<float>(im.size(), -1, 1, &im[0]);
+  Timer timer;
+  timer.Start();
+  for (int i = 0; i < FLAGS_iterations; ++i) {
+    im2col_cpu(&im[0], shape.channels, shape.height, shape.width,
+        shape.kernel, shape.kernel, shape.pad, shape.pad, shape.stride,
+        shape.stride, 1, 1, &col[0]);
+  }
+  *im2col_ms = timer.MilliSeconds() / FLAGS_iterations;
+  timer.Start();
+  for (int i = 0; i < FLAGS_iterations; ++i) {
+    col2im_cpu(&col[0], shape.channels, shape.height, shape.width,
+        shape.kernel, shape.kernel, shape.pad, shape.pad, shape.stride,
+        shape.stride, 1, 1, &im[0]);
+  }
+  *col2im_ms = timer.MilliSeconds() / FLAGS_iterations;
+}
+
+// Average time of the forward and backward passes of a ConvolutionLayer over
+// FLAGS_num images, in ms.
+static void TimeConvolution(const ConvShape& shape, uint64_t batch_bytes,
+    ConvolutionParameter_Engine engine, float* forward_ms,
+    float* backward_ms) {
+  Blob<float> bottom(FLAGS_num, shape.channels, shape.height, shape.width);
+  Blob<float> top;
+  vector<Blob<float>*> bottom_vec(1, &bottom);
+  vector<Blob<float>*> top_vec(1, &top);
+  FillerParameter filler_param;
+  GaussianFiller<float> filler(filler_param);
+  filler.Fill(&bottom);
+  LayerParameter layer_param;
+  layer_param.set_type("Convolution");
+  ConvolutionParameter* convolution_param =
+      layer_param.mutable_convolution_param();
+  convolution_param->add_kernel_size(shape.kernel);
+  convolution_param->add_stride(shape.stride);
+  convolution_param->add_pad(shape.pad);
+  convolution_param->set_num_output(shape.num_output);
+  convolution_param->set_cpu_batch_bytes(batch_bytes);
+  convolution_param->set_engine(engine);
+  convolution_param->mutable_weight_filler()->set_type("gaussian");
+  shared_ptr<Layer<float> > layer =
+      LayerRegistry<float>::CreateLayer(layer_param);
+  layer->SetUp(bottom_vec, top_vec);
+  filler.Fill(&top);
+  caffe_copy(top.count(), top.cpu_data(), top.mutable_cpu_diff());
+  const vector<bool> propagate_down(1, true);
+  Timer timer;
+  timer.Start();
+  for (int i = 0; i < FLAGS_iterations; ++i) {
+    layer->Forward(bottom_vec, top_vec);
+  }
+  *forward_ms = timer.MilliSeconds() / FLAGS_iterations;
+  timer.Start();
+  for (int i = 0; i < FLAGS_iterations; ++i) {
+    layer->Backward(top_vec, propagate_down, bottom_vec);
+  }
+  *backward_ms = timer.MilliSeconds() / FLAGS_iterations;
+}
+
+int main(int argc, char** argv) {
+  ::google::InitGoogleLogging(argv[0]);
+  FLAGS_alsologtostderr = 1;
+#ifndef GFLAGS_GFLAGS_H_
+  namespace gflags = google;
+#endif
+  gflags::SetUsageMessage("Times the CPU convolution kernels\n"
+      "Usage:\n"
+      "    conv_benchmark [FLAGS]\n");
+  gflags::ParseCommandLineFlags(&argc, &argv, true);
+  Caffe::set_mode(Caffe::CPU);
+  const int threads = FLAGS_threads > 0 ? FLAGS_threads : Caffe::cpu_threads();
+
+  LOG(INFO) << "im2col and col2im, 1 vs " << threads << " threads";
+  for (int i = 0; i < sizeof(kShapes) / sizeof(kShapes[0]); ++i) {
+    float im2col_ms, col2im_ms, im2col_threads_ms, col2im_threads_ms;
+    TimeIm2col(kShapes[i], 1, &im2col_ms, &col2im_ms);
+    TimeIm2col(kShapes[i], threads, &im2col_threads_ms, &col2im_threads_ms);
+    LOG(INFO) << kShapes[i].name << ": im2col " << im2col_ms << " / "
+        << im2col_threads_ms << " ms, col2im " << col2im_ms << " / "
+        << col2im_threads_ms << " ms";
+  }
+
+  Caffe::set_cpu_threads(threads);
+  LOG(INFO) << "Convolution of " << FLAGS_num << " images, one at a time vs "
+      << "cpu_batch_bytes " << FLAGS_batch_bytes;
+  for (int i = 0; i < sizeof(kShapes) / sizeof(kShapes[0]); ++i) {
+    float forward_ms, backward_ms, forward_batch_ms, backward_batch_ms;
+    TimeConvolution(kShapes[i], 0, ConvolutionParameter_Engine_CAFFE,
+        &forward_ms, &backward_ms);
+    TimeConvolution(kShapes[i], FLAGS_batch_bytes,
+        ConvolutionParameter_Engine_CAFFE, &forward_batch_ms,
+        &backward_batch_ms);
+    LOG(INFO) << kShapes[i].name << ": forward " << forward_ms << " / "
+        << forward_batch_ms << " ms, backward " << backward_ms << " / "
+        << backward_batch_ms << " ms";
+  }
+
+  LOG(INFO) << "Convolution of " << FLAGS_num << " images, CAFFE vs WINOGRAD "
+      << "engine";
+  for (int i = 0; i < sizeof(kShapes) / sizeof(kShapes[0]); ++i) {
+    if (kShapes[i].kernel != 3 || kShapes[i].stride != 1) {
+      continue;
+    }
+    float forward_ms, backward_ms, forward_winograd_ms, backward_winograd_ms;
+    TimeConvolution(kShapes[i], 0, ConvolutionParameter_Engine_CAFFE,
+        &forward_ms, &backward_ms);
+    TimeConvolution(kShapes[i], 0, ConvolutionParameter_Engine_WINOGRAD,
+        &forward_winograd_ms, &backward_winograd_ms);
+    LOG(INFO) << kShapes[i].name << ": forward " << forward_ms << " / "
+        << forward_winograd_ms << " ms, backward " << backward_ms << " / "
+        << backward_winograd_ms << " ms";
+  }
+  return 0;
+}
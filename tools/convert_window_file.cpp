@@ -0,0 +1,41 @@
+// This program compiles the text window file of a pair or triplet window data
+// layer into a binary file, which the layers memory map instead of parsing.
+// Usage:
+//    convert_window_file WINDOW_FILE BINARY_WINDOW_FILE
+//
+// The binary file can be used as the source of the layers in place of the
+// text file. It is written in host byte order.
+
+#include <string>
+
+#include "glog/logging.h"
+
+#include "caffe/util/window_file.hpp"
+
+using namespace caffe;  // NOLINT(build/namespaces)
+
+int main(int argc, char** argv) {
+  ::google::InitGoogleLogging(argv[0]);
+  if (argc != 3) {
+    LOG(ERROR) << "Usage: "
+        << "convert_window_file WINDOW_FILE BINARY_WINDOW_FILE";
+    return 1;
+  }
+
+  WindowFile window_file;
+  window_file.Open(argv[1]);
+  if (window_file.binary()) {
+    LOG(ERROR) << "File already in binary format: " << argv[1];
+    return 1;
+  }
+  window_file.Write(argv[2]);
+
+  int num_windows = 0;
+  for (int i = 0; i < window_file.num_images(); ++i) {
+    num_windows += window_file.num_windows(i);
+  }
+  LOG(INFO) << "Wrote " << window_file.num_images() << " images, "
+      << num_windows << " windows and " << window_file.num_pairs()
+      << " pairs to " << argv[2];
+  return 0;
+}
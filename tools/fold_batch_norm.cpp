@@ -0,0 +1,38 @@
+// This program folds the BatchNorm, Scale and Bias layers of a deploy net
+// into the Convolution and InnerProduct layers they follow, and writes the
+// folded net and its trained weights.
+// Usage:
+//    fold_batch_norm DEPLOY_IN CAFFEMODEL_IN DEPLOY_OUT CAFFEMODEL_OUT
+
+#include <string>
+
+#include "caffe/caffe.hpp"
+#include "caffe/util/fold_batch_norm.hpp"
+#include "caffe/util/io.hpp"
+#include "caffe/util/upgrade_proto.hpp"
+
+using namespace caffe;  // NOLINT(build/namespaces)
+
+int main(int argc, char** argv) {
+  ::google::InitGoogleLogging(argv[0]);
+  FLAGS_alsologtostderr = 1;
+  if (argc != 5) {
+    LOG(ERROR) << "Usage: fold_batch_norm deploy_proto_in caffemodel_in "
+        << "deploy_proto_out caffemodel_out";
+    return 1;
+  }
+  NetParameter param, weights;
+  ReadNetParamsFromTextFileOrDie(string(argv[1]), &param);
+  ReadNetParamsFromBinaryFileOrDie(string(argv[2]), &weights);
+  // Keeps the layers of the TEST phase
+  param.mutable_state()->set_phase(TEST);
+  NetParameter param_filtered, param_folded, weights_folded;
+  Net<float>::FilterNet(param, &param_filtered);
+  FoldBatchNorm(param_filtered, weights, &param_folded, &weights_folded);
+  WriteProtoToTextFile(param_folded, argv[3]);
+  WriteProtoToBinaryFile(weights_folded, argv[4]);
+  LOG(INFO) << "Folded " << param_filtered.layer_size() -
+      param_folded.layer_size() << " of " << param_filtered.layer_size()
+      << " layers into " << argv[3] << " and " << argv[4];
+  return 0;
+}
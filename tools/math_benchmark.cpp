@@ -0,0 +1,111 @@
+// This program measures the bandwidth of the elementwise CPU math functions
+// for each instruction set of the CPU, on one thread and on all of them, for
+// vectors that fit in L1, in L2 and in memory. Bytes count the values read and
+// written.
+// Usage:
+//    math_benchmark [FLAGS]
+
+#include <stdint.h>
+
+#include <sstream>
+#include <string>
+#include <vector>
+
+#include "gflags/gflags.h"
+#include "glog/logging.h"
+
+#include "caffe/common.hpp"
+#include "caffe/util/benchmark.hpp"
+#include "caffe/util/math_functions.hpp"
+#include "caffe/util/simd.hpp"
+
+using namespace caffe;  // NOLINT(build/namespaces)
+
+DEFINE_int32(threads, 0,
+    "Number of CPU threads to compare to one thread, 0 for all hardware "
+    "threads.");
+DEFINE_double(seconds, 0.2, "Minimum time each function is run for.");
+
+enum Function { ADD, SUB, MUL, DIV, SQR, ABS, SIGN, SCALE, ADD_SCALAR, EXP,
+    LOG, POWX, TANH, SIGMOID, NUM_FUNCTIONS };
+
+static const char* kNames[] = {"add", "sub", "mul", "div", "sqr", "abs",
+    "sign", "scale", "add_scalar", "exp", "log", "powx", "tanh", "sigmoid"};
+
+// Number of vectors each function reads and writes
+static const int kVectors[] = {3, 3, 3, 3, 2, 2, 2, 2, 2, 2, 2, 2, 2, 2};
+
+static void Run(Function function, int n, const float* a, const float* b,
+    float* y) {
+  switch (function) {
+  case ADD: caffe_add(n, a, b, y); break;
+  case SUB: caffe_sub(n, a, b, y); break;
+  case MUL: caffe_mul(n, a, b, y); break;
+  case DIV: caffe_div(n, a, b, y); break;
+  case SQR: caffe_sqr(n, a, y); break;
+  case ABS: caffe_abs(n, a, y); break;
+  case SIGN: caffe_cpu_sign(n, a, y); break;
+  case SCALE: caffe_cpu_scale(n, 0.5f, a, y); break;
+  case ADD_SCALAR: caffe_add_scalar(n, 0.5f, y); break;
+  case EXP: caffe_exp(n, a, y); break;
+  case LOG: caffe_log(n, b, y); break;
+  case POWX: caffe_powx(n, b, 0.75f, y); break;
+  case TANH: simd_tanh(n, a, y); break;
+  case SIGMOID: simd_sigmoid(n, a, y); break;
+  default: LOG(FATAL) << "Unknown function";
+  }
+}
+
+// Bandwidth of function over vectors of n values, in GB/s
+static double Bandwidth(Function function, int n, int threads) {
+  Caffe::set_cpu_threads(threads);
+  vector<float> a(n), b(n), y(n);
+  caffe_rng_uniform<float>(n, -1, 1, &a[0]);
+  caffe_rng_uniform<float>(n, 1, 2, &b[0]);
+  Run(function, n, &a[0], &b[0], &y[0]);
+  // Double the runs until they take long enough
+  CPUTimer timer;
+  for (int64_t runs = 1; ; runs *= 2) {
+    timer.Start();
+    for (int64_t i = 0; i < runs; ++i) {
+      Run(function, n, &a[0], &b[0], &y[0]);
+    }
+    const double seconds = timer.MicroSeconds() / 1e6;
+    if (seconds >= FLAGS_seconds) {
+      return static_cast<double>(runs) * n * kVectors[function]
+          * sizeof(float) / seconds / 1e9;
+    }
+  }
+}
+
+int main(int argc, char** argv) {
+  ::google::InitGoogleLogging(argv[0]);
+  FLAGS_alsologtostderr = 1;
+#ifndef GFLAGS_GFLAGS_H_
+  namespace gflags = google;
+#endif
+  gflags::SetUsageMessage("Measures the bandwidth of the CPU math functions\n"
+      "Usage:\n"
+      "    math_benchmark [FLAGS]\n");
+  gflags::ParseCommandLineFlags(&argc, &argv, true);
+  Caffe::set_mode(Caffe::CPU);
+  const int threads = FLAGS_threads > 0 ? FLAGS_threads : Caffe::cpu_threads();
+  const int sizes[] = {1 << 10, 1 << 15, 1 << 24};
+
+  LOG(INFO) << "Bandwidth in GB/s on 1 / " << threads << " threads, CPU "
+      << "supports " << simd_level_name(simd_cpu_level());
+  for (int s = 0; s < sizeof(sizes) / sizeof(sizes[0]); ++s) {
+    for (int f = 0; f < NUM_FUNCTIONS; ++f) {
+      std::ostringstream line;
+      line << kNames[f] << " of " << sizes[s] << " floats:";
+      for (int level = SIMD_GENERIC; level <= simd_cpu_level(); ++level) {
+        set_simd_level(static_cast<SimdLevel>(level));
+        line << " " << simd_level_name(simd_level()) << " "
+            << Bandwidth(static_cast<Function>(f), sizes[s], 1) << " / "
+            << Bandwidth(static_cast<Function>(f), sizes[s], threads);
+      }
+      LOG(INFO) << line.str();
+    }
+  }
+  return 0;
+}